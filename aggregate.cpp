@@ -0,0 +1,71 @@
+/**
+ * @file aggregate.cpp
+ *
+ */
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <stdio.h>
+
+#include "aggregate.h"
+
+/*********************
+ * MEMBER FUNCTIONS
+ *********************/
+
+//
+// Class Aggregate
+//
+
+Aggregate::Aggregate() {
+	_min = 0.0;
+	_max = 0.0;
+	_sum = 0.0;
+	_last = 0.0;
+	_count = 0;
+	_windowStart = 0;
+	_windowEnd = 0;
+}
+
+void Aggregate::start(time_t now, int window) {
+	if (window < 1) window = 1;
+	_windowStart = now - (now % window);
+	_windowEnd = _windowStart + window;
+	_min = 0.0;
+	_max = 0.0;
+	_sum = 0.0;
+	_last = 0.0;
+	_count = 0;
+}
+
+void Aggregate::add(double value) {
+	if ((_count == 0) || (value < _min)) _min = value;
+	if ((_count == 0) || (value > _max)) _max = value;
+	_sum += value;
+	_last = value;
+	_count++;
+}
+
+bool Aggregate::isClosed(time_t now) {
+	return (now >= _windowEnd) || (now < _windowStart);
+}
+
+int Aggregate::format(char *buf, size_t size, const char *format) {
+	const char *keys[4] = { "min", "max", "mean", "last" };
+	double values[4] = { _min, _max, mean(), _last };
+	size_t len = 0;
+	int n;
+
+	for (int i = 0; i < 4; i++) {
+		n = snprintf(buf + len, size - len, "%s\"%s\":", (i == 0) ? "{" : ",", keys[i]);
+		if ((n < 0) || ((size_t)n >= size - len)) return -1;
+		len += n;
+		n = snprintf(buf + len, size - len, format, values[i]);
+		if ((n < 0) || ((size_t)n >= size - len)) return -1;
+		len += n;
+	}
+	n = snprintf(buf + len, size - len, ",\"count\":%u,\"start\":%lld,\"end\":%lld}", _count, (long long)_windowStart, (long long)_windowEnd);
+	if ((n < 0) || ((size_t)n >= size - len)) return -1;
+	return (int)(len + n);
+}
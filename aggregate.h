@@ -0,0 +1,72 @@
+/**
+ * @file aggregate.h
+
+-----------------------------------------------------------------------------
+ Class "Aggregate" accumulates the readings of a tag over a time window
+ (min, max, mean, count and last value).
+ The state is updated incrementally, the memory per tag is constant.
+ Windows are aligned to the wall clock, a 60s window closes on every full
+ minute.
+-----------------------------------------------------------------------------
+*/
+
+#ifndef _AGGREGATE_H_
+#define _AGGREGATE_H_
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+class Aggregate {
+public:
+	Aggregate();
+
+	/**
+	 * Start a new window, the accumulated values are discarded
+	 * @param now: current time
+	 * @param window: window length [s]
+	 */
+	void start(time_t now, int window);
+
+	/**
+	 * Add reading to current window
+	 */
+	void add(double value);
+
+	/**
+	 * @return true if the window containing "now" is not the current window
+	 */
+	bool isClosed(time_t now);
+
+	/**
+	 * Format window statistics as JSON object
+	 * {"min":..,"max":..,"mean":..,"last":..,"count":n,"start":<s>,"end":<s>}
+	 * @param buf: output buffer
+	 * @param size: size of buf
+	 * @param format: printf style format for min, max, mean and last (double)
+	 * @return number of characters written or -1 if buf is too small
+	 */
+	int format(char *buf, size_t size, const char *format);
+
+	uint32_t count(void) { return _count; };
+	double min(void) { return _min; };
+	double max(void) { return _max; };
+	double mean(void) { return (_count > 0) ? (_sum / _count) : 0.0; };
+	double last(void) { return _last; };
+	time_t windowStart(void) { return _windowStart; };
+	time_t windowEnd(void) { return _windowEnd; };
+
+private:
+	double _min;
+	double _max;
+	double _sum;
+	double _last;
+	uint32_t _count;
+	time_t _windowStart;		// start of current window
+	time_t _windowEnd;			// end of current window (exclusive)
+};
+
+#endif /* _AGGREGATE_H_ */
@@ -0,0 +1,396 @@
+#!/usr/bin/env python3
+"""
+mbbridge end-to-end benchmark
+
+Runs the bridge against the RTU simulator (sim/mbsim) and a minimal MQTT
+broker stand-in built into this script, sweeps the tag layout and load,
+and prints one JSON object per run:
+
+  polls_per_s          Modbus transactions per second (bridge metrics)
+  publishes_per_s      tag messages received by the broker per second
+  write_latency_ms     write command latency MQTT in -> bus done, measured
+                       by the bridge (ack "latency"): p50 / p99 / max
+  write_rtt_ms         write publish -> ack received by the broker: p50 / p99
+  cpu_pct              CPU time of the bridge process [% of one core]
+  cpu_us_per_update    CPU time per published tag update [us]
+  loop_p99_ms          99th percentile of main loop pass duration
+
+The broker stand-in implements the subset of MQTT 3.1.1 the bridge uses
+(QoS 0/1/2 publish, exact topic subscriptions, no retained store) and is
+also the client that publishes write commands and collects the acks.
+
+usage: bench.py [--full] [--tags 20,100] [--group 0,1] [--slaves 1,4]
+                [--cycle 1] [--writes 0,10] [--duration 10] [--baud 0]
+                [--output results.jsonl]
+  default: vary one parameter at a time around the baseline
+  --full:  all combinations
+"""
+
+import argparse
+import asyncio
+import itertools
+import json
+import os
+import re
+import shutil
+import signal
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+BRIDGE = os.path.join(ROOT, "mbbridge")
+SIM = os.path.join(ROOT, "sim", "mbsim")
+
+BASELINE = {"tags": 100, "group": 0.5, "slaves": 4, "cycle": 1, "writes": 5}
+AXES = {
+    "tags": [20, 100, 500],
+    "group": [0.0, 0.5, 1.0],
+    "slaves": [1, 4, 16],
+    "cycle": [1, 5],
+    "writes": [0, 5, 50],
+}
+GROUP_SIZE = 8          # tags per read group
+WRITE_TAGS = 2          # write tags per slave
+WARMUP_S = 2
+
+
+def percentile(values, p):
+    if not values:
+        return None
+    values = sorted(values)
+    k = min(len(values) - 1, max(0, int(round(p / 100.0 * len(values) + 0.5)) - 1))
+    return values[k]
+
+
+# ---------------------------------------------------------------------------
+# MQTT broker stand-in
+# ---------------------------------------------------------------------------
+
+class Broker:
+    def __init__(self, ack_prefix):
+        self.ack_prefix = ack_prefix
+        self.subscriptions = {}     # topic -> writer
+        self.publishes = 0          # tag messages from the bridge
+        self.acks = []              # bridge measured latency [ms]
+        self.rtts = []              # write publish -> ack [ms]
+        self.sent = {}              # write topic -> publish time
+        self.connected = asyncio.Event()
+
+    async def handle(self, reader, writer):
+        try:
+            while True:
+                header = await reader.readexactly(1)
+                length, mult = 0, 1
+                while True:
+                    b = (await reader.readexactly(1))[0]
+                    length += (b & 0x7F) * mult
+                    mult *= 128
+                    if not b & 0x80:
+                        break
+                body = await reader.readexactly(length) if length else b""
+                self.packet(header[0], body, writer)
+                await writer.drain()
+        except (asyncio.IncompleteReadError, ConnectionResetError):
+            pass
+        finally:
+            for topic in [t for t, w in self.subscriptions.items() if w is writer]:
+                del self.subscriptions[topic]
+            writer.close()
+
+    def packet(self, header, body, writer):
+        ptype = header >> 4
+        if ptype == 1:      # CONNECT
+            writer.write(b"\x20\x02\x00\x00")
+            self.connected.set()
+        elif ptype == 3:    # PUBLISH
+            qos = (header >> 1) & 3
+            tlen = struct.unpack(">H", body[:2])[0]
+            topic = body[2:2 + tlen].decode(errors="replace")
+            pos = 2 + tlen
+            if qos:
+                pid = body[pos:pos + 2]
+                pos += 2
+                writer.write((b"\x40\x02" if qos == 1 else b"\x50\x02") + pid)
+            self.received(topic, body[pos:])
+        elif ptype == 6:    # PUBREL
+            writer.write(b"\x70\x02" + body[:2])
+        elif ptype == 8:    # SUBSCRIBE
+            pid, pos, granted = body[:2], 2, b""
+            while pos < len(body):
+                tlen = struct.unpack(">H", body[pos:pos + 2])[0]
+                self.subscriptions[body[pos + 2:pos + 2 + tlen].decode()] = writer
+                pos += 3 + tlen
+                granted += b"\x00"
+            writer.write(bytes([0x90, 2 + len(granted)]) + pid + granted)
+        elif ptype == 10:   # UNSUBSCRIBE
+            writer.write(b"\xb0\x02" + body[:2])
+        elif ptype == 12:   # PINGREQ
+            writer.write(b"\xd0\x00")
+
+    def received(self, topic, payload):
+        if not topic.startswith(self.ack_prefix):
+            self.publishes += 1
+            return
+        now = time.monotonic()
+        try:
+            ack = json.loads(payload)
+        except ValueError:
+            return
+        if ack.get("result") == "ok":
+            self.acks.append(float(ack.get("latency", 0.0)))
+        write_topic = "bench/w/" + topic[len(self.ack_prefix):]
+        if write_topic in self.sent:
+            self.rtts.append((now - self.sent.pop(write_topic)) * 1000.0)
+
+    def publish(self, topic, payload):
+        writer = self.subscriptions.get(topic)
+        if writer is None:
+            return False
+        t = topic.encode()
+        body = struct.pack(">H", len(t)) + t + payload
+        writer.write(bytes([0x30]) + encode_length(len(body)) + body)
+        self.sent[topic] = time.monotonic()
+        return True
+
+    def reset(self):
+        self.publishes = 0
+        self.acks = []
+        self.rtts = []
+
+
+def encode_length(n):
+    out = b""
+    while True:
+        b = n % 128
+        n //= 128
+        out += bytes([b | (0x80 if n else 0)])
+        if not n:
+            return out
+
+
+# ---------------------------------------------------------------------------
+# config generation
+# ---------------------------------------------------------------------------
+
+def write_config(path, p, port, tty, metrics_sock):
+    per_slave = max(1, (p["tags"] + p["slaves"] - 1) // p["slaves"])
+    grouped = int(round(per_slave * p["group"]))
+    slaves, writes = [], []
+    for s in range(1, p["slaves"] + 1):
+        tags = []
+        for i in range(per_slave):
+            group = "group = %d; " % (1 + i // GROUP_SIZE) if i < grouped else ""
+            tags.append('\t\t{ address = %d; update_cycle = 1; %stopic = "bench/s%d/t%d"; }'
+                        % (40000 + i, group, s, i))
+        slaves.append('\t{\n\tname = "s%d";\n\tid = %d;\n\tenabled = true;\n\ttags = (\n%s\n\t);\n\t}'
+                      % (s, s, ",\n".join(tags)))
+        for j in range(WRITE_TAGS):
+            writes.append('\t{ topic = "bench/w/s%d/%d"; slaveid = %d; address = %d; datatype = "r"; acktopic = "bench/ack/s%d/%d"; }'
+                          % (s, j, s, 40900 + j, s, j))
+    with open(path, "w") as f:
+        f.write("""// generated by bench/bench.py
+mainloopinterval = 50;
+mqtt = {
+	broker = "127.0.0.1";
+	port = %d;
+	retain_default = false;
+	clearonexit = false;
+};
+modbusrtu = {
+	device = "%s";
+	baudrate = 115200;
+	responsetimeout_us = 200000;
+	responsetimeout_s = 0;
+	interslavedelay = 0;
+	maxretries = 0;
+	debuglevel = 0;
+};
+metrics = {
+	listen = "%s";
+};
+updatecycles = ( { id = 1; interval = %d; } );
+mqtt_tags = (
+%s
+);
+mbslaves = (
+%s
+);
+""" % (port, tty, metrics_sock, p["cycle"], ",\n".join(writes), ",\n".join(slaves)))
+    return per_slave * p["slaves"], WRITE_TAGS * p["slaves"]
+
+
+# ---------------------------------------------------------------------------
+# measurement
+# ---------------------------------------------------------------------------
+
+def scrape(sock_path):
+    """@return dict metric name (incl. labels) -> value"""
+    s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    s.settimeout(2)
+    s.connect(sock_path)
+    s.sendall(b"GET /metrics HTTP/1.0\r\n\r\n")
+    data = b""
+    while True:
+        chunk = s.recv(65536)
+        if not chunk:
+            break
+        data += chunk
+    s.close()
+    metrics = {}
+    for line in data.decode().split("\r\n\r\n", 1)[-1].splitlines():
+        m = re.match(r"^([a-z_]+)(\{[^}]*\})? (\S+)$", line)
+        if m:
+            metrics[m.group(1) + (m.group(2) or "")] = float(m.group(3))
+    return metrics
+
+
+def metric_sum(metrics, name):
+    return sum(v for k, v in metrics.items() if k == name or k.startswith(name + "{"))
+
+
+def cpu_seconds(pid):
+    with open("/proc/%d/stat" % pid) as f:
+        fields = f.read().rsplit(")", 1)[1].split()
+    return (int(fields[11]) + int(fields[12])) / os.sysconf("SC_CLK_TCK")
+
+
+async def run_one(p, args, workdir):
+    port = free_port()
+    tty = os.path.join(workdir, "tty")
+    metrics_sock = os.path.join(workdir, "metrics.sock")
+    cfg_base = os.path.join(workdir, "bench")
+    tag_count, write_count = write_config(cfg_base + ".cfg", p, port, tty, metrics_sock)
+
+    broker = Broker("bench/ack/")
+    server = await asyncio.start_server(broker.handle, "127.0.0.1", port)
+    sim = subprocess.Popen([SIM, "-c", cfg_base + ".cfg", "-l", tty, "-b", str(args.baud)],
+                           stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    bridge = None
+    try:
+        for _ in range(50):
+            if os.path.exists(tty):
+                break
+            await asyncio.sleep(0.1)
+        bridge = subprocess.Popen([BRIDGE, "-c" + cfg_base], stdout=subprocess.DEVNULL,
+                                  stderr=subprocess.DEVNULL, stdin=subprocess.DEVNULL)
+        await asyncio.wait_for(broker.connected.wait(), 10)
+        await asyncio.sleep(WARMUP_S)
+
+        broker.reset()
+        m0, c0, t0 = scrape(metrics_sock), cpu_seconds(bridge.pid), time.monotonic()
+        sent, nxt, k = 0, t0, 0
+        write_topics = ["bench/w/s%d/%d" % (s, j) for s in range(1, p["slaves"] + 1) for j in range(WRITE_TAGS)]
+        while time.monotonic() - t0 < args.duration:
+            if p["writes"] > 0 and time.monotonic() >= nxt:
+                topic = write_topics[k % len(write_topics)]
+                if broker.publish(topic, str(k % 1000).encode()):
+                    sent += 1
+                k += 1
+                nxt += 1.0 / p["writes"]
+            await asyncio.sleep(0.001 if p["writes"] > 0 else 0.05)
+        m1, c1, t1 = scrape(metrics_sock), cpu_seconds(bridge.pid), time.monotonic()
+        elapsed = t1 - t0
+        cpu = c1 - c0
+        tx = metric_sum(m1, "mbbridge_modbus_transactions_total") - metric_sum(m0, "mbbridge_modbus_transactions_total")
+        errors = metric_sum(m1, "mbbridge_modbus_errors_total") - metric_sum(m0, "mbbridge_modbus_errors_total")
+        result = dict(p)
+        result.update({
+            "tag_count": tag_count,
+            "write_tags": write_count,
+            "baud": args.baud,
+            "duration_s": round(elapsed, 3),
+            "polls_per_s": round(tx / elapsed, 1),
+            "bus_errors": int(errors),
+            "publishes_per_s": round(broker.publishes / elapsed, 1),
+            "writes_sent": sent,
+            "writes_acked": len(broker.acks),
+            "write_latency_ms": {"p50": percentile(broker.acks, 50), "p99": percentile(broker.acks, 99),
+                                 "max": max(broker.acks) if broker.acks else None},
+            "write_rtt_ms": {"p50": rnd(percentile(broker.rtts, 50)), "p99": rnd(percentile(broker.rtts, 99))},
+            "cpu_pct": round(100.0 * cpu / elapsed, 2),
+            "cpu_us_per_update": round(cpu * 1e6 / broker.publishes, 2) if broker.publishes else None,
+            "loop_p99_ms": rnd(m1.get('mbbridge_loop_duration_seconds{quantile="0.99"}', 0.0) * 1000.0),
+        })
+        return result
+    finally:
+        for proc in (bridge, sim):
+            if proc is not None and proc.poll() is None:
+                proc.send_signal(signal.SIGINT)
+                try:
+                    proc.wait(5)
+                except subprocess.TimeoutExpired:
+                    proc.kill()
+        server.close()
+        await server.wait_closed()
+
+
+def rnd(v):
+    return None if v is None else round(v, 3)
+
+
+def free_port():
+    s = socket.socket()
+    s.bind(("127.0.0.1", 0))
+    port = s.getsockname()[1]
+    s.close()
+    return port
+
+
+def sweep(args):
+    axes = {}
+    for name, default in AXES.items():
+        value = getattr(args, name)
+        axes[name] = [type(BASELINE[name])(v) for v in value.split(",")] if value else default
+    if args.full:
+        names = list(axes)
+        for combo in itertools.product(*(axes[n] for n in names)):
+            yield dict(zip(names, combo))
+        return
+    seen = []
+    for name, values in axes.items():
+        for v in values:
+            p = dict(BASELINE)
+            for other, ovalues in axes.items():
+                if len(ovalues) == 1:
+                    p[other] = ovalues[0]
+            p[name] = v
+            if p not in seen:
+                seen.append(p)
+                yield p
+
+
+def main():
+    parser = argparse.ArgumentParser(description="mbbridge end-to-end benchmark")
+    parser.add_argument("--full", action="store_true", help="run all combinations")
+    for name in AXES:
+        parser.add_argument("--" + name, help="comma separated values (default %s)" % AXES[name])
+    parser.add_argument("--duration", type=float, default=10.0, help="measurement time per run [s]")
+    parser.add_argument("--baud", type=int, default=0, help="simulated line speed, 0 = no line delay")
+    parser.add_argument("--output", help="append results to this file (JSON lines)")
+    args = parser.parse_args()
+
+    for binary, target in ((BRIDGE, "make"), (SIM, "make sim")):
+        if not os.access(binary, os.X_OK):
+            sys.exit("%s not found, run '%s' first" % (binary, target))
+    workdir = tempfile.mkdtemp(prefix="mbbench-")
+    out = open(args.output, "a") if args.output else None
+    try:
+        for p in sweep(args):
+            result = asyncio.run(run_one(p, args, workdir))
+            line = json.dumps(result, sort_keys=True)
+            print(line, flush=True)
+            if out:
+                out.write(line + "\n")
+                out.flush()
+    finally:
+        if out:
+            out.close()
+        shutil.rmtree(workdir, ignore_errors=True)
+
+
+if __name__ == "__main__":
+    main()
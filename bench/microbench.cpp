@@ -0,0 +1,357 @@
+/**
+ * @file microbench.cpp
+ *
+ * Microbenchmarks for the per-message paths of mbbridge, built from the
+ * bridge sources (all objects except mbbridge.o).
+ *
+ * Each benchmark is repeated until it has run for the minimum time, the
+ * result is reported as ns/op and heap allocations/op (operator new
+ * calls counted by this program).
+ * Before the benchmarks the history encoding is checked with a round trip
+ * of the delta-of-delta range limits.
+ *
+ * usage: microbench [-t ms] [filter]
+ *   -t      minimum run time per benchmark [ms] (default 200)
+ *   filter  only run benchmarks whose name contains this string
+ */
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <new>
+
+#include "../datatag.h"
+#include "../history.h"
+#include "../modbustag.h"
+#include "../mqtt.h"
+#include "../payload.h"
+#include "../tagtable.h"
+
+/*********************
+ *      DEFINES
+ *********************/
+#define BENCH_TIME_DEFAULT 200		// minimum run time per benchmark [ms]
+#define STORE_TAGS 80				// subscribed tags in TagStore (MAX_TAG_NUM is 100)
+#define READ_TAGS 500				// read tags in TagTable
+#define READ_SLAVES 4
+#define GROUP_SIZE 8				// tags per read group
+
+/**********************
+ *      TYPEDEFS
+ **********************/
+typedef void (*bench_func_t)(long iterations);
+
+typedef struct {
+	const char *name;
+	bench_func_t func;
+}bench_t;
+
+/**********************
+ *  STATIC VARIABLES
+ **********************/
+static unsigned long allocCount = 0;		// operator new calls
+static volatile double sink;				// keeps results alive
+
+static TagStore tagStore;
+static char storeTopics[STORE_TAGS][64];
+static Tag *payloadTag;
+
+static ModbusTag scaledTags[4];
+
+static MQTT mqtt("microbench");
+static char pubBuf[100];
+
+static TagTable tagTable;
+static ModbusTag readTags[READ_TAGS];
+static int readArray[READ_TAGS];
+
+/**********************
+ *  ALLOCATION COUNTING
+ **********************/
+void* operator new(size_t size) {
+	void *p;
+	allocCount++;
+	p = malloc(size ? size : 1);
+	if (p == NULL) throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+	free(p);
+}
+
+void operator delete[](void *p) noexcept {
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+	free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+	free(p);
+}
+
+/**********************
+ *   LOCAL FUNCTIONS
+ **********************/
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Fill the data structures with a realistic tag set
+ */
+static void setup(void) {
+	static const char *valueTypes[] = { "int16", "uint16", "int32", "float32" };
+	int i, slave;
+	uint16_t regs[2];
+	float f = 21.75f;
+
+	// subscribed tags as configured in mqtt_tags (write commands, external values)
+	for (i = 0; i < STORE_TAGS; i++) {
+		snprintf(storeTopics[i], sizeof(storeTopics[i]), "site/plant%d/boiler%d/setpoint/%s", i / 20, i % 20, (i & 1) ? "flow_temperature" : "pressure");
+		tagStore.addTag(storeTopics[i]);
+	}
+	payloadTag = tagStore.getTag(storeTopics[STORE_TAGS - 1]);
+
+	// scaled read values
+	for (i = 0; i < 4; i++) {
+		scaledTags[i].setAddress(40100 + i * 2);
+		scaledTags[i].setValueType(valueTypes[i]);
+		scaledTags[i].setMultiplier(0.1);
+		scaledTags[i].setOffset(-40.0);
+	}
+	regs[0] = 0xFF38;
+	scaledTags[0].setRegisters(regs);
+	scaledTags[1].setRegisters(regs);
+	regs[0] = 0x0001; regs[1] = 0x86A0;
+	scaledTags[2].setRegisters(regs);
+	memcpy(&regs[0], &f, sizeof(regs));
+	scaledTags[3].setRegisters(regs);
+
+	// update cycle with READ_SLAVES slaves, half of the tags in read groups
+	for (i = 0; i < READ_TAGS; i++) {
+		slave = 1 + i / (READ_TAGS / READ_SLAVES);
+		readTags[i].setSlaveId(slave);
+		readTags[i].setAddress(40000 + i % (READ_TAGS / READ_SLAVES));
+		if ((i % (READ_TAGS / READ_SLAVES)) < (READ_TAGS / READ_SLAVES / 2))
+			readTags[i].setGroup(1 + (i % (READ_TAGS / READ_SLAVES)) / GROUP_SIZE);
+		readArray[i] = i;
+	}
+	tagTable.allocate(READ_TAGS);
+	for (i = 0; i < READ_TAGS; i++)
+		tagTable.set(i, &readTags[i]);
+}
+
+/**
+ * Append timestamps whose delta-of-delta hits every range limit of the
+ * history encoding and compare the query result
+ * @return false on mismatch
+ */
+static bool check_history(void) {
+	static const int64_t limits[] = { 1, -1, 63, 64, -64, -65, 255, 256, -256, -257,
+		2047, 2048, -2048, -2049, 100000 };
+	uint64_t expected[2 * sizeof(limits) / sizeof(limits[0]) + 2];
+	history_sample_t samples[sizeof(expected) / sizeof(expected[0])];
+	char path[] = "/tmp/microbench-history-XXXXXX";
+	History history;
+	uint32_t key = 1;
+	uint64_t time = 1700000000000ULL, next;
+	int fd, i, n = 0;
+	bool ok;
+
+	fd = mkstemp(path);
+	if (fd < 0) return false;
+	close(fd);
+	ok = history.open(path, 1, 2, HISTORY_BLOCK_SIZE_DEFAULT, 1, &key);
+	if (ok) {
+		// regular interval of 10s, every limit is followed by its way back
+		expected[n++] = time;
+		time += 10000;
+		expected[n++] = time;
+		for (i = 0; i < (int)(sizeof(limits) / sizeof(limits[0])); i++) {
+			time += 10000 + limits[i];
+			expected[n++] = time;
+			time += 10000;
+			expected[n++] = time;
+		}
+		for (i = 0; i < n; i++)
+			history.append(0, expected[i] * 1000000ULL, (double)i);
+		ok = (history.query(0, 0, UINT64_MAX, samples, n, &next) == n);
+		for (i = 0; ok && (i < n); i++) {
+			if ((samples[i].time != expected[i]) || (samples[i].value != (double)i)) {
+				fprintf(stderr, "history check: sample %d is %llu, expected %llu\n", i,
+					(unsigned long long)samples[i].time, (unsigned long long)expected[i]);
+				ok = false;
+			}
+		}
+		history.close();
+	}
+	unlink(path);
+	return ok;
+}
+
+//
+// Benchmarks
+//
+
+static void bench_getTag_hit(long iterations) {
+	long i;
+	for (i = 0; i < iterations; i++)
+		sink = (double)(uintptr_t)tagStore.getTag(storeTopics[(i * 7) % STORE_TAGS]);
+}
+
+static void bench_getTag_miss(long iterations) {
+	long i;
+	for (i = 0; i < iterations; i++)
+		sink = (double)(uintptr_t)tagStore.getTag("site/plant9/boiler9/setpoint/unknown");
+}
+
+static void bench_setValue_text(long iterations) {
+	static const char *payloads[] = { "23.5", "1024", "-7", "true", "1e-3", " 65535 " };
+	long i;
+	for (i = 0; i < iterations; i++)
+		payloadTag->setValue(payloads[i % 6]);
+	sink = payloadTag->doubleValue();
+}
+
+static void bench_setValue_json(long iterations) {
+	static const char *payloads[] = { "{\"v\":23.5}", "{\"value\": 1024}", "{\"t\":1700000000000000000,\"v\":false}" };
+	long i;
+	for (i = 0; i < iterations; i++)
+		payloadTag->setValue(payloads[i % 3]);
+	sink = payloadTag->doubleValue();
+}
+
+static void bench_getScaledValue(long iterations) {
+	double sum = 0.0;
+	long i;
+	for (i = 0; i < iterations; i++)
+		sum += scaledTags[i & 3].getScaledValue();
+	sink = sum;
+}
+
+static void bench_format_text(long iterations) {
+	long i;
+	int len = 0;
+	for (i = 0; i < iterations; i++)
+		len += mqtt.formatPayload(pubBuf, sizeof(pubBuf), "%.1f", scaledTags[i & 3].getScaledValue(), 0);
+	sink = len;
+}
+
+static void bench_format_text_timestamp(long iterations) {
+	long i;
+	int len = 0;
+	for (i = 0; i < iterations; i++)
+		len += mqtt.formatPayload(pubBuf, sizeof(pubBuf), "%.1f", scaledTags[i & 3].getScaledValue(), 1700000000123456789ULL + i);
+	sink = len;
+}
+
+static void bench_encode_cbor(long iterations) {
+	typed_value_t value;
+	long i;
+	int len = 0;
+	for (i = 0; i < iterations; i++) {
+		value = scaledTags[i & 3].getTypedValue();
+		len += payload_encode(PAYLOAD_CBOR, (uint8_t *)pubBuf, sizeof(pubBuf), &value, 1700000000123456789ULL + i);
+	}
+	sink = len;
+}
+
+/**
+ * one group read of mb_read_multi_tags: range of the group, then all tags
+ * of the slave which are inside the range
+ */
+static void bench_group_match(long iterations) {
+	long i;
+	int index, j, lo, hi, matched = 0;
+	for (i = 0; i < iterations; i++) {
+		index = (int)((i * GROUP_SIZE) % READ_TAGS);
+		if (tagTable.group(index) < 1) index = 0;
+		tagTable.groupRange(readArray, READ_TAGS, tagTable.slaveId(index), tagTable.group(index), &lo, &hi);
+		for (j = 0; j < READ_TAGS; j++) {
+			if (tagTable.inRange(readArray[j], tagTable.slaveId(index), lo, hi)) matched++;
+		}
+	}
+	sink = matched;
+}
+
+static const bench_t benchmarks[] = {
+	{ "TagStore::getTag hit", bench_getTag_hit },
+	{ "TagStore::getTag miss", bench_getTag_miss },
+	{ "Tag::setValue text", bench_setValue_text },
+	{ "Tag::setValue json", bench_setValue_json },
+	{ "ModbusTag::getScaledValue", bench_getScaledValue },
+	{ "MQTT format text", bench_format_text },
+	{ "MQTT format text+timestamp", bench_format_text_timestamp },
+	{ "MQTT encode cbor+timestamp", bench_encode_cbor },
+	{ "mb_read_multi_tags match", bench_group_match },
+};
+
+/**
+ * run benchmark with increasing iteration count until minTime is reached
+ */
+static void run(const bench_t *b, uint64_t minTime) {
+	long iterations = 1000;
+	unsigned long allocs;
+	uint64_t start, elapsed;
+	b->func(iterations);		// warm up
+	for (;;) {
+		allocs = allocCount;
+		start = now_ns();
+		b->func(iterations);
+		elapsed = now_ns() - start;
+		allocs = allocCount - allocs;
+		if ((elapsed >= minTime) || (iterations > (1L << 40))) break;
+		iterations *= (elapsed < minTime / 10) ? 10 : 2;
+	}
+	printf("%-30s %12ld %10.1f %10.2f\n", b->name, iterations, (double)elapsed / iterations, (double)allocs / iterations);
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "usage: %s [-t ms] [filter]\n", name);
+	fprintf(stderr, "  -t  minimum run time per benchmark [ms] (default %d)\n", BENCH_TIME_DEFAULT);
+}
+
+int main(int argc, char *argv[]) {
+	const char *filter = NULL;
+	long minTime = BENCH_TIME_DEFAULT;
+	size_t i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:h")) != -1) {
+		switch (opt) {
+		case 't': minTime = atol(optarg); break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (optind < argc) filter = argv[optind];
+	if (minTime < 1) minTime = 1;
+
+	if (!check_history()) {
+		fprintf(stderr, "history encoding round trip failed\n");
+		return 1;
+	}
+	setup();
+	printf("%-30s %12s %10s %10s\n", "benchmark", "iterations", "ns/op", "allocs/op");
+	for (i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+		if ((filter != NULL) && (strstr(benchmarks[i].name, filter) == NULL)) continue;
+		run(&benchmarks[i], (uint64_t)minTime * 1000000ULL);
+	}
+	return 0;
+}
@@ -0,0 +1,154 @@
+/**
+ * @file busstats.cpp
+ *
+ */
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <errno.h>
+#include <stdio.h>
+
+#include <modbus.h>
+
+#include "busstats.h"
+
+/**********************
+ *  STATIC VARIABLES
+ **********************/
+static const int functionCodes[BUSSTATS_FUNCTIONS] = { 1, 2, 3, 4, 5, 6, 15, 16 };
+
+static const char *counterNames[BUS_COUNTER_COUNT] = {
+	"tx", "timeouts", "exceptions", "crc", "errors", "retries"
+};
+
+/*********************
+ * MEMBER FUNCTIONS
+ *********************/
+
+//
+// Class BusStats
+//
+
+BusStats::BusStats() {
+	_busyTime.store(0, std::memory_order_relaxed);
+	for (int s = 0; s < BUSSTATS_SLAVES; s++) {
+		for (int c = 0; c < BUS_COUNTER_COUNT; c++)
+			_counters[s][c].store(0, std::memory_order_relaxed);
+		for (int f = 0; f < BUSSTATS_FUNCTIONS; f++)
+			_latency[s][f].store(NULL, std::memory_order_relaxed);
+	}
+}
+
+BusStats::~BusStats() {
+	for (int s = 0; s < BUSSTATS_SLAVES; s++)
+		for (int f = 0; f < BUSSTATS_FUNCTIONS; f++)
+			delete _latency[s][f].load(std::memory_order_relaxed);
+}
+
+bool BusStats::_valid(int slaveId) const {
+	return (slaveId >= 0) && (slaveId < BUSSTATS_SLAVES);
+}
+
+int BusStats::functionIndex(int function) {
+	for (int i = 0; i < BUSSTATS_FUNCTIONS; i++)
+		if (functionCodes[i] == function) return i;
+	return -1;
+}
+
+int BusStats::functionCode(int index) {
+	if ((index < 0) || (index >= BUSSTATS_FUNCTIONS)) return 0;
+	return functionCodes[index];
+}
+
+const char *BusStats::counterName(bus_counter_t counter) {
+	if ((counter < 0) || (counter >= BUS_COUNTER_COUNT)) return "";
+	return counterNames[counter];
+}
+
+void BusStats::record(int slaveId, int function, uint64_t rtt, int error) {
+	int fn = functionIndex(function);
+	bool response = true;		// slave has answered
+	Histogram *hist;
+
+	if (!_valid(slaveId)) return;
+	_busyTime.fetch_add(rtt, std::memory_order_relaxed);
+	_counters[slaveId][BUS_COUNTER_TRANSACTIONS].fetch_add(1, std::memory_order_relaxed);
+	if (error == ETIMEDOUT) {
+		_counters[slaveId][BUS_COUNTER_TIMEOUTS].fetch_add(1, std::memory_order_relaxed);
+		response = false;
+	} else if ((error > MODBUS_ENOBASE) && (error < MODBUS_ENOBASE + MODBUS_EXCEPTION_MAX)) {
+		_counters[slaveId][BUS_COUNTER_EXCEPTIONS].fetch_add(1, std::memory_order_relaxed);
+	} else if (error == EMBBADCRC) {
+		_counters[slaveId][BUS_COUNTER_CRC].fetch_add(1, std::memory_order_relaxed);
+		response = false;
+	} else if (error != 0) {
+		_counters[slaveId][BUS_COUNTER_ERRORS].fetch_add(1, std::memory_order_relaxed);
+		response = false;
+	}
+	// timeouts would only record the response timeout
+	if (!response || (fn < 0)) return;
+	hist = _latency[slaveId][fn].load(std::memory_order_acquire);
+	if (hist == NULL) {
+		// only the bus thread records, no other writer can race
+		hist = new Histogram();
+		_latency[slaveId][fn].store(hist, std::memory_order_release);
+	}
+	hist->record(rtt);
+}
+
+void BusStats::retry(int slaveId) {
+	if (!_valid(slaveId)) return;
+	_counters[slaveId][BUS_COUNTER_RETRIES].fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t BusStats::counter(int slaveId, bus_counter_t counter) const {
+	if (!_valid(slaveId) || (counter < 0) || (counter >= BUS_COUNTER_COUNT)) return 0;
+	return _counters[slaveId][counter].load(std::memory_order_relaxed);
+}
+
+const Histogram *BusStats::latency(int slaveId, int function) const {
+	int fn = functionIndex(function);
+	if (!_valid(slaveId) || (fn < 0)) return NULL;
+	return _latency[slaveId][fn].load(std::memory_order_acquire);
+}
+
+uint64_t BusStats::busyTime(void) const {
+	return _busyTime.load(std::memory_order_relaxed);
+}
+
+bool BusStats::isActive(int slaveId) const {
+	return counter(slaveId, BUS_COUNTER_TRANSACTIONS) > 0;
+}
+
+int BusStats::format(int slaveId, char *buf, size_t size) const {
+	const Histogram *hist;
+	int len = 0, n, c, f;
+	bool first = true;
+
+	if (!_valid(slaveId) || (size == 0)) return -1;
+	buf[0] = 0;
+	for (c = 0; c < BUS_COUNTER_COUNT; c++) {
+		n = snprintf(buf + len, size - len, "%s\"%s\":%llu", (c == 0) ? "{" : ",",
+			counterNames[c], (unsigned long long)counter(slaveId, (bus_counter_t)c));
+		if ((n < 0) || (n >= (int)(size - len))) return -1;
+		len += n;
+	}
+	n = snprintf(buf + len, size - len, ",\"fc\":{");
+	if ((n < 0) || (n >= (int)(size - len))) return -1;
+	len += n;
+	for (f = 0; f < BUSSTATS_FUNCTIONS; f++) {
+		hist = _latency[slaveId][f].load(std::memory_order_acquire);
+		if ((hist == NULL) || (hist->count() == 0)) continue;
+		n = snprintf(buf + len, size - len, "%s\"%d\":{\"n\":%llu,\"mean\":%.0f,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"max\":%llu}",
+			first ? "" : ",", functionCodes[f], (unsigned long long)hist->count(), hist->mean(),
+			(unsigned long long)hist->percentile(50.0), (unsigned long long)hist->percentile(90.0),
+			(unsigned long long)hist->percentile(99.0), (unsigned long long)hist->max());
+		if ((n < 0) || (n >= (int)(size - len))) return -1;
+		len += n;
+		first = false;
+	}
+	n = snprintf(buf + len, size - len, "}}");
+	if ((n < 0) || (n >= (int)(size - len))) return -1;
+	return len + n;
+}
@@ -0,0 +1,122 @@
+/**
+ * @file busstats.h
+
+-----------------------------------------------------------------------------
+ Class "BusStats" collects Modbus transaction statistics per slave:
+   - round trip time histograms per function code [us]
+   - counters for transactions, timeouts, exceptions, CRC errors,
+     other errors and retries
+
+ Statistics are recorded by the bus thread and can be read concurrently
+ from any thread without locking. A histogram is allocated when the first
+ transaction of a slave / function code pair is recorded, slaves which are
+ never addressed don't use memory for histograms.
+-----------------------------------------------------------------------------
+*/
+
+#ifndef _BUSSTATS_H_
+#define _BUSSTATS_H_
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <stdint.h>
+#include <stddef.h>
+
+#include <atomic>
+
+#include "histogram.h"
+
+/*********************
+ *      DEFINES
+ *********************/
+#define BUSSTATS_SLAVES 256			// slave IDs 0 .. 255
+#define BUSSTATS_FUNCTIONS 8		// FC 1, 2, 3, 4, 5, 6, 15, 16
+
+/**********************
+ *      TYPEDEFS
+ **********************/
+typedef enum
+{
+	BUS_COUNTER_TRANSACTIONS = 0,	// all transactions incl. failed ones
+	BUS_COUNTER_TIMEOUTS,			// no response
+	BUS_COUNTER_EXCEPTIONS,			// exception response from slave
+	BUS_COUNTER_CRC,				// response with invalid CRC
+	BUS_COUNTER_ERRORS,				// other errors
+	BUS_COUNTER_RETRIES,			// transactions repeated after a failure
+	BUS_COUNTER_COUNT
+}bus_counter_t;
+
+class BusStats {
+public:
+	BusStats();
+	~BusStats();
+
+	/**
+	 * Record a completed transaction
+	 * @param slaveId: slave address
+	 * @param function: Modbus function code
+	 * @param rtt: round trip time [us]
+	 * @param error: errno of a failed transaction, 0 = success
+	 */
+	void record(int slaveId, int function, uint64_t rtt, int error);
+
+	/**
+	 * Record a retry of a failed transaction
+	 * @param slaveId: slave address
+	 */
+	void retry(int slaveId);
+
+	/**
+	 * @return value of counter for slave
+	 */
+	uint64_t counter(int slaveId, bus_counter_t counter) const;
+
+	/**
+	 * @return round trip time histogram of slave and function code, NULL if none has been recorded
+	 */
+	const Histogram *latency(int slaveId, int function) const;
+
+	/**
+	 * @return total time the bus was busy with transactions incl. timeouts [us]
+	 */
+	uint64_t busyTime(void) const;
+
+	/**
+	 * @return true if a transaction has been recorded for slave
+	 */
+	bool isActive(int slaveId) const;
+
+	/**
+	 * Format statistics of a slave as JSON
+	 * {"tx":n,"timeouts":n,"exceptions":n,"crc":n,"errors":n,"retries":n,
+	 *  "fc":{"3":{"n":n,"mean":us,"p50":us,"p90":us,"p99":us,"max":us}, ...}}
+	 * @return length of string or -1 if buf is too small
+	 */
+	int format(int slaveId, char *buf, size_t size) const;
+
+	/**
+	 * @return name of counter (for reporting)
+	 */
+	static const char *counterName(bus_counter_t counter);
+
+	/**
+	 * Get function code index
+	 * @return 0 .. BUSSTATS_FUNCTIONS-1 or -1 for unsupported function codes
+	 */
+	static int functionIndex(int function);
+
+	/**
+	 * @return function code for index
+	 */
+	static int functionCode(int index);
+
+private:
+	bool _valid(int slaveId) const;
+
+	std::atomic<uint64_t> _counters[BUSSTATS_SLAVES][BUS_COUNTER_COUNT];
+	std::atomic<Histogram*> _latency[BUSSTATS_SLAVES][BUSSTATS_FUNCTIONS];
+	std::atomic<uint64_t> _busyTime;
+};
+
+#endif /* _BUSSTATS_H_ */
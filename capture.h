@@ -0,0 +1,59 @@
+/**
+ * @file capture.h
+
+-----------------------------------------------------------------------------
+ File format of a Modbus RTU bus capture.
+
+ tools/mbcapture sits between mbbridge and the serial port (the bridge
+ uses a pty, the proxy forwards every byte to the real device and back)
+ and records each request with the raw response and its timing. The
+ simulator replays a capture (sim/mbsim -p): a request is answered with
+ the next captured response to the same request bytes, after the
+ captured response time. Missing responses (timeouts), exceptions and
+ corrupted frames are reproduced as they happened on the field bus.
+
+ File layout:
+   capture_file_header_t
+   records, each:
+     capture_record_t
+     uint8_t request[requestLen]		(RTU ADU incl. CRC)
+     uint8_t response[responseLen]		(raw bytes, 0 = no response)
+-----------------------------------------------------------------------------
+*/
+
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <stdint.h>
+
+/*********************
+ *      DEFINES
+ *********************/
+#define CAPTURE_MAGIC 0x50434D42		// "BMCP"
+#define CAPTURE_VERSION 1
+#define CAPTURE_FRAME_MAX 256			// RTU ADU size
+
+/**********************
+ *      TYPEDEFS
+ **********************/
+typedef struct
+{
+	uint32_t magic;			// CAPTURE_MAGIC
+	uint32_t version;		// CAPTURE_VERSION
+	uint32_t recordSize;	// sizeof(capture_record_t)
+	uint32_t baudRate;		// line speed of the capture
+	uint64_t startTime;		// start of capture [ns since epoch]
+}capture_file_header_t;
+
+typedef struct
+{
+	uint64_t time;			// start of request [ns since epoch]
+	uint32_t rtt;			// end of request to end of response [us], 0 = no response
+	uint16_t requestLen;	// bytes following this record
+	uint16_t responseLen;	// bytes following the request
+}capture_record_t;
+
+#endif /* _CAPTURE_H_ */
@@ -0,0 +1,119 @@
+/**
+ * @file clock.cpp
+ *
+ */
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "clock.h"
+
+/**********************
+ *  STATIC VARIABLES
+ **********************/
+static clock_shared_t *shared = NULL;		// NULL = system clocks
+
+/**********************
+ *   LOCAL FUNCTIONS
+ **********************/
+static uint64_t system_ns(clockid_t id) {
+	struct timespec now;
+	clock_gettime(id, &now);
+	return ((uint64_t)now.tv_sec * 1000000000ULL) + (uint64_t)now.tv_nsec;
+}
+
+static void system_sleep_us(uint64_t us) {
+	struct timespec ts;
+	if (us == 0) return;
+	ts.tv_sec = us / 1000000ULL;
+	ts.tv_nsec = (us % 1000000ULL) * 1000ULL;
+	nanosleep(&ts, NULL);
+}
+
+/**********************
+ *  GLOBAL FUNCTIONS
+ **********************/
+
+bool clock_virtual_attach(const char *name, bool owner, uint64_t start, uint32_t speed) {
+	clock_shared_t *map;
+	int fd;
+
+	clock_virtual_detach();
+	fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) return false;
+	// a new object is zero filled, an existing one keeps its size
+	if (ftruncate(fd, sizeof(clock_shared_t)) < 0) {
+		::close(fd);
+		return false;
+	}
+	map = (clock_shared_t *) mmap(NULL, sizeof(clock_shared_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (map == MAP_FAILED) return false;
+	if (owner || (__atomic_load_n(&map->magic, __ATOMIC_ACQUIRE) != CLOCK_MAGIC)) {
+		if (!owner) {
+			// first user is not the owner: start with defaults until the owner attaches
+			start = 0;
+			speed = CLOCK_SPEED_DEFAULT;
+		}
+		__atomic_store_n(&map->now, (start != 0) ? start : system_ns(CLOCK_REALTIME), __ATOMIC_RELAXED);
+		__atomic_store_n(&map->speed, speed, __ATOMIC_RELAXED);
+		__atomic_store_n(&map->sleeps, 0, __ATOMIC_RELAXED);
+		map->version = CLOCK_VERSION;
+		__atomic_store_n(&map->magic, CLOCK_MAGIC, __ATOMIC_RELEASE);
+	} else if (map->version != CLOCK_VERSION) {
+		munmap(map, sizeof(clock_shared_t));
+		return false;
+	}
+	shared = map;
+	return true;
+}
+
+void clock_virtual_detach(void) {
+	if (shared == NULL) return;
+	munmap(shared, sizeof(clock_shared_t));
+	shared = NULL;
+}
+
+bool clock_is_virtual(void) {
+	return shared != NULL;
+}
+
+uint64_t clock_realtime_ns(void) {
+	if (shared != NULL) return __atomic_load_n(&shared->now, __ATOMIC_ACQUIRE);
+	return system_ns(CLOCK_REALTIME);
+}
+
+uint64_t clock_monotonic_us(void) {
+	// virtual time never goes backwards
+	if (shared != NULL) return __atomic_load_n(&shared->now, __ATOMIC_ACQUIRE) / 1000ULL;
+	return system_ns(CLOCK_MONOTONIC) / 1000ULL;
+}
+
+time_t clock_time(void) {
+	if (shared != NULL) return (time_t)(__atomic_load_n(&shared->now, __ATOMIC_ACQUIRE) / 1000000000ULL);
+	return time(NULL);
+}
+
+void clock_sleep_us(uint64_t us) {
+	uint32_t speed;
+	if (shared == NULL) {
+		system_sleep_us(us);
+		return;
+	}
+	__atomic_add_fetch(&shared->now, us * 1000ULL, __ATOMIC_ACQ_REL);
+	__atomic_add_fetch(&shared->sleeps, 1, __ATOMIC_RELAXED);
+	speed = __atomic_load_n(&shared->speed, __ATOMIC_RELAXED);
+	if (speed > 0) system_sleep_us(us / speed);
+}
+
+void clock_advance_us(uint64_t us) {
+	if (shared == NULL) return;
+	__atomic_add_fetch(&shared->now, us * 1000ULL, __ATOMIC_ACQ_REL);
+}
@@ -0,0 +1,104 @@
+/**
+ * @file clock.h
+
+-----------------------------------------------------------------------------
+ Time source for scheduling, timestamps and delays.
+
+ All code uses these functions instead of time(), clock_gettime() and
+ usleep(). By default they map directly to the system clocks.
+
+ In virtual mode the time is a counter in a POSIX shared memory object.
+ It only advances when a process sleeps or accounts for time it would
+ have spent: the bridge for its main loop delay, inter slave delay and
+ response timeouts, the simulator (sim/mbsim -k) for the transmission of
+ request and response. Days of cycle scheduling can be replayed in
+ minutes, and because the time does not depend on the host load a run
+ can be repeated with the same timeline.
+
+ A virtual sleep also sleeps for (time / speed) in real time, this keeps
+ the MQTT connection and the serial line (which run in real time) in step
+ with the bridge. Speed 0 does not sleep at all.
+
+ Shared object layout: clock_shared_t
+-----------------------------------------------------------------------------
+*/
+
+#ifndef _CLOCK_H_
+#define _CLOCK_H_
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <stdint.h>
+#include <time.h>
+
+/*********************
+ *      DEFINES
+ *********************/
+#define CLOCK_MAGIC 0x4B4C434D			// "MCLK"
+#define CLOCK_VERSION 1
+#define CLOCK_SPEED_DEFAULT 1000		// virtual time per real time
+
+/**********************
+ *      TYPEDEFS
+ **********************/
+typedef struct
+{
+	uint32_t magic;			// CLOCK_MAGIC, written last
+	uint32_t version;		// CLOCK_VERSION
+	uint64_t now;			// virtual time [ns since epoch]
+	uint32_t speed;			// virtual time per real time, 0 = no real sleep
+	uint32_t reserved;
+	uint64_t sleeps;		// number of virtual sleeps (all processes)
+}clock_shared_t;
+
+/**
+ * Switch to virtual time
+ * @param name: shared memory object name ("/name"), created if it doesn't exist
+ * @param owner: true = (re)initialise time and speed, false = use the values of the owner
+ * @param start: virtual start time [ns since epoch], 0 = current time (owner only)
+ * @param speed: virtual time per real time, 0 = as fast as possible (owner only)
+ * @return false on failure, the system clocks stay in use
+ */
+bool clock_virtual_attach(const char *name, bool owner, uint64_t start, uint32_t speed);
+
+/**
+ * Return to the system clocks, the shared object is not removed
+ */
+void clock_virtual_detach(void);
+
+/**
+ * @return true if virtual time is in use
+ */
+bool clock_is_virtual(void);
+
+/**
+ * @return wall clock time [ns since epoch] (CLOCK_REALTIME)
+ */
+uint64_t clock_realtime_ns(void);
+
+/**
+ * @return time for interval measurement [us] (CLOCK_MONOTONIC)
+ */
+uint64_t clock_monotonic_us(void);
+
+/**
+ * @return wall clock time [s since epoch], replaces time(NULL)
+ */
+time_t clock_time(void);
+
+/**
+ * Sleep, replaces usleep()
+ * may return early on a signal (system clock only)
+ * @param us: time [us]
+ */
+void clock_sleep_us(uint64_t us);
+
+/**
+ * Account for time which passed without sleeping (e.g. waiting for a
+ * response which did not arrive), no effect with the system clock
+ * @param us: time [us]
+ */
+void clock_advance_us(uint64_t us);
+
+#endif /* _CLOCK_H_ */
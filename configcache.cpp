@@ -0,0 +1,287 @@
+/**
+ * @file configcache.cpp
+ *
+ */
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <unordered_map>
+
+#include "clock.h"
+#include "configcache.h"
+
+/*********************
+ *      DEFINES
+ *********************/
+#define FNV64_BASIS 14695981039346656037ULL
+#define FNV64_PRIME 1099511628211ULL
+
+/**********************
+ *   LOCAL FUNCTIONS
+ **********************/
+static uint64_t fnv64(uint64_t hash, const void *data, size_t size) {
+	const uint8_t *p = (const uint8_t *)data;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= p[i];
+		hash *= FNV64_PRIME;
+	}
+	return hash;
+}
+
+/**
+ * add a string to the table, identical strings (formats) are stored once
+ * @return offset of the string
+ */
+static uint32_t string_add(std::string &table, std::unordered_map<std::string, uint32_t> &index, const char *str) {
+	if ((str == NULL) || (*str == 0)) return 0;
+	auto it = index.find(str);
+	if (it != index.end()) return it->second;
+	uint32_t offset = (uint32_t)table.size();
+	table.append(str);
+	table.push_back(0);
+	index.emplace(str, offset);
+	return offset;
+}
+
+static bool write_all(int fd, const void *data, size_t size) {
+	const char *p = (const char *)data;
+	ssize_t n;
+	while (size > 0) {
+		n = ::write(fd, p, size);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+/**********************
+ *  GLOBAL FUNCTIONS
+ **********************/
+
+uint64_t config_cache_source_hash(const char *path, const char *build) {
+	struct stat st;
+	void *map;
+	uint64_t hash;
+	int fd;
+
+	fd = ::open(path, O_RDONLY);
+	if (fd < 0) return 0;
+	if ((fstat(fd, &st) < 0) || (st.st_size < 1)) {
+		::close(fd);
+		return 0;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (map == MAP_FAILED) return 0;
+	hash = 0;
+	// the content of included files is not covered
+	if (memmem(map, st.st_size, "@include", 8) == NULL) {
+		hash = fnv64(FNV64_BASIS, map, st.st_size);
+		hash = fnv64(hash, build, strlen(build));
+		if (hash == 0) hash = 1;
+	}
+	munmap(map, st.st_size);
+	return hash;
+}
+
+bool config_cache_write(const char *path, uint64_t sourceHash, const updatecycle *cycles, int cycleCount, ModbusTag *tags, int tagCount) {
+	config_cache_header_t header;
+	config_cache_cycle_t *cycleRecords;
+	config_cache_tag_t *tagRecords, *rec;
+	std::unordered_map<std::string, uint32_t> stringIndex;
+	std::string strings(1, '\0');		// offset 0 = empty string
+	std::string tmpPath;
+	bool ok;
+	int fd, i;
+
+	if ((path == NULL) || (sourceHash == 0) || (cycleCount < 0) || (tagCount < 0)) return false;
+	cycleRecords = new config_cache_cycle_t[cycleCount+1];
+	tagRecords = new config_cache_tag_t[tagCount+1];
+	for (i = 0; i < cycleCount; i++) {
+		cycleRecords[i].ident = cycles[i].ident;
+		cycleRecords[i].interval = cycles[i].interval;
+	}
+	for (i = 0; i < tagCount; i++) {
+		rec = &tagRecords[i];
+		memset(rec, 0, sizeof(config_cache_tag_t));
+		rec->multiplier = tags[i].getMultiplier();
+		rec->offset = tags[i].getOffset();
+		rec->topic = string_add(strings, stringIndex, tags[i].getTopic());
+		rec->format = string_add(strings, stringIndex, tags[i].getFormat());
+		rec->name = string_add(strings, stringIndex, tags[i].getName());
+		if (tags[i].isComputed()) {
+			rec->expression = string_add(strings, stringIndex, tags[i].getExpression()->getSource());
+			rec->flags |= CONFIG_CACHE_FLAG_COMPUTED;
+		}
+		rec->noreadValue = tags[i].getNoreadValue();
+		rec->noreadAction = tags[i].getNoreadAction();
+		rec->noreadIgnore = tags[i].getNoreadIgnore();
+		rec->updateCycleId = tags[i].updateCycleId();
+		rec->group = tags[i].getGroup();
+		rec->historySlot = tags[i].getHistorySlot();
+		rec->aggregateWindow = tags[i].getAggregateWindow();
+		rec->messageExpiry = tags[i].getMessageExpiry();
+		rec->address = tags[i].getRegisterAddress();
+		rec->slaveId = tags[i].getSlaveId();
+		rec->valueType = (uint8_t)tags[i].getValueType();
+		rec->encoding = (uint8_t)tags[i].getEncoding();
+		rec->qos = (uint8_t)tags[i].getQos();
+		if (tags[i].getPublishRetain()) rec->flags |= CONFIG_CACHE_FLAG_RETAIN;
+		if (tags[i].getPublishTimestamp()) rec->flags |= CONFIG_CACHE_FLAG_TIMESTAMP;
+	}
+
+	memset(&header, 0, sizeof(header));
+	header.magic = CONFIG_CACHE_MAGIC;
+	header.version = CONFIG_CACHE_VERSION;
+	header.headerSize = sizeof(config_cache_header_t);
+	header.cycleSize = sizeof(config_cache_cycle_t);
+	header.tagSize = sizeof(config_cache_tag_t);
+	header.cycleCount = cycleCount;
+	header.tagCount = tagCount;
+	header.stringSize = strings.size();
+	header.sourceHash = sourceHash;
+	header.checksum = fnv64(FNV64_BASIS, cycleRecords, (size_t)cycleCount * sizeof(config_cache_cycle_t));
+	header.checksum = fnv64(header.checksum, tagRecords, (size_t)tagCount * sizeof(config_cache_tag_t));
+	header.checksum = fnv64(header.checksum, strings.data(), strings.size());
+
+	// write to a temporary file and rename, a reader never sees a partial image
+	tmpPath = std::string(path) + ".tmp";
+	fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		syslog(LOG_ERR, "ConfigCache - unable to create %s: %s", tmpPath.c_str(), strerror(errno));
+		delete [] cycleRecords;
+		delete [] tagRecords;
+		return false;
+	}
+	ok = write_all(fd, &header, sizeof(header))
+		&& write_all(fd, cycleRecords, (size_t)cycleCount * sizeof(config_cache_cycle_t))
+		&& write_all(fd, tagRecords, (size_t)tagCount * sizeof(config_cache_tag_t))
+		&& write_all(fd, strings.data(), strings.size())
+		&& (fsync(fd) == 0);
+	::close(fd);
+	delete [] cycleRecords;
+	delete [] tagRecords;
+	if (ok) ok = (rename(tmpPath.c_str(), path) == 0);
+	if (!ok) {
+		syslog(LOG_ERR, "ConfigCache - unable to write %s: %s", path, strerror(errno));
+		unlink(tmpPath.c_str());
+	}
+	return ok;
+}
+
+bool config_cache_read(const char *path, uint64_t sourceHash, updatecycle **cycles, int *cycleCount, ModbusTag **tags, int *tagCount) {
+	const config_cache_header_t *header;
+	const config_cache_cycle_t *cycleRecords;
+	const config_cache_tag_t *tagRecords, *rec;
+	const char *strings;
+	struct stat st;
+	uint8_t *map;
+	updatecycle *newCycles;
+	ModbusTag *newTags;
+	Expression *expression;
+	uint64_t size, checksum;
+	bool valid;
+	int fd;
+	uint32_t i;
+
+	if ((path == NULL) || (sourceHash == 0)) return false;
+	fd = ::open(path, O_RDONLY);
+	if (fd < 0) return false;
+	if ((fstat(fd, &st) < 0) || ((size_t)st.st_size < sizeof(config_cache_header_t))) {
+		::close(fd);
+		return false;
+	}
+	map = (uint8_t *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (map == MAP_FAILED) return false;
+
+	header = (const config_cache_header_t *)map;
+	valid = (header->magic == CONFIG_CACHE_MAGIC) && (header->version == CONFIG_CACHE_VERSION)
+		&& (header->headerSize == sizeof(config_cache_header_t)) && (header->cycleSize == sizeof(config_cache_cycle_t))
+		&& (header->tagSize == sizeof(config_cache_tag_t)) && (header->sourceHash == sourceHash) && (header->stringSize > 0);
+	if (valid) {
+		size = sizeof(config_cache_header_t) + ((uint64_t)header->cycleCount * sizeof(config_cache_cycle_t))
+			+ ((uint64_t)header->tagCount * sizeof(config_cache_tag_t)) + header->stringSize;
+		valid = (size == (uint64_t)st.st_size);
+	}
+	if (valid) {
+		checksum = fnv64(FNV64_BASIS, map + sizeof(config_cache_header_t), st.st_size - sizeof(config_cache_header_t));
+		valid = (checksum == header->checksum);
+	}
+	if (!valid) {
+		munmap(map, st.st_size);
+		return false;
+	}
+	cycleRecords = (const config_cache_cycle_t *)(map + sizeof(config_cache_header_t));
+	tagRecords = (const config_cache_tag_t *)(cycleRecords + header->cycleCount);
+	strings = (const char *)(tagRecords + header->tagCount);
+	// every offset must point into the table and the last string must be terminated
+	valid = (strings[header->stringSize - 1] == 0);
+	for (i = 0; valid && (i < header->tagCount); i++) {
+		rec = &tagRecords[i];
+		valid = (rec->topic < header->stringSize) && (rec->format < header->stringSize)
+			&& (rec->name < header->stringSize) && (rec->expression < header->stringSize);
+	}
+	if (!valid) {
+		munmap(map, st.st_size);
+		return false;
+	}
+
+	newCycles = new updatecycle[header->cycleCount];
+	for (i = 0; i < header->cycleCount; i++) {
+		newCycles[i].ident = cycleRecords[i].ident;
+		newCycles[i].interval = cycleRecords[i].interval;
+		newCycles[i].nextUpdateTime = clock_time() + newCycles[i].interval;
+	}
+	newTags = new ModbusTag[header->tagCount];
+	for (i = 0; i < header->tagCount; i++) {
+		rec = &tagRecords[i];
+		if (rec->flags & CONFIG_CACHE_FLAG_COMPUTED) {
+			expression = new Expression();
+			expression->setSource(&strings[rec->expression]);
+			newTags[i].setExpression(expression);
+		} else {
+			newTags[i].setAddress(rec->address);
+		}
+		newTags[i].setSlaveId(rec->slaveId);
+		newTags[i].setTopic(&strings[rec->topic]);
+		newTags[i].setFormat(&strings[rec->format]);
+		newTags[i].setName(&strings[rec->name]);
+		newTags[i].setMultiplier(rec->multiplier);
+		newTags[i].setOffset(rec->offset);
+		newTags[i].setNoreadValue(rec->noreadValue);
+		newTags[i].setNoreadAction(rec->noreadAction);
+		newTags[i].setNoreadIgnore(rec->noreadIgnore);
+		newTags[i].setUpdateCycleId(rec->updateCycleId);
+		newTags[i].setGroup(rec->group);
+		newTags[i].setHistorySlot(rec->historySlot);
+		newTags[i].setAggregateWindow(rec->aggregateWindow);
+		newTags[i].setMessageExpiry(rec->messageExpiry);
+		newTags[i].setValueType((mb_value_type_t)rec->valueType);
+		newTags[i].setEncoding((payload_encoding_t)rec->encoding);
+		newTags[i].setQos(rec->qos);
+		newTags[i].setPublishRetain((rec->flags & CONFIG_CACHE_FLAG_RETAIN) != 0);
+		newTags[i].setPublishTimestamp((rec->flags & CONFIG_CACHE_FLAG_TIMESTAMP) != 0);
+	}
+	*cycles = newCycles;
+	*cycleCount = header->cycleCount;
+	*tags = newTags;
+	*tagCount = header->tagCount;
+	munmap(map, st.st_size);
+	return true;
+}
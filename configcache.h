@@ -0,0 +1,128 @@
+/**
+ * @file configcache.h
+
+-----------------------------------------------------------------------------
+ Binary image of the read tag configuration (update cycles and the tags of
+ all enabled slaves) for a fast start of large installations.
+
+ The image is written after the config file has been parsed and validated.
+ On the next start it is loaded with mmap instead of walking the mbslaves
+ settings when the source hash matches: the hash covers the bytes of the
+ config file and the build of the program, any edit or a new binary makes
+ the image invalid and it is rebuilt from the text. Config files with
+ @include are not cached (included files are not part of the hash).
+ The file is replaced atomically (rename), a torn image from a power
+ failure fails the checksum and is ignored.
+
+ File layout:
+   config_cache_header_t
+   config_cache_cycle_t[cycleCount]
+   config_cache_tag_t[tagCount]
+   char strings[stringSize]		(NUL terminated, offset 0 = "")
+-----------------------------------------------------------------------------
+*/
+
+#ifndef _CONFIGCACHE_H_
+#define _CONFIGCACHE_H_
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <stdint.h>
+
+#include "modbustag.h"
+#include "mbbridge.h"
+
+/*********************
+ *      DEFINES
+ *********************/
+#define CONFIG_CACHE_MAGIC 0x43434D42		// "BMCC"
+#define CONFIG_CACHE_VERSION 1
+
+#define CONFIG_CACHE_FLAG_RETAIN 0x01		// publish with retain
+#define CONFIG_CACHE_FLAG_TIMESTAMP 0x02	// publish source timestamp
+#define CONFIG_CACHE_FLAG_COMPUTED 0x04		// expression instead of slave register
+
+/**********************
+ *      TYPEDEFS
+ **********************/
+typedef struct
+{
+	uint32_t magic;			// CONFIG_CACHE_MAGIC
+	uint32_t version;		// CONFIG_CACHE_VERSION
+	uint32_t headerSize;	// sizeof(config_cache_header_t)
+	uint32_t cycleSize;		// sizeof(config_cache_cycle_t)
+	uint32_t tagSize;		// sizeof(config_cache_tag_t)
+	uint32_t cycleCount;
+	uint32_t tagCount;
+	uint32_t stringSize;	// size of string table [bytes]
+	uint64_t sourceHash;	// config_cache_source_hash() of the config file
+	uint64_t checksum;		// FNV-1a of everything after the header
+}config_cache_header_t;
+
+typedef struct
+{
+	int32_t ident;
+	int32_t interval;		// [s]
+}config_cache_cycle_t;
+
+typedef struct
+{
+	double multiplier;
+	double offset;
+	uint32_t topic;			// offsets into the string table
+	uint32_t format;
+	uint32_t name;
+	uint32_t expression;	// source of computed tag
+	float noreadValue;
+	int32_t noreadAction;
+	int32_t noreadIgnore;
+	int32_t updateCycleId;
+	int32_t group;
+	int32_t historySlot;	// -1 = no history
+	int32_t aggregateWindow;
+	uint32_t messageExpiry;
+	uint16_t address;		// register address (e.g. 40100)
+	uint8_t slaveId;
+	uint8_t valueType;		// mb_value_type_t
+	uint8_t encoding;		// payload_encoding_t
+	uint8_t qos;
+	uint8_t flags;			// CONFIG_CACHE_FLAG_*
+	uint8_t reserved;
+}config_cache_tag_t;
+
+/**
+ * Hash of a config file for the cache
+ * @param path: config file
+ * @param build: build identification of the program
+ * @return hash of file and build, 0 = file can't be read or can't be cached
+ */
+uint64_t config_cache_source_hash(const char *path, const char *build);
+
+/**
+ * Write tag configuration to the cache file
+ * @param path: cache file, replaced atomically
+ * @param sourceHash: hash of the config file the tags were read from
+ * @param cycles: update cycles
+ * @param cycleCount: number of update cycles
+ * @param tags: read tags
+ * @param tagCount: number of read tags
+ * @return false on failure
+ */
+bool config_cache_write(const char *path, uint64_t sourceHash, const updatecycle *cycles, int cycleCount, ModbusTag *tags, int tagCount);
+
+/**
+ * Load tag configuration from the cache file
+ * the arrays are allocated with new[], expressions of computed tags are
+ * not compiled
+ * @param path: cache file
+ * @param sourceHash: hash of the current config file
+ * @param cycles: storage for update cycle array
+ * @param cycleCount: storage for number of update cycles
+ * @param tags: storage for read tag array
+ * @param tagCount: storage for number of read tags
+ * @return false if the file is missing, invalid or was built from another source
+ */
+bool config_cache_read(const char *path, uint64_t sourceHash, updatecycle **cycles, int *cycleCount, ModbusTag **tags, int *tagCount);
+
+#endif /* _CONFIGCACHE_H_ */
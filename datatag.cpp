@@ -18,6 +18,7 @@
 #include <time.h>
 #include <unistd.h>
 #include "datatag.h"
+#include "clock.h"
 
 #include <stdexcept>
 #include <iostream>
@@ -113,6 +114,9 @@ Tag::Tag(const char *topicStr) {
     _publish = false;        // subscribe tag
     _publishRetain = false;
     _valueIsRetained = false;
+    _topicDoubleValue = 0;
+    _typedValue.type = VALUE_TYPE_NONE;
+    _typedValue.u = 0;
     //cout << topic << endl;
     _topicCRC = gen_crc16(_topic.data(), _topic.length());
     //cout << topicCRC << endl;
@@ -148,8 +152,10 @@ void Tag::testCallback() {
 }
 
 void Tag::setValue(double doubleValue) {
+    _typedValue.type = VALUE_TYPE_FLOAT;
+    _typedValue.f = doubleValue;
     _topicDoubleValue = doubleValue;
-    _lastUpdateTime = time(NULL);
+    _lastUpdateTime = clock_time();
     // call valueUpdate callback if it exists
     if (_valueUpdate != NULL) {
         (*_valueUpdate) (_valueUpdateID, this);
@@ -165,31 +171,31 @@ void Tag::setValue(int intValue) {
 }
 
 bool Tag::setValue(const char* strValue) {
-    float newValue;
-    int result = 0;
-    
     if (strValue == NULL) return false;	// guard against null
-    
-    char firstChar = strValue[0];
-    
-    // check for numeric data
-    if ( (firstChar >= '0') && (firstChar <='9') ) {
-        result = sscanf(strValue, "%f", &newValue);
-    } else {    // non-numeric, assume its "true" or "false"
-        if ( (firstChar == 'f') || (firstChar == 'F') ) {
-            newValue = 0; result = 1; }
-        if ( (firstChar == 't') || (firstChar == 'T') ) {
-            newValue = 1; result = 1; }
-    }
-    // report conversion failure
-    if (result != 1) {
-        fprintf(stderr, "%s[%d] %s - failed to convert <%s> for topic %s\n", __FILE__,__LINE__,__func__, strValue, _topic.c_str());
+    return setValue(strValue, strlen(strValue));
+}
+
+bool Tag::setValue(const void* payload, int payloadlen) {
+    typed_value_t newValue;
+    if (!payload_parse(payload, payloadlen, &newValue)) {
+        // report conversion failure
+        fprintf(stderr, "%s[%d] %s - failed to convert <%.*s> for topic %s\n", __FILE__,__LINE__,__func__, payloadlen > 0 ? payloadlen : 0, (const char*)payload, _topic.c_str());
         return false;
     }
-    setValue(newValue);
+    setValue(&newValue);
     return true;
 }
 
+void Tag::setValue(const typed_value_t *typedValue) {
+    _typedValue = *typedValue;
+    _topicDoubleValue = typed_value_as_double(typedValue);
+    _lastUpdateTime = clock_time();
+    // call valueUpdate callback if it exists
+    if (_valueUpdate != NULL) {
+        (*_valueUpdate) (_valueUpdateID, this);
+    }
+}
+
 double Tag::doubleValue(void) {
     return _topicDoubleValue;
 }
@@ -202,6 +208,10 @@ int Tag::intValue(void) {
     return (int) _topicDoubleValue;
 }
 
+typed_value_t Tag::typedValue(void) {
+    return _typedValue;
+}
+
 bool Tag::isPublish() {
     return _publish;
 }
@@ -258,6 +268,19 @@ TagStore::~TagStore() {
     deleteAll();
 }
 
+bool TagStore::deleteTag(const char* tagTopic) {
+    Tag *tp = getTag(tagTopic);
+    if (tp == NULL) return false;
+    for (int index = 0; index < MAX_TAG_NUM; index++) {
+        if (_tagList[index] == tp) {
+            delete(tp);
+            _tagList[index] = NULL;
+            break;
+        }
+    }
+    return true;
+}
+
 void TagStore::deleteAll(void) {
     // delete every tag
     for (int i = 0; i < MAX_TAG_NUM; i++) {
@@ -30,6 +30,8 @@
 #include <iostream>
 #include <string>
 
+#include "payload.h"
+
 /*********************
  *      DEFINES
  *********************/
@@ -114,6 +116,20 @@ public:
      */
     bool setValue(const char* strValue);
 
+    /**
+     * Set the value from a received payload (see payload_parse)
+     * @param payload: payload data, does not need to be NUL terminated
+     * @param payloadlen: number of bytes in payload
+     * @returns true on success
+     */
+    bool setValue(const void* payload, int payloadlen);
+
+    /**
+     * Set the value, keeps the native type (no loss of integer precision)
+     * @param typedValue: the new value
+     */
+    void setValue(const typed_value_t *typedValue);
+
     /**
      * Get value
      * @return value as double
@@ -132,6 +148,12 @@ public:
      */
     int intValue(void);
 
+    /**
+     * Get value in the type it was set with
+     * @return typed value
+     */
+    typed_value_t typedValue(void);
+
     /**
      * is tag "publish"
      * @return true if publish or false if subscribe
@@ -194,6 +216,7 @@ private:
 	std::string _topic;					// storage for topic path
 	uint16_t _topicCRC;					// CRC on topic path
 	double _topicDoubleValue;			// storage numeric value
+	typed_value_t _typedValue;			// value in native type
 	time_t _lastUpdateTime;				// last update time (change of value)
 	void (*_valueUpdate) (int,Tag*);	// callback for value update
 	int _valueUpdateID;					// ID for value update
@@ -215,6 +238,13 @@ public:
      */
     Tag* addTag(const char* tagTopic);
 
+    /**
+     * Delete a tag
+     * @param tagTopic: the topic as a string
+     * @return false if the tag was not found
+     */
+    bool deleteTag(const char* tagTopic);
+
     /**
      * Delete all tags from tag list
      */
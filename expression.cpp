@@ -0,0 +1,393 @@
+/**
+ * @file expression.cpp
+ *
+ */
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "expression.h"
+
+/*********************
+ *      DEFINES
+ *********************/
+#define EXPRESSION_LEVELS 6		// binary operator precedence levels
+
+/**********************
+ *      TYPEDEFS
+ **********************/
+typedef enum
+{
+	OP_CONST = 0,	// push value
+	OP_LOAD,		// push inputs[arg]
+	OP_ADD,
+	OP_SUB,
+	OP_MUL,
+	OP_DIV,
+	OP_MOD,
+	OP_LT,
+	OP_LE,
+	OP_GT,
+	OP_GE,
+	OP_EQ,
+	OP_NE,
+	OP_AND,
+	OP_OR,
+	OP_NEG,
+	OP_NOT,
+	OP_JZ,			// pop, jump to arg if zero
+	OP_JMP,			// jump to arg
+	OP_MIN,			// argc arguments
+	OP_MAX,			// argc arguments
+	OP_ABS,
+	OP_U32,
+	OP_I32,
+	OP_F32
+}expression_opcode_t;
+
+typedef struct
+{
+	const char *text;
+	uint8_t code;
+}expression_operator_t;
+
+typedef struct
+{
+	const char *name;
+	uint8_t code;
+	int minArgs;
+	int maxArgs;
+}expression_function_t;
+
+/**********************
+ *  STATIC VARIABLES
+ **********************/
+
+// binary operators by precedence level (lowest first), longer operators first
+static const expression_operator_t operators[EXPRESSION_LEVELS][5] = {
+	{ {"||", OP_OR}, {NULL, 0} },
+	{ {"&&", OP_AND}, {NULL, 0} },
+	{ {"==", OP_EQ}, {"!=", OP_NE}, {NULL, 0} },
+	{ {"<=", OP_LE}, {">=", OP_GE}, {"<", OP_LT}, {">", OP_GT}, {NULL, 0} },
+	{ {"+", OP_ADD}, {"-", OP_SUB}, {NULL, 0} },
+	{ {"*", OP_MUL}, {"/", OP_DIV}, {"%", OP_MOD}, {NULL, 0} }
+};
+
+static const expression_function_t functions[] = {
+	{ "min", OP_MIN, 2, EXPRESSION_STACK_MAX },
+	{ "max", OP_MAX, 2, EXPRESSION_STACK_MAX },
+	{ "abs", OP_ABS, 1, 1 },
+	{ "u32", OP_U32, 2, 2 },
+	{ "i32", OP_I32, 2, 2 },
+	{ "f32", OP_F32, 2, 2 },
+	{ NULL, 0, 0, 0 }
+};
+
+/*********************
+ * LOCAL FUNCTIONS
+ *********************/
+
+/**
+ * Combine two 16 bit register values (high word first)
+ * @return false if a value is not in 0..65535 (incl. NaN)
+ */
+static bool register_words(double hi, double lo, uint32_t *bits) {
+	if (!((hi >= 0.0) && (hi < 65536.0) && (lo >= 0.0) && (lo < 65536.0))) return false;
+	*bits = ((uint32_t)hi << 16) | (uint32_t)lo;
+	return true;
+}
+
+/*********************
+ * MEMBER FUNCTIONS
+ *********************/
+
+//
+// Class Expression
+//
+
+Expression::Expression() {
+	_pos = NULL;
+	_depth = 0;
+	_maxDepth = 0;
+	_resolver = NULL;
+	_ctx = NULL;
+}
+
+void Expression::setSource(const char *source) {
+	if (source != NULL) _source = source;
+	_code.clear();
+	_inputs.clear();
+}
+
+const char* Expression::getSource(void) {
+	return _source.c_str();
+}
+
+const char* Expression::getError(void) {
+	return _error.c_str();
+}
+
+int Expression::inputCount(void) {
+	return (int) _inputs.size();
+}
+
+int Expression::inputId(int index) {
+	if ((index < 0) || (index >= (int)_inputs.size())) return -1;
+	return _inputs[index];
+}
+
+bool Expression::compile(expression_resolver_t resolver, void *ctx) {
+	_code.clear();
+	_inputs.clear();
+	_error.clear();
+	_resolver = resolver;
+	_ctx = ctx;
+	_pos = _source.c_str();
+	_depth = 0;
+	_maxDepth = 0;
+	if (!_parseConditional()) {
+		_code.clear();
+		_inputs.clear();
+		return false;
+	}
+	_skipSpace();
+	if (*_pos != 0) {
+		_fail("unexpected character");
+		_code.clear();
+		_inputs.clear();
+		return false;
+	}
+	return true;
+}
+
+double Expression::evaluate(const double *inputs) {
+	double stack[EXPRESSION_STACK_MAX];
+	const expression_op_t *op;
+	const expression_op_t *code = _code.data();
+	size_t pc = 0, n = _code.size();
+	int sp = 0;
+	double a, b;
+	uint32_t bits;
+	float f;
+
+	while (pc < n) {
+		op = &code[pc++];
+		switch (op->code) {
+		case OP_CONST: stack[sp++] = op->value; continue;
+		case OP_LOAD: stack[sp++] = inputs[op->arg]; continue;
+		case OP_NEG: stack[sp-1] = -stack[sp-1]; continue;
+		case OP_NOT: stack[sp-1] = (stack[sp-1] == 0.0) ? 1.0 : 0.0; continue;
+		case OP_ABS: stack[sp-1] = fabs(stack[sp-1]); continue;
+		case OP_JZ:
+			if (stack[--sp] == 0.0) pc = op->arg;
+			continue;
+		case OP_JMP: pc = op->arg; continue;
+		case OP_MIN:
+		case OP_MAX:
+			sp -= op->argc;
+			a = stack[sp];
+			for (int i = 1; i < op->argc; i++) {
+				b = stack[sp + i];
+				if ((op->code == OP_MIN) ? (b < a) : (b > a)) a = b;
+			}
+			stack[sp++] = a;
+			continue;
+		default:
+			break;
+		}
+		// binary operations
+		b = stack[--sp];
+		a = stack[sp-1];
+		switch (op->code) {
+		case OP_ADD: a = a + b; break;
+		case OP_SUB: a = a - b; break;
+		case OP_MUL: a = a * b; break;
+		case OP_DIV: a = a / b; break;
+		case OP_MOD: a = fmod(a, b); break;
+		case OP_LT: a = (a < b); break;
+		case OP_LE: a = (a <= b); break;
+		case OP_GT: a = (a > b); break;
+		case OP_GE: a = (a >= b); break;
+		case OP_EQ: a = (a == b); break;
+		case OP_NE: a = (a != b); break;
+		case OP_AND: a = (a != 0.0) && (b != 0.0); break;
+		case OP_OR: a = (a != 0.0) || (b != 0.0); break;
+		case OP_U32:
+			a = register_words(a, b, &bits) ? (double) bits : NAN;
+			break;
+		case OP_I32:
+			a = register_words(a, b, &bits) ? (double) (int32_t) bits : NAN;
+			break;
+		case OP_F32:
+			if (register_words(a, b, &bits)) {
+				memcpy(&f, &bits, sizeof(f));
+				a = f;
+			} else {
+				a = NAN;
+			}
+			break;
+		default: break;
+		}
+		stack[sp-1] = a;
+	}
+	return (sp > 0) ? stack[sp-1] : NAN;
+}
+
+bool Expression::_fail(const char *message) {
+	char buf[32];
+	snprintf(buf, sizeof(buf), " at position %d", (int)(_pos - _source.c_str()) + 1);
+	_error = message;
+	_error += buf;
+	return false;
+}
+
+void Expression::_skipSpace(void) {
+	while (isspace((unsigned char)*_pos)) _pos++;
+}
+
+bool Expression::_emit(uint8_t code, int stackChange, uint16_t arg, double value, uint8_t argc) {
+	expression_op_t op;
+	if (_code.size() >= UINT16_MAX) return _fail("expression too long");
+	_depth += stackChange;
+	if (_depth > _maxDepth) _maxDepth = _depth;
+	if (_maxDepth > EXPRESSION_STACK_MAX) return _fail("expression too complex");
+	memset(&op, 0, sizeof(op));
+	op.code = code;
+	op.argc = argc;
+	op.arg = arg;
+	op.value = value;
+	_code.push_back(op);
+	return true;
+}
+
+bool Expression::_parseConditional(void) {
+	size_t jz, jmp;
+	int depth;
+	if (!_parseBinary(0)) return false;
+	_skipSpace();
+	if (*_pos != '?') return true;
+	_pos++;
+	jz = _code.size();
+	if (!_emit(OP_JZ, -1)) return false;
+	depth = _depth;
+	if (!_parseConditional()) return false;
+	_skipSpace();
+	if (*_pos != ':') return _fail("':' expected");
+	_pos++;
+	jmp = _code.size();
+	if (!_emit(OP_JMP, 0)) return false;
+	_code[jz].arg = (uint16_t) _code.size();
+	_depth = depth;			// only one branch is executed
+	if (!_parseConditional()) return false;
+	_code[jmp].arg = (uint16_t) _code.size();
+	return true;
+}
+
+bool Expression::_parseBinary(int level) {
+	const expression_operator_t *op;
+	if (level >= EXPRESSION_LEVELS) return _parseUnary();
+	if (!_parseBinary(level + 1)) return false;
+	for (;;) {
+		_skipSpace();
+		for (op = operators[level]; op->text != NULL; op++)
+			if (strncmp(_pos, op->text, strlen(op->text)) == 0) break;
+		if (op->text == NULL) return true;
+		_pos += strlen(op->text);
+		if (!_parseBinary(level + 1)) return false;
+		if (!_emit(op->code, -1)) return false;
+	}
+}
+
+bool Expression::_parseUnary(void) {
+	_skipSpace();
+	if (*_pos == '-') {
+		_pos++;
+		if (!_parseUnary()) return false;
+		return _emit(OP_NEG, 0);
+	}
+	if (*_pos == '+') {
+		_pos++;
+		return _parseUnary();
+	}
+	if ((*_pos == '!') && (_pos[1] != '=')) {
+		_pos++;
+		if (!_parseUnary()) return false;
+		return _emit(OP_NOT, 0);
+	}
+	return _parsePrimary();
+}
+
+bool Expression::_parsePrimary(void) {
+	const expression_function_t *fn;
+	const char *name;
+	size_t len;
+	char *end;
+	double value;
+	int id, argc;
+	size_t i;
+
+	_skipSpace();
+	if (*_pos == '(') {
+		_pos++;
+		if (!_parseConditional()) return false;
+		_skipSpace();
+		if (*_pos != ')') return _fail("')' expected");
+		_pos++;
+		return true;
+	}
+	if (isdigit((unsigned char)*_pos) || (*_pos == '.')) {
+		value = strtod(_pos, &end);
+		if (end == _pos) return _fail("invalid number");
+		_pos = end;
+		return _emit(OP_CONST, 1, 0, value);
+	}
+	if (!isalpha((unsigned char)*_pos) && (*_pos != '_'))
+		return _fail((*_pos == 0) ? "unexpected end of expression" : "unexpected character");
+	name = _pos;
+	while (isalnum((unsigned char)*_pos) || (*_pos == '_')) _pos++;
+	len = _pos - name;
+	_skipSpace();
+	if (*_pos == '(') {
+		// function call
+		for (fn = functions; fn->name != NULL; fn++)
+			if ((strlen(fn->name) == len) && (strncmp(fn->name, name, len) == 0)) break;
+		if (fn->name == NULL) {
+			_pos = name;
+			return _fail("unknown function");
+		}
+		_pos++;
+		argc = 0;
+		for (;;) {
+			if (!_parseConditional()) return false;
+			argc++;
+			_skipSpace();
+			if (*_pos == ',') { _pos++; continue; }
+			if (*_pos == ')') { _pos++; break; }
+			return _fail("',' or ')' expected");
+		}
+		if ((argc < fn->minArgs) || (argc > fn->maxArgs)) {
+			_pos = name;
+			return _fail("wrong number of arguments");
+		}
+		return _emit(fn->code, 1 - argc, 0, 0.0, (uint8_t)argc);
+	}
+	// tag reference
+	id = (_resolver != NULL) ? _resolver(name, len, _ctx) : -1;
+	if (id < 0) {
+		_pos = name;
+		return _fail("unknown tag");
+	}
+	for (i = 0; i < _inputs.size(); i++)
+		if (_inputs[i] == id) break;
+	if (i == _inputs.size()) {
+		if (_inputs.size() >= EXPRESSION_INPUTS_MAX) return _fail("too many tags");
+		_inputs.push_back(id);
+	}
+	return _emit(OP_LOAD, 1, (uint16_t)i);
+}
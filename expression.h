@@ -0,0 +1,123 @@
+/**
+ * @file expression.h
+
+-----------------------------------------------------------------------------
+ Class "Expression" evaluates the formula of a computed tag.
+
+ The formula is compiled once (at config load) into a compact stack based
+ bytecode, evaluation does not allocate memory.
+
+ Syntax:
+   numbers      12, 0.5, 1e3, 0x1F
+   tag names    voltage, l1_current (resolved by the caller)
+   operators    + - * / %  < <= > >= == !=  && || !  cond ? a : b  ( )
+   functions    min(a, b, ...), max(a, b, ...), abs(a)
+                u32(hi, lo), i32(hi, lo), f32(hi, lo)
+                combine two 16 bit register values (high word first),
+                NaN if a value is not in 0..65535
+ Comparisons and logical operators return 1 or 0.
+-----------------------------------------------------------------------------
+*/
+
+#ifndef _EXPRESSION_H_
+#define _EXPRESSION_H_
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+/*********************
+ *      DEFINES
+ *********************/
+#define EXPRESSION_STACK_MAX 32		// max evaluation stack depth
+#define EXPRESSION_INPUTS_MAX 16	// max number of different tags per expression
+
+/**********************
+ *      TYPEDEFS
+ **********************/
+
+/**
+ * Resolve a tag name
+ * @param name: tag name (not NUL terminated)
+ * @param len: length of name
+ * @param ctx: context pointer passed to compile()
+ * @return tag id (>= 0) or -1 if the name can't be used
+ */
+typedef int (*expression_resolver_t)(const char *name, size_t len, void *ctx);
+
+typedef struct
+{
+	uint8_t code;			// operation
+	uint8_t argc;			// argument count (functions)
+	uint16_t arg;			// input index or jump target
+	uint32_t reserved;
+	double value;			// constant
+}expression_op_t;
+
+class Expression {
+public:
+	Expression();
+
+	/**
+	 * Set formula, compile() must be called before the expression can be used
+	 */
+	void setSource(const char *source);
+	const char* getSource(void);
+
+	/**
+	 * Compile formula
+	 * @param resolver: function to resolve tag names to tag ids
+	 * @param ctx: passed to resolver
+	 * @return false on syntax error, see getError()
+	 */
+	bool compile(expression_resolver_t resolver, void *ctx);
+
+	/**
+	 * @return description of last compile error
+	 */
+	const char* getError(void);
+
+	/**
+	 * @return number of different tags used by the expression
+	 */
+	int inputCount(void);
+
+	/**
+	 * @return tag id of input
+	 */
+	int inputId(int index);
+
+	/**
+	 * Evaluate expression
+	 * @param inputs: values of the input tags (same order as inputId)
+	 * @return result
+	 */
+	double evaluate(const double *inputs);
+
+private:
+	bool _fail(const char *message);
+	bool _parseConditional(void);
+	bool _parseBinary(int level);
+	bool _parseUnary(void);
+	bool _parsePrimary(void);
+	bool _emit(uint8_t code, int stackChange, uint16_t arg = 0, double value = 0.0, uint8_t argc = 0);
+	void _skipSpace(void);
+
+	std::string _source;
+	std::string _error;
+	std::vector<expression_op_t> _code;
+	std::vector<int> _inputs;			// tag ids
+	// compile state
+	const char *_pos;
+	int _depth;
+	int _maxDepth;
+	expression_resolver_t _resolver;
+	void *_ctx;
+};
+
+#endif /* _EXPRESSION_H_ */
@@ -0,0 +1,108 @@
+/**
+ * @file histogram.cpp
+ *
+ */
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <stdint.h>
+
+#include "histogram.h"
+
+/*********************
+ * MEMBER FUNCTIONS
+ *********************/
+
+//
+// Class Histogram
+//
+
+Histogram::Histogram() {
+	reset();
+}
+
+Histogram::~Histogram() {
+}
+
+int Histogram::bucketIndex(uint64_t value) {
+	int msb, shift;
+	if (value < HISTOGRAM_SUB_COUNT) return (int) value;
+	msb = 63 - __builtin_clzll(value);
+	shift = msb - HISTOGRAM_SUB_BITS;
+	return ((shift + 1) << HISTOGRAM_SUB_BITS) + (int)((value >> shift) & (HISTOGRAM_SUB_COUNT - 1));
+}
+
+uint64_t Histogram::bucketUpperBound(int bucket) {
+	int shift;
+	uint64_t lower;
+	if (bucket < HISTOGRAM_SUB_COUNT) return (uint64_t) bucket;
+	shift = (bucket >> HISTOGRAM_SUB_BITS) - 1;
+	lower = (uint64_t)(HISTOGRAM_SUB_COUNT + (bucket & (HISTOGRAM_SUB_COUNT - 1))) << shift;
+	return lower + ((1ULL << shift) - 1);
+}
+
+void Histogram::record(uint64_t value) {
+	uint64_t prev;
+	_buckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+	_count.fetch_add(1, std::memory_order_relaxed);
+	_sum.fetch_add(value, std::memory_order_relaxed);
+	prev = _min.load(std::memory_order_relaxed);
+	while ((value < prev) && !_min.compare_exchange_weak(prev, value, std::memory_order_relaxed));
+	prev = _max.load(std::memory_order_relaxed);
+	while ((value > prev) && !_max.compare_exchange_weak(prev, value, std::memory_order_relaxed));
+}
+
+void Histogram::reset(void) {
+	for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+		_buckets[i].store(0, std::memory_order_relaxed);
+	_count.store(0, std::memory_order_relaxed);
+	_sum.store(0, std::memory_order_relaxed);
+	_min.store(UINT64_MAX, std::memory_order_relaxed);
+	_max.store(0, std::memory_order_relaxed);
+}
+
+uint64_t Histogram::count(void) const {
+	return _count.load(std::memory_order_relaxed);
+}
+
+uint64_t Histogram::sum(void) const {
+	return _sum.load(std::memory_order_relaxed);
+}
+
+uint64_t Histogram::min(void) const {
+	uint64_t value = _min.load(std::memory_order_relaxed);
+	return (value == UINT64_MAX) ? 0 : value;
+}
+
+uint64_t Histogram::max(void) const {
+	return _max.load(std::memory_order_relaxed);
+}
+
+double Histogram::mean(void) const {
+	uint64_t n = count();
+	if (n == 0) return 0.0;
+	return (double) sum() / (double) n;
+}
+
+uint64_t Histogram::percentile(double percentile) const {
+	uint64_t total = count();
+	uint64_t target, seen = 0;
+	if (total == 0) return 0;
+	if (percentile >= 100.0) return max();
+	target = (uint64_t)((percentile / 100.0) * (double)total);
+	if (target < 1) target = 1;
+	for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		seen += _buckets[i].load(std::memory_order_relaxed);
+		if (seen >= target) {
+			uint64_t upper = bucketUpperBound(i);
+			return (upper < max()) ? upper : max();
+		}
+	}
+	return max();
+}
+
+uint64_t Histogram::bucketCount(int bucket) const {
+	if ((bucket < 0) || (bucket >= HISTOGRAM_BUCKETS)) return 0;
+	return _buckets[bucket].load(std::memory_order_relaxed);
+}
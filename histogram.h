@@ -0,0 +1,105 @@
+/**
+ * @file histogram.h
+
+-----------------------------------------------------------------------------
+ Class "Histogram" records the distribution of a non-negative value
+ (typically a latency in microseconds).
+
+ The buckets are log-linear (HDR style): every power of two is divided into
+ 8 sub-buckets, which gives a relative error of less than 12.5% over the
+ full uint64 range with a fixed number of buckets.
+ All counters are atomic, values can be recorded from any thread without
+ locking and read concurrently (e.g. for reporting).
+-----------------------------------------------------------------------------
+*/
+
+#ifndef _HISTOGRAM_H_
+#define _HISTOGRAM_H_
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <stdint.h>
+
+#include <atomic>
+
+/*********************
+ *      DEFINES
+ *********************/
+#define HISTOGRAM_SUB_BITS 3						// 8 sub-buckets per power of two
+#define HISTOGRAM_SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS (64 * HISTOGRAM_SUB_COUNT)
+
+class Histogram {
+public:
+	Histogram();
+	~Histogram();
+
+	/**
+	 * Record a value
+	 * @param value: the value to record
+	 */
+	void record(uint64_t value);
+
+	/**
+	 * Clear all recorded values
+	 */
+	void reset(void);
+
+	/**
+	 * @return number of recorded values
+	 */
+	uint64_t count(void) const;
+
+	/**
+	 * @return sum of all recorded values
+	 */
+	uint64_t sum(void) const;
+
+	/**
+	 * @return smallest recorded value (0 if empty)
+	 */
+	uint64_t min(void) const;
+
+	/**
+	 * @return largest recorded value
+	 */
+	uint64_t max(void) const;
+
+	/**
+	 * @return mean of recorded values
+	 */
+	double mean(void) const;
+
+	/**
+	 * Get value at percentile
+	 * @param percentile: 0.0 .. 100.0
+	 * @return upper bound of the bucket containing the percentile
+	 */
+	uint64_t percentile(double percentile) const;
+
+	/**
+	 * Get number of values recorded in a bucket
+	 * @param bucket: bucket index 0 .. HISTOGRAM_BUCKETS-1
+	 */
+	uint64_t bucketCount(int bucket) const;
+
+	/**
+	 * Get bucket index for a value
+	 */
+	static int bucketIndex(uint64_t value);
+
+	/**
+	 * Get highest value stored in a bucket
+	 */
+	static uint64_t bucketUpperBound(int bucket);
+
+private:
+	std::atomic<uint64_t> _buckets[HISTOGRAM_BUCKETS];
+	std::atomic<uint64_t> _count;
+	std::atomic<uint64_t> _sum;
+	std::atomic<uint64_t> _min;
+	std::atomic<uint64_t> _max;
+};
+
+#endif /* _HISTOGRAM_H_ */
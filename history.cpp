@@ -0,0 +1,470 @@
+/**
+ * @file history.cpp
+ *
+ */
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "history.h"
+
+/*********************
+ *      DEFINES
+ *********************/
+#define HISTORY_MAGIC 0x4D424853		// "MBHS"
+#define HISTORY_VERSION 2					// 2: slot keys
+#define HISTORY_SAMPLE_BITS_MAX (4 + 32 + 2 + 5 + 6 + 64)	// worst case bits per sample
+#define HISTORY_NO_WINDOW 0xFF
+
+/*********************
+ * LOCAL FUNCTIONS
+ *********************/
+
+/**
+ * Append bits (MSB first) to a zero initialised bit stream
+ * @param data: bit stream
+ * @param pos: bit position, advanced by n
+ * @param value: bits to write (right aligned)
+ * @param n: number of bits [1..64]
+ */
+static void put_bits(uint8_t *data, uint32_t *pos, uint64_t value, int n) {
+	while (n > 0) {
+		uint32_t byte = *pos >> 3;
+		int room = 8 - (*pos & 7);
+		int take = (n < room) ? n : room;
+		uint8_t bits = (uint8_t) ((value >> (n - take)) & ((1u << take) - 1));
+		data[byte] |= bits << (room - take);
+		*pos += take;
+		n -= take;
+	}
+}
+
+/**
+ * Read bits (MSB first) from bit stream
+ * @param data: bit stream
+ * @param pos: bit position, advanced by n
+ * @param n: number of bits [1..64]
+ * @return bits (right aligned)
+ */
+static uint64_t get_bits(const uint8_t *data, uint32_t *pos, int n) {
+	uint64_t value = 0;
+	while (n > 0) {
+		uint32_t byte = *pos >> 3;
+		int avail = 8 - (*pos & 7);
+		int take = (n < avail) ? n : avail;
+		value = (value << take) | ((data[byte] >> (avail - take)) & ((1u << take) - 1));
+		*pos += take;
+		n -= take;
+	}
+	return value;
+}
+
+/**
+ * Offset of the first block, blocks start on a page
+ */
+static size_t blocks_offset(uint32_t slotCount) {
+	size_t offset = sizeof(history_file_header_t) + ((size_t)slotCount * sizeof(history_slot_t));
+	return (offset + 4095) & ~(size_t)4095;
+}
+
+/**
+ * Sign extend n bit value
+ */
+static inline int64_t sign_extend(uint64_t value, int n) {
+	uint64_t m = 1ULL << (n - 1);
+	return (int64_t) ((value ^ m) - m);
+}
+
+static inline uint64_t double_bits(double d) {
+	uint64_t u;
+	memcpy(&u, &d, sizeof(u));
+	return u;
+}
+
+static inline double bits_double(uint64_t u) {
+	double d;
+	memcpy(&d, &u, sizeof(d));
+	return d;
+}
+
+/**
+ * Write delta-of-delta, two's complement (as read back by sign_extend)
+ *   '0'                 dod = 0
+ *   '10'   + 7 bits     -64 .. 63
+ *   '110'  + 9 bits     -256 .. 255
+ *   '1110' + 12 bits    -2048 .. 2047
+ *   '1111' + 32 bits    otherwise
+ */
+static void put_dod(uint8_t *data, uint32_t *pos, int64_t dod) {
+	if (dod == 0) {
+		put_bits(data, pos, 0, 1);
+	} else if ((dod >= -64) && (dod <= 63)) {
+		put_bits(data, pos, 0x2, 2);
+		put_bits(data, pos, (uint64_t) dod, 7);
+	} else if ((dod >= -256) && (dod <= 255)) {
+		put_bits(data, pos, 0x6, 3);
+		put_bits(data, pos, (uint64_t) dod, 9);
+	} else if ((dod >= -2048) && (dod <= 2047)) {
+		put_bits(data, pos, 0xE, 4);
+		put_bits(data, pos, (uint64_t) dod, 12);
+	} else {
+		put_bits(data, pos, 0xF, 4);
+		put_bits(data, pos, (uint64_t) dod, 32);
+	}
+}
+
+static int64_t get_dod(const uint8_t *data, uint32_t *pos) {
+	if (get_bits(data, pos, 1) == 0) return 0;
+	if (get_bits(data, pos, 1) == 0) return sign_extend(get_bits(data, pos, 7), 7);
+	if (get_bits(data, pos, 1) == 0) return sign_extend(get_bits(data, pos, 9), 9);
+	if (get_bits(data, pos, 1) == 0) return sign_extend(get_bits(data, pos, 12), 12);
+	return sign_extend(get_bits(data, pos, 32), 32);
+}
+
+/**
+ * Write value XOR'ed with previous value
+ *   '0'                                     unchanged
+ *   '10' + meaningful bits                  fits into previous window
+ *   '11' + 5 bits leading + 6 bits length-1 + meaningful bits
+ */
+static void put_xor(uint8_t *data, uint32_t *pos, uint64_t x, uint8_t *leading, uint8_t *trailing) {
+	int lead, trail, len;
+	if (x == 0) {
+		put_bits(data, pos, 0, 1);
+		return;
+	}
+	lead = __builtin_clzll(x);
+	trail = __builtin_ctzll(x);
+	if (lead > 31) lead = 31;			// 5 bits
+	if ((*leading != HISTORY_NO_WINDOW) && (lead >= *leading) && (trail >= *trailing)) {
+		len = 64 - *leading - *trailing;
+		put_bits(data, pos, 0x2, 2);
+		put_bits(data, pos, x >> *trailing, len);
+		return;
+	}
+	len = 64 - lead - trail;
+	put_bits(data, pos, 0x3, 2);
+	put_bits(data, pos, (uint64_t) lead, 5);
+	put_bits(data, pos, (uint64_t) (len - 1), 6);
+	put_bits(data, pos, x >> trail, len);
+	*leading = (uint8_t) lead;
+	*trailing = (uint8_t) trail;
+}
+
+static uint64_t get_xor(const uint8_t *data, uint32_t *pos, uint8_t *leading, uint8_t *trailing) {
+	int len;
+	if (get_bits(data, pos, 1) == 0) return 0;
+	if (get_bits(data, pos, 1) == 1) {
+		*leading = (uint8_t) get_bits(data, pos, 5);
+		len = (int) get_bits(data, pos, 6) + 1;
+		*trailing = (uint8_t) (64 - *leading - len);
+	} else {
+		len = 64 - *leading - *trailing;
+	}
+	return get_bits(data, pos, len) << *trailing;
+}
+
+/*********************
+ * MEMBER FUNCTIONS
+ *********************/
+
+//
+// Class History
+//
+
+History::History() {
+	_fd = -1;
+	_mapSize = 0;
+	_dataBits = 0;
+	_header = NULL;
+	_slots = NULL;
+	_blocks = NULL;
+}
+
+History::~History() {
+	close();
+}
+
+bool History::open(const char *path, uint32_t slotCount, uint32_t blocksPerSlot, uint32_t blockSize, uint32_t layoutHash, const uint32_t *slotKeys) {
+	void *map;
+	size_t blocksOffset;
+	history_file_header_t header;
+	bool valid;
+	if (isOpen()) close();
+	if ((path == NULL) || (slotKeys == NULL) || (slotCount < 1) || (blocksPerSlot < 2) || (blockSize < 256)) return false;
+	blockSize &= ~7u;
+	_path = path;
+	_fd = ::open(path, O_RDWR | O_CREAT, 0644);
+	if (_fd < 0) {
+		syslog(LOG_ERR, "History - unable to open %s: %s", path, strerror(errno));
+		return false;
+	}
+	blocksOffset = blocks_offset(slotCount);
+	_mapSize = blocksOffset + ((size_t)slotCount * blocksPerSlot * blockSize);
+	memset(&header, 0, sizeof(header));
+	if (pread(_fd, &header, sizeof(header), 0) < 0) header.magic = 0;
+	// a version 1 file (without slot keys) is taken over if the layout is unchanged
+	valid = (header.magic == HISTORY_MAGIC) && ((header.version == HISTORY_VERSION) || (header.version == 1))
+		&& (header.slotCount == slotCount) && (header.blocksPerSlot == blocksPerSlot)
+		&& (header.blockSize == blockSize) && (header.layoutHash == layoutHash);
+	if (!valid && (header.magic == HISTORY_MAGIC) && (header.version == HISTORY_VERSION)
+		&& (header.blocksPerSlot == blocksPerSlot) && (header.blockSize == blockSize)) {
+		// tags added or removed, the history of the remaining tags is kept
+		if (_migrate(&header, slotCount, layoutHash, slotKeys)) {
+			::close(_fd);
+			_fd = ::open(path, O_RDWR);
+			if (_fd < 0) {
+				syslog(LOG_ERR, "History - unable to open %s: %s", path, strerror(errno));
+				return false;
+			}
+			valid = true;
+		}
+	}
+	if (!valid) {
+		if (header.magic == HISTORY_MAGIC)
+			syslog(LOG_WARNING, "History - block layout of %s changed, history discarded", path);
+		else
+			syslog(LOG_NOTICE, "History - initialising %s", path);
+		// truncating avoids writing the whole file, the new file is sparse (zero)
+		if (ftruncate(_fd, 0) < 0)
+			syslog(LOG_WARNING, "History - unable to truncate %s: %s", path, strerror(errno));
+	}
+	if (ftruncate(_fd, _mapSize) < 0) {
+		syslog(LOG_ERR, "History - unable to resize %s: %s", path, strerror(errno));
+		::close(_fd);
+		_fd = -1;
+		return false;
+	}
+	map = mmap(NULL, _mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+	if (map == MAP_FAILED) {
+		syslog(LOG_ERR, "History - mmap %s failed: %s", path, strerror(errno));
+		::close(_fd);
+		_fd = -1;
+		return false;
+	}
+	_header = (history_file_header_t *) map;
+	_slots = (history_slot_t *) (_header + 1);
+	_blocks = (uint8_t *) map + blocksOffset;
+	_dataBits = (blockSize - sizeof(history_block_header_t)) * 8;
+	if (!valid) {
+		_header->version = HISTORY_VERSION;
+		_header->slotCount = slotCount;
+		_header->blocksPerSlot = blocksPerSlot;
+		_header->blockSize = blockSize;
+		_header->layoutHash = layoutHash;
+		for (uint32_t i = 0; i < slotCount; i++) {
+			_slots[i].key = slotKeys[i];
+			_slots[i].nextSequence = 1;
+		}
+		_header->magic = HISTORY_MAGIC;
+		msync(map, _mapSize, MS_ASYNC);
+	} else if (_header->version != HISTORY_VERSION) {
+		for (uint32_t i = 0; i < slotCount; i++)
+			_slots[i].key = slotKeys[i];
+		_header->version = HISTORY_VERSION;
+		msync(map, _mapSize, MS_ASYNC);
+	}
+	return true;
+}
+
+bool History::_migrate(const history_file_header_t *old, uint32_t slotCount, uint32_t layoutHash, const uint32_t *slotKeys) {
+	const history_slot_t *oldSlots;
+	const history_block_header_t *block;
+	history_file_header_t *header;
+	history_slot_t *slots;
+	std::string tmpPath;
+	struct stat st;
+	uint8_t *oldMap, *map;
+	size_t oldOffset, oldSize, offset, size, slotSize;
+	uint32_t i, j, b, kept = 0;
+	bool ok;
+	int fd;
+
+	oldOffset = blocks_offset(old->slotCount);
+	slotSize = (size_t)old->blocksPerSlot * old->blockSize;
+	oldSize = oldOffset + ((size_t)old->slotCount * slotSize);
+	if ((fstat(_fd, &st) < 0) || ((size_t)st.st_size < oldSize)) return false;
+	oldMap = (uint8_t *) mmap(NULL, oldSize, PROT_READ, MAP_SHARED, _fd, 0);
+	if (oldMap == MAP_FAILED) return false;
+	oldSlots = (const history_slot_t *) (oldMap + sizeof(history_file_header_t));
+
+	// the new file replaces the old one atomically (rename)
+	tmpPath = _path + ".tmp";
+	offset = blocks_offset(slotCount);
+	size = offset + ((size_t)slotCount * slotSize);
+	map = (uint8_t *) MAP_FAILED;
+	fd = ::open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	ok = (fd >= 0) && (ftruncate(fd, size) == 0);
+	if (ok) {
+		map = (uint8_t *) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		ok = (map != MAP_FAILED);
+	}
+	if (ok) {
+		header = (history_file_header_t *) map;
+		slots = (history_slot_t *) (header + 1);
+		for (i = 0; i < slotCount; i++) {
+			slots[i].key = slotKeys[i];
+			slots[i].nextSequence = 1;
+			for (j = 0; j < old->slotCount; j++) {
+				if (oldSlots[j].key != slotKeys[i]) continue;
+				slots[i].current = oldSlots[j].current;
+				slots[i].nextSequence = oldSlots[j].nextSequence;
+				// unused blocks stay sparse
+				for (b = 0; b < old->blocksPerSlot; b++) {
+					block = (const history_block_header_t *) (oldMap + oldOffset + (j * slotSize) + ((size_t)b * old->blockSize));
+					if (block->sequence != 0)
+						memcpy(map + offset + (i * slotSize) + ((size_t)b * old->blockSize), block, old->blockSize);
+				}
+				kept++;
+				break;
+			}
+		}
+		header->version = HISTORY_VERSION;
+		header->slotCount = slotCount;
+		header->blocksPerSlot = old->blocksPerSlot;
+		header->blockSize = old->blockSize;
+		header->layoutHash = layoutHash;
+		header->magic = HISTORY_MAGIC;
+		ok = (msync(map, size, MS_SYNC) == 0);
+		munmap(map, size);
+	}
+	munmap(oldMap, oldSize);
+	if (fd >= 0) ::close(fd);
+	if (ok) ok = (rename(tmpPath.c_str(), _path.c_str()) == 0);
+	if (!ok) {
+		syslog(LOG_ERR, "History - unable to rebuild %s: %s", _path.c_str(), strerror(errno));
+		unlink(tmpPath.c_str());
+		return false;
+	}
+	syslog(LOG_NOTICE, "History - tags of %s changed, history of %u of %u tags kept", _path.c_str(), kept, slotCount);
+	return true;
+}
+
+void History::close(void) {
+	if (_header != NULL) {
+		msync(_header, _mapSize, MS_SYNC);
+		munmap(_header, _mapSize);
+		_header = NULL;
+		_slots = NULL;
+		_blocks = NULL;
+	}
+	if (_fd >= 0) {
+		::close(_fd);
+		_fd = -1;
+	}
+}
+
+bool History::isOpen(void) {
+	return (_header != NULL);
+}
+
+history_block_header_t *History::_block(uint32_t slot, uint32_t index) {
+	size_t n = ((size_t)slot * _header->blocksPerSlot) + index;
+	return (history_block_header_t *) (_blocks + (n * _header->blockSize));
+}
+
+void History::_startBlock(uint32_t slot, uint32_t index, uint64_t time, double value) {
+	history_block_header_t *block = _block(slot, index);
+	uint32_t pos = 0;
+	memset(block, 0, _header->blockSize);
+	block->firstTime = time;
+	block->lastTime = time;
+	block->lastDelta = 0;
+	block->lastValue = double_bits(value);
+	block->lastLeading = HISTORY_NO_WINDOW;
+	// the first value is stored uncompressed
+	put_bits((uint8_t *)(block + 1), &pos, block->lastValue, 64);
+	block->bitLen = pos;
+	block->count = 1;
+	_slots[slot].current = index;
+	// sequence is written last, the block is valid from here
+	block->sequence = _slots[slot].nextSequence++;
+}
+
+void History::append(uint32_t slot, uint64_t timestamp, double value) {
+	history_block_header_t *block;
+	uint64_t time = timestamp / 1000000ULL;		// [ms]
+	uint64_t bits = double_bits(value);
+	int64_t delta, dod;
+	uint32_t pos;
+	uint8_t *data;
+
+	if ((_header == NULL) || (slot >= _header->slotCount)) return;
+	block = _block(slot, _slots[slot].current);
+	if (block->count == 0) {
+		_startBlock(slot, _slots[slot].current, time, value);
+		return;
+	}
+	if (time < block->lastTime) return;		// clock went backwards, drop sample
+	delta = (int64_t) (time - block->lastTime);
+	dod = delta - block->lastDelta;
+	// start next block if full or the delta-of-delta doesn't fit
+	if ( ((block->bitLen + HISTORY_SAMPLE_BITS_MAX) > _dataBits)
+		|| (dod < INT32_MIN) || (dod > INT32_MAX) ) {
+		_startBlock(slot, (_slots[slot].current + 1) % _header->blocksPerSlot, time, value);
+		return;
+	}
+	data = (uint8_t *)(block + 1);
+	pos = block->bitLen;
+	put_dod(data, &pos, dod);
+	put_xor(data, &pos, bits ^ block->lastValue, &block->lastLeading, &block->lastTrailing);
+	block->lastDelta = delta;
+	block->lastTime = time;
+	block->lastValue = bits;
+	block->bitLen = pos;
+	block->count++;
+}
+
+int History::query(uint32_t slot, uint64_t from, uint64_t to, history_sample_t *samples, int maxSamples, uint64_t *next) {
+	history_block_header_t *block;
+	const uint8_t *data;
+	uint32_t index, pos, i, n;
+	uint64_t time, bits;
+	int64_t delta;
+	uint8_t leading, trailing;
+	int count = 0;
+
+	*next = 0;
+	if ((_header == NULL) || (slot >= _header->slotCount)) return 0;
+	n = _header->blocksPerSlot;
+	// oldest block follows the current block in the ring
+	for (uint32_t b = 1; b <= n; b++) {
+		index = (_slots[slot].current + b) % n;
+		block = _block(slot, index);
+		if ((block->sequence == 0) || (block->count == 0)) continue;
+		if ((block->lastTime < from) || (block->firstTime > to)) continue;
+		data = (const uint8_t *)(block + 1);
+		pos = 0;
+		time = block->firstTime;
+		delta = 0;
+		bits = get_bits(data, &pos, 64);
+		leading = HISTORY_NO_WINDOW;
+		trailing = 0;
+		for (i = 0; i < block->count; i++) {
+			if (i > 0) {
+				delta += get_dod(data, &pos);
+				time += delta;
+				bits ^= get_xor(data, &pos, &leading, &trailing);
+			}
+			if (time < from) continue;
+			if (time > to) break;
+			if (count >= maxSamples) {
+				*next = time;
+				return count;
+			}
+			samples[count].time = time;
+			samples[count].value = bits_double(bits);
+			count++;
+		}
+	}
+	return count;
+}
@@ -0,0 +1,148 @@
+/**
+ * @file history.h
+
+-----------------------------------------------------------------------------
+ Class "History" keeps a compressed time series of tag values in a memory
+ mapped file.
+
+ Every history tag owns a ring of fixed size blocks. Samples are appended
+ to the current block with Gorilla style compression (Pelkonen et al.,
+ "Gorilla: A Fast, Scalable, In-Memory Time Series Database", VLDB 2015):
+   timestamps [ms]: delta-of-delta, 1 bit for a regular interval
+   values (double): XOR with the previous value, 1 bit for an unchanged value
+ When a block is full the next block is started, the oldest block of the tag
+ is overwritten. Writes only touch the tail of the current block.
+ The complete encoder state is kept in the block header, appending continues
+ after a restart as long as the tag layout is unchanged.
+ Every slot carries a key of its tag (hash of the topic). When tags are added
+ or removed the file is rebuilt and the blocks of the remaining tags are
+ moved to their new slots. A change of the block count or size discards the
+ history.
+
+ File layout:
+   history_file_header_t
+   history_slot_t[slotCount]
+   blocks: slot 0 block 0..blocksPerSlot-1, slot 1 block 0.., ...
+-----------------------------------------------------------------------------
+*/
+
+#ifndef _HISTORY_H_
+#define _HISTORY_H_
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+
+/*********************
+ *      DEFINES
+ *********************/
+#define HISTORY_BLOCK_SIZE_DEFAULT 4096		// bytes
+#define HISTORY_BLOCKS_DEFAULT 64			// blocks per tag
+
+/**********************
+ *      TYPEDEFS
+ **********************/
+typedef struct
+{
+	uint32_t magic;			// HISTORY_MAGIC
+	uint32_t version;		// file format version
+	uint32_t slotCount;		// number of history tags
+	uint32_t blocksPerSlot;	// blocks per tag
+	uint32_t blockSize;		// bytes per block incl. block header
+	uint32_t layoutHash;	// identifies the tag layout
+}history_file_header_t;
+
+typedef struct
+{
+	uint32_t current;		// index of block being appended
+	uint32_t key;			// identifies the tag of the slot
+	uint64_t nextSequence;	// sequence number for next block
+}history_slot_t;
+
+typedef struct
+{
+	uint64_t sequence;		// block sequence (0 = unused), orders blocks of a tag
+	uint64_t firstTime;		// time of first sample [ms since epoch]
+	uint64_t lastTime;		// time of last sample [ms since epoch]
+	int64_t lastDelta;		// last time delta [ms]
+	uint64_t lastValue;		// last value (double bits)
+	uint32_t count;			// number of samples in block
+	uint32_t bitLen;		// number of bits used in data
+	uint8_t lastLeading;	// leading zeros of last XOR window (0xFF = none)
+	uint8_t lastTrailing;	// trailing zeros of last XOR window
+	uint8_t reserved[14];
+}history_block_header_t;
+
+typedef struct
+{
+	uint64_t time;			// [ms since epoch]
+	double value;
+}history_sample_t;
+
+class History {
+public:
+	History();
+	~History();
+
+	/**
+	 * Open (or create) history file
+	 * @param path: file name
+	 * @param slotCount: number of history tags
+	 * @param blocksPerSlot: number of blocks per tag
+	 * @param blockSize: block size [bytes]
+	 * @param layoutHash: hash of tag layout
+	 * @param slotKeys: key of the tag of each slot (slotCount entries), on a
+	 *        layout change the history of a key is moved to its new slot
+	 * @return false on failure
+	 */
+	bool open(const char *path, uint32_t slotCount, uint32_t blocksPerSlot, uint32_t blockSize, uint32_t layoutHash, const uint32_t *slotKeys);
+
+	/**
+	 * Flush and close history file
+	 */
+	void close(void);
+
+	/**
+	 * @return true if history file is open
+	 */
+	bool isOpen(void);
+
+	/**
+	 * Append sample
+	 * @param slot: history slot of tag
+	 * @param timestamp: time of reading [ns since epoch]
+	 * @param value: sample value
+	 */
+	void append(uint32_t slot, uint64_t timestamp, double value);
+
+	/**
+	 * Get samples in time range (oldest first)
+	 * @param slot: history slot of tag
+	 * @param from: start of range [ms since epoch] (inclusive)
+	 * @param to: end of range [ms since epoch] (inclusive)
+	 * @param samples: storage for samples
+	 * @param maxSamples: size of samples array
+	 * @param next: time of first sample not returned, 0 if all samples have been returned
+	 * @return number of samples
+	 */
+	int query(uint32_t slot, uint64_t from, uint64_t to, history_sample_t *samples, int maxSamples, uint64_t *next);
+
+private:
+	history_block_header_t *_block(uint32_t slot, uint32_t index);
+	bool _migrate(const history_file_header_t *old, uint32_t slotCount, uint32_t layoutHash, const uint32_t *slotKeys);
+	void _startBlock(uint32_t slot, uint32_t index, uint64_t time, double value);
+
+	std::string _path;
+	int _fd;
+	size_t _mapSize;
+	size_t _dataBits;					// capacity of block data [bits]
+	history_file_header_t *_header;		// start of mapped file
+	history_slot_t *_slots;				// slot table following header
+	uint8_t *_blocks;					// first block
+};
+
+#endif /* _HISTORY_H_ */
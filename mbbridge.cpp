@@ -13,6 +13,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <math.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
@@ -25,6 +26,10 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
 #include <libconfig.h++>
 #include <mosquitto.h>
 #include <modbus.h>
@@ -33,6 +38,19 @@
 #include "mqtt.h"
 #include "datatag.h"
 #include "modbustag.h"
+#include "payload.h"
+#include "samplebuffer.h"
+#include "readrequest.h"
+#include "shmtable.h"
+#include "history.h"
+#include "expression.h"
+#include "tagtable.h"
+#include "writescheduler.h"
+#include "busstats.h"
+#include "metrics.h"
+#include "trace.h"
+#include "clock.h"
+#include "configcache.h"
 #include "mbbridge.h"
 
 using namespace std;
@@ -51,11 +69,29 @@ const int version_minor = 11;
 #define MQTT_BROKER_DEFAULT "127.0.0.1"
 #define MQTT_CLIENT_ID "mbbridge"
 #define MQTT_RECONNECT_INTERVAL 10
+#define MQTT_TIMESTAMP_TOPIC_SUFFIX_DEFAULT "/ts"
+#define MQTT_READ_RESPONSE_SUFFIX_DEFAULT "/response"
+
+#define READ_REQUEST_BURST 4		// max bus reads for on-demand requests per call
+
+#define STOREFORWARD_CAPACITY_DEFAULT 100000	// samples
+#define STOREFORWARD_DRAINRATE_DEFAULT 50		// samples per second
+
+#define BUS_STATS_INTERVAL_DEFAULT 60	// seconds
+
+#define TRACE_FILE_DEFAULT "/tmp/mbbridge-trace.bin"
 
 static string cpu_temp_topic = "";
 static string cfgFileName;
 static string execName;
 static string mbSlaveStatusTopic;
+static string mbStatsTopic;			// bus statistics (empty = disabled)
+static string readRequestTopic;		// on-demand read requests (empty = disabled)
+static string readResponseTopic;	// on-demand read responses
+static string historyRequestTopic;	// history queries (empty = disabled)
+static string historyResponseTopic;	// history query responses
+static string traceCommandTopic;	// transaction trace dump command (empty = disabled)
+static string traceFile = TRACE_FILE_DEFAULT;	// transaction trace dump file
 bool mbSlaveStatusRetain = false;
 bool exitSignal = false;
 bool debugEnabled = false;
@@ -76,15 +112,27 @@ useconds_t mainloopinterval = 250;   // milli seconds
 //extern void roomTempUpdate(int x, Tag* t);
 modbus_t *mb_ctx = NULL;
 updatecycle *updateCycles = NULL;	// array of update cycle definitions
+int updateCycleCount = 0;			// number of update cycles
+int mbWriteTagCount = 0;			// number of modbus write tags
 ModbusTag *mbReadTags = NULL;		// array of all modbus read tags
 ModbusTag *mbWriteTags = NULL;		// array of all modbus write tags
 int mbTagCount = -1;
-int pendingWrites = 0;				// number of pending writes
 uint32_t modbusinterslavedelay = 0;	// delay between modbus transactions
 int mbMaxRetries = 0;				// number of retries on modbus error (config file)
 #define MODBUS_SLAVE_MAX 254		// highest permitted slave ID
 #define MODBUS_SLAVE_MIN 1			// lowest permitted slave ID
 bool mbSlaveOnline[MODBUS_SLAVE_MAX+1];			// array to store online/offline status
+int storeForwardDrainRate = STOREFORWARD_DRAINRATE_DEFAULT;	// samples per second
+std::atomic<uint32_t> storeForwardSamples(0);	// sampleBuffer.count() of the main thread for metrics
+bool mbCaptureTimestamps = false;	// capture source timestamp for each modbus response
+int historyTagCount = 0;			// number of tags with history
+int *computedTags = NULL;			// indexes of computed tags
+int computedTagCount = 0;			// number of computed tags
+bool *computePending = NULL;		// per tag: an input of the computed tag has been updated
+bool computeRequired = false;		// at least one computed tag is pending
+int mbStatsInterval = BUS_STATS_INTERVAL_DEFAULT;	// bus statistics publish interval [s]
+time_t mbStatsNextTime = 0;			// next time bus statistics are published
+uint64_t cfgSourceHash = 0;			// hash of the config file for the config cache
 
 
 #pragma mark Proto types
@@ -94,15 +142,41 @@ void mqtt_topic_update(const struct mosquitto_message *message);
 void mqtt_subscribe_tags(void);
 void setMainLoopInterval(int newValue);
 int mb_read_tag(ModbusTag *tag);
-bool mb_read_registers(int slaveId, modbus_t *ctx, uint16_t addr, int nb, int regtype, uint16_t *dest);
-bool mb_write_tag(ModbusTag *tag);
+bool mb_read_registers(int slaveId, modbus_t *ctx, uint16_t addr, int nb, int regtype, uint16_t *dest, uint64_t *timestamp);
+bool mb_write_tag(ModbusTag *tag, int *error = NULL);
 void mb_write_request(int callbackId, Tag *tag);
 bool mqtt_publish_tag(ModbusTag *tag);
+bool storeforward_process(void);
+bool read_request_process(void);
+bool history_query_process(void);
+void mb_tag_updated(ModbusTag *tag);
+bool mb_compute_process(void);
+bool bus_stats_process(void);
+bool trace_process(void);
+bool reload_process(void);
 
 TagStore ts;
 MQTT mqtt(MQTT_CLIENT_ID);
 Config cfg;			// config file
 Hardware hw(false);	// no screen
+SampleBuffer sampleBuffer;	// store-and-forward buffer for broker outages
+ReadRequestQueue readRequests;	// on-demand read requests from MQTT
+ShmTable shmTable;			// shared memory live value table for local consumers
+History history;			// compressed tag history
+HistoryQueryQueue historyQueries;	// history queries from MQTT
+TagTable mbTagTable;		// read planning data of mbReadTags (same index)
+TagIndex mbCycleIndex;		// read tags per update cycle (key = index in updateCycles)
+TagIndex mbSlaveReadIndex;	// read tags per slave ID
+TagIndex mbSlaveWriteIndex;	// write tags per slave ID
+WriteScheduler writeScheduler;	// pending writes by priority and arrival
+BusStats busStats;			// transaction statistics per slave and function code
+Histogram loopLatency;		// duration of process() passes which did work [us]
+MetricsServer metricsServer;	// Prometheus metrics endpoint (optional)
+TransactionTrace mbTrace;	// ring of recent Modbus transactions
+std::atomic<bool> traceDumpRequest(false);	// dump mbTrace (SIGUSR1 or MQTT)
+std::atomic<bool> reloadRequest(false);		// reload config file (SIGHUP)
+std::mutex tagModelMutex;	// tag arrays and tagstore used by the MQTT thread (config reload)
+std::atomic<bool> tagModelReload(false);	// reload in progress, the MQTT thread queues no commands
 
 /**
  * log to console and syslog for daemon
@@ -121,13 +195,20 @@ template<typename... Args> void log(int priority, const char * f, Args... args)
 void sigHandler(int signum)
 {
 	char signame[10];
+	if (signum == SIGUSR1) {
+		// dump transaction trace, processed in main loop
+		traceDumpRequest = true;
+		return;
+	}
+	if (signum == SIGHUP) {
+		// reload config file, processed in main loop
+		reloadRequest = true;
+		return;
+	}
 	switch (signum) {
 		case SIGTERM:
 			strcpy(signame, "SIGTERM");
 			break;
-		case SIGHUP:
-			strcpy(signame, "SIGHUP");
-			break;
 		case SIGINT:
 			strcpy(signame, "SIGINT");
 			break;
@@ -140,17 +221,6 @@ void sigHandler(int signum)
 	exitSignal = true;
 }
 
-void timespec_diff(struct timespec *start, struct timespec *stop, struct timespec *result) {
-	if ((stop->tv_nsec - start->tv_nsec) < 0) {
-		result->tv_sec = stop->tv_sec - start->tv_sec - 1;
-		result->tv_nsec = stop->tv_nsec - start->tv_nsec + 1000000000;
-	} else {
-		result->tv_sec = stop->tv_sec - start->tv_sec;
-	result->tv_nsec = stop->tv_nsec - start->tv_nsec;
-	}
-	return;
-}
-
 #pragma mark -- Config File functions
 
 /** Read configuration file.
@@ -161,6 +231,8 @@ bool readConfig (void)
 	//int ival;
 	// Read the file. If there is an error, report it and exit.
 
+	// hash before parsing, a later edit must not be cached under this hash
+	cfgSourceHash = config_cache_source_hash(cfgFileName.c_str(), build_date_str);
 	try
 	{
 		cfg.readFile(cfgFileName.c_str());
@@ -198,6 +270,9 @@ bool readConfig (void)
 		std::cerr << "Error in config file <" << excp.getPath() << "> is not a string" << std::endl;
 		return false;
 	}
+	int port;
+	if (cfg.lookupValue("mqtt.port", port))
+		mqtt.setPort(port);
 	return true;
 }
 
@@ -223,6 +298,21 @@ bool cfg_get_str(const std::string &path, std::string &value) {
 	return true;
 }
 
+/**
+ * Compare a scalar setting of the running config with another config
+ * @return true if the setting has been added, removed or changed
+ */
+bool cfg_setting_changed(Config &other, const char *path) {
+	string s1, s2;
+	long long i1, i2;
+	bool b1, b2;
+	if (cfg.exists(path) != other.exists(path)) return true;
+	if (cfg.lookupValue(path, s1)) return !other.lookupValue(path, s2) || (s1 != s2);
+	if (cfg.lookupValue(path, i1)) return !other.lookupValue(path, i2) || (i1 != i2);
+	if (cfg.lookupValue(path, b1)) return !other.lookupValue(path, b2) || (b1 != b2);
+	return false;
+}
+
 #pragma mark -- Processing
 
 /**
@@ -234,7 +324,7 @@ bool cfg_get_str(const std::string &path, std::string &value) {
  */
 bool var_process(void) {
     bool retval = false;
-    time_t now = time(NULL);
+    time_t now = clock_time();
 //    if (now > var_process_time) {
 //        var_process_time = now + VAR_PROCESS_INTERVAL;
 
@@ -263,65 +353,142 @@ bool var_process(void) {
     return retval;
 }
 
+/**
+ * Publish the outcome of a write command on the ack topic of the write tag
+ * payload: {"result":"ok|failed|abandoned|expired|invalid", ...}
+ *   "error": timeout|exception|error of the last attempt (failed, abandoned)
+ *   "code": modbus exception code (exception)
+ *   "attempts": number of bus writes
+ *   "latency": MQTT arrival to bus completion [ms]
+ *   "v": value read back from the slave (readback enabled)
+ * @param tag: the write tag
+ * @param command: the completed write command
+ * @param result: outcome
+ * @param error: errno of the last failed write, 0 = none
+ * @param attempts: number of bus writes
+ */
+void write_ack_publish(ModbusTag *tag, const write_command_t *command, const char *result, int error, int attempts) {
+	char buf[256];
+	char value[64];
+	const char *lastError = NULL;
+	int len, code = 0;
+	uint16_t registers[2];
+	typed_value_t readValue;
+	ModbusTag reg;
+
+	if (!tag->hasAckTopic()) return;
+	if (error == ETIMEDOUT) {
+		lastError = "timeout";
+	} else if ((error > MODBUS_ENOBASE) && (error < MODBUS_ENOBASE + MODBUS_EXCEPTION_MAX)) {
+		lastError = "exception";
+		code = error - MODBUS_ENOBASE;
+	} else if (error != 0) {
+		lastError = "error";
+	}
+	len = snprintf(buf, sizeof(buf), "{\"result\":\"%s\"", result);
+	if (lastError != NULL)
+		len += snprintf(buf + len, sizeof(buf) - len, ",\"error\":\"%s\"", lastError);
+	if (code != 0)
+		len += snprintf(buf + len, sizeof(buf) - len, ",\"code\":%d", code);
+	len += snprintf(buf + len, sizeof(buf) - len, ",\"attempts\":%d,\"latency\":%.3f",
+		attempts, (double)(clock_realtime_ns() - command->arrival) / 1000000.0);
+	// read back the register, the write tag itself may already hold a newer value
+	if ((error == 0) && (attempts > 0) && tag->getReadback()) {
+		reg.setSlaveId(tag->getSlaveId());
+		reg.setAddress(tag->getRegisterAddress());
+		reg.setDataType(tag->getDataType());
+		reg.setValueType(tag->getValueType());
+		reg.setMultiplier(tag->getMultiplier());
+		reg.setOffset(tag->getOffset());
+		if (mb_read_registers(reg.getSlaveId(), mb_ctx, reg.getRegisterAddress(), reg.getRegisterCount(), reg.getRegisterType(), registers, NULL)) {
+			reg.setRegisters(registers);
+			readValue = reg.getTypedValue();
+			if (payload_format_value(value, sizeof(value), &readValue) > 0)
+				len += snprintf(buf + len, sizeof(buf) - len, ",\"v\":%s", value);
+		}
+	}
+	len += snprintf(buf + len, sizeof(buf) - len, "}");
+	if ((len >= (int)sizeof(buf)) || !mqtt.isConnected()) return;
+	mqtt.publishPayload(tag->getAckTopic(), buf, len, false);
+}
+
 /**
  * process modbus write
- * only one successful write function is processed per call
- * if write failed it is attempted again on next call
- * until max write attempts have been exceeded
+ * only one write is processed per call, the most urgent command first
+ * (priority class, then arrival). If the write failed it is queued again
+ * until max write attempts have been exceeded.
+ * Commands older than the deadline of the write tag are dropped.
+ * The final outcome is published on the ack topic of the tag (if any).
  * @return false if there was nothing to process, otherwise true
  */
 bool modbus_write_process() {
-	int idx = 0;
-	bool success = FALSE;
-	uint8_t slaveId = mbWriteTags[idx].getSlaveId();
-	uint8_t prevSlaveId = slaveId;	// to detect change in slave ID
-	// The last entry in the mbWriteTags has a SlaveID of MODBUS_SLAVE_MAX+1
-	// so this while loop will run through to the last item in mbWriteTags[]
-	while ((slaveId >= MODBUS_SLAVE_MIN) && (slaveId <= MODBUS_SLAVE_MAX)) {
-		if (mbWriteTags[idx].getWritePending()) {
-			//printf ("%s - writing %d to Slave %d Addr %d idx %d\n", __func__, mbWriteTags[idx].getRawValue(),slaveId, mbWriteTags[idx].getRegisterAddress(), idx);
-        	// detect change in Slave ID
-        	if (slaveId != prevSlaveId) {
-            	// execute inter slave delay
-            	usleep(modbusinterslavedelay);
-            	prevSlaveId = slaveId;
-        	}
-			success = mb_write_tag(&mbWriteTags[idx]);
-			if (success) {
-				// upon successful write
-				mbWriteTags[idx].setWritePending(false);	// mark as write done
-				pendingWrites--;
-				// clear write attempts
-				mbWriteTags[idx].clearWriteFailedCount();
-				// register slave as "online"
-				mbSlaveOnline[slaveId] = true;
-				return true;			// end here, we only do one write
-			} else {	// write has failed
-				// increment write attempt counter
-				mbWriteTags[idx].incWriteFailedCount();
-				// log failed write but only if the  slave is online
-		        if ( (modbusDebugLevel > 0) && (mbSlaveOnline[slaveId]) ) {
-					if ( !runningAsDaemon ) {
-						printf("%s - write attempt#%d failed [Slave %d Addr %d]\n", __func__, mbWriteTags[idx].getWriteFailedCount(), slaveId, mbWriteTags[idx].getRegisterAddress());
-					} else {
-						log(LOG_WARNING, "Modbus write attempt#%d failed [Slave %d Addr %d]", mbWriteTags[idx].getWriteFailedCount(), slaveId, mbWriteTags[idx].getRegisterAddress());
-					}
-				}
-				// check for max write attempts
-				if (mbWriteTags[idx].getWriteFailedCount() >= modbusWriteMaxAttempts) {
-					// abandon write attempts
-					mbWriteTags[idx].setWritePending(false);
-					pendingWrites--;
-					// clear failed counter
-					mbWriteTags[idx].clearWriteFailedCount();
-				}
-			}
+	static int prevSlaveId = 0;	// to detect change in slave ID
+	write_command_t command;
+	ModbusTag *tag;
+	uint64_t now;
+	int slaveId, error = 0;
+
+	if (!writeScheduler.pop(&command)) return false;
+	tag = &mbWriteTags[command.tagIndex];
+	// a value received from now on is queued as new command
+	tag->setWritePending(false);
+	// the command writes the latest value, age and deadline follow its arrival
+	if (tag->getWriteArrival() > command.arrival) {
+		command.arrival = tag->getWriteArrival();
+		if (command.deadline != 0)
+			command.deadline = command.arrival + ((uint64_t)tag->getWriteDeadline() * 1000000ULL);
+	}
+	slaveId = tag->getSlaveId();
+	if ((slaveId < MODBUS_SLAVE_MIN) || (slaveId > MODBUS_SLAVE_MAX)) {
+		log(LOG_WARNING, "Modbus write to %s dropped, invalid slave ID %d", tag->getTopic(), slaveId);
+		write_ack_publish(tag, &command, "invalid", 0, 0);
+		return true;
+	}
+	now = clock_realtime_ns();
+	if ((command.deadline != 0) && (now > command.deadline)) {
+		log(LOG_WARNING, "Modbus write to %s dropped, deadline exceeded by %llums", tag->getTopic(), (unsigned long long)((now - command.deadline) / 1000000ULL));
+		write_ack_publish(tag, &command, "expired", 0, tag->getWriteFailedCount());
+		tag->clearWriteFailedCount();
+		return true;
+	}
+	//printf ("%s - writing %d to Slave %d Addr %d idx %d\n", __func__, tag->getRawValue(),slaveId, tag->getRegisterAddress(), command.tagIndex);
+	// detect change in Slave ID
+	if ((prevSlaveId != 0) && (slaveId != prevSlaveId)) {
+		// execute inter slave delay
+		clock_sleep_us(modbusinterslavedelay);
+	}
+	prevSlaveId = slaveId;
+	if (mb_write_tag(tag, &error)) {
+		// register slave as "online"
+		mbSlaveOnline[slaveId] = true;
+		write_ack_publish(tag, &command, "ok", 0, tag->getWriteFailedCount() + 1);
+		// upon successful write clear write attempts
+		tag->clearWriteFailedCount();
+		return true;
+	}
+	// write has failed, increment write attempt counter
+	tag->incWriteFailedCount();
+	// log failed write but only if the  slave is online
+	if ( (modbusDebugLevel > 0) && (mbSlaveOnline[slaveId]) ) {
+		if ( !runningAsDaemon ) {
+			printf("%s - write attempt#%d failed [Slave %d Addr %d]\n", __func__, tag->getWriteFailedCount(), slaveId, tag->getRegisterAddress());
+		} else {
+			log(LOG_WARNING, "Modbus write attempt#%d failed [Slave %d Addr %d]", tag->getWriteFailedCount(), slaveId, tag->getRegisterAddress());
 		}
-		// index to next write tag
-		idx++;
-		slaveId = mbWriteTags[idx].getSlaveId();
 	}
-	return false;
+	// check for max write attempts
+	if (tag->getWriteFailedCount() >= modbusWriteMaxAttempts) {
+		// abandon write attempts
+		write_ack_publish(tag, &command, (modbusWriteMaxAttempts > 1) ? "abandoned" : "failed", error, tag->getWriteFailedCount());
+		tag->clearWriteFailedCount();
+		return true;
+	}
+	// retry, unless a newer value has been queued meanwhile
+	if (!tag->testAndSetWritePending()) {
+		writeScheduler.requeue(&command);
+		busStats.retry(slaveId);
+	}
+	return true;
 }
 
 /**
@@ -330,99 +497,65 @@ bool modbus_write_process() {
  * if called with a tag which has already been read in this cycle
  * use the previously read result and just publish the value.
  * @param tagArray: an array tag indexes which are part 
+ * @param tagArraySize: number of entries in tagArray
  * @param arrayIndex: index into current tag array
  * @param refTime: time reference to identify already read tags
  * @returns 0 if group of tags have been read from modbus device, -1 if tag is not in a group or a failure has occured, 1 if tag has been read as part of group read
  */
-int mb_read_multi_tags(int *tagArray, int arrayIndex, time_t refTime) {
-	ModbusTag *t = &mbReadTags[tagArray[arrayIndex]];
-	ModbusTag tag;
+int mb_read_multi_tags(const int *tagArray, int tagArraySize, int arrayIndex, time_t refTime) {
+	int index = tagArray[arrayIndex];
 	ModbusTag *tp;
-	uint16_t *mbReadRegisters;
-	int slaveId, addr, addrRange, addrLo=99999, addrHi=0, addrCount = 0, group = t->getGroup();
-	int i, r, tagArraySize, regType;
+	uint16_t mbReadRegisters[125];
+	uint64_t timestamp = 0;
+	int slaveId, addr, addrRange, addrLo, addrHi, group = mbTagTable.group(index);
+	int i, id, regType;
 	bool noread = false;
 	// if tag is not part of a group then return false
 	if (group < 1) return -1;
 	// if tag has already been read in this cycle the reference time will match
-	if (t->getReferenceTime() == refTime) {
+	if (mbTagTable.referenceTime(index) == refTime) {
 		//tag value is up-to-date, we can to publish the tag
-		//printf("%s: already updated #%d [%d], publishing value %d\n", __func__, t.getSlaveId(), t.getAddress(), t.getRawValue());
-		if (!t->isNoread())
-			mqtt_publish_tag(t);
+		tp = &mbReadTags[index];
+		if (!tp->isNoread())
+			mqtt_publish_tag(tp);
 		return 1;			// success but didn't read from modbus device
 	}
-	regType = t->getRegisterType();
+	regType = mbTagTable.registerType(index);
 	// the tag is part of a group which has not been read in this cycle
-	slaveId = t->getSlaveId();
-	// assemble tag indexes which belong to same group and slave into one array
-	i = 0;
-	//printf("%s: reading [%d]=%d tagArray: ", __func__, t->getAddress(), t->getRawValue());
-	while (tagArray[i] >= 0) {
-		tag = mbReadTags[tagArray[i]];
-		i++;
-		// does the tag belong to this slave?
-		if (tag.getSlaveId() != slaveId) continue;
-		// is the tag in the same group?
-		if (tag.getGroup() != group) continue;
-		// Tag belongs to the same slave and group
-		// determine highest / lowest address to read
-		addr = tag.getRegisterAddress();
-		//printf("[%d] ", addr);
-		if (addr < addrLo) addrLo = addr;
-		if (addr > addrHi) addrHi = addr; 
-		// could have gaps in addresses, therefore (addrHi - addrLo) can be != addrCount
-		addrCount++;
-	}
-	//printf("\n");
-	
-	tagArraySize = i;	// record the size of tagArray;
-	
+	slaveId = mbTagTable.slaveId(index);
+	// determine highest / lowest address of tags which belong to same group and slave
+	mbTagTable.groupRange(tagArray, tagArraySize, slaveId, group, &addrLo, &addrHi);
+
 	// perform sanity check on address range
 	addrRange = addrHi - addrLo + 1;
 	if (addrRange > 125) return -1;		// attempting to read too many registers
-	//printf("%s: tagArraySize=%d addrLo=%d addrHi=%d addrRange=%d\n",__func__, tagArraySize, addrLo, addrHi, addrRange);
-	
-	// Allocate memory for registers
-	mbReadRegisters = new uint16_t[addrRange];
 	
 	// read all tags in this group (multi read)
-	if (!mb_read_registers(slaveId, mb_ctx, addrLo, addrRange, regType, mbReadRegisters)) {
-		//printf("%s: mb_read_registers failed\n", __func__);
+	if (!mb_read_registers(slaveId, mb_ctx, addrLo, addrRange, regType, mbReadRegisters, mbCaptureTimestamps ? &timestamp : NULL)) {
 		noread = true;	// mark this as a failed read
 	} else {
-		usleep(modbusinterslavedelay);
+		clock_sleep_us(modbusinterslavedelay);
 	}
 	
-	//iterate through register data
-	for (r=0; r<addrRange; r++) {
-		// calculate register address
-		addr = addrLo + r;
-		// iterate through tag array
-		for (i=0; i<tagArraySize; i++) {
-			tp = &mbReadTags[tagArray[i]];	// need to use pointer so we can modify original
-			// find matching register address and slaveId in tagArray
-			if ( (addr == tp->getRegisterAddress()) && (slaveId == tp->getSlaveId()) ) {				// tag matches address
-				//printf("%s: #%d %d\n", __func__, tp->getSlaveId(), tp->getModbusAddress());
-				if (noread) {
-					tp->noreadNotify();	// notify tag of noread event
-				} else {
-					tp->setRawValue(mbReadRegisters[r]);	// update tag with register value
-					//printf("%s: updating #%s %d\n", __func__, tp->getTopic(), tp->getRawValue());
-					//printf("%s: updating #%d [%d]=%d\n", __func__, slaveId, addr, mbReadRegisters[r]);
-				}
-				tp->setReferenceTime(refTime);			// update tag reference time
-				break;									// stop iterating through tagArray
-			}
-			// it is possible that the address is not found in the tagArray as the multi read
-			// will read a continous range of registers, some of which are located in between
-			// the used registers.
+	// update all tags of this slave located in the range which has been read
+	// the range can contain registers of tags which are not in the group
+	for (i = 0; i < tagArraySize; i++) {
+		id = tagArray[i];
+		if (!mbTagTable.inRange(id, slaveId, addrLo, addrHi)) continue;
+		addr = mbTagTable.address(id);
+		tp = &mbReadTags[id];
+		if (noread) {
+			tp->noreadNotify();	// notify tag of noread event
+		} else {
+			tp->setRegisters(&mbReadRegisters[addr - addrLo]);	// update tag with register value(s)
+			tp->setTimestamp(timestamp);
 		}
+		mb_tag_updated(tp);
+		mbTagTable.setReferenceTime(id, refTime);	// update tag reference time
 	}
 	
 	// publish only the one tag referenced in parameters
-	mqtt_publish_tag(t);
-	delete [] mbReadRegisters;
+	mqtt_publish_tag(&mbReadTags[index]);
 	if (noread) return -1;
 	return 0;	// indicate that group of tags has been read from modbus device
 }
@@ -432,46 +565,46 @@ int mb_read_multi_tags(int *tagArray, int arrayIndex, time_t refTime) {
  * @return false if there was nothing to process, otherwise true
  */
 bool mb_read_process() {
-	int index = 0;
+	int index;
 	int tagIndex = 0;
-	int *tagArray;
+	const int *tagArray;
+	int tagArraySize;
 	bool retval = false;
 	//int readsuccess = -1;
 	uint8_t lastSlaveId = 0;
-	time_t now = time(NULL);
+	time_t now = clock_time();
 	time_t refTime;
-	while (updateCycles[index].ident >= 0) {
+	for (index = 0; index < updateCycleCount; index++) {
 		// ignore if cycle has no tags to process
-		if (updateCycles[index].tagArray == NULL) {
-			index++; continue;
-		}
+		if (updateCycles[index].tagArraySize < 1) continue;
 		// new reference time for each read cycle
-		refTime = time(NULL);		// used for group reads
+		refTime = clock_time();		// used for group reads
 		if (now >= updateCycles[index].nextUpdateTime) {
 			// set next update cycle time
 			updateCycles[index].nextUpdateTime = now + updateCycles[index].interval;
 			// get array for tags
 			tagArray = updateCycles[index].tagArray;
+			tagArraySize = updateCycles[index].tagArraySize;
 			// read each tag in the array
 			tagIndex = 0;
-			while (tagArray[tagIndex] >= 0) {
+			while (tagIndex < tagArraySize) {
 				// apply interslave delay  whenever SlaveID changes
-				if (lastSlaveId != mbReadTags[tagArray[tagIndex]].getSlaveId()) {
-					if (lastSlaveId != 0) usleep(modbusinterslavedelay);	// skip delay on first execution
-					lastSlaveId = mbReadTags[tagArray[tagIndex]].getSlaveId();
+				if (lastSlaveId != mbTagTable.slaveId(tagArray[tagIndex])) {
+					if (lastSlaveId != 0) clock_sleep_us(modbusinterslavedelay);	// skip delay on first execution
+					lastSlaveId = mbTagTable.slaveId(tagArray[tagIndex]);
 				}
-				if ((&mbReadTags[tagArray[tagIndex]])->getGroup() < 1) {		// if tag is not part of a group
+				if (mbTagTable.group(tagArray[tagIndex]) < 1) {		// if tag is not part of a group
 					mb_read_tag(&mbReadTags[tagArray[tagIndex]]);	// perform single tag read
 				} else {
-					mb_read_multi_tags(tagArray, tagIndex, refTime);	// multi tag read
+					mb_read_multi_tags(tagArray, tagArraySize, tagIndex, refTime);	// multi tag read
 				}
 				tagIndex++;
-				if (pendingWrites > 0) return true;			// abort reading if writes are pending
+				if (readRequests.count() > 0) read_request_process();	// on-demand reads have priority
+				if (writeScheduler.count() > 0) return true;	// abort reading if writes are pending
 			}
 			retval = true;
 			//cout << now << " Update Cycle: " << updateCycles[index].ident << " - " << updateCycles[index].tagArraySize << " tags" << endl;
 		}
-		index++;
 	}
 	
 	return retval;
@@ -484,10 +617,18 @@ bool mb_read_process() {
  */
 bool process() {
 	bool retval = false;
-	if (mqtt.isConnected()) {
+	if (reload_process()) retval = true;
+	// keep polling during broker outages if readings can be buffered
+	if (mqtt.isConnected() || sampleBuffer.isOpen()) {
+		if (read_request_process()) retval = true;
 		if (mb_read_process()) retval = true;
 		if (modbus_write_process()) retval = true;
 	}
+	if (mb_compute_process()) retval = true;
+	if (storeforward_process()) retval = true;
+	if (history_query_process()) retval = true;
+	if (bus_stats_process()) retval = true;
+	if (trace_process()) retval = true;
 	var_process();	// don't want it in time measuring, doesn't take up much time
 	return retval;
 }
@@ -532,39 +673,31 @@ bool init_hwtags(void)
 		tp->publishInterval = 0;
 		if (!cfg_get_int("cputemp.readinterval", tp->readInterval)) return false;
 		if (!cfg_get_int("cputemp.publishinterval", tp->publishInterval)) return false;
-		tp->nextReadTime = time(NULL) + tp->readInterval;
+		tp->nextReadTime = clock_time() + tp->readInterval;
 		// enable publish if interval is present
 		if (tp->publishInterval > 0) {
 			tp->setPublish();
-			tp->nextPublishTime = time(NULL) + tp->publishInterval;
+			tp->nextPublishTime = clock_time() + tp->publishInterval;
 		}
 	}
 	return true;
 }
 
-/** Initialise the tag database (tagstore)
- * @return false on failure
+/**
+ * read write tag configuration ("mqtt_tags") from config file
  */
-bool init_tags(void) {
-	Tag* tp = NULL;
+bool mb_config_writetags(Setting& mqttTagsSettings) {
 	std::string strValue;
 	int numTags, iVal, i;
+	double dVal;
 	bool bVal;
 
-	if (!init_hwtags()) return false;
-	if (!cfg.exists("mqtt_tags")) {	// optional
-		log(LOG_NOTICE,"configuration - parameter \"mqtt_tags\" does not exist");
-		return true;
-		}
-	Setting& mqttTagsSettings = cfg.lookup("mqtt_tags");
 	numTags = mqttTagsSettings.getLength();
-	mbWriteTags = new ModbusTag[numTags+1];
+	mbWriteTags = new ModbusTag[numTags];
+	mbWriteTagCount = numTags;
 	//printf("%s - %d mqtt tags found\n", __func__, numTags);
 	for (i=0; i < numTags; i++) {
 		if (mqttTagsSettings[i].lookupValue("topic", strValue)) {
-			tp = ts.addTag(strValue.c_str());
-			tp->setSubscribe();
-			tp->registerCallback(mb_write_request, i);
 			mbWriteTags[i].setTopic(strValue.c_str());
 			if (mqttTagsSettings[i].lookupValue("slaveid", iVal))
 				mbWriteTags[i].setSlaveId(iVal);
@@ -577,22 +710,74 @@ bool init_tags(void) {
 				//printf("%s - %s\n", __func__, strValue.c_str());
 				mbWriteTags[i].setDataType(strValue[0]);
 			}
+			if (mqttTagsSettings[i].lookupValue("valuetype", strValue)) {
+				if (!mbWriteTags[i].setValueType(strValue.c_str()))
+					log(LOG_WARNING, "Config error - invalid valuetype \"%s\" for %s", strValue.c_str(), mbWriteTags[i].getTopic());
+			}
+			if (mqttTagsSettings[i].lookupValue("multiplier", dVal))
+				mbWriteTags[i].setMultiplier(dVal);
+			if (mqttTagsSettings[i].lookupValue("offset", dVal))
+				mbWriteTags[i].setOffset(dVal);
+			if (mqttTagsSettings[i].lookupValue("priority", iVal))
+				mbWriteTags[i].setWritePriority(iVal);
+			if (mqttTagsSettings[i].lookupValue("deadline", iVal))
+				mbWriteTags[i].setWriteDeadline(iVal);
+			if (mqttTagsSettings[i].lookupValue("acktopic", strValue))
+				mbWriteTags[i].setAckTopic(strValue.c_str());
+			if (mqttTagsSettings[i].lookupValue("readback", bVal))
+				mbWriteTags[i].setReadback(bVal);
 		}
 	}
-	// Mark end of list
-	mbWriteTags[i].setSlaveId(MODBUS_SLAVE_MAX +1);
-	mbWriteTags[i].setUpdateCycleId(-1);
-	//printf("%s - allocated %d tags, last is index %d\n", __func__, i, i-1);
+	return true;
+}
+
+/**
+ * index write tags by slave and size the write scheduler
+ */
+void mb_index_writetags(void) {
+	int *keys = new int[mbWriteTagCount+1];
+	for (int i = 0; i < mbWriteTagCount; i++)
+		keys[i] = mbWriteTags[i].getSlaveId();
+	mbSlaveWriteIndex.build(keys, mbWriteTagCount, MODBUS_SLAVE_MAX+1);
+	delete [] keys;
+	writeScheduler.reserve(mbWriteTagCount);
+}
+
+/** Initialise the tag database (tagstore)
+ * @return false on failure
+ */
+bool init_tags(void) {
+	Tag* tp = NULL;
+
+	if (!init_hwtags()) return false;
+	if (!cfg.exists("mqtt_tags")) {	// optional
+		log(LOG_NOTICE,"configuration - parameter \"mqtt_tags\" does not exist");
+		return true;
+		}
+	if (!mb_config_writetags(cfg.lookup("mqtt_tags"))) return false;
+	for (int i = 0; i < mbWriteTagCount; i++) {
+		if (mbWriteTags[i].getTopicString().empty()) continue;
+		tp = ts.addTag(mbWriteTags[i].getTopic());
+		tp->setSubscribe();
+		tp->registerCallback(mb_write_request, i);
+	}
+	mb_index_writetags();
 	return true;
 }
 
 void mqtt_connect(void) {
 	if (mqttDebugEnabled)
 		printf("%s - attempting to connect to mqtt broker %s.\n", __func__, mqtt.broker());
-	mqtt.connect();
+	// the result may be reported before connect() returns
 	mqtt_connection_in_progress = true;
-	mqtt_connect_time = time(NULL);
+	mqtt_connect_time = clock_time();
 	mqtt_next_connect_time = 0;
+	if (!mqtt.connect()) {
+		// keep polling, try again later
+		mqtt_connection_in_progress = false;
+		mqtt_next_connect_time = clock_time() + MQTT_RECONNECT_INTERVAL;
+		log(LOG_WARNING, "mqtt connect to %s failed, retry in %d seconds", mqtt.broker(), MQTT_RECONNECT_INTERVAL);
+	}
 	//printf("%s - Done\n", __func__);
 }
 
@@ -601,6 +786,9 @@ void mqtt_connect(void) {
  */
 bool mqtt_init(void) {
 	bool bValue;
+	int iValue;
+	string strValue, suffix;
+	mqtt_timestamp_mode_t timestampMode = MQTT_TIMESTAMP_PAYLOAD;
 	if (!runningAsDaemon) {
 		if (cfg.lookupValue("mqtt.debug", bValue)) {
 			mqttDebugEnabled = bValue;
@@ -610,6 +798,52 @@ bool mqtt_init(void) {
 	}
 	if (cfg.lookupValue("mqtt.retain_default", bValue))
 		mqtt_retain_default = bValue;
+	if (cfg.lookupValue("mqtt.inflightwindow", iValue))
+		mqtt.setInflightWindow(iValue);
+	// MQTT v5 options
+	if (cfg.lookupValue("mqtt.protocol", iValue)) {
+		if (mqtt.setProtocolVersion(iValue) < 0) {
+			log(LOG_ERR, "Config error - mqtt protocol %d not supported (4 or 5)", iValue);
+			return false;
+		}
+	}
+	if (cfg.lookupValue("mqtt.timestamp", strValue)) {
+		if (strValue == "payload") {
+			timestampMode = MQTT_TIMESTAMP_PAYLOAD;
+		} else if (strValue == "property") {
+			timestampMode = MQTT_TIMESTAMP_PROPERTY;
+		} else if (strValue == "topic") {
+			timestampMode = MQTT_TIMESTAMP_TOPIC;
+		} else {
+			log(LOG_ERR, "Config error - invalid mqtt timestamp \"%s\" (payload, property or topic)", strValue.c_str());
+			return false;
+		}
+	}
+	if ((timestampMode == MQTT_TIMESTAMP_PROPERTY) && (mqtt.getProtocolVersion() != MQTT_PROTOCOL_V5)) {
+		log(LOG_WARNING, "Config error - mqtt timestamp \"property\" requires protocol 5, using \"payload\"");
+		timestampMode = MQTT_TIMESTAMP_PAYLOAD;
+	}
+	if (!cfg.lookupValue("mqtt.timestamptopicsuffix", suffix))
+		suffix = MQTT_TIMESTAMP_TOPIC_SUFFIX_DEFAULT;
+	mqtt.setTimestampMode(timestampMode, suffix.c_str());
+	if (cfg.lookupValue("mqtt.readrequesttopic", readRequestTopic)) {
+		if (!cfg.lookupValue("mqtt.readresponsetopic", readResponseTopic))
+			readResponseTopic = readRequestTopic + MQTT_READ_RESPONSE_SUFFIX_DEFAULT;
+	}
+	if (cfg.lookupValue("history.requesttopic", historyRequestTopic)) {
+		if (!cfg.lookupValue("history.responsetopic", historyResponseTopic))
+			historyResponseTopic = historyRequestTopic + MQTT_READ_RESPONSE_SUFFIX_DEFAULT;
+	}
+	cfg.lookupValue("trace.commandtopic", traceCommandTopic);
+	if (mqtt.getProtocolVersion() == MQTT_PROTOCOL_V5) {
+		if (cfg.lookupValue("mqtt.topicalias", bValue))
+			mqtt.setTopicAlias(bValue);
+		if (cfg.lookupValue("mqtt.receivemaximum", iValue))
+			mqtt.setReceiveMaximum(iValue);
+		if (cfg.lookupValue("mqtt.maxpacketsize", iValue))
+			mqtt.setMaximumPacketSize(iValue);
+		log(LOG_INFO, "Using MQTT v5");
+	}
 	mqtt.registerConnectionCallback(mqtt_connection_status);
 	mqtt.registerTopicUpdateCallback(mqtt_topic_update);
 	mqtt_connect();
@@ -622,6 +856,7 @@ bool mqtt_init(void) {
  */
 void mqtt_subscribe_tags(void) {
 	//printf("%s - Start\n", __func__);
+	std::lock_guard<std::mutex> lock(tagModelMutex);
 	Tag* tp = ts.getFirstTag();
 	while (tp != NULL) {
 		if (tp->isSubscribe()) {
@@ -630,6 +865,12 @@ void mqtt_subscribe_tags(void) {
 		}
 		tp = ts.getNextTag();
 	}
+	if (!readRequestTopic.empty())
+		mqtt.subscribe(readRequestTopic.c_str());
+	if (!historyRequestTopic.empty())
+		mqtt.subscribe(historyRequestTopic.c_str());
+	if (!traceCommandTopic.empty())
+		mqtt.subscribe(traceCommandTopic.c_str());
 	//printf("%s - Done\n", __func__);
 }
 
@@ -653,37 +894,126 @@ void mqtt_connection_status(bool status) {
 		if (mqtt_connection_in_progress) {
 			mqtt.disconnect();
 			// Note: the timeout is determined by OS network stack
-			unsigned long timeout = time(NULL) - mqtt_connect_time;
+			unsigned long timeout = clock_time() - mqtt_connect_time;
 			log(LOG_INFO, "mqtt connection timeout after %lds", timeout);
 			mqtt_connection_in_progress = false;
 		} else {
 			log(LOG_WARNING, "Disconnected from MQTT broker [%s]", mqtt.broker());
 		}
 		if (!exitSignal) {
- 			mqtt_next_connect_time = time(NULL) + MQTT_RECONNECT_INTERVAL;	// current time
+ 			mqtt_next_connect_time = clock_time() + MQTT_RECONNECT_INTERVAL;	// current time
  			log(LOG_INFO, "mqtt reconnect scheduled in %d seconds", MQTT_RECONNECT_INTERVAL);
  		}
 	}
 	//printf("%s - done\n", __func__);
 }
 
+/**
+ * Queue history query for processing in main loop
+ * called from MQTT thread, the tag array is only replaced by reload_process
+ * while tagModelMutex is held
+ */
+void history_query_receive(const struct mosquitto_message *message) {
+	history_query_t query;
+	const char *topic;
+	size_t topicLen;
+	std::lock_guard<std::mutex> lock(tagModelMutex);
+	if (tagModelReload) {
+		log(LOG_WARNING, "History query dropped, config reload in progress");
+		return;
+	}
+	if (!history_query_parse(message->payload, message->payloadlen, &query, &topic, &topicLen)) {
+		log(LOG_WARNING, "Invalid history query <%.*s>", message->payloadlen, (const char*)message->payload);
+		return;
+	}
+	for (int i = 0; i < mbTagCount; i++) {
+		if (mbReadTags[i].getHistorySlot() < 0) continue;
+		if ((strlen(mbReadTags[i].getTopic()) == topicLen) && (memcmp(mbReadTags[i].getTopic(), topic, topicLen) == 0)) {
+			query.tagIndex = i;
+			break;
+		}
+	}
+	if (query.tagIndex < 0)
+		log(LOG_WARNING, "History query for unknown tag <%.*s>", (int)topicLen, topic);
+	else if (!historyQueries.push(&query))
+		log(LOG_WARNING, "History query queue full, query for <%s> dropped", mbReadTags[query.tagIndex].getTopic());
+}
+
 /**
  * callback function for MQTT
  * MQTT notifies when a subscribed topic has received an update
- * @param topic: topic string
- * @param value: value as a string
- * Note: do not store the pointers "topic" & "value", they will be
+ * @param message: received message, the payload is not NUL terminated
+ * Note: do not store the pointers "topic" & "payload", they will be
  * destroyed after this function returns
  */
 void mqtt_topic_update(const struct mosquitto_message *message) {
 	//printf("%s - %s %s\n", __func__, topic, value);
+	if (!readRequestTopic.empty() && (readRequestTopic == message->topic)) {
+		// on-demand read, processed in main loop
+		read_request_t request;
+		if (message->retain) return;	// don't repeat old requests on reconnect
+		if (!read_request_parse(message->payload, message->payloadlen, &request))
+			log(LOG_WARNING, "Invalid read request <%.*s>", message->payloadlen, (const char*)message->payload);
+		else if (!readRequests.push(&request))
+			log(LOG_WARNING, "Read request queue full, request for #%d %u dropped", request.slaveId, request.address);
+		return;
+	}
+	if (!historyRequestTopic.empty() && (historyRequestTopic == message->topic)) {
+		if (!message->retain) history_query_receive(message);
+		return;
+	}
+	if (!traceCommandTopic.empty() && (traceCommandTopic == message->topic)) {
+		// any payload triggers a dump, processed in main loop
+		if (!message->retain) traceDumpRequest = true;
+		return;
+	}
+	std::lock_guard<std::mutex> lock(tagModelMutex);
 	Tag *tp = ts.getTag(message->topic);
 	if (tp == NULL) {
 		fprintf(stderr, "%s: <%s> not  in ts\n", __func__, message->topic);
 	} else {
 		tp->setValueIsRetained(message->retain);
-		tp->setValue((const char*)message->payload);	// This will trigger a callback to mb_write_request
+		tp->setValue(message->payload, message->payloadlen);	// This will trigger a callback to mb_write_request
+	}
+}
+
+/**
+ * Publish a value under the tag's topic using the tag's payload encoding
+ * @param tag: ModbusTag providing topic, format, encoding and retain
+ * @param value: the value to publish
+ * @param timestamp: source timestamp [ns], 0 = publish without timestamp
+ */
+void mqtt_publish_value(ModbusTag *tag, const typed_value_t *value, uint64_t timestamp) {
+	if (tag->getEncoding() == PAYLOAD_TEXT) {
+		mqtt.publish(tag->getTopic(), tag->getFormat(), typed_value_as_double(value), tag->getPublishRetain(), tag->getMessageExpiry(), tag->getQos(), timestamp);
+		return;
 	}
+	mqtt.publish(tag->getTopic(), tag->getEncoding(), value, timestamp, tag->getPublishRetain(), tag->getMessageExpiry(), tag->getQos());
+}
+
+/**
+ * Aggregate reading of a tag, publish statistics when the window has closed
+ * A window is closed by the first read (or noread) after its end.
+ * Statistics are published as JSON text, windows without readings are not
+ * published. Aggregated tags are not buffered while the broker is disconnected.
+ * @param tag: ModbusTag with aggregation window
+ */
+void mqtt_aggregate_tag(ModbusTag *tag) {
+	char buf[256];
+	int len;
+	Aggregate *agg = tag->getAggregate();
+	time_t now = clock_time();
+
+	if (agg->isClosed(now)) {
+		if ((agg->count() > 0) && mqtt.isConnected()) {
+			len = agg->format(buf, sizeof(buf), tag->getFormat());
+			if (len > 0)
+				mqtt.publishPayload(tag->getTopic(), buf, len, tag->getPublishRetain(), tag->getQos());
+		}
+		agg->start(now, tag->getAggregateWindow());
+	}
+	if (!tag->isNoread())
+		agg->add(tag->getScaledValue());
 }
 
 /**
@@ -692,11 +1022,31 @@ void mqtt_topic_update(const struct mosquitto_message *message) {
  * 
  */
 bool mqtt_publish_tag(ModbusTag *tag) {
-	if (!mqtt.isConnected()) return false;
+	typed_value_t value;
+	uint64_t timestamp;
 	if (tag->getTopicString().empty()) return true;	// don't publish if topic is empty
+	if (tag->getAggregateWindow() > 0) {
+		mqtt_aggregate_tag(tag);
+		if (!tag->isNoread()) return true;		// readings are published with the window statistics
+	}
+	if (!mqtt.isConnected()) {
+		// store reading for publishing after reconnect
+		if (sampleBuffer.isOpen() && !tag->isNoread()) {
+			value = tag->getTypedValue();
+			sampleBuffer.push((uint32_t)(tag - mbReadTags), &value, tag->getTimestamp());
+			storeForwardSamples = sampleBuffer.count();
+		}
+		return false;
+	}
 	// Publish value if read was OK
 	if (!tag->isNoread()) {
-		mqtt.publish(tag->getTopic(), tag->getFormat(), tag->getScaledValue(), tag->getPublishRetain());
+		timestamp = tag->getPublishTimestamp() ? tag->getTimestamp() : 0;
+		if (tag->getEncoding() == PAYLOAD_TEXT) {
+			mqtt.publish(tag->getTopic(), tag->getFormat(), tag->getScaledValue(), tag->getPublishRetain(), tag->getMessageExpiry(), tag->getQos(), timestamp);
+		} else {
+			value = tag->getTypedValue();
+			mqtt_publish_value(tag, &value, timestamp);
+		}
 		return true;
 	}
 	// Handle Noread
@@ -707,7 +1057,9 @@ bool mqtt_publish_tag(ModbusTag *tag) {
 		mqtt.clear_retained_message(tag->getTopic());
 		break;
 	case 1:	// publish noread value
-		mqtt.publish(tag->getTopic(), tag->getFormat(), tag->getNoreadValue(), tag->getPublishRetain());
+		value.type = VALUE_TYPE_FLOAT;
+		value.f = tag->getNoreadValue();
+		mqtt_publish_value(tag, &value, 0);
 		break;
 	default:
 		// do nothing (default, -1)
@@ -717,6 +1069,72 @@ bool mqtt_publish_tag(ModbusTag *tag) {
 	return true;
 }
 
+/**
+ * Publish a buffered sample, the timestamp is always published
+ * (transport according to the mqtt timestamp mode)
+ * Buffered samples are never retained as they are older than the current value
+ * @param tag: ModbusTag providing topic, format and encoding
+ * @param value: sample value
+ * @param timestamp: time of reading [ns]
+ */
+void mqtt_publish_sample(ModbusTag *tag, const typed_value_t *value, uint64_t timestamp) {
+	if (tag->getEncoding() == PAYLOAD_TEXT) {
+		mqtt.publish(tag->getTopic(), tag->getFormat(), typed_value_as_double(value), false, tag->getMessageExpiry(), tag->getQos(), timestamp);
+	} else {
+		mqtt.publish(tag->getTopic(), tag->getEncoding(), value, timestamp, false, tag->getMessageExpiry(), tag->getQos());
+	}
+}
+
+/**
+ * Drain store-and-forward buffer after reconnect
+ * publishes up to storeForwardDrainRate samples per second
+ * @return true if samples have been published
+ */
+bool storeforward_process(void) {
+	uint32_t tagIndex;
+	uint64_t timestamp;
+	typed_value_t value;
+	int budget;
+	static uint64_t evictedReported = 0;
+
+	if (!sampleBuffer.isOpen() || !mqtt.isConnected()) return false;
+	if (sampleBuffer.count() == 0) return false;
+	// number of samples for one main loop interval
+	budget = (storeForwardDrainRate * (int)mainloopinterval) / 1000;
+	if (budget < 1) budget = 1;
+	while ((budget-- > 0) && sampleBuffer.peek(&tagIndex, &value, &timestamp)) {
+		if (tagIndex < (uint32_t)mbTagCount)
+			mqtt_publish_sample(&mbReadTags[tagIndex], &value, timestamp);
+		sampleBuffer.pop();
+	}
+	storeForwardSamples = sampleBuffer.count();
+	if (storeForwardSamples == 0) {
+		log(LOG_INFO, "Store-and-forward buffer drained");
+		if (sampleBuffer.evictedCount() > evictedReported) {
+			log(LOG_WARNING, "Store-and-forward buffer overflow, %llu samples lost", (unsigned long long)(sampleBuffer.evictedCount() - evictedReported));
+			evictedReported = sampleBuffer.evictedCount();
+		}
+	}
+	return true;
+}
+
+/**
+ * Publish noread value of a tag and/or clear its retained value
+ * @param tag: ModbusTag to clear
+ * @param publish_noread: publish the "noread" value of the tag
+ * @param clear_retain: clear retained value from broker's persistance store
+ */
+void mqtt_clear_tag(ModbusTag *tag, bool publish_noread, bool clear_retain) {
+	typed_value_t noreadValue;
+	if (publish_noread) {
+		noreadValue.type = VALUE_TYPE_FLOAT;
+		noreadValue.f = tag->getNoreadValue();
+		mqtt_publish_value(tag, &noreadValue, 0);
+	}
+	if (clear_retain)
+		mqtt.clear_retained_message(tag->getTopic());	// clear retained status
+}
+
 /**
  * Publish noread value to all tags (normally done on program exit)
  * @param publish_noread: publish the "noread" value of the tag
@@ -724,35 +1142,31 @@ bool mqtt_publish_tag(ModbusTag *tag) {
  */
 void mqtt_clear_tags(bool publish_noread = true, bool clear_retain = true) {
 
-	int index = 0, tagIndex = 0;
-	int *tagArray;
-	ModbusTag mbTag;
+	int index, tagIndex;
+	const int *tagArray;
+	ModbusTag *mbTag;
 	//printf("%s", __func__);
 	
 	// Iterate over modbus array
 	//mqtt.setRetain(false);
-	while (updateCycles[index].ident >= 0) {
-		// ignore if cycle has no tags to process
-		if (updateCycles[index].tagArray == NULL) {
-			index++; continue;
-		}
+	for (index = 0; index < updateCycleCount; index++) {
 		// get array for tags
 		tagArray = updateCycles[index].tagArray;
 		// read each tag in the array
-		tagIndex = 0;
-		while (tagArray[tagIndex] >= 0) {
-			mbTag = mbReadTags[tagArray[tagIndex]];
+		for (tagIndex = 0; tagIndex < updateCycles[index].tagArraySize; tagIndex++) {
+			mbTag = &mbReadTags[tagArray[tagIndex]];
 			if (debugEnabled)
-				cout << "clearing: " << mbTag.getTopic() << endl;
-			if (publish_noread)
-				mqtt.publish(mbTag.getTopic(), mbTag.getFormat(), mbTag.getNoreadValue(), mbTag.getPublishRetain());
-				//mqtt_publish_tag(mbTag, true);			// publish noread value
-			if (clear_retain)
-				mqtt.clear_retained_message(mbTag.getTopic());	// clear retained status
-			tagIndex++;
+				cout << "clearing: " << mbTag->getTopic() << endl;
+			mqtt_clear_tag(mbTag, publish_noread, clear_retain);
 		}
-		index++;
-	}	// while 
+	}
+
+	// computed tags are not part of an update cycle
+	for (tagIndex = 0; tagIndex < mbTagCount; tagIndex++) {
+		mbTag = &mbReadTags[tagIndex];
+		if (!mbTag->isComputed() || mbTag->getTopicString().empty()) continue;
+		mqtt_clear_tag(mbTag, publish_noread, clear_retain);
+	}
 
 	// Iterate over local tags (e.g. CPU temp)
 	Tag *tag = ts.getFirstTag();
@@ -783,6 +1197,7 @@ void mb_slave_set_online_status (int slaveId, bool newStatus, bool forceReport =
 		if (!topic.empty()) {
 			topic = topic.append(std::to_string(slaveId));
 			//printf("%s - topic= %s value=%d\n", __func__, topic.c_str(), mbSlaveOnline[slaveId]);
+			if (!mqtt.isConnected()) return;
 			if (mbSlaveOnline[slaveId]) {
 				mqtt.publish(topic.c_str(), "%.0f", 1, mbSlaveStatusRetain);
 			} else {
@@ -797,41 +1212,96 @@ void mb_slave_set_online_status (int slaveId, bool newStatus, bool forceReport =
  * This a callback function from Tag class
  * it is executed when the value of tag is assigned
  * that is, when it's published by the broker
- * the request is added to the list of write requests
+ * the request is queued in the write scheduler
  */
 void mb_write_request(int callbackId, Tag *tag) {
 	// If tag is retained value and retained values are to be ignored then abort
 	if (tag->getValueIsRetained() && mbWriteTags[callbackId].getIgnoreRetained()) return;
+	// the write tags are about to be replaced
+	if (tagModelReload) {
+		log(LOG_WARNING, "Write to %s dropped, config reload in progress", tag->getTopic());
+		return;
+	}
 	// update value in tag array
-	mbWriteTags[callbackId].setRawValue(tag->intValue());
-	// set write request on tag
-	mbWriteTags[callbackId].setWritePending(true);
-	pendingWrites++;		// track number of pending writes
-	//printf("%s - %s is %d (%d)\n", __func__, tag->getTopic(), mbWriteTags[callbackId].getRawValue(),tag->intValue());
+	typed_value_t value = tag->typedValue();
+	if (!mbWriteTags[callbackId].setWriteValue(&value)) {
+		log(LOG_WARNING, "Write value %g out of range for %s", typed_value_as_double(&value), tag->getTopic());
+		return;
+	}
+	mbWriteTags[callbackId].setWriteArrival(clock_realtime_ns());
+	// a queued command writes the latest value
+	if (mbWriteTags[callbackId].testAndSetWritePending()) return;
+	// queue write command
+	write_command_t command;
+	command.tagIndex = callbackId;
+	command.priority = mbWriteTags[callbackId].getWritePriority();
+	command.arrival = mbWriteTags[callbackId].getWriteArrival();
+	command.deadline = 0;
+	if (mbWriteTags[callbackId].getWriteDeadline() > 0)
+		command.deadline = command.arrival + ((uint64_t)mbWriteTags[callbackId].getWriteDeadline() * 1000000ULL);
+	writeScheduler.push(&command);
+	//printf("%s - %s is %d\n", __func__, tag->getTopic(), mbWriteTags[callbackId].getRawValue());
+}
+
+/**
+ * Record a completed modbus transaction in bus statistics and trace
+ * @param slaveId: address of RTU slave
+ * @param function: modbus function code
+ * @param mbaddr: protocol address
+ * @param nb: number of registers / bits
+ * @param start: start of transaction [us] (clock_monotonic_us)
+ * @param error: errno of a failed transaction, 0 = success
+ * @param retry: retry number
+ */
+void mb_transaction_record(int slaveId, int function, uint16_t mbaddr, int nb, uint64_t start, int error, int retry) {
+	uint64_t rtt;
+	uint32_t sec, usec;
+	// the bus timeout was spent in real time
+	if ((error == ETIMEDOUT) && clock_is_virtual() && (modbus_get_response_timeout(mb_ctx, &sec, &usec) >= 0))
+		clock_advance_us(((uint64_t)sec * 1000000ULL) + usec);
+	rtt = clock_monotonic_us() - start;
+	busStats.record(slaveId, function, rtt, error);
+	mbTrace.record(slaveId, function, mbaddr, nb, rtt, error, retry, clock_realtime_ns());
 }
 
 /**
  * Write tag to modbus device
+ * @param tag: the tag to write
+ * @param error: storage for errno of a failed write, NULL = not required
  */
-bool mb_write_tag(ModbusTag *tag) {
-	int rc = 0, addrtype;
+bool mb_write_tag(ModbusTag *tag, int *error) {
+	int rc = 0, addrtype, nb = 1, function;
 	uint16_t mbaddr;
+	uint16_t registers[2];
+	uint64_t start;
 	
 	uint8_t slaveId = tag->getSlaveId();
 	if (modbusDebugLevel > 0)
 		printf ("%s - writing %d to Slave %d Addr %d\n", __func__, tag->getRawValue(),slaveId, tag->getRegisterAddress());
 	modbus_set_slave(mb_ctx, slaveId);
+	if (error != NULL) *error = EINVAL;
 	addrtype = tag->getRegisterType();
 	if (addrtype < 0) return false;		// invalid register address type
 	mbaddr = tag->getModbusAddress();
 	if (mbaddr < 0) return false;
 
+	start = clock_monotonic_us();
 	if (tag->getDataType() == 'r') {
-		rc = modbus_write_register(mb_ctx, mbaddr, tag->getRawValue());	// Modbus FC 6
+		nb = tag->getRegisterCount();
+		if (nb > 1) {
+			tag->getRegisters(registers);
+			rc = modbus_write_registers(mb_ctx, mbaddr, nb, registers);	// Modbus FC 16
+			function = 16;
+		} else {
+			rc = modbus_write_register(mb_ctx, mbaddr, tag->getRawValue());	// Modbus FC 6
+			function = 6;
+		}
 	} else {
 		rc = modbus_write_bit(mb_ctx, mbaddr, tag->getBoolValue());		// Modbus FC 5
+		function = 5;
 	}
-	if (rc != 1) {
+	mb_transaction_record(slaveId, function, mbaddr, nb, start, (rc == nb) ? 0 : errno, tag->getWriteFailedCount());
+	if (rc != nb) {
 		if (errno == 110) {		//timeout
 			if (!runningAsDaemon) {
 				printf("%s - failed: no response from slave %d addr %d (timeout)\n", __func__, slaveId, tag->getRegisterAddress()); 
@@ -843,6 +1313,7 @@ bool mb_write_tag(ModbusTag *tag) {
 				printf("%s - failed: illegal data address %d on slave %d\n", __func__, tag->getRegisterAddress(), slaveId);
 		}
 		log(LOG_ERR, "Modbus Write #%d (Addr %d) failed (%x): %s", slaveId, tag->getRegisterAddress(), errno, modbus_strerror(errno));
+		if (error != NULL) *error = errno;
 		return false;
 	} else {
 		// successful read
@@ -863,13 +1334,15 @@ bool mb_write_tag(ModbusTag *tag) {
  * @param nb: number of registers to read
  * @param regtype: register type (as returned by ModbusTag class)
  * @param dest: storage for read values
+ * @param timestamp: storage for time of response [ns since epoch], NULL = don't capture
  */
-bool mb_read_registers(int slaveId, modbus_t *ctx, uint16_t addr, int nb, int regtype, uint16_t *dest) {
+bool mb_read_registers(int slaveId, modbus_t *ctx, uint16_t addr, int nb, int regtype, uint16_t *dest, uint64_t *timestamp) {
 	bool retVal = false, singleBit = false;
-	int i, rc;
+	int i, rc, function;
 	uint16_t mbaddr;
 	uint8_t bitDest[nb+1];
 	int retrycount = 0;
+	uint64_t start;
 	if (modbusDebugLevel > 0)
 		printf ("%s - reading #%d HR %d qty %d\n", __func__, slaveId, addr, nb);
 	
@@ -881,27 +1354,33 @@ bool mb_read_registers(int slaveId, modbus_t *ctx, uint16_t addr, int nb, int re
 		return retVal;
 		}
 retry:	
+	start = clock_monotonic_us();
 	// select modbus function for register type and subtract register type offset
 	switch (regtype) {
 		case 0: mbaddr = addr;
 			singleBit = true;
 			rc = modbus_read_bits(ctx, mbaddr, nb, &bitDest[0]);	//Modbus FC 1
+			function = 1;
 			break;
 		case 1: mbaddr = addr - 10000;
 			singleBit = true;
 			rc = modbus_read_input_bits(ctx, mbaddr, nb, &bitDest[0]);	//Modbus FC 2
+			function = 2;
 			break;
 		case 3: mbaddr = addr - 30000;
 			rc = modbus_read_input_registers(ctx, mbaddr, nb, (uint16_t*)dest);	// Modbus FC_4
+			function = 4;
 			break;
 		case 4: mbaddr = addr - 40000;
 			rc = modbus_read_registers(ctx, mbaddr, nb, (uint16_t*)dest);	// Modbus FC_3
+			function = 3;
 			break;
 		default:
 			if (!runningAsDaemon)
 				printf("%s - Invalid address type %d \n", __func__, addr);
 			return retVal;
 	}
+	mb_transaction_record(slaveId, function, mbaddr, nb, start, (rc == nb) ? 0 : errno, retrycount);
 	
 	if (rc != nb) {
 		// Handle error
@@ -911,11 +1390,13 @@ retry:
 			if ( (errno == 110) ) {		// handle timeout error
 				if (mbSlaveOnline[slaveId])  {	//prevent retry if slave is already offline
 					retrycount++;
+					busStats.retry(slaveId);
 					goto retry;
 				}
 			} else {	// handle all non-timeout errors
 				if (errno != 0x6b24250) {	// No retry for Illegal Data Address error
 					retrycount++;
+					busStats.retry(slaveId);
 					goto retry;
 				}
 			}
@@ -930,7 +1411,9 @@ retry:
 				printf("%s - failed: illegal data address %u on slave %d\n", __func__, addr, slaveId);
 		}
 	} else {
-		// successful read
+		// successful read, capture time of response before any further processing
+		if (timestamp != NULL)
+			*timestamp = clock_realtime_ns();
 		mb_slave_set_online_status(slaveId, true);
 		retVal = true;
 		
@@ -957,95 +1440,170 @@ retry:
  */
 int mb_read_tag(ModbusTag *tag) {
 	uint16_t registers[4];
+	uint64_t timestamp = 0;
 	bool retVal;
 
 	uint8_t slaveId = tag->getSlaveId();
 		
-	retVal = mb_read_registers(slaveId, mb_ctx, tag->getRegisterAddress(), 1, tag->getRegisterType(),registers);
+	retVal = mb_read_registers(slaveId, mb_ctx, tag->getRegisterAddress(), tag->getRegisterCount(), tag->getRegisterType(),registers, mbCaptureTimestamps ? &timestamp : NULL);
 	if (retVal) {
-		tag->setRawValue(registers[0]);
+		tag->setRegisters(registers);
+		tag->setTimestamp(timestamp);
 	} else {
 		tag->noreadNotify();
 	}
+	mb_tag_updated(tag);
 	mqtt_publish_tag(tag);
 	if (retVal) return 0;
 	else return -1;
 }
 
 
+/**
+ * Publish response to on-demand read request
+ * @param request: the request
+ * @param value: value read or NULL on failure
+ * @param timestamp: time of reading [ns]
+ * @param ageMs: age of value [ms]
+ * @param source: "cache" or "bus"
+ * @param error: error description if value is NULL
+ */
+void read_request_respond(const read_request_t *request, const typed_value_t *value, uint64_t timestamp, uint64_t ageMs, const char *source, const char *error) {
+	char buf[256];
+	int len = read_response_format(buf, sizeof(buf), request, value, timestamp, ageMs, source, error);
+	if (len < 0) return;
+	if (mqtt.isConnected())
+		mqtt.publishPayload(readResponseTopic.c_str(), buf, len, false);
+}
+
+/**
+ * Answer read request from the last cyclic read
+ * @return false if no tag holds a value which is younger than maxage
+ */
+bool read_request_from_cache(const read_request_t *request) {
+	ModbusTag reg;
+	ModbusTag *tag;
+	uint16_t registers[2];
+	uint64_t now, timestamp;
+	typed_value_t value;
+	if (request->maxAge <= 0) return false;
+	now = clock_realtime_ns();
+	const int *tags = mbSlaveReadIndex.tags(request->slaveId);
+	for (int i = 0; i < mbSlaveReadIndex.size(request->slaveId); i++) {
+		tag = &mbReadTags[tags[i]];
+		if (tag->getRegisterAddress() != request->address) continue;
+		if (tag->getValueType() != request->valueType) continue;
+		if (tag->isNoread() || (tag->getLastUpdateTime() == 0)) continue;
+		timestamp = tag->getTimestamp();
+		if (timestamp == 0) timestamp = (uint64_t)tag->getLastUpdateTime() * 1000000000ULL;
+		if (now < timestamp) now = timestamp;
+		if ((double)(now - timestamp) > (request->maxAge * 1e9)) return false;
+		// the register value is returned unscaled
+		reg.setAddress(request->address);
+		reg.setValueType(request->valueType);
+		tag->getRegisters(registers);
+		reg.setRegisters(registers);
+		value = reg.getTypedValue();
+		read_request_respond(request, &value, timestamp, (now - timestamp) / 1000000ULL, "cache", NULL);
+		return true;
+	}
+	return false;
+}
+
+/**
+ * Read register(s) of read request from slave
+ */
+void read_request_from_bus(const read_request_t *request) {
+	ModbusTag reg;
+	uint16_t registers[2];
+	uint64_t timestamp = 0;
+	typed_value_t value;
+	reg.setSlaveId(request->slaveId);
+	reg.setAddress(request->address);
+	reg.setValueType(request->valueType);
+	if (reg.getRegisterType() < 0) {
+		read_request_respond(request, NULL, 0, 0, NULL, "invalid address");
+		return;
+	}
+	if (!mb_read_registers(request->slaveId, mb_ctx, request->address, reg.getRegisterCount(), reg.getRegisterType(), registers, &timestamp)) {
+		read_request_respond(request, NULL, 0, 0, NULL, "read failed");
+	} else {
+		reg.setRegisters(registers);
+		value = reg.getTypedValue();
+		read_request_respond(request, &value, timestamp, 0, "bus", NULL);
+	}
+	clock_sleep_us(modbusinterslavedelay);
+}
+
+/**
+ * process on-demand read requests
+ * requests are answered from memory if the cached value is younger than
+ * maxage, otherwise the register is read from the slave.
+ * Called between cyclic reads, max READ_REQUEST_BURST bus reads per call.
+ * @return true if a request has been processed
+ */
+bool read_request_process(void) {
+	read_request_t request;
+	int busReads = 0;
+	bool retval = false;
+	while ((busReads < READ_REQUEST_BURST) && readRequests.pop(&request)) {
+		retval = true;
+		if (read_request_from_cache(&request)) continue;
+		read_request_from_bus(&request);
+		busReads++;
+	}
+	return retval;
+}
+
 /**
  * assign tags to update cycles
- * generate arrays of tags assigned ot the same updatecycle
- * 1) iterate over update cycles
- * 2) count tags which refer to update cycle
- * 3) allocate array for those tags
- * 4) fill array with index of tags that match update cycle
- * 5) assign array to update cycle
- * 6) go back to 1) until all update cycles have been matched
+ * builds the per cycle tag index in one pass over the tags (config file order
+ * is kept within each cycle), computed tags are not read from a slave
  */
 bool mb_assign_updatecycles () {
-	int updidx = 0;
-	int mbTagIdx = 0;
-	int cycleIdent = 0;
-	int matchCount = 0;
-	int *intArray = NULL;
-	int arIndex = 0;
-	// iterate over updatecycle array
-	while (updateCycles[updidx].ident >= 0) {
-		cycleIdent = updateCycles[updidx].ident;
-		updateCycles[updidx].tagArray = NULL;
-		updateCycles[updidx].tagArraySize = 0;
-		// iterate over mbReadTags array
-		mbTagIdx = 0;
-		matchCount = 0;
-		while (mbReadTags[mbTagIdx].updateCycleId() >= 0) {
-			// count tags with cycle id match
-			if (mbReadTags[mbTagIdx].updateCycleId() == cycleIdent) {
-				matchCount++;
-				//cout << cycleIdent <<" " << mbReadTags[mbTagIdx].getAddress() << endl;
-			}
-			mbTagIdx++;
-		}
-		// skip to next cycle update if we have no matching tags
-		if (matchCount < 1) {
-			updidx++;
-			continue;
-		}
-		// -- We have some matching tags
-		// allocate array for tags in this cycleupdate
-		intArray = new int[matchCount+1];			// +1 to allow for end marker
-		// fill array with matching tag indexes
-		mbTagIdx = 0;
-		arIndex = 0;
-		while (mbReadTags[mbTagIdx].updateCycleId() >= 0) {
-			// count tags with cycle id match
-			if (mbReadTags[mbTagIdx].updateCycleId() == cycleIdent) {
-				intArray[arIndex] = mbTagIdx;
-				arIndex++;
+	int *keys;
+	int i, k;
+	// dense copy of the fields used by the read loops
+	mbTagTable.allocate(mbTagCount);
+	for (i = 0; i < mbTagCount; i++)
+		mbTagTable.set(i, &mbReadTags[i]);
+	keys = new int[mbTagCount+1];
+	for (i = 0; i < mbTagCount; i++) {
+		keys[i] = -1;
+		if (mbReadTags[i].isComputed()) continue;
+		// cycles are few, a linear search is faster than a map
+		for (k = 0; k < updateCycleCount; k++) {
+			if (updateCycles[k].ident == mbReadTags[i].updateCycleId()) {
+				keys[i] = k;
+				break;
 			}
-			mbTagIdx++;
 		}
-		// mark end of array
-		intArray[arIndex] = -1;
-		// add the array to the update cycles
-		updateCycles[updidx].tagArray = intArray;
-		updateCycles[updidx].tagArraySize = arIndex;
-		// next update index
-		updidx++;
 	}
+	mbCycleIndex.build(keys, mbTagCount, updateCycleCount);
+	for (k = 0; k < updateCycleCount; k++) {
+		updateCycles[k].tagArray = mbCycleIndex.tags(k);
+		updateCycles[k].tagArraySize = mbCycleIndex.size(k);
+	}
+	// index read tags by slave
+	for (i = 0; i < mbTagCount; i++)
+		keys[i] = mbReadTags[i].isComputed() ? -1 : mbReadTags[i].getSlaveId();
+	mbSlaveReadIndex.build(keys, mbTagCount, MODBUS_SLAVE_MAX+1);
+	delete [] keys;
 	return true;
 }
 
 /**
  * read tag configuration for one slave from config file
  */
-bool mb_config_tags(Setting& mbTagsSettings, uint8_t slaveId, bool defaultRetain, int defaultNoreadAction) {
+bool mb_config_tags(Setting& mbTagsSettings, uint8_t slaveId, bool defaultRetain, int defaultNoreadAction, payload_encoding_t defaultEncoding, int defaultExpiry, int defaultQos, bool defaultTimestamp) {
 	int tagIndex;
 	unsigned int tagAddress;
 	int tagUpdateCycle;
 	string strValue;
 	float fValue;
+	double dValue;
 	int intValue;
+	payload_encoding_t encoding;
 	bool bValue;
 	
 	int numTags = mbTagsSettings.getLength();
@@ -1055,18 +1613,31 @@ bool mb_config_tags(Setting& mbTagsSettings, uint8_t slaveId, bool defaultRetain
 	}
 	
 	for (tagIndex = 0; tagIndex < numTags; tagIndex++) {
+		tagAddress = 0;
 		if (mbTagsSettings[tagIndex].lookupValue("address", tagAddress)) {
 			mbReadTags[mbTagCount].setAddress((uint16_t)tagAddress);
 			mbReadTags[mbTagCount].setSlaveId(slaveId);
+		} else if (mbTagsSettings[tagIndex].lookupValue("expression", strValue)) {
+			// computed tag, compiled after all tags have been configured
+			Expression *expression = new Expression();
+			expression->setSource(strValue.c_str());
+			mbReadTags[mbTagCount].setExpression(expression);
+			mbReadTags[mbTagCount].setSlaveId(slaveId);
 		} else {
 			log(LOG_WARNING, "Error in config file, tag address missing");
 			continue;		// skip to next tag
 		}
+		if (mbTagsSettings[tagIndex].lookupValue("name", strValue))
+			mbReadTags[mbTagCount].setName(strValue.c_str());
 		if (mbTagsSettings[tagIndex].lookupValue("update_cycle", tagUpdateCycle)) {
 			mbReadTags[mbTagCount].setUpdateCycleId(tagUpdateCycle);
 		}
 		if (mbTagsSettings[tagIndex].lookupValue("group", intValue))
 				mbReadTags[mbTagCount].setGroup(intValue);
+		if (mbTagsSettings[tagIndex].lookupValue("valuetype", strValue)) {
+			if (!mbReadTags[mbTagCount].setValueType(strValue.c_str()))
+				log(LOG_WARNING, "Config error - invalid valuetype \"%s\" for slave %d address %d", strValue.c_str(), slaveId, tagAddress);
+		}
 		// is topic present? -> read mqtt related parametrs
 		if (mbTagsSettings[tagIndex].lookupValue("topic", strValue)) {
 			mbReadTags[mbTagCount].setTopic(strValue.c_str());
@@ -1076,10 +1647,30 @@ bool mb_config_tags(Setting& mbTagsSettings, uint8_t slaveId, bool defaultRetain
 				mbReadTags[mbTagCount].setPublishRetain(defaultRetain);
 			if (mbTagsSettings[tagIndex].lookupValue("format", strValue))
 				mbReadTags[mbTagCount].setFormat(strValue.c_str());
-			if (mbTagsSettings[tagIndex].lookupValue("multiplier", fValue))
-				mbReadTags[mbTagCount].setMultiplier(fValue);
-			if (mbTagsSettings[tagIndex].lookupValue("offset", fValue))
-				mbReadTags[mbTagCount].setOffset(fValue);
+			if (mbTagsSettings[tagIndex].lookupValue("multiplier", dValue))
+				mbReadTags[mbTagCount].setMultiplier(dValue);
+			if (mbTagsSettings[tagIndex].lookupValue("offset", dValue))
+				mbReadTags[mbTagCount].setOffset(dValue);
+			encoding = defaultEncoding;
+			if (mbTagsSettings[tagIndex].lookupValue("encoding", strValue)) {
+				if (!payload_encoding_from_string(strValue.c_str(), &encoding)) {
+					log(LOG_WARNING, "Config error - invalid encoding \"%s\" for %s", strValue.c_str(), mbReadTags[mbTagCount].getTopic());
+					encoding = defaultEncoding;
+				}
+			}
+			mbReadTags[mbTagCount].setEncoding(encoding);
+			if (!mbTagsSettings[tagIndex].lookupValue("timestamp", bValue))
+				bValue = defaultTimestamp;
+			mbReadTags[mbTagCount].setPublishTimestamp(bValue);
+			if (bValue) mbCaptureTimestamps = true;
+			if (mbTagsSettings[tagIndex].lookupValue("expiry", intValue))
+				mbReadTags[mbTagCount].setMessageExpiry(intValue);
+			else
+				mbReadTags[mbTagCount].setMessageExpiry(defaultExpiry);
+			if (mbTagsSettings[tagIndex].lookupValue("qos", intValue))
+				mbReadTags[mbTagCount].setQos(intValue);
+			else
+				mbReadTags[mbTagCount].setQos(defaultQos);
 			if (mbTagsSettings[tagIndex].lookupValue("noreadvalue", fValue))
 				mbReadTags[mbTagCount].setNoreadValue(fValue);
 			if (mbTagsSettings[tagIndex].lookupValue("noreadaction", intValue))
@@ -1088,6 +1679,10 @@ bool mb_config_tags(Setting& mbTagsSettings, uint8_t slaveId, bool defaultRetain
 				mbReadTags[mbTagCount].setNoreadAction(defaultNoreadAction);
 			if (mbTagsSettings[tagIndex].lookupValue("noreadignore", intValue))
 				mbReadTags[mbTagCount].setNoreadIgnore(intValue);
+			if (mbTagsSettings[tagIndex].lookupValue("aggregate", intValue))
+				mbReadTags[mbTagCount].setAggregateWindow(intValue);
+			if (mbTagsSettings[tagIndex].lookupValue("history", bValue) && bValue)
+				mbReadTags[mbTagCount].setHistorySlot(historyTagCount++);
 		}
 		mbTagCount++;
 		//cout << "Tag " << mbTagCount << " addr: " << tagAddress << " cycle: " << tagUpdateCycle << endl;
@@ -1095,14 +1690,63 @@ bool mb_config_tags(Setting& mbTagsSettings, uint8_t slaveId, bool defaultRetain
 	return true;
 }
 
+/**
+ * resolve tag name in expression of computed tag
+ * @param ctx: pointer to index of computed tag
+ * @return index of tag or -1 if not found
+ */
+int mb_expression_resolve(const char *name, size_t len, void *ctx) {
+	int self = *(int *)ctx;
+	for (int i = 0; i < mbTagCount; i++) {
+		if ((strlen(mbReadTags[i].getName()) != len) || (strncmp(mbReadTags[i].getName(), name, len) != 0)) continue;
+		// computed tags are evaluated in config file order
+		if (mbReadTags[i].isComputed() && (i >= self)) {
+			log(LOG_ERR, "Config error - computed tag <%.*s> must be defined before it is used", (int)len, name);
+			return -1;
+		}
+		return i;
+	}
+	return -1;
+}
+
+/**
+ * compile expressions of computed tags and register them with their inputs
+ * @returns false for configuration error, otherwise true
+ */
+bool mb_config_expressions(void) {
+	Expression *expression;
+	int i, count = 0;
+
+	for (i = 0; i < mbTagCount; i++)
+		if (mbReadTags[i].isComputed()) count++;
+	if (count < 1) return true;
+	computedTags = new int[count];
+	computePending = new bool[mbTagCount];
+	for (i = 0; i < mbTagCount; i++) {
+		computePending[i] = false;
+		if (!mbReadTags[i].isComputed()) continue;
+		expression = mbReadTags[i].getExpression();
+		if (!expression->compile(mb_expression_resolve, &i)) {
+			log(LOG_ERR, "Config error - expression \"%s\" for %s: %s", expression->getSource(), mbReadTags[i].getTopic(), expression->getError());
+			return false;
+		}
+		for (int k = 0; k < expression->inputCount(); k++)
+			mbReadTags[expression->inputId(k)].addDependent(i);
+		computedTags[computedTagCount++] = i;
+	}
+	log(LOG_INFO, "%d computed tags", count);
+	return true;
+}
+
 /**
  * read slave configuration from config file
  */
 
 bool mb_config_slaves(Setting& mbSlavesSettings) {
-	int slaveId, numTags, defaultNoreadAction;
-	string slaveName;
-	bool slaveEnabled, defaultRetain;
+	int slaveId, numTags, defaultNoreadAction, defaultExpiry, defaultQos;
+	payload_encoding_t defaultEncoding;
+	string slaveName, strValue;
+	bool slaveEnabled, defaultRetain, defaultTimestamp;
 	
 	// we need at least one slave in config file
 	int numSlaves = mbSlavesSettings.getLength();
@@ -1125,7 +1769,7 @@ bool mb_config_slaves(Setting& mbSlavesSettings) {
 		}
 	}
 	
-	mbReadTags = new ModbusTag[numTags+1];
+	mbReadTags = new ModbusTag[numTags];
 	
 	mbTagCount = 0;
 	// iterate through slaves
@@ -1149,8 +1793,21 @@ bool mb_config_slaves(Setting& mbSlavesSettings) {
 					defaultRetain = false;
 				if (!mbSlavesSettings[slavesIdx].lookupValue("default_noreadaction", defaultNoreadAction)) 
 					defaultNoreadAction = -1;
+				defaultEncoding = PAYLOAD_TEXT;
+				if (mbSlavesSettings[slavesIdx].lookupValue("default_encoding", strValue)) {
+					if (!payload_encoding_from_string(strValue.c_str(), &defaultEncoding)) {
+						log(LOG_WARNING, "Config error - invalid default_encoding \"%s\" for slave %d", strValue.c_str(), slaveId);
+						defaultEncoding = PAYLOAD_TEXT;
+					}
+				}
+				if (!mbSlavesSettings[slavesIdx].lookupValue("default_expiry", defaultExpiry))
+					defaultExpiry = 0;
+				if (!mbSlavesSettings[slavesIdx].lookupValue("default_qos", defaultQos))
+					defaultQos = 0;
+				if (!mbSlavesSettings[slavesIdx].lookupValue("default_timestamp", defaultTimestamp))
+					defaultTimestamp = false;
 				Setting& mbTagsSettings = mbSlavesSettings[slavesIdx].lookup("tags");
-				if (!mb_config_tags(mbTagsSettings, slaveId, defaultRetain, defaultNoreadAction)) {
+				if (!mb_config_tags(mbTagsSettings, slaveId, defaultRetain, defaultNoreadAction, defaultEncoding, defaultExpiry, defaultQos, defaultTimestamp)) {
 					return false; }
 			} else {
 				log(LOG_NOTICE, "Slave %d (%s) disabled in config", slaveId, slaveName.c_str());
@@ -1160,9 +1817,6 @@ bool mb_config_slaves(Setting& mbSlavesSettings) {
 			// this is a permissible condition
 		}
 	}
-	// mark end of array
-	mbReadTags[mbTagCount].setUpdateCycleId(-1);
-	mbReadTags[mbTagCount].setSlaveId(MODBUS_SLAVE_MAX +1);
 	return true;
 }
 
@@ -1178,7 +1832,8 @@ bool mb_config_updatecycles(Setting& updateCyclesSettings) {
 	}
 	
 	// allocate array 
-	updateCycles = new updatecycle[numUpdateCycles+1];
+	updateCycles = new updatecycle[numUpdateCycles];
+	updateCycleCount = numUpdateCycles;
 	
 	for (index = 0; index < numUpdateCycles; index++) {
 		if (updateCyclesSettings[index].lookupValue("id", idValue)) {
@@ -1193,24 +1848,21 @@ bool mb_config_updatecycles(Setting& updateCyclesSettings) {
 		}
 		updateCycles[index].ident = idValue;
 		updateCycles[index].interval = interval;
-		updateCycles[index].nextUpdateTime = time(0) + interval;
+		updateCycles[index].nextUpdateTime = clock_time() + interval;
 		//cout << "Update " << index << " ID " << idValue << " Interval: " << interval << " t:" << updateCycles[index].nextUpdateTime << endl;
 	}
-	// mark end of data
-	updateCycles[index].ident = -1;
-	updateCycles[index].interval = -1;
-	
 	return true;
 }
 
 /**
  * read modbus configuration from config file
+ * @param config: parsed config file (running or reloaded)
  */
 
-bool mb_config() {
+bool mb_config(Config &config) {
 	// Configure update cycles
 	try {
-		Setting& updateCyclesSettings = cfg.lookup("updatecycles");
+		Setting& updateCyclesSettings = config.lookup("updatecycles");
 		if (!mb_config_updatecycles(updateCyclesSettings)) {
 			return false; }
 	} catch (const SettingNotFoundException &excp) {
@@ -1223,9 +1875,11 @@ bool mb_config() {
 	
 	// Configure modbus slaves
 	try {
-		Setting& mbSlavesSettings = cfg.lookup("mbslaves");
+		Setting& mbSlavesSettings = config.lookup("mbslaves");
 		if (!mb_config_slaves(mbSlavesSettings)) {
 			return false; }
+		if (!mb_config_expressions()) {
+			return false; }
 	} catch (const SettingNotFoundException &excp) {
 		log(LOG_ERR, "Error in config file <%s> not found", excp.getPath());
 		return false;
@@ -1242,6 +1896,45 @@ bool mb_config() {
 	return true;
 }
 
+/**
+ * load update cycles and read tags from the config cache (optional)
+ * @return false if the cache is not configured, missing or out of date
+ */
+bool mb_config_cache_load(void) {
+	string fileName;
+	uint64_t start = clock_monotonic_us();
+
+	if (!cfg.lookupValue("configcache.file", fileName)) return false;
+	if (!config_cache_read(fileName.c_str(), cfgSourceHash, &updateCycles, &updateCycleCount, &mbReadTags, &mbTagCount)) {
+		log(LOG_NOTICE, "Config cache <%s> missing or out of date, reading config file", fileName.c_str());
+		return false;
+	}
+	for (int i = 0; i < mbTagCount; i++) {
+		if (mbReadTags[i].getPublishTimestamp()) mbCaptureTimestamps = true;
+		if (mbReadTags[i].getHistorySlot() >= 0) historyTagCount++;
+	}
+	log(LOG_INFO, "Config cache <%s> loaded, %d tags in %lluus", fileName.c_str(), mbTagCount, (unsigned long long)(clock_monotonic_us() - start));
+	return true;
+}
+
+/**
+ * write update cycles and read tags to the config cache (optional)
+ * @param sourceHash: hash of the config file the tags have been read from
+ */
+void mb_config_cache_save(uint64_t sourceHash) {
+	string fileName;
+
+	if (!cfg.lookupValue("configcache.file", fileName)) return;
+	if (sourceHash == 0) {
+		log(LOG_NOTICE, "Config file can't be cached (@include)");
+		return;
+	}
+	if (config_cache_write(fileName.c_str(), sourceHash, updateCycles, updateCycleCount, mbReadTags, mbTagCount))
+		log(LOG_INFO, "Config cache <%s> written, %d tags", fileName.c_str(), mbTagCount);
+	else
+		log(LOG_WARNING, "Unable to write config cache <%s>", fileName.c_str());
+}
+
 /**
  * initialize modbus
  * @returns false for configuration error, otherwise true
@@ -1299,6 +1992,13 @@ bool init_modbus()
 	if (cfg.lookupValue("modbusrtu.slavestatusretain", bValue)) {
 		mbSlaveStatusRetain = bValue;
 	}
+	// bus statistics reporting (optional)
+	if (cfg.lookupValue("modbusrtu.statstopic", strValue)) {
+		mbStatsTopic = strValue;
+		if (cfg.lookupValue("modbusrtu.statsinterval", newValue) && (newValue > 0))
+			mbStatsInterval = newValue;
+		mbStatsNextTime = clock_time() + mbStatsInterval;
+	}
 	
 	if (cfg_get_int("modbusrtu.maxretries", newValue)) {
 		mbMaxRetries = newValue;
@@ -1339,7 +2039,12 @@ bool init_modbus()
 	
 	log(LOG_INFO, "Modbus RTU opened on port %s at %d baud", rtu_port.c_str(), port_baud);
 	
-	if (!mb_config()) return false;
+	if (mb_config_cache_load()) {
+		if (!mb_config_expressions()) return false;
+	} else {
+		if (!mb_config(cfg)) return false;
+		mb_config_cache_save(cfgSourceHash);
+	}
 	if (!mb_assign_updatecycles()) return false;
 	
 	// all slaves start life in offline mode
@@ -1349,6 +2054,705 @@ bool init_modbus()
 	return true;
 }
 
+/**
+ * hash of the read tag layout, identifies the tags referenced by buffered samples
+ */
+uint32_t mb_tag_layout_hash(void) {
+	uint32_t hash = 2166136261u;	// FNV-1a
+	const char *p;
+	for (int i = 0; i < mbTagCount; i++) {
+		for (p = mbReadTags[i].getTopic(); *p != 0; p++) {
+			hash ^= (uint8_t)*p;
+			hash *= 16777619u;
+		}
+		hash ^= 0xFF;		// topic separator
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/**
+ * initialize store-and-forward buffer (optional)
+ * @returns false for configuration error, otherwise true
+ */
+bool init_storeforward(void) {
+	string fileName;
+	int capacity = STOREFORWARD_CAPACITY_DEFAULT;
+	int iValue;
+
+	if (!cfg.lookupValue("storeforward.file", fileName))
+		return true;		// store-and-forward is not configured
+	if (mbTagCount < 1)
+		return true;
+	if (cfg.lookupValue("storeforward.capacity", iValue))
+		capacity = iValue;
+	if (cfg.lookupValue("storeforward.drainrate", iValue))
+		storeForwardDrainRate = iValue;
+	if ((capacity < 1) || (storeForwardDrainRate < 1)) {
+		log(LOG_ERR, "Config error - storeforward capacity and drainrate must be > 0");
+		return false;
+	}
+	if (!sampleBuffer.open(fileName.c_str(), capacity, mb_tag_layout_hash())) {
+		log(LOG_ERR, "Unable to open store-and-forward buffer <%s>", fileName.c_str());
+		return false;
+	}
+	mbCaptureTimestamps = true;		// buffered samples are always published with timestamp
+	storeForwardSamples = sampleBuffer.count();
+	log(LOG_INFO, "Store-and-forward buffer <%s> %d samples (%d buffered)", fileName.c_str(), capacity, sampleBuffer.count());
+	return true;
+}
+
+/**
+ * Update shared memory slot of a tag after a read
+ * @param tag: ModbusTag which has been read (or failed to read)
+ */
+void shm_update_tag(ModbusTag *tag) {
+	typed_value_t value;
+	if (!shmTable.isOpen()) return;
+	if (tag->isNoread()) {
+		shmTable.update((uint32_t)(tag - mbReadTags), NULL, 0, SHM_QUALITY_BAD);
+		return;
+	}
+	value = tag->getTypedValue();
+	shmTable.update((uint32_t)(tag - mbReadTags), &value, tag->getTimestamp(), SHM_QUALITY_GOOD);
+}
+
+/**
+ * Append reading of a tag to its history
+ * @param tag: ModbusTag which has been read
+ */
+void history_update_tag(ModbusTag *tag) {
+	typed_value_t value;
+	if (!history.isOpen() || (tag->getHistorySlot() < 0) || tag->isNoread()) return;
+	value = tag->getTypedValue();
+	history.append((uint32_t)tag->getHistorySlot(), tag->getTimestamp(), typed_value_as_double(&value));
+}
+
+/**
+ * Called after every read attempt of a tag (successful or noread)
+ * @param tag: ModbusTag which has been read (or failed to read)
+ */
+void mb_tag_updated(ModbusTag *tag) {
+	shm_update_tag(tag);
+	history_update_tag(tag);
+	for (int i = 0; i < tag->getDependentCount(); i++) {
+		computePending[tag->getDependent(i)] = true;
+		computeRequired = true;
+	}
+}
+
+/**
+ * evaluate computed tags whose inputs have been updated
+ * A computed tag is noread while one of its inputs is noread, it is not
+ * evaluated before all inputs have been read once.
+ * Computed tags only depend on tags defined before them, a single pass in
+ * config file order also updates computed tags using computed tags.
+ * @return true if at least one tag has been evaluated
+ */
+bool mb_compute_process(void) {
+	double inputs[EXPRESSION_INPUTS_MAX];
+	ModbusTag *tag, *input;
+	Expression *expression;
+	uint64_t timestamp;
+	bool noread, complete;
+	bool retval = false;
+
+	if (!computeRequired) return false;
+	computeRequired = false;
+	for (int i = 0; i < computedTagCount; i++) {
+		if (!computePending[computedTags[i]]) continue;
+		computePending[computedTags[i]] = false;
+		tag = &mbReadTags[computedTags[i]];
+		expression = tag->getExpression();
+		noread = false;
+		complete = true;
+		timestamp = 0;
+		for (int k = 0; k < expression->inputCount(); k++) {
+			input = &mbReadTags[expression->inputId(k)];
+			if (input->isNoread()) noread = true;
+			else if (input->getLastUpdateTime() == 0) complete = false;		// not read yet
+			inputs[k] = input->getScaledValue();
+			if (input->getTimestamp() > timestamp) timestamp = input->getTimestamp();
+		}
+		if (!noread && !complete) continue;
+		if (noread) {
+			tag->noreadNotify();
+		} else {
+			tag->setComputedValue(expression->evaluate(inputs));
+			tag->setTimestamp(timestamp);		// time of the latest input
+		}
+		mb_tag_updated(tag);
+		mqtt_publish_tag(tag);
+		retval = true;
+	}
+	return retval;
+}
+
+/**
+ * initialize shared memory live value table (optional)
+ * @returns false for configuration error, otherwise true
+ */
+bool init_shmtable(void) {
+	string name;
+
+	if (!cfg.lookupValue("sharedmemory.name", name))
+		return true;		// shared memory table is not configured
+	if (mbTagCount < 1)
+		return true;
+	if (name[0] != '/') name.insert(0, "/");
+	if (!shmTable.open(name.c_str(), mbTagCount, mb_tag_layout_hash())) {
+		log(LOG_ERR, "Unable to create shared memory table <%s>", name.c_str());
+		return false;
+	}
+	for (int i = 0; i < mbTagCount; i++)
+		shmTable.setDescriptor(i, mbReadTags[i].getTopic(), mbReadTags[i].getSlaveId(), mbReadTags[i].getRegisterAddress());
+	mbCaptureTimestamps = true;		// every slot carries the time of reading
+	log(LOG_INFO, "Shared memory table <%s> %d tags", name.c_str(), mbTagCount);
+	return true;
+}
+
+/**
+ * key of a history tag in the history file (hash of the topic), the history
+ * of a tag moves with the tag when history tags are added or removed
+ */
+uint32_t mb_history_key(ModbusTag *tag) {
+	uint32_t hash = 2166136261u;	// FNV-1a
+	for (const char *p = tag->getTopic(); *p != 0; p++) {
+		hash ^= (uint8_t)*p;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/**
+ * hash of the history tags, the history file is remapped when it changes
+ */
+uint32_t mb_history_layout_hash(void) {
+	uint32_t hash = 2166136261u;	// FNV-1a
+	for (int i = 0; i < mbTagCount; i++) {
+		if (mbReadTags[i].getHistorySlot() < 0) continue;
+		for (const char *p = mbReadTags[i].getTopic(); *p != 0; p++) {
+			hash ^= (uint8_t)*p;
+			hash *= 16777619u;
+		}
+		hash ^= 0xFF;		// topic separator
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/**
+ * initialize tag history (optional)
+ * @returns false for configuration error, otherwise true
+ */
+bool init_history(void) {
+	string fileName;
+	uint32_t *slotKeys;
+	int blocks = HISTORY_BLOCKS_DEFAULT;
+	int blockSize = HISTORY_BLOCK_SIZE_DEFAULT;
+	bool ok;
+
+	if (!cfg.lookupValue("history.file", fileName))
+		return true;		// history is not configured
+	if (historyTagCount < 1) {
+		log(LOG_WARNING, "History file configured but no tag has history enabled");
+		return true;
+	}
+	cfg.lookupValue("history.blocks", blocks);
+	cfg.lookupValue("history.blocksize", blockSize);
+	if ((blocks < 2) || (blockSize < 256)) {
+		log(LOG_ERR, "Config error - history blocks must be > 1 and blocksize >= 256");
+		return false;
+	}
+	slotKeys = new uint32_t[historyTagCount];
+	for (int i = 0; i < mbTagCount; i++)
+		if (mbReadTags[i].getHistorySlot() >= 0) slotKeys[mbReadTags[i].getHistorySlot()] = mb_history_key(&mbReadTags[i]);
+	ok = history.open(fileName.c_str(), historyTagCount, blocks, blockSize, mb_history_layout_hash(), slotKeys);
+	delete [] slotKeys;
+	if (!ok) {
+		log(LOG_ERR, "Unable to open history file <%s>", fileName.c_str());
+		return false;
+	}
+	mbCaptureTimestamps = true;		// samples are stored with the time of reading
+	log(LOG_INFO, "History <%s> %d tags, %d blocks of %d bytes per tag", fileName.c_str(), historyTagCount, blocks, blockSize);
+	return true;
+}
+
+/**
+ * process one queued history query
+ * @return true if a query has been processed
+ */
+bool history_query_process(void) {
+	static history_sample_t samples[HISTORY_QUERY_MAX];
+	history_query_t query;
+	ModbusTag *tag;
+	uint64_t next = 0;
+	string response;
+	char buf[64];
+	int n;
+
+	if (!historyQueries.pop(&query)) return false;
+	if (!history.isOpen()) return true;
+	tag = &mbReadTags[query.tagIndex];
+	n = history.query((uint32_t)tag->getHistorySlot(), query.from, query.to, samples, query.maxSamples, &next);
+	response.reserve(64 + strlen(tag->getTopic()) + (n * 32));
+	response = "{\"id\":\"";
+	response += query.id;
+	response += "\",\"topic\":\"";
+	response += tag->getTopic();
+	response += "\",\"samples\":[";
+	for (int i = 0; i < n; i++) {
+		if (isfinite(samples[i].value))
+			snprintf(buf, sizeof(buf), "%s[%llu,%.10g]", (i > 0) ? "," : "", (unsigned long long)samples[i].time, samples[i].value);
+		else
+			snprintf(buf, sizeof(buf), "%s[%llu,null]", (i > 0) ? "," : "", (unsigned long long)samples[i].time);
+		response += buf;
+	}
+	snprintf(buf, sizeof(buf), "],\"next\":%llu}", (unsigned long long)next);
+	response += buf;
+	if (mqtt.isConnected())
+		mqtt.publishPayload(historyResponseTopic.c_str(), response.c_str(), response.length(), false);
+	return true;
+}
+
+/**
+ * render metrics in Prometheus text exposition format
+ * runs in the metrics server thread, only reads atomic counters and
+ * snapshots; the mapped files (sampleBuffer, shmTable, history) are owned by
+ * the main thread and must not be accessed here
+ */
+void metrics_render(std::string &out, void *ctx) {
+	static const bus_counter_t errorCounters[] = { BUS_COUNTER_TIMEOUTS, BUS_COUNTER_EXCEPTIONS, BUS_COUNTER_CRC, BUS_COUNTER_ERRORS };
+	const Histogram *hist;
+	char labels[64];
+	int slaveId, f;
+
+	out.reserve(16384);
+	MetricsServer::appendHeader(out, "mbbridge_modbus_transactions_total", "counter", "Modbus transactions incl. failed ones");
+	for (slaveId = MODBUS_SLAVE_MIN; slaveId <= MODBUS_SLAVE_MAX; slaveId++) {
+		if (!busStats.isActive(slaveId)) continue;
+		snprintf(labels, sizeof(labels), "slave=\"%d\"", slaveId);
+		MetricsServer::appendValue(out, "mbbridge_modbus_transactions_total", labels, busStats.counter(slaveId, BUS_COUNTER_TRANSACTIONS));
+	}
+	MetricsServer::appendHeader(out, "mbbridge_modbus_errors_total", "counter", "Failed Modbus transactions by error type");
+	for (slaveId = MODBUS_SLAVE_MIN; slaveId <= MODBUS_SLAVE_MAX; slaveId++) {
+		if (!busStats.isActive(slaveId)) continue;
+		for (bus_counter_t counter : errorCounters) {
+			snprintf(labels, sizeof(labels), "slave=\"%d\",type=\"%s\"", slaveId, BusStats::counterName(counter));
+			MetricsServer::appendValue(out, "mbbridge_modbus_errors_total", labels, busStats.counter(slaveId, counter));
+		}
+	}
+	MetricsServer::appendHeader(out, "mbbridge_modbus_retries_total", "counter", "Repeated Modbus transactions");
+	for (slaveId = MODBUS_SLAVE_MIN; slaveId <= MODBUS_SLAVE_MAX; slaveId++) {
+		if (!busStats.isActive(slaveId)) continue;
+		snprintf(labels, sizeof(labels), "slave=\"%d\"", slaveId);
+		MetricsServer::appendValue(out, "mbbridge_modbus_retries_total", labels, busStats.counter(slaveId, BUS_COUNTER_RETRIES));
+	}
+	MetricsServer::appendHeader(out, "mbbridge_modbus_rtt_seconds", "summary", "Modbus round trip time of answered requests");
+	for (slaveId = MODBUS_SLAVE_MIN; slaveId <= MODBUS_SLAVE_MAX; slaveId++) {
+		if (!busStats.isActive(slaveId)) continue;
+		for (f = 0; f < BUSSTATS_FUNCTIONS; f++) {
+			hist = busStats.latency(slaveId, BusStats::functionCode(f));
+			if (hist == NULL) continue;
+			snprintf(labels, sizeof(labels), "slave=\"%d\",fc=\"%d\"", slaveId, BusStats::functionCode(f));
+			MetricsServer::appendSummary(out, "mbbridge_modbus_rtt_seconds", labels, *hist, 1e-6);
+		}
+	}
+	MetricsServer::appendHeader(out, "mbbridge_modbus_busy_seconds_total", "counter", "Time the bus was busy with transactions (rate = bus utilization)");
+	MetricsServer::appendValue(out, "mbbridge_modbus_busy_seconds_total", NULL, (double)busStats.busyTime() * 1e-6);
+	MetricsServer::appendHeader(out, "mbbridge_write_queue_depth", "gauge", "Queued Modbus write commands");
+	MetricsServer::appendValue(out, "mbbridge_write_queue_depth", NULL, writeScheduler.count());
+	MetricsServer::appendHeader(out, "mbbridge_read_request_queue_depth", "gauge", "Queued on-demand read requests");
+	MetricsServer::appendValue(out, "mbbridge_read_request_queue_depth", NULL, readRequests.count());
+	MetricsServer::appendHeader(out, "mbbridge_history_query_queue_depth", "gauge", "Queued history queries");
+	MetricsServer::appendValue(out, "mbbridge_history_query_queue_depth", NULL, historyQueries.count());
+	MetricsServer::appendHeader(out, "mbbridge_storeforward_samples", "gauge", "Samples in the store-and-forward buffer");
+	MetricsServer::appendValue(out, "mbbridge_storeforward_samples", NULL, storeForwardSamples);
+	MetricsServer::appendHeader(out, "mbbridge_mqtt_connected", "gauge", "MQTT broker connection status");
+	MetricsServer::appendValue(out, "mbbridge_mqtt_connected", NULL, mqtt.isConnected() ? 1 : 0);
+	MetricsServer::appendHeader(out, "mbbridge_mqtt_published_total", "counter", "Messages published to the broker");
+	MetricsServer::appendValue(out, "mbbridge_mqtt_published_total", NULL, mqtt.publishCount());
+	MetricsServer::appendHeader(out, "mbbridge_mqtt_publish_errors_total", "counter", "Messages which could not be published");
+	MetricsServer::appendValue(out, "mbbridge_mqtt_publish_errors_total", NULL, mqtt.publishErrorCount());
+	MetricsServer::appendHeader(out, "mbbridge_mqtt_inflight", "gauge", "Unacknowledged QoS>0 messages");
+	MetricsServer::appendValue(out, "mbbridge_mqtt_inflight", NULL, mqtt.inflightCount());
+	MetricsServer::appendHeader(out, "mbbridge_mqtt_pending", "gauge", "Messages waiting for space in the in-flight window");
+	MetricsServer::appendValue(out, "mbbridge_mqtt_pending", NULL, mqtt.pendingCount());
+	MetricsServer::appendHeader(out, "mbbridge_mqtt_dropped_total", "counter", "Superseded messages dropped while the in-flight window was full");
+	MetricsServer::appendValue(out, "mbbridge_mqtt_dropped_total", NULL, mqtt.droppedCount());
+	MetricsServer::appendHeader(out, "mbbridge_mqtt_ack_latency_seconds", "summary", "Publish to acknowledge latency");
+	MetricsServer::appendSummary(out, "mbbridge_mqtt_ack_latency_seconds", NULL, mqtt.ackLatency(), 1e-6);
+	MetricsServer::appendHeader(out, "mbbridge_loop_duration_seconds", "summary", "Duration of main loop passes which did work");
+	MetricsServer::appendSummary(out, "mbbridge_loop_duration_seconds", NULL, loopLatency, 1e-6);
+}
+
+/**
+ * start metrics endpoint if configured
+ * @return false on failure
+ */
+bool init_metrics(void) {
+	std::string listen;
+	if (!cfg.lookupValue("metrics.listen", listen)) return true;	// optional
+	if (!metricsServer.start(listen.c_str(), metrics_render, NULL)) {
+		log(LOG_ERR, "Metrics endpoint <%s> could not be started", listen.c_str());
+		return false;
+	}
+	log(LOG_INFO, "Metrics endpoint listening on <%s>", listen.c_str());
+	return true;
+}
+
+/**
+ * switch to virtual time if configured (soak tests with sim/mbsim -k)
+ * must be called before anything is scheduled
+ * @return false on failure
+ */
+bool init_clock(void) {
+	std::string name;
+	unsigned int start = 0;
+	int speed = CLOCK_SPEED_DEFAULT;
+	if (!cfg.lookupValue("clock.virtual", name)) return true;	// system clock
+	cfg.lookupValue("clock.start", start);
+	cfg.lookupValue("clock.speed", speed);
+	if (speed < 0) speed = 0;
+	if (!clock_virtual_attach(name.c_str(), true, (uint64_t)start * 1000000000ULL, (uint32_t)speed)) {
+		log(LOG_ERR, "Virtual clock <%s> could not be created: %s", name.c_str(), strerror(errno));
+		return false;
+	}
+	log(LOG_WARNING, "Using virtual clock <%s>, speed %d", name.c_str(), speed);
+	return true;
+}
+
+/**
+ * allocate transaction trace ring
+ * @return false on failure
+ */
+bool init_trace(void) {
+	int records = TRACE_RECORDS_DEFAULT;
+	cfg.lookupValue("trace.file", traceFile);
+	cfg.lookupValue("trace.records", records);
+	if (records <= 0) return true;	// disabled
+	if (!mbTrace.init((uint32_t)records)) {
+		log(LOG_ERR, "Transaction trace of %d records could not be allocated", records);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * dump transaction trace to file if requested
+ * @return true if the trace has been dumped
+ */
+bool trace_process(void) {
+	int n;
+	if (!traceDumpRequest) return false;
+	traceDumpRequest = false;
+	n = mbTrace.dump(traceFile.c_str(), clock_realtime_ns());
+	if (n < 0)
+		log(LOG_ERR, "Transaction trace dump to <%s> failed: %s", traceFile.c_str(), strerror(errno));
+	else
+		log(LOG_NOTICE, "Transaction trace: %d records dumped to <%s>", n, traceFile.c_str());
+	return true;
+}
+
+/**
+ * publish bus statistics of all slaves which have been addressed
+ * to statstopic/<slaveId> every statsinterval seconds
+ * @return true if statistics have been published
+ */
+bool bus_stats_process(void) {
+	char buf[1024];
+	string topic;
+	time_t now;
+	int len;
+
+	if (mbStatsTopic.empty()) return false;
+	now = clock_time();
+	if (now < mbStatsNextTime) return false;
+	mbStatsNextTime = now + mbStatsInterval;
+	if (!mqtt.isConnected()) return false;
+	for (int slaveId = MODBUS_SLAVE_MIN; slaveId <= MODBUS_SLAVE_MAX; slaveId++) {
+		if (!busStats.isActive(slaveId)) continue;
+		len = busStats.format(slaveId, buf, sizeof(buf));
+		if (len < 0) continue;
+		topic = mbStatsTopic + std::to_string(slaveId);
+		mqtt.publishPayload(topic.c_str(), buf, len, false);
+	}
+	return true;
+}
+
+#pragma mark Config reload
+
+/**
+ * capture timestamps only while a tag or a file uses them
+ * the config and the init functions only ever enable it
+ */
+void mb_capture_timestamps_update(void) {
+	mbCaptureTimestamps = sampleBuffer.isOpen() || shmTable.isOpen() || history.isOpen();
+	for (int i = 0; !mbCaptureTimestamps && (i < mbTagCount); i++)
+		if (mbReadTags[i].getPublishTimestamp()) mbCaptureTimestamps = true;
+}
+
+/**
+ * move the tag model out of the globals, the globals are left empty
+ */
+void mb_model_take(tagmodel *model) {
+	model->updateCycles = updateCycles;
+	model->updateCycleCount = updateCycleCount;
+	model->readTags = mbReadTags;
+	model->readTagCount = mbTagCount;
+	model->writeTags = mbWriteTags;
+	model->writeTagCount = mbWriteTagCount;
+	model->computedTags = computedTags;
+	model->computedTagCount = computedTagCount;
+	model->computePending = computePending;
+	model->historyTagCount = historyTagCount;
+	updateCycles = NULL;
+	updateCycleCount = 0;
+	mbReadTags = NULL;
+	mbTagCount = -1;
+	mbWriteTags = NULL;
+	mbWriteTagCount = 0;
+	computedTags = NULL;
+	computedTagCount = 0;
+	computePending = NULL;
+	historyTagCount = 0;
+}
+
+/**
+ * install a tag model in the globals
+ */
+void mb_model_put(const tagmodel *model) {
+	updateCycles = model->updateCycles;
+	updateCycleCount = model->updateCycleCount;
+	mbReadTags = model->readTags;
+	mbTagCount = model->readTagCount;
+	mbWriteTags = model->writeTags;
+	mbWriteTagCount = model->writeTagCount;
+	computedTags = model->computedTags;
+	computedTagCount = model->computedTagCount;
+	computePending = model->computePending;
+	historyTagCount = model->historyTagCount;
+}
+
+/**
+ * free the arrays of a tag model
+ */
+void mb_model_free(tagmodel *model) {
+	delete [] model->updateCycles;
+	delete [] model->readTags;
+	delete [] model->writeTags;
+	delete [] model->computedTags;
+	delete [] model->computePending;
+	model->updateCycles = NULL;
+	model->readTags = NULL;
+	model->writeTags = NULL;
+	model->computedTags = NULL;
+	model->computedTagCount = 0;
+	model->computePending = NULL;
+}
+
+/**
+ * identity of a read tag across a reload: topic and source of the value
+ * a tag with the same identity keeps its reading
+ */
+std::string mb_tag_identity(ModbusTag *tag) {
+	char buf[32];
+	if (tag->isComputed())
+		return tag->getTopicString() + "=" + tag->getExpression()->getSource();
+	snprintf(buf, sizeof(buf), "@%d:%u:%d", tag->getSlaveId(), tag->getRegisterAddress(), (int)tag->getValueType());
+	return tag->getTopicString() + buf;
+}
+
+/**
+ * Reload the config file (SIGHUP)
+ * The update cycles, read tags, computed tags and write tags are rebuilt
+ * from the file and replace the running model between two transactions.
+ * Tags with the same topic and source keep their value, noread state and
+ * aggregation window, cycles with the same ID and interval keep their
+ * schedule. The MQTT session, the serial port and the slave status are not
+ * touched. If the file cannot be parsed or the tag configuration is invalid
+ * the running model stays in use.
+ * Writes and history queries received during the reload are dropped, the
+ * MQTT thread is only blocked while the model is replaced.
+ * Settings outside of updatecycles, mbslaves and mqtt_tags require a restart.
+ * @return true if a reload has been processed
+ */
+bool reload_process(void) {
+	static const char *restartSettings[] = { "modbusrtu.device", "modbusrtu.baudrate", "mqtt.broker", "mqtt.port",
+		"sharedmemory.name", "storeforward.file", "history.file", NULL };
+	Config newCfg;
+	tagmodel running, loaded;
+	std::unordered_multimap<std::string, int> identities;	// tags of the running model, duplicates are possible
+	uint64_t sourceHash;
+	uint32_t layoutHash, historyHash;
+	int i, k, kept = 0, writeAdded = 0, writeRemoved = 0;
+	bool ok = true, bValue, clearRemoved = false, noreadRemoved = false;
+	const char *topic;
+	Tag *tp;
+
+	if (!reloadRequest.exchange(false)) return false;
+	log(LOG_INFO, "Reloading config file <%s>", cfgFileName.c_str());
+	sourceHash = config_cache_source_hash(cfgFileName.c_str(), build_date_str);
+	try {
+		newCfg.readFile(cfgFileName.c_str());
+	} catch (const FileIOException &fioex) {
+		log(LOG_ERR, "Reload failed, I/O error while reading file <%s>", cfgFileName.c_str());
+		return true;
+	} catch (const ParseException &pex) {
+		log(LOG_ERR, "Reload failed, parse error at %s:%d - %s", pex.getFile(), pex.getLine(), pex.getError());
+		return true;
+	}
+	for (i = 0; restartSettings[i] != NULL; i++) {
+		if (cfg_setting_changed(newCfg, restartSettings[i]))
+			log(LOG_WARNING, "Config setting <%s> changed, restart required to apply", restartSettings[i]);
+	}
+
+	// queued writes and history queries refer to indexes of the running model,
+	// no new ones are queued and the queued ones are completed before the swap
+	tagModelReload = true;
+	{
+		std::lock_guard<std::mutex> barrier(tagModelMutex);	// a callback which is queueing has finished
+	}
+	while (modbus_write_process());
+	while (history_query_process());
+	mb_compute_process();
+	// the MQTT thread resolves topics to tag indexes, it waits only for the swap
+	std::unique_lock<std::mutex> lock(tagModelMutex);
+
+	layoutHash = mb_tag_layout_hash();
+	historyHash = mb_history_layout_hash();
+	mb_model_take(&running);
+	if (newCfg.exists("mqtt_tags"))
+		ok = mb_config_writetags(newCfg.lookup("mqtt_tags"));
+	if (ok && (mb_ctx != NULL))
+		ok = mb_config(newCfg);
+	// buffered samples refer to indexes of the running model
+	if (ok && sampleBuffer.isOpen() && (sampleBuffer.count() > 0) && (mb_tag_layout_hash() != layoutHash)) {
+		log(LOG_ERR, "Reload failed, read tags added or removed while %d samples are buffered", sampleBuffer.count());
+		ok = false;
+	}
+	if (!ok) {
+		mb_model_take(&loaded);
+		mb_model_free(&loaded);
+		mb_model_put(&running);
+		lock.unlock();
+		tagModelReload = false;
+		mb_capture_timestamps_update();
+		log(LOG_ERR, "Config file not reloaded, running configuration unchanged");
+		return true;
+	}
+
+	// carry over state of unchanged read tags, each running tag to one new tag
+	for (i = 0; i < running.readTagCount; i++)
+		identities.emplace(mb_tag_identity(&running.readTags[i]), i);
+	for (i = 0; i < mbTagCount; i++) {
+		auto it = identities.find(mb_tag_identity(&mbReadTags[i]));
+		if (it == identities.end()) {
+			// evaluate a new computed tag with the current inputs
+			if (mbReadTags[i].isComputed()) {
+				computePending[i] = true;
+				computeRequired = true;
+			}
+			continue;
+		}
+		mbReadTags[i].copyState(&running.readTags[it->second]);
+		identities.erase(it);
+		kept++;
+	}
+	// remaining identities are removed tags, treated like on exit
+	if (newCfg.lookupValue("mqtt.clearonexit", bValue))
+		clearRemoved = bValue;
+	if (newCfg.lookupValue("mqtt.noreadonexit", bValue))
+		noreadRemoved = bValue;
+	if (clearRemoved || noreadRemoved) {
+		for (auto &it : identities) {
+			if (running.readTags[it.second].getTopicString().empty()) continue;
+			mqtt_clear_tag(&running.readTags[it.second], noreadRemoved, clearRemoved);
+		}
+	}
+	for (i = 0; i < updateCycleCount; i++) {
+		for (k = 0; k < running.updateCycleCount; k++) {
+			if ((updateCycles[i].ident == running.updateCycles[k].ident) && (updateCycles[i].interval == running.updateCycles[k].interval)) {
+				updateCycles[i].nextUpdateTime = running.updateCycles[k].nextUpdateTime;
+				break;
+			}
+		}
+	}
+	if (mb_ctx != NULL) mb_assign_updatecycles();
+
+	// subscriptions of write tags, a topic which is still configured stays subscribed
+	for (i = 0; i < running.writeTagCount; i++) {
+		topic = running.writeTags[i].getTopic();
+		if (*topic == 0) continue;
+		for (k = 0; k < mbWriteTagCount; k++)
+			if (strcmp(mbWriteTags[k].getTopic(), topic) == 0) break;
+		if (k < mbWriteTagCount) continue;
+		if (mqtt.isConnected()) mqtt.unsubscribe(topic);
+		ts.deleteTag(topic);
+		writeRemoved++;
+	}
+	for (i = 0; i < mbWriteTagCount; i++) {
+		topic = mbWriteTags[i].getTopic();
+		if (*topic == 0) continue;
+		tp = ts.getTag(topic);
+		if (tp == NULL) {
+			tp = ts.addTag(topic);
+			if (tp == NULL) {
+				log(LOG_ERR, "Tag store full, write tag <%s> ignored", topic);
+				continue;
+			}
+			tp->setSubscribe();
+			if (mqtt.isConnected()) mqtt.subscribe(topic);
+			writeAdded++;
+		}
+		tp->registerCallback(mb_write_request, i);
+	}
+	mb_index_writetags();
+	lock.unlock();
+	tagModelReload = false;
+
+	// slaves without tags are no longer polled
+	for (i = MODBUS_SLAVE_MIN; i <= MODBUS_SLAVE_MAX; i++) {
+		if (mbSlaveOnline[i] && (mbSlaveReadIndex.size(i) == 0) && (mbSlaveWriteIndex.size(i) == 0))
+			mb_slave_set_online_status(i, false);
+	}
+
+	// files and tables indexed by tag position follow the new layout
+	try {
+		cfg.readFile(cfgFileName.c_str());
+	} catch (const ConfigException &excp) {
+		log(LOG_ERR, "Reload - config file <%s> changed while reloading", cfgFileName.c_str());
+	}
+	cfgSourceHash = sourceHash;
+	if (mb_ctx != NULL) mb_config_cache_save(sourceHash);
+	// the metrics thread only reads storeForwardSamples, the files can be reopened here
+	if (mb_tag_layout_hash() != layoutHash) {
+		if (shmTable.isOpen()) {
+			shmTable.close();
+			init_shmtable();
+			for (i = 0; i < mbTagCount; i++)
+				if (mbReadTags[i].getLastUpdateTime() != 0) shm_update_tag(&mbReadTags[i]);
+		}
+		if (sampleBuffer.isOpen()) {
+			sampleBuffer.close();
+			storeForwardSamples = 0;
+			init_storeforward();
+		}
+	}
+	if (history.isOpen() && (mb_history_layout_hash() != historyHash)) {
+		log(LOG_INFO, "History tags changed, history of unchanged tags is kept");
+		history.close();
+		init_history();
+	}
+	mb_capture_timestamps_update();
+
+	log(LOG_INFO, "Config file reloaded: %d read tags (%d kept, %d added, %d removed), %d write tags (%d added, %d removed), %d update cycles",
+		(mbTagCount > 0) ? mbTagCount : 0, kept, ((mbTagCount > 0) ? mbTagCount : 0) - kept, (int)identities.size(),
+		mbWriteTagCount, writeAdded, writeRemoved, updateCycleCount);
+	mb_model_free(&running);
+	return true;
+}
+
 #pragma mark Loops
 
 /** 
@@ -1385,6 +2789,8 @@ void exit_loop(void)
 		}
 	}
 	
+	metricsServer.stop();
+
 	// close modbus device
 	if (mb_ctx != NULL) {
 		modbus_close(mb_ctx);
@@ -1412,29 +2818,32 @@ void exit_loop(void)
 	mqtt.disconnect();
 	for (i=0; i < 50; i++) {	// wait up to 5s for MQTT disconnect
 		if (!mqtt_connection_active) break;
-		usleep(100000);
+		usleep(100000);		// real time, waits for the MQTT thread
 	}
 	if ((debugEnabled) && (mqtt_connection_active))
 		cout << "MQTT disconnect failed (waited for 5s)" << endl << flush;
 		
 	// free allocated memory
-	// arrays of tags in cycleupdates
-	int *ar, idx=0;
 	if (debugEnabled)
-		cout << "Deleting tag arrays ..." << endl << flush;
-	while (updateCycles[idx].ident >= 0) {
-		ar = updateCycles[idx].tagArray;
-		if (ar != NULL) delete [] ar;		// delete array if one exists
-		idx++;
-	}
+		cout << "Deleting tag indexes ..." << endl << flush;
+	mbCycleIndex.release();
+	mbSlaveReadIndex.release();
+	mbSlaveWriteIndex.release();
 	if (debugEnabled)
 		cout << "Deleting updateCycles" << endl << flush;
 	delete [] updateCycles;
 	if (debugEnabled)
 		cout << "Deleting mbWriteTags" << endl << flush;
 	delete [] mbWriteTags;
+	if (computedTags != NULL) delete [] computedTags;
+	computedTagCount = 0;
+	if (computePending != NULL) delete [] computePending;
+	sampleBuffer.close();
+	shmTable.close();
+	history.close();
 	if (debugEnabled)
 		cout << "Deleting mbReadTags" << endl << flush;
+	mbTagTable.release();
 	delete [] mbReadTags;
 }
 
@@ -1444,7 +2853,7 @@ void main_loop()
 {
 	bool processing_success = false;
 	//clock_t start, end;
-	struct timespec starttime, endtime, difftime;
+	uint64_t starttime;
 	useconds_t sleep_usec;
 	//double delta_time;
 	useconds_t processing_time;
@@ -1454,15 +2863,14 @@ void main_loop()
 	// first call takes a long time (10ms)
 	while (!exitSignal) {
 	// run processing and record start/stop time
-		clock_gettime(CLOCK_MONOTONIC, &starttime);
+		starttime = clock_monotonic_us();
 		processing_success = process();
-		clock_gettime(CLOCK_MONOTONIC, &endtime);
 		// calculate cpu time used [us]
-		timespec_diff(&starttime, &endtime, &difftime);
-		processing_time = (difftime.tv_nsec / 1000) + (difftime.tv_sec * 1000000);
+		processing_time = (useconds_t)(clock_monotonic_us() - starttime);
 
 		// store min/max times if any processing was done
 		if (processing_success) {
+			loopLatency.record(processing_time);
 			// calculate cpu time used [us]
 			if (debugEnabled)
 				printf("%s - process() took %dus\n", __func__, processing_time);
@@ -1480,18 +2888,32 @@ void main_loop()
 		if (interval > processing_time) {
 			sleep_usec = interval - processing_time;  // sleep time in us
 			//printf("%s - sleeping for %dus (%dus)\n", __func__, sleep_usec, processing_time);
-			usleep(sleep_usec);
+			clock_sleep_us(sleep_usec);
 		}
 
 		if (mqtt_next_connect_time > 0) {
- 			if (time(NULL) >= mqtt_next_connect_time) {
+ 			if (clock_time() >= mqtt_next_connect_time) {
  				mqtt_connect();
  			}
 		}
 
 	}
-	if (!runningAsDaemon)
+	if (!runningAsDaemon) {
 		printf("CPU time for variable processing: %dus - %dus\n", min_time, max_time);
+		const Histogram &ackLatency = mqtt.ackLatency();
+		if (ackLatency.count() > 0) {
+			printf("MQTT ack latency: %llu acks, p50 %lluus p99 %lluus max %lluus, %llu superseded values dropped\n",
+				(unsigned long long)ackLatency.count(), (unsigned long long)ackLatency.percentile(50.0),
+				(unsigned long long)ackLatency.percentile(99.0), (unsigned long long)ackLatency.max(),
+				(unsigned long long)mqtt.droppedCount());
+		}
+		for (int slaveId = MODBUS_SLAVE_MIN; slaveId <= MODBUS_SLAVE_MAX; slaveId++) {
+			char buf[1024];
+			if (!busStats.isActive(slaveId)) continue;
+			if (busStats.format(slaveId, buf, sizeof(buf)) > 0)
+				printf("Modbus slave %d: %s\n", slaveId, buf);
+		}
+	}
 }
 
 /** Display program usage instructions.
@@ -1561,7 +2983,8 @@ int main (int argc, char *argv[])
 	log(LOG_INFO,"Version %d.%02d [%s] ", version_major, version_minor, build_date_str);
 
 	signal (SIGINT, sigHandler);
-	//signal (SIGHUP, sigHandler);
+	signal (SIGUSR1, sigHandler);
+	signal (SIGHUP, sigHandler);
 
 	// catch SIGTERM only if running as daemon (started via systemctl)
 	// when run from command line SIGTERM provides a last resort method
@@ -1576,10 +2999,16 @@ int main (int argc, char *argv[])
 		goto exit_fail;
 	}
 
+	if (!init_clock()) goto exit_fail;
 	if (!init_tags()) goto exit_fail;
 	if (!mqtt_init()) goto exit_fail;
 	if (!init_values()) goto exit_fail;
 	if (!init_modbus()) goto exit_fail;
+	if (!init_storeforward()) goto exit_fail;
+	if (!init_shmtable()) goto exit_fail;
+	if (!init_history()) goto exit_fail;
+	if (!init_trace()) goto exit_fail;
+	if (!init_metrics()) goto exit_fail;
 	usleep(100000);
 	main_loop();
 
@@ -11,10 +11,26 @@
 struct updatecycle {
 	int	ident;
 	int interval;	// seconds
-	int *tagArray = NULL;
+	const int *tagArray = NULL;		// indexes of tags in this cycle (tagArraySize entries)
 	int tagArraySize = 0;
 	time_t nextUpdateTime;			// next update time 
 };
 
+class ModbusTag;
+
+// arrays built from the config file, replaced as a whole on reload
+struct tagmodel {
+	updatecycle *updateCycles;
+	int updateCycleCount;
+	ModbusTag *readTags;
+	int readTagCount;
+	ModbusTag *writeTags;
+	int writeTagCount;
+	int *computedTags;
+	int computedTagCount;
+	bool *computePending;
+	int historyTagCount;
+};
+
 
 #endif /* MBBRIDGE_H */
@@ -0,0 +1,257 @@
+/**
+ * @file metrics.cpp
+ *
+ */
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "metrics.h"
+
+/*********************
+ *      DEFINES
+ *********************/
+#define METRICS_POLL_MS 500				// interval to check for stop request
+#define METRICS_IO_TIMEOUT_S 2			// max time for request / response
+#define METRICS_REQUEST_MAX 2048		// max size of request header
+
+/*********************
+ * MEMBER FUNCTIONS
+ *********************/
+
+//
+// Class MetricsServer
+//
+
+MetricsServer::MetricsServer() {
+	_fd = -1;
+	_running = false;
+	_requestCount = 0;
+	_render = NULL;
+	_ctx = NULL;
+}
+
+MetricsServer::~MetricsServer() {
+	stop();
+}
+
+bool MetricsServer::start(const char *listen, metrics_render_t render, void *ctx) {
+	bool ok;
+	if (_running || (listen == NULL) || (render == NULL)) return false;
+	_render = render;
+	_ctx = ctx;
+	if (listen[0] == '/')
+		ok = _listenUnix(listen);
+	else
+		ok = _listenTcp(listen);
+	if (!ok) return false;
+	_running = true;
+	_thread = std::thread(&MetricsServer::_serve, this);
+	return true;
+}
+
+void MetricsServer::stop(void) {
+	if (_running) {
+		_running = false;
+		if (_thread.joinable()) _thread.join();
+	}
+	if (_fd >= 0) {
+		::close(_fd);
+		_fd = -1;
+	}
+	if (!_unixPath.empty()) {
+		unlink(_unixPath.c_str());
+		_unixPath.clear();
+	}
+}
+
+bool MetricsServer::isRunning(void) {
+	return _running;
+}
+
+uint64_t MetricsServer::requestCount(void) {
+	return _requestCount;
+}
+
+bool MetricsServer::_listenTcp(const char *address) {
+	struct addrinfo hints, *res, *ai;
+	std::string host = address;
+	std::string port;
+	size_t colon = host.rfind(':');
+	int on = 1;
+
+	if (colon == std::string::npos) {
+		fprintf(stderr, "%s: invalid listen address <%s>, host:port expected\n", __func__, address);
+		return false;
+	}
+	port = host.substr(colon + 1);
+	host = host.substr(0, colon);
+	// [::1]:9102
+	if ((host.size() >= 2) && (host.front() == '[') && (host.back() == ']'))
+		host = host.substr(1, host.size() - 2);
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	if (getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(), &hints, &res) != 0) {
+		fprintf(stderr, "%s: can't resolve <%s>\n", __func__, address);
+		return false;
+	}
+	for (ai = res; ai != NULL; ai = ai->ai_next) {
+		_fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+		if (_fd < 0) continue;
+		setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if ((bind(_fd, ai->ai_addr, ai->ai_addrlen) == 0) && (::listen(_fd, 4) == 0)) break;
+		::close(_fd);
+		_fd = -1;
+	}
+	freeaddrinfo(res);
+	if (_fd < 0) {
+		fprintf(stderr, "%s: can't listen on <%s>: %s\n", __func__, address, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+bool MetricsServer::_listenUnix(const char *path) {
+	struct sockaddr_un addr;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "%s: socket path too long <%s>\n", __func__, path);
+		return false;
+	}
+	_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (_fd < 0) {
+		fprintf(stderr, "%s: socket failed: %s\n", __func__, strerror(errno));
+		return false;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);		// stale socket of a previous run
+	if ((bind(_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) || (::listen(_fd, 4) != 0)) {
+		fprintf(stderr, "%s: can't listen on <%s>: %s\n", __func__, path, strerror(errno));
+		::close(_fd);
+		_fd = -1;
+		return false;
+	}
+	_unixPath = path;
+	return true;
+}
+
+void MetricsServer::_serve(void) {
+	struct pollfd pfd;
+	int client;
+
+	pfd.fd = _fd;
+	pfd.events = POLLIN;
+	while (_running) {
+		pfd.revents = 0;
+		if (poll(&pfd, 1, METRICS_POLL_MS) <= 0) continue;
+		client = accept4(_fd, NULL, NULL, SOCK_CLOEXEC);
+		if (client < 0) continue;
+		_handle(client);
+		::close(client);
+	}
+}
+
+void MetricsServer::_handle(int fd) {
+	char request[METRICS_REQUEST_MAX];
+	char header[160];
+	struct timeval tv;
+	std::string body;
+	const char *status = "200 OK";
+	size_t len = 0, sent;
+	ssize_t n;
+	int headerLen;
+
+	tv.tv_sec = METRICS_IO_TIMEOUT_S;
+	tv.tv_usec = 0;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	// read request header
+	while (len < sizeof(request) - 1) {
+		n = recv(fd, request + len, sizeof(request) - 1 - len, 0);
+		if (n <= 0) return;
+		len += n;
+		request[len] = 0;
+		if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) break;
+	}
+	request[len] = 0;
+	if (strncmp(request, "GET ", 4) != 0) {
+		status = "405 Method Not Allowed";
+	} else if ((strncmp(request + 4, "/metrics", 8) == 0) && strchr(" ?", request[12])) {
+		_render(body, _ctx);
+	} else if (strncmp(request + 4, "/ ", 2) == 0) {
+		body = "<html><body><a href=\"/metrics\">Metrics</a></body></html>\n";
+	} else {
+		status = "404 Not Found";
+	}
+	_requestCount++;
+	headerLen = snprintf(header, sizeof(header),
+		"HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+		status, (body.compare(0, 6, "<html>") == 0) ? "text/html" : "text/plain; version=0.0.4; charset=utf-8", body.size());
+	if (send(fd, header, headerLen, MSG_NOSIGNAL) != headerLen) return;
+	for (sent = 0; sent < body.size(); sent += n) {
+		n = send(fd, body.data() + sent, body.size() - sent, MSG_NOSIGNAL);
+		if (n <= 0) return;
+	}
+}
+
+void MetricsServer::appendHeader(std::string &out, const char *name, const char *type, const char *help) {
+	out += "# HELP ";
+	out += name;
+	out += ' ';
+	out += help;
+	out += "\n# TYPE ";
+	out += name;
+	out += ' ';
+	out += type;
+	out += '\n';
+}
+
+void MetricsServer::appendValue(std::string &out, const char *name, const char *labels, double value) {
+	char buf[32];
+	out += name;
+	if ((labels != NULL) && (labels[0] != 0)) {
+		out += '{';
+		out += labels;
+		out += '}';
+	}
+	snprintf(buf, sizeof(buf), " %.10g\n", value);
+	out += buf;
+}
+
+void MetricsServer::appendSummary(std::string &out, const char *name, const char *labels, const Histogram &hist, double scale) {
+	static const char *quantiles[] = { "0.5", "0.9", "0.99" };
+	static const double percentiles[] = { 50.0, 90.0, 99.0 };
+	std::string metric;
+	std::string ql;
+	bool hasLabels = (labels != NULL) && (labels[0] != 0);
+
+	for (int i = 0; i < 3; i++) {
+		ql = hasLabels ? labels : "";
+		if (hasLabels) ql += ',';
+		ql += "quantile=\"";
+		ql += quantiles[i];
+		ql += '"';
+		appendValue(out, name, ql.c_str(), (double)hist.percentile(percentiles[i]) * scale);
+	}
+	metric = name;
+	metric += "_sum";
+	appendValue(out, metric.c_str(), labels, (double)hist.sum() * scale);
+	metric = name;
+	metric += "_count";
+	appendValue(out, metric.c_str(), labels, (double)hist.count());
+}
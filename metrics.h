@@ -0,0 +1,104 @@
+/**
+ * @file metrics.h
+
+-----------------------------------------------------------------------------
+ Class "MetricsServer" serves bridge metrics in Prometheus text exposition
+ format (version 0.0.4) over HTTP.
+
+ The server listens on a TCP address (e.g. "127.0.0.1:9102") or a Unix
+ domain socket (path starting with '/') and runs in its own thread.
+ Every request calls the render function which builds the response from
+ in-process counters, the bus thread is never blocked by a scrape.
+ Requests are handled one at a time, the server is meant for a local
+ scraper (node_exporter, Prometheus, curl), not for public access.
+-----------------------------------------------------------------------------
+*/
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "histogram.h"
+
+/**********************
+ *      TYPEDEFS
+ **********************/
+
+/**
+ * Render metrics
+ * @param out: append metrics in text exposition format
+ * @param ctx: context pointer passed to start()
+ */
+typedef void (*metrics_render_t)(std::string &out, void *ctx);
+
+class MetricsServer {
+public:
+	MetricsServer();
+	~MetricsServer();
+
+	/**
+	 * Start listening and serving requests
+	 * @param listen: "host:port" or path of Unix domain socket
+	 * @param render: function to render the metrics
+	 * @param ctx: passed to render
+	 * @return false on failure
+	 */
+	bool start(const char *listen, metrics_render_t render, void *ctx);
+
+	/**
+	 * Stop server thread and close socket
+	 */
+	void stop(void);
+
+	/**
+	 * @return true if the server is running
+	 */
+	bool isRunning(void);
+
+	/**
+	 * @return number of requests served
+	 */
+	uint64_t requestCount(void);
+
+	/**
+	 * Append HELP and TYPE lines of a metric
+	 * @param type: "counter", "gauge" or "summary"
+	 */
+	static void appendHeader(std::string &out, const char *name, const char *type, const char *help);
+
+	/**
+	 * Append sample
+	 * @param labels: label list without braces (e.g. "slave=\"10\""), NULL or "" for none
+	 */
+	static void appendValue(std::string &out, const char *name, const char *labels, double value);
+
+	/**
+	 * Append histogram as summary (quantiles 0.5, 0.9, 0.99, sum and count)
+	 * @param scale: factor to convert recorded values to the metric's unit (e.g. 1e-6 for us -> s)
+	 */
+	static void appendSummary(std::string &out, const char *name, const char *labels, const Histogram &hist, double scale);
+
+private:
+	bool _listenTcp(const char *address);
+	bool _listenUnix(const char *path);
+	void _serve(void);
+	void _handle(int fd);
+
+	int _fd;						// listening socket
+	std::string _unixPath;			// removed on stop
+	std::thread _thread;
+	std::atomic<bool> _running;
+	std::atomic<uint64_t> _requestCount;
+	metrics_render_t _render;
+	void *_ctx;
+};
+
+#endif /* _METRICS_H_ */
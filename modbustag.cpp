@@ -15,9 +15,11 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
 #include <time.h>
 #include <unistd.h>
 #include "modbustag.h"
+#include "clock.h"
 
 #include <stdexcept>
 #include <iostream>
@@ -31,6 +33,16 @@ using namespace std;
  * GLOBAL FUNCTIONS
  *********************/
 
+bool mb_value_type_from_string(const char *name, mb_value_type_t *type) {
+	if (name == NULL) return false;
+	if (strcmp(name, "uint16") == 0) *type = MB_VALUE_UINT16;
+	else if (strcmp(name, "int16") == 0) *type = MB_VALUE_INT16;
+	else if (strcmp(name, "uint32") == 0) *type = MB_VALUE_UINT32;
+	else if (strcmp(name, "int32") == 0) *type = MB_VALUE_INT32;
+	else if (strcmp(name, "float32") == 0) *type = MB_VALUE_FLOAT32;
+	else return false;
+	return true;
+}
 
 /*********************
  * MEMBER FUNCTIONS
@@ -55,10 +67,25 @@ ModbusTag::ModbusTag() {
 	this->_noreadcount = 0;
 	this->_publish_retain = false;
 	this->_writePending = false;
+	this->_writePriority = 0;
+	this->_writeDeadline = 0;
+	this->_writeArrival = 0;
+	this->_readback = false;
 	this->_writefailedcount = 0;
 	this->_ignoreRetained = false;
 	this->_dataType = 'r';
-	this->_referenceTime = 0;
+	this->_updatecycle_id = 0;
+	this->_lastUpdateTime = 0;
+	this->_timestamp = 0;
+	this->_valueType = MB_VALUE_UINT16;
+	this->_encoding = PAYLOAD_TEXT;
+	this->_publishTimestamp = false;
+	this->_messageExpiry = 0;
+	this->_qos = 0;
+	this->_historySlot = -1;
+	this->_aggregateWindow = 0;
+	this->_expression = NULL;
+	this->_computedValue = 0.0;
 	//printf("%s - constructor %d %s\\", __func__, this->_slaveId, this->_topic.c_str());
 	//throw runtime_error("Class Tag - forbidden constructor");
 }
@@ -66,9 +93,11 @@ ModbusTag::ModbusTag() {
 ModbusTag::ModbusTag(const uint16_t addr) {
 	this->_address = addr;
 	this->_rawValue = 0;
+	this->_expression = NULL;
 }
 
 ModbusTag::~ModbusTag() {
+	if (_expression != NULL) delete _expression;
 	//cout << "Topic: <" << topic << ">" << endl;
 	//printf("%s - destructor %d\n", __func__, address);
 }
@@ -146,6 +175,49 @@ std::string ModbusTag::getTopicString(void) {
 	return _topic;
 }
 
+void ModbusTag::setName(const char *nameStr) {
+	if (nameStr != NULL) {
+		_name = nameStr;
+	}
+}
+
+const char* ModbusTag::getName(void) {
+	return _name.c_str();
+}
+
+void ModbusTag::setExpression(Expression *expression) {
+	if (_expression != NULL) delete _expression;
+	_expression = expression;
+}
+
+Expression* ModbusTag::getExpression(void) {
+	return _expression;
+}
+
+bool ModbusTag::isComputed(void) {
+	return (_expression != NULL);
+}
+
+void ModbusTag::setComputedValue(double newValue) {
+	_computedValue = newValue;
+	_lastUpdateTime = clock_time();
+	_noreadcount = 0;
+}
+
+void ModbusTag::addDependent(int tagIndex) {
+	for (size_t i = 0; i < _dependents.size(); i++)
+		if (_dependents[i] == tagIndex) return;
+	_dependents.push_back(tagIndex);
+}
+
+int ModbusTag::getDependentCount(void) {
+	return (int) _dependents.size();
+}
+
+int ModbusTag::getDependent(int index) {
+	return _dependents[index];
+}
+
 void ModbusTag::setPublishRetain(bool newRetain) {
     _publish_retain = newRetain;
 }
@@ -184,11 +256,79 @@ void ModbusTag::setRawValue(uint16_t uintValue) {
 			else _rawValue = 0;
 			break;
 	}
-	_lastUpdateTime = time(NULL);
+	_lastUpdateTime = clock_time();
 	_noreadcount = 0;
 }
 
-uint16_t ModbusTag::getRawValue(void) {
+void ModbusTag::setRegisters(const uint16_t *registers) {
+	if (getRegisterCount() == 1) {
+		setRawValue(registers[0]);
+		return;
+	}
+	_rawValue = ((uint32_t)registers[0] << 16) | registers[1];
+	_lastUpdateTime = clock_time();
+	_noreadcount = 0;
+}
+
+bool ModbusTag::setWriteValue(const typed_value_t *value) {
+	double dValue;
+	int64_t iValue;
+	float fValue;
+	uint32_t bits;
+	bool scaled = (_multiplier != 1.0) || (_offset != 0.0);
+
+	if (value->type == VALUE_TYPE_NONE) return false;
+	// coils and single bit tags
+	if (isSingleBit() || (_dataType == 'i') || (_dataType == 'q')) {
+		setRawValue(typed_value_as_double(value) != 0.0 ? 1 : 0);
+		return true;
+	}
+	dValue = typed_value_as_double(value);
+	if (scaled) {
+		if (_multiplier == 0.0) return false;
+		dValue = (dValue - _offset) / _multiplier;
+	}
+	if (_valueType == MB_VALUE_FLOAT32) {
+		fValue = (float) dValue;
+		memcpy(&bits, &fValue, sizeof(bits));
+		_rawValue = bits;
+		_lastUpdateTime = clock_time();
+		return true;
+	}
+	// integer register types, use the integer directly if not scaled
+	if (!scaled && (value->type == VALUE_TYPE_INT)) {
+		iValue = value->i;
+	} else if (!scaled && (value->type == VALUE_TYPE_UINT)) {
+		if (value->u > (uint64_t)INT64_MAX) return false;
+		iValue = (int64_t) value->u;
+	} else if (!scaled && (value->type == VALUE_TYPE_BOOL)) {
+		iValue = value->b ? 1 : 0;
+	} else {
+		if ((dValue != dValue) || (dValue < -9.2e18) || (dValue > 9.2e18)) return false;
+		iValue = llround(dValue);
+	}
+	// range check, signed and unsigned representation of the register(s) are accepted
+	if (getRegisterCount() == 1) {
+		if ((iValue < INT16_MIN) || (iValue > UINT16_MAX)) return false;
+		_rawValue = (uint16_t) iValue;
+	} else {
+		if ((iValue < INT32_MIN) || (iValue > UINT32_MAX)) return false;
+		_rawValue = (uint32_t) iValue;
+	}
+	_lastUpdateTime = clock_time();
+	return true;
+}
+
+void ModbusTag::getRegisters(uint16_t *registers) {
+	if (getRegisterCount() == 1) {
+		registers[0] = (uint16_t) _rawValue;
+		return;
+	}
+	registers[0] = (uint16_t) (_rawValue >> 16);	// high word first
+	registers[1] = (uint16_t) _rawValue;
+}
+
+uint32_t ModbusTag::getRawValue(void) {
 	return _rawValue;
 }
 
@@ -199,20 +339,176 @@ uint16_t ModbusTag::getBoolValue(void) {
 		return true;
 }
 
-float ModbusTag::getScaledValue(void) {
-	float fValue = (float) _rawValue;
-	fValue *= _multiplier;
-	return fValue + _offset;
+double ModbusTag::getScaledValue(void) {
+	double dValue;
+	float fValue;
+	if (_expression != NULL) return (_computedValue * _multiplier) + _offset;
+	switch (_valueType) {
+	case MB_VALUE_INT16:
+		dValue = (int16_t) _rawValue;
+		break;
+	case MB_VALUE_INT32:
+		dValue = (int32_t) _rawValue;
+		break;
+	case MB_VALUE_FLOAT32:
+		memcpy(&fValue, &_rawValue, sizeof(fValue));
+		dValue = fValue;
+		break;
+	default:
+		dValue = _rawValue;
+		break;
+	}
+	return (dValue * _multiplier) + _offset;
+}
+
+typed_value_t ModbusTag::getTypedValue(void) {
+	typed_value_t value;
+	// scaled values, floats and computed values are published as floating point
+	if ( (_multiplier != 1.0) || (_offset != 0.0) || (_valueType == MB_VALUE_FLOAT32) || (_expression != NULL) ) {
+		value.type = VALUE_TYPE_FLOAT;
+		value.f = getScaledValue();
+		return value;
+	}
+	if (isSingleBit() || (_dataType == 'i') || (_dataType == 'q')) {
+		value.type = VALUE_TYPE_BOOL;
+		value.b = (_rawValue != 0);
+		return value;
+	}
+	switch (_valueType) {
+	case MB_VALUE_INT16:
+		value.type = VALUE_TYPE_INT;
+		value.i = (int16_t) _rawValue;
+		break;
+	case MB_VALUE_INT32:
+		value.type = VALUE_TYPE_INT;
+		value.i = (int32_t) _rawValue;
+		break;
+	default:
+		value.type = VALUE_TYPE_UINT;
+		value.u = _rawValue;
+		break;
+	}
+	return value;
+}
+
+bool ModbusTag::setValueType(const char *typeName) {
+	return mb_value_type_from_string(typeName, &_valueType);
+}
+
+void ModbusTag::setValueType(mb_value_type_t newType) {
+	_valueType = newType;
+}
+
+mb_value_type_t ModbusTag::getValueType(void) {
+	return _valueType;
+}
+
+int ModbusTag::getRegisterCount(void) {
+	switch (_valueType) {
+	case MB_VALUE_UINT32:
+	case MB_VALUE_INT32:
+	case MB_VALUE_FLOAT32:
+		if (!isSingleBit()) return 2;
+		break;
+	default:
+		break;
+	}
+	return 1;
+}
+
+time_t ModbusTag::getLastUpdateTime(void) {
+	return _lastUpdateTime;
+}
+
+void ModbusTag::setTimestamp(uint64_t newValue) {
+	_timestamp = newValue;
+}
+
+uint64_t ModbusTag::getTimestamp(void) {
+	return _timestamp;
+}
+
+void ModbusTag::setEncoding(payload_encoding_t newEncoding) {
+	_encoding = newEncoding;
+}
+
+payload_encoding_t ModbusTag::getEncoding(void) {
+	return _encoding;
+}
+
+void ModbusTag::setPublishTimestamp(bool newValue) {
+	_publishTimestamp = newValue;
+}
+
+bool ModbusTag::getPublishTimestamp(void) {
+	return _publishTimestamp;
+}
+
+void ModbusTag::setMessageExpiry(uint32_t newValue) {
+	_messageExpiry = newValue;
+}
+
+uint32_t ModbusTag::getMessageExpiry(void) {
+	return _messageExpiry;
+}
+
+void ModbusTag::setQos(int newValue) {
+	if ((newValue >= 0) && (newValue <= 2))
+		_qos = newValue;
+}
+
+int ModbusTag::getQos(void) {
+	return _qos;
+}
+
+void ModbusTag::setHistorySlot(int newValue) {
+	_historySlot = newValue;
+}
+
+int ModbusTag::getHistorySlot(void) {
+	return _historySlot;
+}
+
+void ModbusTag::setAggregateWindow(int newValue) {
+	if (newValue >= 0)
+		_aggregateWindow = newValue;
+}
+
+int ModbusTag::getAggregateWindow(void) {
+	return _aggregateWindow;
+}
+
+Aggregate *ModbusTag::getAggregate(void) {
+	return &_aggregate;
+}
+
+void ModbusTag::copyState(ModbusTag *from) {
+	_rawValue = from->_rawValue;
+	_noreadcount = from->_noreadcount;
+	_lastUpdateTime = from->_lastUpdateTime;
+	_timestamp = from->_timestamp;
+	_computedValue = from->_computedValue;
+	// a window of a different length starts with the next reading
+	if (_aggregateWindow == from->_aggregateWindow)
+		_aggregate = from->_aggregate;
 }
 
-void ModbusTag::setMultiplier(float newMultiplier) {
+void ModbusTag::setMultiplier(double newMultiplier) {
 	_multiplier = newMultiplier;
 }
 
-void ModbusTag::setOffset(float newOffset) {
+void ModbusTag::setOffset(double newOffset) {
 	_offset = newOffset;
 }
 
+double ModbusTag::getMultiplier(void) {
+	return _multiplier;
+}
+
+double ModbusTag::getOffset(void) {
+	return _offset;
+}
+
 void ModbusTag::setUpdateCycleId(int ident) {
 	_updatecycle_id = ident;
 }
@@ -277,14 +573,6 @@ int ModbusTag::getGroup(void) {
 	return _group;
 }
 
-void ModbusTag::setReferenceTime(time_t newValue) {
-	_referenceTime = newValue;
-}
-	
-time_t ModbusTag::getReferenceTime(void) {
-	return _referenceTime;
-}
-
 void ModbusTag::setWritePending(bool newValue) {
 	_writePending = newValue;
 }
@@ -293,6 +581,10 @@ bool ModbusTag::getWritePending(void) {
 	return _writePending;
 }
 
+bool ModbusTag::testAndSetWritePending(void) {
+	return _writePending.exchange(true);
+}
+
 int ModbusTag::getWriteFailedCount(void) {
 	return _writefailedcount;
 }
@@ -304,3 +596,50 @@ void ModbusTag::incWriteFailedCount(void) {
 void ModbusTag::clearWriteFailedCount(void) {
 	_writefailedcount =  0;
 }
+
+void ModbusTag::setWritePriority(int newValue) {
+	_writePriority = newValue;
+}
+
+int ModbusTag::getWritePriority(void) {
+	return _writePriority;
+}
+
+void ModbusTag::setWriteDeadline(int newValue) {
+	if (newValue >= 0)
+		_writeDeadline = newValue;
+}
+
+int ModbusTag::getWriteDeadline(void) {
+	return _writeDeadline;
+}
+
+void ModbusTag::setWriteArrival(uint64_t newValue) {
+	_writeArrival = newValue;
+}
+
+uint64_t ModbusTag::getWriteArrival(void) {
+	return _writeArrival;
+}
+
+void ModbusTag::setAckTopic(const char *topicStr) {
+	if (topicStr != NULL) {
+		_ackTopic = topicStr;
+	}
+}
+
+const char* ModbusTag::getAckTopic(void) {
+	return _ackTopic.c_str();
+}
+
+bool ModbusTag::hasAckTopic(void) {
+	return !_ackTopic.empty();
+}
+
+void ModbusTag::setReadback(bool newValue) {
+	_readback = newValue;
+}
+
+bool ModbusTag::getReadback(void) {
+	return _readback;
+}
@@ -12,8 +12,34 @@
 
 #include <stdint.h>
 
+#include <atomic>
 #include <iostream>
 #include <string>
+#include <vector>
+
+#include "payload.h"
+#include "aggregate.h"
+#include "expression.h"
+
+/**********************
+ *      TYPEDEFS
+ **********************/
+    typedef enum
+    {
+        MB_VALUE_UINT16 = 0,	// single register, unsigned (default)
+        MB_VALUE_INT16 = 1,		// single register, signed
+        MB_VALUE_UINT32 = 2,	// two registers, high word first, unsigned
+        MB_VALUE_INT32 = 3,		// two registers, high word first, signed
+        MB_VALUE_FLOAT32 = 4	// two registers, high word first, IEEE754 float
+    }mb_value_type_t;
+
+/**
+ * Convert value type name ("uint16", "int16", "uint32", "int32", "float32")
+ * @param name: value type name
+ * @param type: storage for result
+ * @return false if name is not a valid value type
+ */
+bool mb_value_type_from_string(const char *name, mb_value_type_t *type);
 
 class ModbusTag {
 public:
@@ -33,6 +59,10 @@ public:
      */
     ~ModbusTag();
 
+	// tags own their expression and are never copied
+	ModbusTag(const ModbusTag&) = delete;
+	ModbusTag& operator=(const ModbusTag&) = delete;
+
 	/**
 	 * Notification for noread occurence
 	 */
@@ -97,11 +127,32 @@ public:
 	*/
 	void setRawValue(uint16_t uintValue);
 
+	/**
+	* Set value to be written to the slave
+	* applies inverse scaling ((value - offset) / multiplier) and converts
+	* to the value type, unscaled integers are converted without loss
+	* @param value: value received from MQTT
+	* @return false if the value is out of range for the value type
+	*/
+	bool setWriteValue(const typed_value_t *value);
+
+	/**
+	* Get the value as registers (for writing multiple registers)
+	* @param registers: storage for getRegisterCount() registers
+	*/
+	void getRegisters(uint16_t *registers);
+
+	/**
+	* Set the value from consecutive registers
+	* @param registers: array of getRegisterCount() register values
+	*/
+	void setRegisters(const uint16_t *registers);
+
 	/**
 	* Get value
-	* @return value as uint
+	* @return value as uint (both registers for 32 bit value types)
 	*/
-	uint16_t getRawValue(void);
+	uint32_t getRawValue(void);
 
 	/**
 	* Get value as bool
@@ -111,9 +162,46 @@ public:
 
 	/**
 	* Get scaled value
-	* @return scaled value as float
+	* @return scaled value as double
 	*/
-	float getScaledValue(void);
+	double getScaledValue(void);
+
+	/**
+	* Get value in it's native type
+	* bool for single bit tags, integer for unscaled registers,
+	* otherwise the scaled value as floating point
+	*/
+	typed_value_t getTypedValue(void);
+
+	/**
+	 * Set value type
+	 * @param typeName: "uint16", "int16", "uint32", "int32" or "float32"
+	 * @return false if typeName is not valid
+	 */
+	bool setValueType(const char *typeName);
+	void setValueType(mb_value_type_t newType);
+
+	/**
+	 * Get value type
+	 */
+	mb_value_type_t getValueType(void);
+
+	/**
+	 * Get number of registers occupied by the value
+	 */
+	int getRegisterCount(void);
+
+	/**
+	 * Get time of last value update
+	 */
+	time_t getLastUpdateTime(void);
+
+	/**
+	 * Set/Get source timestamp of the last reading [ns since epoch]
+	 * only maintained when timestamps are enabled, otherwise 0
+	 */
+	void setTimestamp(uint64_t);
+	uint64_t getTimestamp(void);
 
 	/**
 	* Set the updatecycle_id
@@ -144,6 +232,37 @@ public:
 	 */
 	void setTopic(const char*);
 
+	/**
+	 * Set/Get tag name (used in expressions of computed tags)
+	 */
+	void setName(const char*);
+	const char* getName(void);
+
+	/**
+	 * Set expression, the tag becomes a computed tag which is not read from
+	 * a slave. The tag takes ownership of the expression.
+	 */
+	void setExpression(Expression*);
+	Expression* getExpression(void);
+
+	/**
+	 * @return true if the value is computed from other tags
+	 */
+	bool isComputed(void);
+
+	/**
+	 * Set result of expression (computed tags)
+	 */
+	void setComputedValue(double);
+
+	/**
+	 * Register a computed tag which uses this tag in its expression
+	 * @param tagIndex: index of computed tag
+	 */
+	void addDependent(int tagIndex);
+	int getDependentCount(void);
+	int getDependent(int index);
+
     /**
      * assign mqtt retain value
      */
@@ -193,15 +312,69 @@ public:
 	 */
 	void setFormat(const char*);
 
+	/**
+	 * Set/Get payload encoding for publish
+	 */
+	void setEncoding(payload_encoding_t);
+	payload_encoding_t getEncoding(void);
+
+	/**
+	 * Set/Get publish of source timestamp with the value
+	 */
+	void setPublishTimestamp(bool);
+	bool getPublishTimestamp(void);
+
+	/**
+	 * Set/Get MQTT v5 message expiry interval [s], 0 = no expiry
+	 */
+	void setMessageExpiry(uint32_t);
+	uint32_t getMessageExpiry(void);
+
+	/**
+	 * Set/Get MQTT quality of service for publish [0..2]
+	 */
+	void setQos(int);
+	int getQos(void);
+
+	/**
+	 * Set/Get history slot, -1 = no history recorded
+	 */
+	void setHistorySlot(int);
+	int getHistorySlot(void);
+
+	/**
+	 * Set/Get aggregation window [s], 0 = publish every reading
+	 */
+	void setAggregateWindow(int);
+	int getAggregateWindow(void);
+
+	/**
+	 * @return aggregation state of this tag
+	 */
+	Aggregate *getAggregate(void);
+
+	/**
+	 * Take over the reading state (value, noread count, update time,
+	 * timestamp, open aggregation window) of a tag with the same source,
+	 * used when the configuration is reloaded
+	 */
+	void copyState(ModbusTag *from);
+
 	/**
 	* Set multiplier
 	*/
-	void setMultiplier(float);
+	void setMultiplier(double);
 	
 	/**
 	* Set offset value
 	*/
-	void setOffset(float);
+	void setOffset(double);
+
+	/**
+	* Get multiplier / offset
+	*/
+	double getMultiplier(void);
+	double getOffset(void);
 	
 	/**
 	* Set noread value
@@ -253,16 +426,6 @@ public:
 	 */
 	int getGroup(void);
 
-	/**
-	 * Set reference time
-	 */
-	void setReferenceTime(time_t);
-	
-	/**
-	 * Get reference time
-	 */
-	time_t getReferenceTime(void);
-	
 	/**
 	 * Set write pending
 	 * to indicate that value needs to be written to the slave
@@ -274,6 +437,12 @@ public:
 	 */
 	bool getWritePending(void);
 
+	/**
+	 * Set write pending in one atomic step (MQTT and main thread)
+	 * @return previous state, true = a command is already queued
+	 */
+	bool testAndSetWritePending(void);
+
 	/**
 	 * get wite failed counter
 	 */
@@ -288,6 +457,39 @@ public:
 	 * clear write failed counter
 	 */
 	void clearWriteFailedCount(void);
+
+	/**
+	 * Set/Get write priority class, higher is more urgent (default 0)
+	 */
+	void setWritePriority(int);
+	int getWritePriority(void);
+
+	/**
+	 * Set/Get write deadline [ms], a write which could not be executed
+	 * within this time after arrival is dropped (0 = no deadline)
+	 */
+	void setWriteDeadline(int);
+	int getWriteDeadline(void);
+
+	/**
+	 * Set/Get arrival of the latest write value [ns] (clock_realtime_ns)
+	 * set by the MQTT thread, also when the value supersedes a queued command
+	 */
+	void setWriteArrival(uint64_t);
+	uint64_t getWriteArrival(void);
+
+	/**
+	 * Set/Get topic for write acknowledgements (empty = none)
+	 */
+	void setAckTopic(const char*);
+	const char* getAckTopic(void);
+	bool hasAckTopic(void);
+
+	/**
+	 * Set/Get read back of the register after a successful write
+	 */
+	void setReadback(bool);
+	bool getReadback(void);
 	
 	// public members used to store data which is not used inside this class
 	//int readInterval;                   // seconds between reads
@@ -302,11 +504,16 @@ private:
 	std::string _format;			// storage for publish format
 	bool _publish_retain;           // publish with or without retain
 	bool _write;					// true for write tag, false for read tag
-	bool _writePending;				// value needs to be written to slave
+	std::atomic<bool> _writePending;	// value needs to be written to slave
 	int	_writefailedcount;			// number of failed writes
+	int _writePriority;				// write priority class
+	int _writeDeadline;				// max age of a write command [ms] (0 = none)
+	std::atomic<uint64_t> _writeArrival;	// arrival of the latest write value [ns]
+	std::string _ackTopic;			// topic for write acknowledgements
+	bool _readback;					// read register after write
 	bool _ignoreRetained;			// do not write retained value to slave
-	float _multiplier;				// multiplier for scaled value
-	float _offset;					// offset for scaled value
+	double _multiplier;				// multiplier for scaled value
+	double _offset;					// offset for scaled value
 	float _noreadvalue;				// value to publish when read fails
 	int _noreadaction;				// action to take on noread
 	int _noreadignore;				// number of noreads to ignore before noreadaction
@@ -314,11 +521,23 @@ private:
 	uint8_t	_slaveId;				// modbus address of slave
 	uint16_t _address;				// the address of the modbus tag in the slave
 	int	_group;						// group tags for single read
-	uint16_t _rawValue;				// the value of this modbus tag
+	uint32_t _rawValue;				// the value of this modbus tag
+	mb_value_type_t _valueType;		// register interpretation
+	payload_encoding_t _encoding;	// publish payload encoding
+	bool _publishTimestamp;			// publish source timestamp with value
+	uint32_t _messageExpiry;		// MQTT v5 message expiry interval [s]
+	int _qos;						// MQTT quality of service for publish
+	int _historySlot;				// slot in history file (-1 = none)
+	int _aggregateWindow;			// aggregation window [s] (0 = none)
+	std::string _name;				// name for expressions
+	Expression *_expression;		// formula of computed tag (NULL = read from slave)
+	double _computedValue;			// result of expression
+	std::vector<int> _dependents;	// computed tags using this tag
+	Aggregate _aggregate;			// statistics of current aggregation window
 	int _updatecycle_id;			// update cycle identifier
 	time_t _lastUpdateTime;			// last update time (change of value)
+	uint64_t _timestamp;			// source timestamp of last reading [ns]
 	char _dataType;					// i = input, q = output, r = register
-	time_t _referenceTime;			// time to be used externally only
 	
 };
 
@@ -33,6 +33,8 @@
 #define MQTT_BROKER_DEFAULT_PORT 1883
 #define MQTT_BROKER_DEFAULT_KEEPALIVE 60
 #define MQTT_RETAIN_DEFAULT false
+#define MQTT_TOPIC_ALIAS_MIN_PUBLISH 2      // publishes of a topic before an alias is assigned
+#define MQTT_INFLIGHT_WINDOW_DEFAULT 20     // max unacknowledged QoS>0 messages
 
 using namespace std;
 
@@ -65,6 +67,11 @@ static void on_connect(struct mosquitto *mosq, void *obj, int result) {
     ((MQTT*)obj)->connect_callback(mosq, result);
 }
 
+// Callback function for mosquitto connect async (MQTT v5)
+static void on_connect_v5(struct mosquitto *mosq, void *obj, int result, int flags, const mosquitto_property *props) {
+    ((MQTT*)obj)->connect_v5_callback(mosq, result, props);
+}
+
 // Callback function for mosquitto disconnect async
 static void on_disconnect(struct mosquitto *mosq, void *obj, int rc) {
     // callback function of the relevant instance
@@ -95,6 +102,15 @@ static void on_subscribe(struct mosquitto *mosq, void *obj, int mid, int qos_cou
  * GLOBAL FUNCTIONS
  *********************/
 
+/**
+ * Get monotonic time in microseconds
+ */
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000ULL) + (ts.tv_nsec / 1000);
+}
+
  /*********************
   * MEMBER FUNCTIONS
   *********************/
@@ -116,6 +132,18 @@ static void on_subscribe(struct mosquitto *mosq, void *obj, int mid, int qos_cou
      _console_log_enable = false;
      _qos = 0;
      _retain = MQTT_RETAIN_DEFAULT;
+     _timestampMode = MQTT_TIMESTAMP_PAYLOAD;
+     _protocolVersion = MQTT_PROTOCOL_V311;
+     _connecting = false;
+     _receiveMaximum = 0;
+     _maximumPacketSize = 0;
+     _topicAliasEnable = false;
+     _topicAliasMaximum = 0;
+     _topicAliasNext = 1;
+     _inflightWindow = MQTT_INFLIGHT_WINDOW_DEFAULT;
+     _droppedCount = 0;
+     _publishCount = 0;
+     _publishErrorCount = 0;
      connectionStatusCallback = NULL;
      topicUpdateCallback = NULL;
      _mqttBroker.assign( MQTT_BROKER_DEFAULT );
@@ -158,6 +186,7 @@ static void on_subscribe(struct mosquitto *mosq, void *obj, int mid, int qos_cou
      //mosquitto_loop_stop(_mosq, false);
      connectionStatusCallback = NULL;
      topicUpdateCallback = NULL;
+     if (_connectThread.joinable()) _connectThread.join();
 
      mosquitto_loop_stop(_mosq, true); // Note: must be true or this will block
      if (_mosq != NULL) {
@@ -169,16 +198,46 @@ static void on_subscribe(struct mosquitto *mosq, void *obj, int mid, int qos_cou
 
 #pragma mark Connecting
 
-void MQTT::connect(void) {
-    char strbuf[255];
+bool MQTT::connect(void) {
+    int result;
     // connect to mqtt server
-    int result = mosquitto_connect_async(_mosq, _mqttBroker.c_str(), _mqttPort, _mqttKeepalive);
+    if (_protocolVersion == MQTT_PROTOCOL_V5) {
+        if (_connecting) return true;       // previous attempt still waiting for TCP connect
+        if (_connectThread.joinable()) _connectThread.join();
+        mosquitto_int_option(_mosq, MOSQ_OPT_PROTOCOL_VERSION, MQTT_PROTOCOL_V5);
+        // CONNACK properties are evaluated in the v5 callback
+        mosquitto_connect_callback_set(_mosq, NULL);
+        mosquitto_connect_v5_callback_set(_mosq, on_connect_v5);
+        // Note: there is no async v5 connect, the blocking connect must not stall the caller
+        _connecting = true;
+        _connectThread = std::thread(&MQTT::_connectV5, this);
+        return true;
+    }
+    result = mosquitto_connect_async(_mosq, _mqttBroker.c_str(), _mqttPort, _mqttKeepalive);
     if (result != MOSQ_ERR_SUCCESS) {
-        sprintf(strbuf, "%s - mosquitto_connect failed: %s [%d]\n", __func__, strerror(result), result);
-        syslog(LOG_ERR, "mosquitto_connect failed: %s [%d]", strerror(result), result);
-        throw runtime_error(strbuf);
+        syslog(LOG_ERR, "mosquitto_connect failed: %s [%d]", mosquitto_strerror(result), result);
+        return false;
     }
     //printf ("%s\n", __func__);
+    return true;
+}
+
+void MQTT::_connectV5(void) {
+    int result;
+    mosquitto_property *props = NULL;
+    if (_receiveMaximum > 0)
+        mosquitto_property_add_int16(&props, MQTT_PROP_RECEIVE_MAXIMUM, _receiveMaximum);
+    if (_maximumPacketSize > 0)
+        mosquitto_property_add_int32(&props, MQTT_PROP_MAXIMUM_PACKET_SIZE, _maximumPacketSize);
+    result = mosquitto_connect_bind_v5(_mosq, _mqttBroker.c_str(), _mqttPort, _mqttKeepalive, NULL, props);
+    mosquitto_property_free_all(&props);
+    _connecting = false;
+    if (result != MOSQ_ERR_SUCCESS) {
+        syslog(LOG_ERR, "mosquitto_connect failed: %s [%d]", mosquitto_strerror(result), result);
+        // the owner schedules the next attempt
+        if (connectionStatusCallback != NULL)
+            (*connectionStatusCallback)(false);
+    }
 }
 
 void MQTT::disconnect(void) {
@@ -195,20 +254,68 @@ void MQTT::registerTopicUpdateCallback(void (*callback) (const struct mosquitto_
     topicUpdateCallback = callback;
 }
 
-int MQTT::publish(const char* topic, const char* format, float value, bool pubRetain) {
+int MQTT::publish(const char* topic, const char* format, double value, bool pubRetain, uint32_t expiry, int qos, uint64_t timestamp) {
     int messageid = 0;
+    int len;
     if (!_connected) {
         fprintf(stderr, "%s: Not Connected!\n", __func__);
         return -1;
     } else {
         //printf ("%s: %s\n", __func__, topic);
     }
-    sprintf(_pub_buf, format, value);
+    len = formatPayload(_pub_buf, sizeof(_pub_buf), format, value, timestamp);
+    if (len < 0) {
+        // a truncated payload would not be valid JSON
+        syslog(LOG_WARNING, "MQTT - payload for %s exceeds %d bytes, not published", topic, (int)sizeof(_pub_buf));
+        _publishErrorCount++;
+        return -1;
+    }
     //printf ("%s: %s %s\n", __func__, topic, _pub_buf);
-    int result = mosquitto_publish(_mosq, &messageid, topic, strlen(_pub_buf), (const char *) _pub_buf, _qos, pubRetain);
-    if (result != MOSQ_ERR_SUCCESS) {
-        fprintf(stderr, "%s: %s [%s]\n", __func__, mosquitto_strerror(result), topic);
+    messageid = _send(topic, len, (const char *) _pub_buf, pubRetain, expiry, qos, timestamp);
+    if ((timestamp != 0) && (_timestampMode == MQTT_TIMESTAMP_TOPIC))
+        _sendTimestampTopic(topic, timestamp, pubRetain, expiry, qos);
+    return messageid;
+}
+
+int MQTT::formatPayload(char *buf, int size, const char* format, double value, uint64_t timestamp) {
+    int len;
+    if ((timestamp != 0) && (_timestampMode == MQTT_TIMESTAMP_PAYLOAD)) {
+        // {"v":<formatted value>,"t":<timestamp>}
+        len = snprintf(buf, size, "{\"v\":");
+        len += snprintf(&buf[len], size - len, format, value);
+        if (len < size)
+            len += snprintf(&buf[len], size - len, ",\"t\":%llu}", (unsigned long long)timestamp);
+    } else {
+        len = snprintf(buf, size, format, value);
+    }
+    if ((len < 0) || (len >= size)) return -1;     // truncated payload
+    return len;
+}
+
+int MQTT::publishPayload(const char* topic, const void *payload, int payloadlen, bool pubRetain, int qos) {
+    if (!_connected) {
+        fprintf(stderr, "%s: Not Connected!\n", __func__);
+        return -1;
+    }
+    return _send(topic, payloadlen, payload, pubRetain, 0, qos, 0);
+}
+
+int MQTT::publish(const char* topic, payload_encoding_t encoding, const typed_value_t *value, uint64_t timestamp, bool pubRetain, uint32_t expiry, int qos) {
+    int messageid = 0;
+    if (!_connected) {
+        fprintf(stderr, "%s: Not Connected!\n", __func__);
+        return -1;
     }
+    // the timestamp is only part of the payload in MQTT_TIMESTAMP_PAYLOAD mode
+    uint64_t payloadTimestamp = (_timestampMode == MQTT_TIMESTAMP_PAYLOAD) ? timestamp : 0;
+    int len = payload_encode(encoding, (uint8_t *) _pub_buf, sizeof(_pub_buf), value, payloadTimestamp);
+    if (len < 0) {
+        fprintf(stderr, "%s: payload encoding failed [%s]\n", __func__, topic);
+        return -1;
+    }
+    messageid = _send(topic, len, (const void *) _pub_buf, pubRetain, expiry, qos, timestamp);
+    if ((timestamp != 0) && (_timestampMode == MQTT_TIMESTAMP_TOPIC))
+        _sendTimestampTopic(topic, timestamp, pubRetain, expiry, qos);
     return messageid;
 }
 
@@ -222,10 +329,7 @@ int MQTT::clear_retained_message(const char* topic) {
     }
 	// publishing an empty message with retain on will clear the message from 
 	// mosquitto's persistance store
-    int result = mosquitto_publish(_mosq, &messageid, topic, 0, "", _qos, true);
-    if (result != MOSQ_ERR_SUCCESS) {
-        fprintf(stderr, "%s: %s [%s]\n", __func__, mosquitto_strerror(result), topic);
-    }
+    messageid = _send(topic, 0, "", true, 0, _qos, 0);
     return messageid;
 }
 
@@ -265,6 +369,10 @@ const char* MQTT::broker(void) {
     return _mqttBroker.c_str();
 }
 
+void MQTT::setPort(unsigned int newPort) {
+    _mqttPort = newPort;
+}
+
 unsigned int MQTT::port(void) {
     return _mqttPort;
 }
@@ -282,6 +390,70 @@ bool MQTT::getRetain(void) {
 	return _retain;
 }
 
+int MQTT::setProtocolVersion(int version) {
+	switch (version) {
+	case MQTT_PROTOCOL_V311:
+	case MQTT_PROTOCOL_V5:
+		_protocolVersion = version;
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+int MQTT::getProtocolVersion(void) {
+	return _protocolVersion;
+}
+
+void MQTT::setTopicAlias(bool enable) {
+	_topicAliasEnable = enable;
+}
+
+void MQTT::setReceiveMaximum(int newValue) {
+	_receiveMaximum = newValue;
+}
+
+void MQTT::setMaximumPacketSize(uint32_t newValue) {
+	_maximumPacketSize = newValue;
+}
+
+void MQTT::setTimestampMode(mqtt_timestamp_mode_t mode, const char *topicSuffix) {
+	_timestampMode = mode;
+	if (topicSuffix != NULL)
+		_timestampTopicSuffix = topicSuffix;
+}
+
+void MQTT::setInflightWindow(int newValue) {
+	_inflightWindow = (newValue > 0) ? newValue : 0;
+}
+
+int MQTT::inflightCount(void) {
+	std::lock_guard<std::mutex> lock(_inflightMutex);
+	return _inflight.size();
+}
+
+int MQTT::pendingCount(void) {
+	std::lock_guard<std::mutex> lock(_inflightMutex);
+	return _pending.size();
+}
+
+uint64_t MQTT::droppedCount(void) {
+	std::lock_guard<std::mutex> lock(_inflightMutex);
+	return _droppedCount;
+}
+
+const Histogram& MQTT::ackLatency(void) {
+	return _ackLatency;
+}
+
+uint64_t MQTT::publishCount(void) {
+	return _publishCount;
+}
+
+uint64_t MQTT::publishErrorCount(void) {
+	return _publishErrorCount;
+}
+
 #pragma mark Callbacks
 
 void MQTT::message_callback(struct mosquitto *m, const struct mosquitto_message *message) {
@@ -315,6 +487,13 @@ void MQTT::subscribe_callback(struct mosquitto *m, int mid, int qos_count, const
 
 void MQTT::publish_callback(struct mosquitto *m, int mid) {
     //fprintf(stderr, "%s: %d\n", __func__, mid );
+    // QoS 0 messages are reported when sent, they are not tracked
+    std::lock_guard<std::mutex> lock(_inflightMutex);
+    auto it = _inflight.find(mid);
+    if (it == _inflight.end()) return;
+    _ackLatency.record(monotonic_us() - it->second);
+    _inflight.erase(it);
+    _sendPending();
 }
 
 void MQTT::connect_callback(struct mosquitto *m, int result) {
@@ -324,6 +503,9 @@ void MQTT::connect_callback(struct mosquitto *m, int result) {
          if (_console_log_enable) {
              printf("%s: connection success\n", __func__);
          }
+         // messages which were waiting for the window when the connection was lost
+         std::lock_guard<std::mutex> lock(_inflightMutex);
+         _sendPending();
      } else {
          syslog(LOG_ERR, "%s", mosquitto_connack_string(result));
          fprintf(stderr, "%s: %s\n", __func__ , mosquitto_connack_string(result) );
@@ -333,9 +515,30 @@ void MQTT::connect_callback(struct mosquitto *m, int result) {
      }
 }
 
+void MQTT::connect_v5_callback(struct mosquitto *m, int result, const mosquitto_property *props) {
+    uint16_t aliasMaximum = 0;
+    if (result == MOSQ_ERR_SUCCESS) {
+        // topic aliases are only valid for the lifetime of a connection
+        mosquitto_property_read_int16(props, MQTT_PROP_TOPIC_ALIAS_MAXIMUM, &aliasMaximum, false);
+        std::lock_guard<std::mutex> lock(_topicAliasMutex);
+        _topicAliases.clear();
+        _topicAliasNext = 1;
+        _topicAliasMaximum = _topicAliasEnable ? aliasMaximum : 0;
+        if (_console_log_enable) {
+            printf("%s: topic alias maximum %d\n", __func__, aliasMaximum);
+        }
+    }
+    connect_callback(m, result);
+}
+
 void MQTT::disconnect_callback(struct mosquitto *m, int rc) {
      //fprintf(stderr, "%s: %s\n", __func__, mosquitto_strerror(rc) );
      _connected = false;
+     {
+         // acknowledges of the lost connection don't arrive, the window starts empty
+         std::lock_guard<std::mutex> lock(_inflightMutex);
+         _inflight.clear();
+     }
      if (connectionStatusCallback != NULL) {
          (*connectionStatusCallback) (_connected);
      }
@@ -344,3 +547,129 @@ void MQTT::disconnect_callback(struct mosquitto *m, int rc) {
  /*********************
   * PRIVATE FUNCTIONS
   *********************/
+
+int MQTT::_send(const char* topic, int payloadlen, const void *payload, bool pubRetain, uint32_t expiry, int qos, uint64_t timestamp) {
+    int messageid;
+    if (qos == 0) return _sendNow(topic, payloadlen, payload, pubRetain, expiry, qos, timestamp);
+
+    // Note: the lock is held while publishing so the acknowledge callback
+    // can't process the message before it has been registered
+    std::lock_guard<std::mutex> lock(_inflightMutex);
+    if ((_inflightWindow > 0) && (_inflight.size() >= _inflightWindow)) {
+        // window is full, keep only the latest value of each topic
+        auto it = _pending.find(topic);
+        if (it != _pending.end()) {
+            _droppedCount++;    // superseded value
+        } else {
+            _pendingOrder.push_back(topic);
+            it = _pending.emplace(topic, pending_message_t()).first;
+        }
+        it->second.payload.assign((const char *) payload, payloadlen);
+        it->second.retain = pubRetain;
+        it->second.expiry = expiry;
+        it->second.qos = qos;
+        it->second.timestamp = timestamp;
+        return 0;
+    }
+    messageid = _sendNow(topic, payloadlen, payload, pubRetain, expiry, qos, timestamp);
+    if (messageid > 0)
+        _inflight[messageid] = monotonic_us();
+    return messageid;
+}
+
+void MQTT::_sendTimestampTopic(const char* topic, uint64_t timestamp, bool pubRetain, uint32_t expiry, int qos) {
+    char tsbuf[24];
+    std::string tsTopic(topic);
+    tsTopic.append(_timestampTopicSuffix);
+    int len = snprintf(tsbuf, sizeof(tsbuf), "%llu", (unsigned long long)timestamp);
+    _send(tsTopic.c_str(), len, tsbuf, pubRetain, expiry, qos, 0);
+}
+
+void MQTT::_sendPending(void) {
+    int messageid;
+    while (!_pendingOrder.empty() && ((_inflightWindow == 0) || (_inflight.size() < _inflightWindow))) {
+        std::string topic = _pendingOrder.front();
+        _pendingOrder.pop_front();
+        auto it = _pending.find(topic);
+        if (it == _pending.end()) continue;
+        pending_message_t &msg = it->second;
+        messageid = _sendNow(topic.c_str(), msg.payload.size(), msg.payload.data(), msg.retain, msg.expiry, msg.qos, msg.timestamp);
+        if ((messageid < 0) && !_connected) {
+            // keep the latest value of the topic for the reconnect
+            _pendingOrder.push_front(topic);
+            break;
+        }
+        // a message the broker connection refused is counted in _publishErrorCount
+        if (messageid > 0)
+            _inflight[messageid] = monotonic_us();
+        _pending.erase(it);
+    }
+}
+
+int MQTT::_sendNow(const char* topic, int payloadlen, const void *payload, bool pubRetain, uint32_t expiry, int qos, uint64_t timestamp) {
+    int messageid = 0;
+    int result;
+    char tsbuf[24];
+    mosquitto_property *props = NULL;
+    const char *pubTopic = topic;
+    uint16_t alias;
+    bool isNewAlias = false;
+
+    if (_protocolVersion != MQTT_PROTOCOL_V5) {
+        result = mosquitto_publish(_mosq, &messageid, topic, payloadlen, payload, qos, pubRetain);
+    } else {
+        // the lock is held until a new alias is committed, the broker learns
+        // an alias from the first message which carries it
+        std::lock_guard<std::mutex> lock(_topicAliasMutex);
+        // QoS>0 messages are resent by libmosquitto after a reconnect, when
+        // the aliases of the connection are no longer valid
+        alias = (qos == 0) ? _topicAlias(topic, &isNewAlias) : 0;
+        if (alias > 0) {
+            mosquitto_property_add_int16(&props, MQTT_PROP_TOPIC_ALIAS, alias);
+            // once the alias is known to the broker the topic can be omitted
+            if (!isNewAlias) pubTopic = NULL;
+        }
+        if (expiry > 0)
+            mosquitto_property_add_int32(&props, MQTT_PROP_MESSAGE_EXPIRY_INTERVAL, expiry);
+        if ((timestamp != 0) && (_timestampMode == MQTT_TIMESTAMP_PROPERTY)) {
+            snprintf(tsbuf, sizeof(tsbuf), "%llu", (unsigned long long)timestamp);
+            mosquitto_property_add_string_pair(&props, MQTT_PROP_USER_PROPERTY, "t", tsbuf);
+        }
+        result = mosquitto_publish_v5(_mosq, &messageid, pubTopic, payloadlen, payload, qos, pubRetain, props);
+        mosquitto_property_free_all(&props);
+        if ((result == MOSQ_ERR_SUCCESS) && isNewAlias) {
+            _topicAliases[topic].alias = alias;
+            _topicAliasNext++;
+            if (_topicAliasNext > _topicAliasMaximum) {
+                // last alias assigned, publish counters are no longer needed
+                for (auto it = _topicAliases.begin(); it != _topicAliases.end(); ) {
+                    if (it->second.alias == 0) it = _topicAliases.erase(it);
+                    else ++it;
+                }
+            }
+        }
+    }
+    if (result != MOSQ_ERR_SUCCESS) {
+        _publishErrorCount++;
+        fprintf(stderr, "%s: %s [%s]\n", __func__, mosquitto_strerror(result), topic);
+        return -1;
+    }
+    _publishCount++;
+    return messageid;
+}
+
+uint16_t MQTT::_topicAlias(const char* topic, bool *isNew) {
+    *isNew = false;
+    if (_topicAliasMaximum == 0) return 0;
+    if (_topicAliasNext > _topicAliasMaximum) {
+        // all aliases in use, topics without alias are not recorded
+        auto it = _topicAliases.find(topic);
+        return (it != _topicAliases.end()) ? it->second.alias : 0;
+    }
+    topic_alias_t &entry = _topicAliases[topic];
+    if (entry.alias > 0) return entry.alias;
+    // assign aliases only to topics which are published repeatedly
+    if (++entry.count < MQTT_TOPIC_ALIAS_MIN_PUBLISH) return 0;
+    *isNew = true;
+    return _topicAliasNext;
+}
@@ -15,7 +15,30 @@
 
 #include <mosquitto.h>
 
+#include <atomic>
+#include <deque>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "payload.h"
+#include "histogram.h"
+
+/*********************
+ *      DEFINES
+ *********************/
+#define MQTT_PAYLOAD_BUF_SIZE 256       // formatted / encoded payload incl. timestamp
+
+/**********************
+ *      TYPEDEFS
+ **********************/
+    typedef enum
+    {
+        MQTT_TIMESTAMP_PAYLOAD = 0,     // text: {"v":<value>,"t":<ns>}, binary: map {"v","t"}
+        MQTT_TIMESTAMP_PROPERTY = 1,    // MQTT v5 user property "t"
+        MQTT_TIMESTAMP_TOPIC = 2        // separate message on <topic><suffix>
+    }mqtt_timestamp_mode_t;
 
 class MQTT {
 public:
@@ -32,9 +55,13 @@ public:
     ~MQTT();
 
     /**
-     * Connect to the MQTT broker
+     * Connect to the MQTT broker, the result is reported by the connection
+     * status callback
+     * MQTT v5 connects in a separate thread (libmosquitto has no async v5
+     * connect), a failure is reported as status false
+     * @return false if the connect could not be initiated
      */
-    void connect(void);
+    bool connect(void);
 
     /**
      * Disconnect from the MQTT broker
@@ -63,6 +90,14 @@ public:
      */
     void connect_callback(struct mosquitto *mosq, int result);
 
+    /**
+     * callback function for MQTT v5 connect, evaluates CONNACK properties
+     * @param mosq: pointer to mosquitto structure
+     * @param result: connection result
+     * @param props: CONNACK properties
+     */
+    void connect_v5_callback(struct mosquitto *mosq, int result, const mosquitto_property *props);
+
     /**
      * callback function for disconnect
      * @param mosq: pointer to mosquitto structure
@@ -108,9 +143,49 @@ public:
      * @param format: printf style format string
      * @param value: the numeric value to publish
      * @param pubRetain: 
+     * @param expiry: MQTT v5 message expiry interval [s], 0 = no expiry
+     * @param qos: quality of service [0..2]
+     * @param timestamp: source timestamp [ns], 0 = no timestamp
      * @return: message ID, can be used for further tracking
      */
-    int publish(const char* topic, const char* format, float value, bool pubRetain);
+    int publish(const char* topic, const char* format, double value, bool pubRetain, uint32_t expiry = 0, int qos = 0, uint64_t timestamp = 0);
+
+    /**
+     * format a numeric value as text payload (used by publish)
+     * the timestamp is added as {"v":<value>,"t":<timestamp>} in MQTT_TIMESTAMP_PAYLOAD mode
+     * @param buf: output buffer
+     * @param size: size of buf
+     * @param format: printf style format string
+     * @param value: the numeric value
+     * @param timestamp: source timestamp [ns], 0 = no timestamp
+     * @return: payload length, -1 if the payload does not fit into buf
+     */
+    int formatPayload(char *buf, int size, const char* format, double value, uint64_t timestamp);
+
+    /**
+     * publish a preformatted payload
+     * @param topic: the topic name to be published
+     * @param payload: payload data
+     * @param payloadlen: number of bytes in payload
+     * @param pubRetain: retain flag
+     * @param qos: quality of service [0..2]
+     * @return: message ID, can be used for further tracking
+     */
+    int publishPayload(const char* topic, const void *payload, int payloadlen, bool pubRetain, int qos = 0);
+
+    /**
+     * publish topic with binary payload encoding
+     * the value is encoded directly into the publish buffer
+     * @param topic: the topic name to be published
+     * @param encoding: binary payload encoding (CBOR or MessagePack)
+     * @param value: the typed value to publish
+     * @param timestamp: source timestamp [ns], 0 = no timestamp
+     * @param pubRetain: 
+     * @param expiry: MQTT v5 message expiry interval [s], 0 = no expiry
+     * @param qos: quality of service [0..2]
+     * @return: message ID, can be used for further tracking
+     */
+    int publish(const char* topic, payload_encoding_t encoding, const typed_value_t *value, uint64_t timestamp, bool pubRetain, uint32_t expiry = 0, int qos = 0);
 
 	/**
 	 * Clear retained message from mosquitto persistance store
@@ -144,6 +219,11 @@ public:
      */
     const char* broker(void);
 
+    /**
+     * set MQTT server port
+     */
+    void setPort(unsigned int newPort);
+
     /**
      * get MQTT server port
      * @return: mqtt server port
@@ -170,14 +250,128 @@ public:
 	 */
 	bool getRetain(void);
 
+	/**
+	 * set MQTT protocol version, must be called before connect
+	 * @param version: 4 = MQTT v3.1.1 (default), 5 = MQTT v5
+	 * @return: 0 on success, negative number for error
+	 */
+	int setProtocolVersion(int version);
+
+	/**
+	 * get MQTT protocol version
+	 */
+	int getProtocolVersion(void);
+
+	/**
+	 * enable / disable MQTT v5 topic aliases for publish
+	 */
+	void setTopicAlias(bool enable);
+
+	/**
+	 * set MQTT v5 receive-maximum sent with CONNECT (0 = library default)
+	 */
+	void setReceiveMaximum(int newValue);
+
+	/**
+	 * set MQTT v5 maximum-packet-size sent with CONNECT (0 = no limit)
+	 */
+	void setMaximumPacketSize(uint32_t newValue);
+
+	/**
+	 * set how source timestamps are transported
+	 * @param mode: see mqtt_timestamp_mode_t
+	 * @param topicSuffix: suffix for MQTT_TIMESTAMP_TOPIC
+	 */
+	void setTimestampMode(mqtt_timestamp_mode_t mode, const char *topicSuffix);
+
+	/**
+	 * set the maximum number of unacknowledged QoS>0 messages
+	 * when the window is full only the latest value of each topic is queued
+	 * the window is emptied when the connection is lost, queued messages
+	 * are sent after the reconnect
+	 * @param newValue: window size, 0 = unlimited
+	 */
+	void setInflightWindow(int newValue);
+
+	/**
+	 * @return: number of unacknowledged QoS>0 messages
+	 */
+	int inflightCount(void);
+
+	/**
+	 * @return: number of messages waiting for space in the in-flight window
+	 */
+	int pendingCount(void);
+
+	/**
+	 * @return: number of superseded messages dropped while the window was full
+	 */
+	uint64_t droppedCount(void);
+
+	/**
+	 * @return: histogram of publish to acknowledge latency [us]
+	 */
+	const Histogram& ackLatency(void);
+
+	/**
+	 * @return: number of messages handed to the broker connection
+	 */
+	uint64_t publishCount(void);
+
+	/**
+	 * @return: number of messages which could not be published
+	 */
+	uint64_t publishErrorCount(void);
+
 private:
+    /**
+     * send payload, used by all publish functions
+     * QoS>0 messages are tracked until acknowledged by the broker
+     * @return: message ID or -1 on failure
+     */
+    int _send(const char* topic, int payloadlen, const void *payload, bool pubRetain, uint32_t expiry, int qos, uint64_t timestamp);
+
+    /**
+     * send payload to broker
+     * adds MQTT v5 properties (topic alias, message expiry, timestamp) when enabled
+     * @return: message ID or -1 on failure
+     */
+    int _sendNow(const char* topic, int payloadlen, const void *payload, bool pubRetain, uint32_t expiry, int qos, uint64_t timestamp);
+
+    /**
+     * publish timestamp on <topic><suffix> (MQTT_TIMESTAMP_TOPIC)
+     */
+    void _sendTimestampTopic(const char* topic, uint64_t timestamp, bool pubRetain, uint32_t expiry, int qos);
+
+    /**
+     * send queued messages while there is space in the in-flight window
+     * a message stays queued if the connection is lost
+     * _inflightMutex must be held by caller
+     */
+    void _sendPending(void);
+
+    /**
+     * get topic alias for a topic, proposes a new alias for frequently published topics
+     * a new alias is committed by the caller after a successful publish
+     * _topicAliasMutex must be held by caller
+     * @param topic: the topic to publish
+     * @param isNew: set to true if the alias is new (to be sent with the topic)
+     * @return: alias or 0 if no alias is available
+     */
+    uint16_t _topicAlias(const char* topic, bool *isNew);
+
     void (*connectionStatusCallback) (bool);     // callback for connection status change
     void (*topicUpdateCallback) (const struct mosquitto_message*);     // callback for topic update
     void _construct (const char* clientID);
 
+    /**
+     * blocking MQTT v5 connect, runs in _connectThread
+     */
+    void _connectV5(void);
+
     struct mosquitto *_mosq;
     bool _connected;
-    char _pub_buf[100];
+    char _pub_buf[MQTT_PAYLOAD_BUF_SIZE];
     std::string _mqttBroker;
     unsigned int _mqttPort;
     int _mqttKeepalive;
@@ -186,6 +380,40 @@ private:
 
     int _qos;        // quality of service [0..2]
     bool _retain;    // retain setting for publish commands
+    mqtt_timestamp_mode_t _timestampMode;   // transport of source timestamps
+    std::string _timestampTopicSuffix;      // suffix for MQTT_TIMESTAMP_TOPIC
+
+    int _protocolVersion;           // MQTT_PROTOCOL_V311 or MQTT_PROTOCOL_V5
+    std::thread _connectThread;     // blocking v5 connect
+    std::atomic<bool> _connecting;  // _connectThread is running
+    int _receiveMaximum;            // v5 CONNECT receive-maximum
+    uint32_t _maximumPacketSize;    // v5 CONNECT maximum-packet-size
+    bool _topicAliasEnable;         // use v5 topic aliases for publish
+    uint16_t _topicAliasMaximum;    // topic alias maximum granted by broker
+    uint16_t _topicAliasNext;       // next alias to assign
+    struct topic_alias_t {
+        uint16_t alias;             // 0 = not assigned
+        uint16_t count;             // number of publishes before alias assignment
+    };
+    std::unordered_map<std::string, topic_alias_t> _topicAliases;  // aliases of current connection
+    std::mutex _topicAliasMutex;
+
+    struct pending_message_t {
+        std::string payload;
+        bool retain;
+        uint32_t expiry;
+        int qos;
+        uint64_t timestamp;
+    };
+    unsigned int _inflightWindow;                               // max unacknowledged messages, 0 = unlimited
+    std::unordered_map<int, uint64_t> _inflight;                // message id -> publish time [us]
+    std::unordered_map<std::string, pending_message_t> _pending;// latest message per topic waiting for window
+    std::deque<std::string> _pendingOrder;                      // topics of _pending in arrival order
+    uint64_t _droppedCount;                                     // superseded pending messages
+    Histogram _ackLatency;                                      // publish to PUBACK latency [us]
+    std::atomic<uint64_t> _publishCount;                        // messages sent
+    std::atomic<uint64_t> _publishErrorCount;                   // failed publishes
+    std::mutex _inflightMutex;
 };
 
 #endif /* HARDWARE_H */
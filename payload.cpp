@@ -0,0 +1,502 @@
+/**
+ * @file payload.cpp
+ *
+ */
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <charconv>
+
+#include "payload.h"
+
+/*********************
+ *      DEFINES
+ *********************/
+
+// CBOR major types (RFC 8949 section 3.1)
+#define CBOR_UINT 0x00
+#define CBOR_NEGINT 0x20
+#define CBOR_TEXT 0x60
+#define CBOR_MAP 0xA0
+#define CBOR_FALSE 0xF4
+#define CBOR_TRUE 0xF5
+#define CBOR_NULL 0xF6
+#define CBOR_FLOAT32 0xFA
+#define CBOR_FLOAT64 0xFB
+
+// MessagePack format bytes
+#define MSGPACK_NIL 0xC0
+#define MSGPACK_FALSE 0xC2
+#define MSGPACK_TRUE 0xC3
+#define MSGPACK_FLOAT32 0xCA
+#define MSGPACK_FLOAT64 0xCB
+#define MSGPACK_UINT8 0xCC
+#define MSGPACK_UINT16 0xCD
+#define MSGPACK_UINT32 0xCE
+#define MSGPACK_UINT64 0xCF
+#define MSGPACK_INT8 0xD0
+#define MSGPACK_INT16 0xD1
+#define MSGPACK_INT32 0xD2
+#define MSGPACK_INT64 0xD3
+#define MSGPACK_FIXMAP 0x80
+#define MSGPACK_FIXSTR 0xA0
+
+#define PAYLOAD_NUMBER_MAX 64		// longest number accepted by payload_parse
+#define PAYLOAD_FIELDS_MAX 8		// max number of keys in a write payload object
+
+/*********************
+ * LOCAL FUNCTIONS
+ *********************/
+
+/**
+ * Write big endian integer of n bytes
+ */
+static inline void put_be(uint8_t *p, uint64_t v, int n) {
+	for (int i = n-1; i >= 0; i--) {
+		p[i] = (uint8_t) v;
+		v >>= 8;
+	}
+}
+
+/**
+ * Check if a double can be stored as float without loss
+ */
+static inline bool fits_float(double d) {
+	float f = (float) d;
+	return ((double) f == d) || (d != d);	// NaN is encoded as float as well
+}
+
+/**
+ * CBOR: write major type with argument
+ * @return number of bytes written or -1 if buffer too small
+ */
+static int cbor_head(uint8_t *buf, size_t size, uint8_t major, uint64_t arg) {
+	int n;
+	if (arg < 24) n = 0;
+	else if (arg <= 0xFF) n = 1;
+	else if (arg <= 0xFFFF) n = 2;
+	else if (arg <= 0xFFFFFFFF) n = 4;
+	else n = 8;
+	if (size < (size_t)(n + 1)) return -1;
+	switch (n) {
+	case 0: buf[0] = major | (uint8_t)arg; break;
+	case 1: buf[0] = major | 24; break;
+	case 2: buf[0] = major | 25; break;
+	case 4: buf[0] = major | 26; break;
+	default: buf[0] = major | 27; break;
+	}
+	if (n > 0) put_be(&buf[1], arg, n);
+	return n + 1;
+}
+
+static int cbor_value(uint8_t *buf, size_t size, const typed_value_t *value) {
+	switch (value->type) {
+	case VALUE_TYPE_BOOL:
+		if (size < 1) return -1;
+		buf[0] = value->b ? CBOR_TRUE : CBOR_FALSE;
+		return 1;
+	case VALUE_TYPE_INT:
+		if (value->i < 0)
+			return cbor_head(buf, size, CBOR_NEGINT, (uint64_t)(-1 - value->i));
+		return cbor_head(buf, size, CBOR_UINT, (uint64_t)value->i);
+	case VALUE_TYPE_UINT:
+		return cbor_head(buf, size, CBOR_UINT, value->u);
+	case VALUE_TYPE_FLOAT:
+		if (fits_float(value->f)) {
+			float f = (float) value->f;
+			uint32_t bits;
+			if (size < 5) return -1;
+			memcpy(&bits, &f, sizeof(bits));
+			buf[0] = CBOR_FLOAT32;
+			put_be(&buf[1], bits, 4);
+			return 5;
+		} else {
+			uint64_t bits;
+			if (size < 9) return -1;
+			memcpy(&bits, &value->f, sizeof(bits));
+			buf[0] = CBOR_FLOAT64;
+			put_be(&buf[1], bits, 8);
+			return 9;
+		}
+	default:
+		if (size < 1) return -1;
+		buf[0] = CBOR_NULL;
+		return 1;
+	}
+}
+
+static int msgpack_value(uint8_t *buf, size_t size, const typed_value_t *value) {
+	uint64_t u;
+	int64_t i;
+	switch (value->type) {
+	case VALUE_TYPE_BOOL:
+		if (size < 1) return -1;
+		buf[0] = value->b ? MSGPACK_TRUE : MSGPACK_FALSE;
+		return 1;
+	case VALUE_TYPE_INT:
+		i = value->i;
+		if (i >= 0) {
+			u = (uint64_t) i;
+			goto positive;
+		}
+		if (i >= -32) {
+			if (size < 1) return -1;
+			buf[0] = (uint8_t)(int8_t) i;		// negative fixint
+			return 1;
+		}
+		if (i >= INT8_MIN) {
+			if (size < 2) return -1;
+			buf[0] = MSGPACK_INT8; put_be(&buf[1], (uint64_t)i, 1);
+			return 2;
+		}
+		if (i >= INT16_MIN) {
+			if (size < 3) return -1;
+			buf[0] = MSGPACK_INT16; put_be(&buf[1], (uint64_t)i, 2);
+			return 3;
+		}
+		if (i >= INT32_MIN) {
+			if (size < 5) return -1;
+			buf[0] = MSGPACK_INT32; put_be(&buf[1], (uint64_t)i, 4);
+			return 5;
+		}
+		if (size < 9) return -1;
+		buf[0] = MSGPACK_INT64; put_be(&buf[1], (uint64_t)i, 8);
+		return 9;
+	case VALUE_TYPE_UINT:
+		u = value->u;
+positive:
+		if (u <= 0x7F) {
+			if (size < 1) return -1;
+			buf[0] = (uint8_t) u;				// positive fixint
+			return 1;
+		}
+		if (u <= 0xFF) {
+			if (size < 2) return -1;
+			buf[0] = MSGPACK_UINT8; put_be(&buf[1], u, 1);
+			return 2;
+		}
+		if (u <= 0xFFFF) {
+			if (size < 3) return -1;
+			buf[0] = MSGPACK_UINT16; put_be(&buf[1], u, 2);
+			return 3;
+		}
+		if (u <= 0xFFFFFFFF) {
+			if (size < 5) return -1;
+			buf[0] = MSGPACK_UINT32; put_be(&buf[1], u, 4);
+			return 5;
+		}
+		if (size < 9) return -1;
+		buf[0] = MSGPACK_UINT64; put_be(&buf[1], u, 8);
+		return 9;
+	case VALUE_TYPE_FLOAT:
+		if (fits_float(value->f)) {
+			float f = (float) value->f;
+			uint32_t bits;
+			if (size < 5) return -1;
+			memcpy(&bits, &f, sizeof(bits));
+			buf[0] = MSGPACK_FLOAT32;
+			put_be(&buf[1], bits, 4);
+			return 5;
+		} else {
+			uint64_t bits;
+			if (size < 9) return -1;
+			memcpy(&bits, &value->f, sizeof(bits));
+			buf[0] = MSGPACK_FLOAT64;
+			put_be(&buf[1], bits, 8);
+			return 9;
+		}
+	default:
+		if (size < 1) return -1;
+		buf[0] = MSGPACK_NIL;
+		return 1;
+	}
+}
+
+/**
+ * Check for JSON white space
+ */
+static inline bool is_space(char c) {
+	return (c == ' ') || (c == '\t') || (c == '\r') || (c == '\n');
+}
+
+/**
+ * Skip white space
+ * @return pointer to first non white space character or end
+ */
+static inline const char *skip_space(const char *p, const char *end) {
+	while ((p < end) && is_space(*p)) p++;
+	return p;
+}
+
+/**
+ * Parse a floating point number
+ * @return pointer after last character used or NULL on failure
+ */
+static const char *parse_double(const char *p, const char *end, double *result) {
+#if defined(__cpp_lib_to_chars) && (__cpp_lib_to_chars >= 201611L)
+	std::from_chars_result res = std::from_chars(p, end, *result);
+	if (res.ec != std::errc()) return NULL;
+	return res.ptr;
+#else
+	// strtod needs a terminated string
+	char buf[PAYLOAD_NUMBER_MAX+1];
+	char *last;
+	size_t len = end - p;
+	if (len > PAYLOAD_NUMBER_MAX) len = PAYLOAD_NUMBER_MAX;
+	memcpy(buf, p, len);
+	buf[len] = 0;
+	*result = strtod(buf, &last);
+	if (last == buf) return NULL;
+	return p + (last - buf);
+#endif
+}
+
+/**
+ * Parse a scalar: number, true/false (case insensitive)
+ * leading '+' is accepted for numbers
+ * @return pointer after scalar or NULL on failure
+ */
+static const char *parse_scalar(const char *p, const char *end, typed_value_t *value) {
+	std::from_chars_result res;
+	const char *q;
+	size_t len;
+	if (p >= end) return NULL;
+	// booleans, any other word starting with t/f is invalid
+	if (((*p | 0x20) == 't') || ((*p | 0x20) == 'f')) {
+		q = p;
+		while ((q < end) && (((*q | 0x20) >= 'a') && ((*q | 0x20) <= 'z'))) q++;
+		len = q - p;
+		if ((len == 4) && (strncasecmp(p, "true", 4) == 0)) value->b = true;
+		else if ((len == 5) && (strncasecmp(p, "false", 5) == 0)) value->b = false;
+		else return NULL;
+		value->type = VALUE_TYPE_BOOL;
+		return q;
+	}
+	if ((*p == '+') && ((p + 1) < end)) p++;
+	// integers are decoded without loss of precision
+	if (*p == '-') {
+		res = std::from_chars(p, end, value->i);
+		value->type = VALUE_TYPE_INT;
+	} else {
+		res = std::from_chars(p, end, value->u);
+		value->type = VALUE_TYPE_UINT;
+	}
+	if ((res.ec == std::errc()) && ((res.ptr == end) || ((*res.ptr != '.') && ((*res.ptr | 0x20) != 'e'))))
+		return res.ptr;
+	// floating point (or integer out of range)
+	q = parse_double(p, end, &value->f);
+	if (q == NULL) return NULL;
+	value->type = VALUE_TYPE_FLOAT;
+	return q;
+}
+
+/*********************
+ * GLOBAL FUNCTIONS
+ *********************/
+
+bool payload_encoding_from_string(const char *name, payload_encoding_t *encoding) {
+	if (name == NULL) return false;
+	if (strcasecmp(name, "text") == 0) {
+		*encoding = PAYLOAD_TEXT;
+	} else if (strcasecmp(name, "cbor") == 0) {
+		*encoding = PAYLOAD_CBOR;
+	} else if ( (strcasecmp(name, "msgpack") == 0) || (strcasecmp(name, "messagepack") == 0) ) {
+		*encoding = PAYLOAD_MSGPACK;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+double typed_value_as_double(const typed_value_t *value) {
+	switch (value->type) {
+	case VALUE_TYPE_BOOL: return value->b ? 1.0 : 0.0;
+	case VALUE_TYPE_INT: return (double) value->i;
+	case VALUE_TYPE_UINT: return (double) value->u;
+	case VALUE_TYPE_FLOAT: return value->f;
+	default: return 0.0;
+	}
+}
+
+int payload_encode_cbor(uint8_t *buf, size_t size, const typed_value_t *value, uint64_t timestamp) {
+	int len, n;
+	if (timestamp == 0)
+		return cbor_value(buf, size, value);
+	// map(2) { "v": value, "t": timestamp }
+	if (size < 3) return -1;
+	buf[0] = CBOR_MAP | 2;
+	buf[1] = CBOR_TEXT | 1;
+	buf[2] = 'v';
+	len = 3;
+	n = cbor_value(&buf[len], size - len, value);
+	if (n < 0) return -1;
+	len += n;
+	if (size < (size_t)(len + 2)) return -1;
+	buf[len++] = CBOR_TEXT | 1;
+	buf[len++] = 't';
+	n = cbor_head(&buf[len], size - len, CBOR_UINT, timestamp);
+	if (n < 0) return -1;
+	return len + n;
+}
+
+int payload_encode_msgpack(uint8_t *buf, size_t size, const typed_value_t *value, uint64_t timestamp) {
+	int len, n;
+	typed_value_t ts;
+	if (timestamp == 0)
+		return msgpack_value(buf, size, value);
+	// fixmap(2) { "v": value, "t": timestamp }
+	if (size < 3) return -1;
+	buf[0] = MSGPACK_FIXMAP | 2;
+	buf[1] = MSGPACK_FIXSTR | 1;
+	buf[2] = 'v';
+	len = 3;
+	n = msgpack_value(&buf[len], size - len, value);
+	if (n < 0) return -1;
+	len += n;
+	if (size < (size_t)(len + 2)) return -1;
+	buf[len++] = MSGPACK_FIXSTR | 1;
+	buf[len++] = 't';
+	ts.type = VALUE_TYPE_UINT;
+	ts.u = timestamp;
+	n = msgpack_value(&buf[len], size - len, &ts);
+	if (n < 0) return -1;
+	return len + n;
+}
+
+int payload_encode(payload_encoding_t encoding, uint8_t *buf, size_t size, const typed_value_t *value, uint64_t timestamp) {
+	switch (encoding) {
+	case PAYLOAD_CBOR:
+		return payload_encode_cbor(buf, size, value, timestamp);
+	case PAYLOAD_MSGPACK:
+		return payload_encode_msgpack(buf, size, value, timestamp);
+	default:
+		return -1;
+	}
+}
+
+bool payload_parse(const void *payload, int payloadlen, typed_value_t *value) {
+	const char *p = (const char *) payload;
+	const char *end;
+	payload_field_t fields[PAYLOAD_FIELDS_MAX];
+	int i, n;
+	if ((p == NULL) || (payloadlen <= 0)) return false;
+	end = p + payloadlen;
+	// ignore white space and trailing NUL characters
+	while ((end > p) && ((end[-1] == 0) || is_space(end[-1]))) end--;
+	p = skip_space(p, end);
+	if (p >= end) return false;
+	if (*p == '{') {
+		// the value is taken from key "v" or "value"
+		n = payload_parse_object(p, end - p, fields, PAYLOAD_FIELDS_MAX);
+		for (i = 0; i < n; i++) {
+			if (payload_field_is(&fields[i], "v") || payload_field_is(&fields[i], "value")) {
+				if (fields[i].value.type == VALUE_TYPE_NONE) return false;
+				*value = fields[i].value;
+				return true;
+			}
+		}
+		return false;
+	}
+	p = parse_scalar(p, end, value);
+	return (p == end);
+}
+
+int payload_parse_object(const void *payload, int payloadlen, payload_field_t *fields, int maxFields) {
+	const char *p = (const char *) payload;
+	const char *end, *q;
+	payload_field_t *field;
+	int count = 0;
+	if ((p == NULL) || (payloadlen <= 0)) return -1;
+	end = p + payloadlen;
+	p = skip_space(p, end);
+	if ((p >= end) || (*p != '{')) return -1;
+	p++;
+	for (;;) {
+		p = skip_space(p, end);
+		if (p >= end) return -1;
+		if (*p == '}') break;
+		if (count >= maxFields) return -1;
+		field = &fields[count];
+		// key
+		if (*p != '"') return -1;
+		field->key = ++p;
+		while ((p < end) && (*p != '"')) p++;
+		if (p >= end) return -1;
+		field->keyLen = p - field->key;
+		p = skip_space(p + 1, end);
+		if ((p >= end) || (*p != ':')) return -1;
+		p = skip_space(p + 1, end);
+		if (p >= end) return -1;
+		field->str = NULL;
+		field->strLen = 0;
+		field->value.type = VALUE_TYPE_NONE;
+		if (*p == '"') {
+			// string, escape sequences are not decoded
+			field->str = ++p;
+			while ((p < end) && (*p != '"')) {
+				if ((*p == '\\') && ((p + 1) < end)) p++;
+				p++;
+			}
+			if (p >= end) return -1;
+			field->strLen = p - field->str;
+			p++;
+			// strings containing a scalar are accepted as value as well
+			q = parse_scalar(field->str, field->str + field->strLen, &field->value);
+			if (q != field->str + field->strLen) field->value.type = VALUE_TYPE_NONE;
+		} else if ((end - p >= 4) && (memcmp(p, "null", 4) == 0)) {
+			p += 4;
+		} else {
+			p = parse_scalar(p, end, &field->value);
+			if (p == NULL) return -1;
+		}
+		count++;
+		p = skip_space(p, end);
+		if ((p < end) && (*p == ',')) {
+			p++;
+			continue;
+		}
+		if ((p < end) && (*p == '}')) break;
+		return -1;
+	}
+	return count;
+}
+
+bool payload_field_is(const payload_field_t *field, const char *key) {
+	size_t len = strlen(key);
+	return (field->keyLen == len) && (memcmp(field->key, key, len) == 0);
+}
+
+int payload_format_value(char *buf, size_t size, const typed_value_t *value) {
+	int len;
+	switch (value->type) {
+	case VALUE_TYPE_BOOL:
+		len = snprintf(buf, size, "%s", value->b ? "true" : "false");
+		break;
+	case VALUE_TYPE_INT:
+		len = snprintf(buf, size, "%lld", (long long) value->i);
+		break;
+	case VALUE_TYPE_UINT:
+		len = snprintf(buf, size, "%llu", (unsigned long long) value->u);
+		break;
+	case VALUE_TYPE_FLOAT:
+		// JSON has no representation for NaN / infinity
+		if ((value->f != value->f) || (value->f - value->f != 0.0))
+			len = snprintf(buf, size, "null");
+		else
+			len = snprintf(buf, size, "%.9g", value->f);
+		break;
+	default:
+		len = snprintf(buf, size, "null");
+		break;
+	}
+	if ((len < 0) || ((size_t)len >= size)) return -1;
+	return len;
+}
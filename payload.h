@@ -0,0 +1,148 @@
+/**
+ * @file payload.h
+
+-----------------------------------------------------------------------------
+ Encoding of MQTT payloads.
+
+ By default values are published as printf formatted text. For high rate
+ tags a compact binary encoding (CBOR, RFC 8949 or MessagePack) can be
+ selected instead. Binary payloads carry the native type of the value
+ (bool, signed/unsigned integer or floating point) so no precision is lost
+ and consumers don't have to parse text.
+
+ Binary payload layout:
+   without timestamp:  <value>
+   with timestamp:     map { "v": <value>, "t": <unix time in ns> }
+
+ The encoders write directly into a caller supplied buffer and never
+ allocate memory.
+
+ Received payloads (write commands) are decoded by payload_parse() into a
+ typed value. Accepted formats (surrounding white space is ignored):
+   numbers:   12  -7  18446744073709551615  3.25  1e-3
+   booleans:  true / false (any case, legacy: any word starting with t/f)
+   JSON:      {"v": <number|bool>} or {"value": <number|bool>}
+ The parser respects the payload length (payloads are not NUL terminated),
+ integers are decoded without going through floating point.
+-----------------------------------------------------------------------------
+*/
+
+#ifndef _PAYLOAD_H_
+#define _PAYLOAD_H_
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <stdint.h>
+#include <stddef.h>
+
+/**********************
+ *      TYPEDEFS
+ **********************/
+typedef enum
+{
+	PAYLOAD_TEXT = 0,		// printf formatted text (default)
+	PAYLOAD_CBOR = 1,		// RFC 8949 CBOR
+	PAYLOAD_MSGPACK = 2		// MessagePack
+}payload_encoding_t;
+
+typedef enum
+{
+	VALUE_TYPE_NONE = 0,	// no value (null)
+	VALUE_TYPE_BOOL = 1,
+	VALUE_TYPE_INT = 2,		// signed integer
+	VALUE_TYPE_UINT = 3,	// unsigned integer
+	VALUE_TYPE_FLOAT = 4	// double precision floating point
+}value_type_t;
+
+typedef struct
+{
+	value_type_t type;
+	union {
+		bool b;
+		int64_t i;
+		uint64_t u;
+		double f;
+	};
+}typed_value_t;
+
+typedef struct
+{
+	const char *key;		// key (points into payload, not terminated)
+	size_t keyLen;
+	const char *str;		// string value (points into payload), NULL if not a string
+	size_t strLen;
+	typed_value_t value;	// scalar value, VALUE_TYPE_NONE for null or non numeric strings
+}payload_field_t;
+
+/**********************
+ * GLOBAL PROTOTYPES
+ **********************/
+
+/**
+ * Convert encoding name from config file ("text", "cbor", "msgpack")
+ * @param name: encoding name
+ * @param encoding: storage for result
+ * @return false if name is not a valid encoding
+ */
+bool payload_encoding_from_string(const char *name, payload_encoding_t *encoding);
+
+/**
+ * Get typed value as double
+ */
+double typed_value_as_double(const typed_value_t *value);
+
+/**
+ * Encode value as CBOR
+ * @param buf: destination buffer
+ * @param size: size of destination buffer
+ * @param value: value to encode
+ * @param timestamp: source timestamp [ns since epoch], 0 = no timestamp
+ * @return number of bytes written or -1 if the buffer is too small
+ */
+int payload_encode_cbor(uint8_t *buf, size_t size, const typed_value_t *value, uint64_t timestamp);
+
+/**
+ * Encode value as MessagePack
+ * parameters and return value as payload_encode_cbor
+ */
+int payload_encode_msgpack(uint8_t *buf, size_t size, const typed_value_t *value, uint64_t timestamp);
+
+/**
+ * Encode value with binary encoding
+ * @return number of bytes written or -1 on failure (PAYLOAD_TEXT is not handled here)
+ */
+int payload_encode(payload_encoding_t encoding, uint8_t *buf, size_t size, const typed_value_t *value, uint64_t timestamp);
+
+/**
+ * Decode a received payload
+ * @param payload: payload data (not necessarily NUL terminated)
+ * @param payloadlen: number of bytes in payload
+ * @param value: storage for result
+ * @return false if the payload could not be decoded
+ */
+bool payload_parse(const void *payload, int payloadlen, typed_value_t *value);
+
+/**
+ * Decode a flat JSON object (no nested objects or arrays)
+ * @param payload: payload data (not necessarily NUL terminated)
+ * @param payloadlen: number of bytes in payload
+ * @param fields: storage for decoded fields, pointers refer into payload
+ * @param maxFields: size of fields array
+ * @return number of fields or -1 on failure
+ */
+int payload_parse_object(const void *payload, int payloadlen, payload_field_t *fields, int maxFields);
+
+/**
+ * Compare field key
+ * @return true if the field key equals key
+ */
+bool payload_field_is(const payload_field_t *field, const char *key);
+
+/**
+ * Format value as JSON scalar (true/false, integer, float or null)
+ * @return number of characters written or -1 if buffer is too small
+ */
+int payload_format_value(char *buf, size_t size, const typed_value_t *value);
+
+#endif /* _PAYLOAD_H_ */
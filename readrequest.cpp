@@ -0,0 +1,135 @@
+/**
+ * @file readrequest.cpp
+ *
+ */
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "readrequest.h"
+
+/*********************
+ *      DEFINES
+ *********************/
+#define READ_REQUEST_FIELDS_MAX 8
+
+/*********************
+ * LOCAL FUNCTIONS
+ *********************/
+
+/**
+ * Copy request id from JSON field (string or integer)
+ * @param id: destination, READ_REQUEST_ID_MAX+1 characters
+ * @param f: id field
+ */
+static void request_id_copy(char *id, const payload_field_t *f) {
+	size_t len;
+	id[0] = 0;
+	if (f->str != NULL) {
+		len = (f->strLen > READ_REQUEST_ID_MAX) ? READ_REQUEST_ID_MAX : f->strLen;
+		memcpy(id, f->str, len);
+		id[len] = 0;
+	} else if ((f->value.type == VALUE_TYPE_UINT) || (f->value.type == VALUE_TYPE_INT)) {
+		snprintf(id, READ_REQUEST_ID_MAX+1, "%lld", (long long) f->value.i);
+	}
+	// quotes and backslashes would break the response
+	for (char *c = id; *c; c++)
+		if ((*c == '"') || (*c == '\\') || ((unsigned char)*c < 0x20)) *c = '_';
+}
+
+/*********************
+ * GLOBAL FUNCTIONS
+ *********************/
+
+bool read_request_parse(const void *payload, int payloadlen, read_request_t *request) {
+	payload_field_t fields[READ_REQUEST_FIELDS_MAX];
+	char typeName[8];
+	bool haveSlave = false, haveAddress = false;
+	int i, n;
+
+	memset(request, 0, sizeof(read_request_t));
+	request->valueType = MB_VALUE_UINT16;
+	n = payload_parse_object(payload, payloadlen, fields, READ_REQUEST_FIELDS_MAX);
+	if (n < 0) return false;
+	for (i = 0; i < n; i++) {
+		payload_field_t *f = &fields[i];
+		if (payload_field_is(f, "id")) {
+			request_id_copy(request->id, f);
+		} else if (payload_field_is(f, "slave")) {
+			if ((f->value.type != VALUE_TYPE_UINT) || (f->value.u < 1) || (f->value.u > 254)) return false;
+			request->slaveId = (int) f->value.u;
+			haveSlave = true;
+		} else if (payload_field_is(f, "address")) {
+			if ((f->value.type != VALUE_TYPE_UINT) || (f->value.u > 49999)) return false;
+			request->address = (uint16_t) f->value.u;
+			haveAddress = true;
+		} else if (payload_field_is(f, "type")) {
+			if ((f->str == NULL) || (f->strLen >= sizeof(typeName))) return false;
+			memcpy(typeName, f->str, f->strLen);
+			typeName[f->strLen] = 0;
+			if (!mb_value_type_from_string(typeName, &request->valueType)) return false;
+		} else if (payload_field_is(f, "maxage")) {
+			if (f->value.type == VALUE_TYPE_NONE) return false;
+			request->maxAge = typed_value_as_double(&f->value);
+		}
+	}
+	return haveSlave && haveAddress;
+}
+
+int read_response_format(char *buf, size_t size, const read_request_t *request, const typed_value_t *value, uint64_t timestamp, uint64_t ageMs, const char *source, const char *error) {
+	int len, n;
+	len = snprintf(buf, size, "{\"id\":\"%s\",\"slave\":%d,\"address\":%u,", request->id, request->slaveId, request->address);
+	if ((len < 0) || ((size_t)len >= size)) return -1;
+	if (value == NULL) {
+		n = snprintf(&buf[len], size - len, "\"error\":\"%s\"}", error);
+	} else {
+		n = snprintf(&buf[len], size - len, "\"v\":");
+		if ((n < 0) || ((size_t)(len + n) >= size)) return -1;
+		len += n;
+		n = payload_format_value(&buf[len], size - len, value);
+		if (n < 0) return -1;
+		len += n;
+		n = snprintf(&buf[len], size - len, ",\"t\":%llu,\"age\":%llu,\"source\":\"%s\"}",
+			(unsigned long long) timestamp, (unsigned long long) ageMs, source);
+	}
+	if ((n < 0) || ((size_t)(len + n) >= size)) return -1;
+	return len + n;
+}
+
+bool history_query_parse(const void *payload, int payloadlen, history_query_t *query, const char **topic, size_t *topicLen) {
+	payload_field_t fields[READ_REQUEST_FIELDS_MAX];
+	int i, n;
+
+	memset(query, 0, sizeof(history_query_t));
+	query->tagIndex = -1;
+	query->to = UINT64_MAX;
+	query->maxSamples = HISTORY_QUERY_MAX;
+	*topic = NULL;
+	*topicLen = 0;
+	n = payload_parse_object(payload, payloadlen, fields, READ_REQUEST_FIELDS_MAX);
+	if (n < 0) return false;
+	for (i = 0; i < n; i++) {
+		payload_field_t *f = &fields[i];
+		if (payload_field_is(f, "id")) {
+			request_id_copy(query->id, f);
+		} else if (payload_field_is(f, "topic")) {
+			if (f->str == NULL) return false;
+			*topic = f->str;
+			*topicLen = f->strLen;
+		} else if (payload_field_is(f, "from")) {
+			if (f->value.type != VALUE_TYPE_UINT) return false;
+			query->from = f->value.u;
+		} else if (payload_field_is(f, "to")) {
+			if (f->value.type != VALUE_TYPE_UINT) return false;
+			query->to = f->value.u;
+		} else if (payload_field_is(f, "max")) {
+			if ((f->value.type != VALUE_TYPE_UINT) || (f->value.u < 1)) return false;
+			if (f->value.u < HISTORY_QUERY_MAX) query->maxSamples = (int) f->value.u;
+		}
+	}
+	return (*topic != NULL) && (query->from <= query->to);
+}
@@ -0,0 +1,117 @@
+/**
+ * @file readrequest.h
+
+-----------------------------------------------------------------------------
+ On-demand read requests received via MQTT.
+
+ A request is a JSON object published to the read request topic:
+   {"id": "abc", "slave": 10, "address": 40001, "type": "uint16", "maxage": 5}
+   id:      optional, returned unchanged in the response
+   slave:   modbus slave address
+   address: register address (same notation as tag addresses)
+   type:    optional value type, default "uint16" (see mb_value_type_t)
+   maxage:  optional, max age [s] of a cached value, 0 (default) = always read
+
+ The response is published to the read response topic:
+   {"id":"abc","slave":10,"address":40001,"v":123,"t":<ns>,"age":<ms>,"source":"cache"}
+   {"id":"abc","slave":10,"address":40001,"error":"read failed"}
+
+ History queries are published to the history request topic:
+   {"id": "abc", "topic": "<tag topic>", "from": <ms>, "to": <ms>, "max": 500}
+   from / to: optional time range [ms since epoch], default: all samples
+   max:       optional, max number of samples in the response
+ The response contains the samples as [time, value] pairs, "next" is the
+ time of the first sample which didn't fit into the response:
+   {"id":"abc","topic":"...","samples":[[<ms>,<value>],...],"next":<ms>}
+
+ Requests are passed from the MQTT thread to the main loop in a
+ RequestQueue (see requestqueue.h).
+-----------------------------------------------------------------------------
+*/
+
+#ifndef _READREQUEST_H_
+#define _READREQUEST_H_
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <stdint.h>
+#include <stddef.h>
+
+#include "payload.h"
+#include "modbustag.h"
+#include "requestqueue.h"
+
+/*********************
+ *      DEFINES
+ *********************/
+#define READ_REQUEST_ID_MAX 40			// max length of request id
+#define READ_REQUEST_QUEUE_SIZE 32		// max number of queued requests
+#define HISTORY_QUERY_QUEUE_SIZE 8		// max number of queued history queries
+#define HISTORY_QUERY_MAX 1000			// max samples per history response
+
+/**********************
+ *      TYPEDEFS
+ **********************/
+typedef struct
+{
+	char id[READ_REQUEST_ID_MAX+1];		// request id (may be empty)
+	int slaveId;
+	uint16_t address;
+	mb_value_type_t valueType;
+	double maxAge;						// max age of cached value [s]
+}read_request_t;
+
+typedef RequestQueue<read_request_t, READ_REQUEST_QUEUE_SIZE> ReadRequestQueue;
+
+typedef struct
+{
+	char id[READ_REQUEST_ID_MAX+1];		// request id (may be empty)
+	int tagIndex;						// index of tag in tag array
+	uint64_t from;						// start of time range [ms since epoch]
+	uint64_t to;						// end of time range [ms since epoch]
+	int maxSamples;						// max number of samples in response
+}history_query_t;
+
+typedef RequestQueue<history_query_t, HISTORY_QUERY_QUEUE_SIZE> HistoryQueryQueue;
+
+/**********************
+ * GLOBAL PROTOTYPES
+ **********************/
+
+/**
+ * Decode read request
+ * @param payload: payload data (not necessarily NUL terminated)
+ * @param payloadlen: number of bytes in payload
+ * @param request: storage for result
+ * @return false if the request is invalid
+ */
+bool read_request_parse(const void *payload, int payloadlen, read_request_t *request);
+
+/**
+ * Format read response
+ * @param buf: destination buffer
+ * @param size: size of destination buffer
+ * @param request: the request to answer
+ * @param value: value read, NULL if the read failed
+ * @param timestamp: time of reading [ns since epoch]
+ * @param ageMs: age of value [ms]
+ * @param source: "cache" or "bus"
+ * @param error: error text (only used if value is NULL)
+ * @return number of characters written or -1 if the buffer is too small
+ */
+int read_response_format(char *buf, size_t size, const read_request_t *request, const typed_value_t *value, uint64_t timestamp, uint64_t ageMs, const char *source, const char *error);
+
+/**
+ * Decode history query
+ * the tag topic is returned separately as it has to be resolved by the caller
+ * @param payload: payload data (not necessarily NUL terminated)
+ * @param payloadlen: number of bytes in payload
+ * @param query: storage for result (tagIndex is set to -1)
+ * @param topic: storage for pointer to tag topic (points into payload)
+ * @param topicLen: storage for length of tag topic
+ * @return false if the query is invalid
+ */
+bool history_query_parse(const void *payload, int payloadlen, history_query_t *query, const char **topic, size_t *topicLen);
+
+#endif /* _READREQUEST_H_ */
@@ -0,0 +1,68 @@
+/**
+ * @file requestqueue.h
+
+-----------------------------------------------------------------------------
+ Class template "RequestQueue" passes requests received in the MQTT thread
+ to the main loop. It is a fixed size ring buffer protected by a mutex,
+ push and pop never allocate memory.
+-----------------------------------------------------------------------------
+*/
+
+#ifndef _REQUESTQUEUE_H_
+#define _REQUESTQUEUE_H_
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <atomic>
+#include <mutex>
+
+template <typename T, int SIZE>
+class RequestQueue {
+public:
+	RequestQueue() {
+		_head = 0;
+		_count = 0;
+	}
+
+	/**
+	 * Add request
+	 * @return false if the queue is full
+	 */
+	bool push(const T *request) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (_count >= SIZE) return false;
+		_requests[_head] = *request;
+		_head = (_head + 1) % SIZE;
+		_count++;
+		return true;
+	}
+
+	/**
+	 * Remove oldest request
+	 * @param request: storage for request
+	 * @return false if the queue is empty
+	 */
+	bool pop(T *request) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (_count == 0) return false;
+		*request = _requests[(_head - _count + SIZE) % SIZE];
+		_count--;
+		return true;
+	}
+
+	/**
+	 * @return number of queued requests (without locking)
+	 */
+	int count(void) {
+		return _count;
+	}
+
+private:
+	std::mutex _mutex;
+	T _requests[SIZE];
+	int _head;					// next write position
+	std::atomic<int> _count;	// number of queued requests
+};
+
+#endif /* _REQUESTQUEUE_H_ */
@@ -0,0 +1,143 @@
+/**
+ * @file samplebuffer.cpp
+ *
+ */
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "samplebuffer.h"
+
+/*********************
+ *      DEFINES
+ *********************/
+#define SAMPLE_BUFFER_MAGIC 0x4D425342		// "MBSB"
+#define SAMPLE_BUFFER_VERSION 1
+
+/*********************
+ * MEMBER FUNCTIONS
+ *********************/
+
+//
+// Class SampleBuffer
+//
+
+SampleBuffer::SampleBuffer() {
+	_fd = -1;
+	_mapSize = 0;
+	_header = NULL;
+	_records = NULL;
+}
+
+SampleBuffer::~SampleBuffer() {
+	close();
+}
+
+bool SampleBuffer::open(const char *path, uint32_t capacity, uint32_t layoutHash) {
+	void *map;
+	if (isOpen()) close();
+	if ((path == NULL) || (capacity < 1)) return false;
+	_path = path;
+	_fd = ::open(path, O_RDWR | O_CREAT, 0644);
+	if (_fd < 0) {
+		syslog(LOG_ERR, "SampleBuffer - unable to open %s: %s", path, strerror(errno));
+		return false;
+	}
+	_mapSize = sizeof(sample_buffer_header_t) + ((size_t)capacity * sizeof(sample_record_t));
+	if (ftruncate(_fd, _mapSize) < 0) {
+		syslog(LOG_ERR, "SampleBuffer - unable to resize %s: %s", path, strerror(errno));
+		::close(_fd);
+		_fd = -1;
+		return false;
+	}
+	map = mmap(NULL, _mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+	if (map == MAP_FAILED) {
+		syslog(LOG_ERR, "SampleBuffer - mmap %s failed: %s", path, strerror(errno));
+		::close(_fd);
+		_fd = -1;
+		return false;
+	}
+	_header = (sample_buffer_header_t *) map;
+	_records = (sample_record_t *) (_header + 1);
+	// discard existing content if the file doesn't match
+	if ( (_header->magic != SAMPLE_BUFFER_MAGIC) || (_header->version != SAMPLE_BUFFER_VERSION)
+		|| (_header->capacity != capacity) || (_header->recordSize != sizeof(sample_record_t))
+		|| (_header->layoutHash != layoutHash) || (_header->head < _header->tail)
+		|| ((_header->head - _header->tail) > capacity) ) {
+		memset(_header, 0, sizeof(sample_buffer_header_t));
+		_header->magic = SAMPLE_BUFFER_MAGIC;
+		_header->version = SAMPLE_BUFFER_VERSION;
+		_header->capacity = capacity;
+		_header->recordSize = sizeof(sample_record_t);
+		_header->layoutHash = layoutHash;
+	}
+	return true;
+}
+
+void SampleBuffer::close(void) {
+	if (_header != NULL) {
+		msync(_header, _mapSize, MS_SYNC);
+		munmap(_header, _mapSize);
+		_header = NULL;
+		_records = NULL;
+	}
+	if (_fd >= 0) {
+		::close(_fd);
+		_fd = -1;
+	}
+}
+
+bool SampleBuffer::isOpen(void) {
+	return (_header != NULL);
+}
+
+void SampleBuffer::push(uint32_t tagIndex, const typed_value_t *value, uint64_t timestamp) {
+	sample_record_t *rec;
+	if (_header == NULL) return;
+	// evict oldest sample if buffer is full
+	if ((_header->head - _header->tail) >= _header->capacity) {
+		_header->tail++;
+		_header->evicted++;
+	}
+	rec = &_records[_header->head % _header->capacity];
+	rec->timestamp = timestamp;
+	rec->u = value->u;					// copies all union members
+	rec->tagIndex = tagIndex;
+	rec->valueType = (uint8_t) value->type;
+	_header->head++;
+}
+
+bool SampleBuffer::peek(uint32_t *tagIndex, typed_value_t *value, uint64_t *timestamp) {
+	sample_record_t *rec;
+	if ((_header == NULL) || (_header->head == _header->tail)) return false;
+	rec = &_records[_header->tail % _header->capacity];
+	*tagIndex = rec->tagIndex;
+	*timestamp = rec->timestamp;
+	value->type = (value_type_t) rec->valueType;
+	value->u = rec->u;
+	return true;
+}
+
+void SampleBuffer::pop(void) {
+	if ((_header == NULL) || (_header->head == _header->tail)) return;
+	_header->tail++;
+}
+
+uint32_t SampleBuffer::count(void) {
+	if (_header == NULL) return 0;
+	return (uint32_t) (_header->head - _header->tail);
+}
+
+uint64_t SampleBuffer::evictedCount(void) {
+	if (_header == NULL) return 0;
+	return _header->evicted;
+}
@@ -0,0 +1,122 @@
+/**
+ * @file samplebuffer.h
+
+-----------------------------------------------------------------------------
+ Class "SampleBuffer" provides a bounded store-and-forward ring buffer of
+ timestamped samples in a memory mapped file.
+
+ Samples are stored while the MQTT broker is not connected and are drained
+ after the connection has been re-established. When the buffer is full the
+ oldest sample is evicted; evictions are counted in the file header.
+ The file survives a restart of the process, samples are discarded when
+ the tag layout (config file) has changed.
+-----------------------------------------------------------------------------
+*/
+
+#ifndef _SAMPLEBUFFER_H_
+#define _SAMPLEBUFFER_H_
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <stdint.h>
+
+#include <string>
+
+#include "payload.h"
+
+/**********************
+ *      TYPEDEFS
+ **********************/
+typedef struct
+{
+	uint64_t timestamp;		// time of reading [ns since epoch]
+	union {					// value, interpreted according to valueType
+		bool b;
+		int64_t i;
+		uint64_t u;
+		double f;
+	};
+	uint32_t tagIndex;		// index of tag in tag array
+	uint8_t valueType;		// value_type_t
+	uint8_t reserved[3];
+}sample_record_t;
+
+typedef struct
+{
+	uint32_t magic;			// SAMPLE_BUFFER_MAGIC
+	uint32_t version;		// file format version
+	uint32_t capacity;		// number of records
+	uint32_t recordSize;	// sizeof(sample_record_t)
+	uint32_t layoutHash;	// identifies the tag layout the records refer to
+	uint32_t reserved;
+	uint64_t head;			// total number of records written
+	uint64_t tail;			// total number of records removed
+	uint64_t evicted;		// total number of records evicted (buffer full)
+}sample_buffer_header_t;
+
+class SampleBuffer {
+public:
+	SampleBuffer();
+	~SampleBuffer();
+
+	/**
+	 * Open (or create) buffer file
+	 * @param path: file name
+	 * @param capacity: maximum number of samples
+	 * @param layoutHash: hash of tag layout, existing samples are discarded on mismatch
+	 * @return false on failure
+	 */
+	bool open(const char *path, uint32_t capacity, uint32_t layoutHash);
+
+	/**
+	 * Flush and close buffer file
+	 */
+	void close(void);
+
+	/**
+	 * @return true if buffer file is open
+	 */
+	bool isOpen(void);
+
+	/**
+	 * Add sample, evicts the oldest sample if the buffer is full
+	 * @param tagIndex: index of tag in tag array
+	 * @param value: sample value
+	 * @param timestamp: time of reading [ns]
+	 */
+	void push(uint32_t tagIndex, const typed_value_t *value, uint64_t timestamp);
+
+	/**
+	 * Get oldest sample without removing it
+	 * @param tagIndex: storage for tag index
+	 * @param value: storage for value
+	 * @param timestamp: storage for timestamp
+	 * @return false if buffer is empty
+	 */
+	bool peek(uint32_t *tagIndex, typed_value_t *value, uint64_t *timestamp);
+
+	/**
+	 * Remove oldest sample
+	 */
+	void pop(void);
+
+	/**
+	 * @return number of samples in buffer
+	 */
+	uint32_t count(void);
+
+	/**
+	 * @return total number of evicted samples
+	 */
+	uint64_t evictedCount(void);
+
+private:
+	std::string _path;
+	int _fd;
+	size_t _mapSize;
+	sample_buffer_header_t *_header;	// start of mapped file
+	sample_record_t *_records;			// record array following header
+};
+
+#endif /* _SAMPLEBUFFER_H_ */
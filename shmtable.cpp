@@ -0,0 +1,134 @@
+/**
+ * @file shmtable.cpp
+ *
+ */
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shmtable.h"
+
+/*********************
+ * MEMBER FUNCTIONS
+ *********************/
+
+//
+// Class ShmTable
+//
+
+ShmTable::ShmTable() {
+	_mapSize = 0;
+	_header = NULL;
+	_descs = NULL;
+	_slots = NULL;
+}
+
+ShmTable::~ShmTable() {
+	close();
+}
+
+bool ShmTable::open(const char *name, uint32_t slotCount, uint32_t layoutHash) {
+	void *map;
+	int fd;
+	size_t descOffset, slotOffset;
+	struct timespec now;
+
+	if (isOpen()) close();
+	if ((name == NULL) || (slotCount < 1)) return false;
+	_name = name;
+	descOffset = sizeof(shm_table_header_t);
+	slotOffset = descOffset + ((size_t)slotCount * sizeof(shm_tag_desc_t));
+	slotOffset = (slotOffset + 63) & ~(size_t)63;		// slots start on a cache line
+	_mapSize = slotOffset + ((size_t)slotCount * sizeof(shm_slot_t));
+
+	// always start with a fresh object, readers detect this via generation
+	shm_unlink(name);
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0) {
+		syslog(LOG_ERR, "ShmTable - unable to create %s: %s", name, strerror(errno));
+		return false;
+	}
+	if (ftruncate(fd, _mapSize) < 0) {
+		syslog(LOG_ERR, "ShmTable - unable to resize %s: %s", name, strerror(errno));
+		::close(fd);
+		shm_unlink(name);
+		return false;
+	}
+	map = mmap(NULL, _mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);		// the mapping stays valid
+	if (map == MAP_FAILED) {
+		syslog(LOG_ERR, "ShmTable - mmap %s failed: %s", name, strerror(errno));
+		shm_unlink(name);
+		return false;
+	}
+	// ftruncate has zeroed the object: all slots have quality SHM_QUALITY_NONE
+	_header = (shm_table_header_t *) map;
+	_descs = (shm_tag_desc_t *) ((uint8_t *) map + descOffset);
+	_slots = (shm_slot_t *) ((uint8_t *) map + slotOffset);
+	clock_gettime(CLOCK_REALTIME, &now);
+	_header->version = SHM_TABLE_VERSION;
+	_header->headerSize = sizeof(shm_table_header_t);
+	_header->slotCount = slotCount;
+	_header->descSize = sizeof(shm_tag_desc_t);
+	_header->slotSize = sizeof(shm_slot_t);
+	_header->descOffset = (uint32_t) descOffset;
+	_header->slotOffset = (uint32_t) slotOffset;
+	_header->layoutHash = layoutHash;
+	_header->generation = ((uint64_t)now.tv_sec * 1000000000ULL) + (uint64_t)now.tv_nsec;
+	// magic is written last, readers must check it before using the layout
+	__atomic_store_n(&_header->magic, SHM_TABLE_MAGIC, __ATOMIC_RELEASE);
+	return true;
+}
+
+void ShmTable::close(void) {
+	if (_header != NULL) {
+		munmap(_header, _mapSize);
+		shm_unlink(_name.c_str());
+		_header = NULL;
+		_descs = NULL;
+		_slots = NULL;
+	}
+}
+
+bool ShmTable::isOpen(void) {
+	return (_header != NULL);
+}
+
+void ShmTable::setDescriptor(uint32_t index, const char *topic, uint8_t slaveId, uint16_t address) {
+	shm_tag_desc_t *desc;
+	if ((_header == NULL) || (index >= _header->slotCount)) return;
+	desc = &_descs[index];
+	strncpy(desc->topic, topic, SHM_TABLE_TOPIC_MAX - 1);
+	desc->topic[SHM_TABLE_TOPIC_MAX - 1] = 0;
+	desc->slaveId = slaveId;
+	desc->address = address;
+}
+
+void ShmTable::update(uint32_t index, const typed_value_t *value, uint64_t timestamp, shm_quality_t quality) {
+	shm_slot_t *slot;
+	uint32_t seq;
+	if ((_header == NULL) || (index >= _header->slotCount)) return;
+	slot = &_slots[index];
+	// single writer: odd sequence marks the update in progress
+	seq = slot->seq;
+	__atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	if (value != NULL) {
+		slot->valueType = (uint8_t) value->type;
+		slot->u = value->u;			// copies all union members
+		slot->timestamp = timestamp;
+	}
+	slot->quality = (uint8_t) quality;
+	slot->updateCount++;
+	__atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,177 @@
+/**
+ * @file shmtable.h
+
+-----------------------------------------------------------------------------
+ Class "ShmTable" publishes the latest value of every read tag in a POSIX
+ shared memory object (/dev/shm) for local consumers.
+
+ Memory layout (all offsets from the start of the object):
+   shm_table_header_t                  at 0
+   shm_tag_desc_t[slotCount]           at header.descOffset
+   shm_slot_t[slotCount]               at header.slotOffset
+ There is one fixed slot per tag (same index as the tag in the config file).
+
+ Every slot is protected by a sequence lock: the writer increments "seq" to
+ an odd number before and to an even number after updating the slot. The
+ daemon never waits for readers. A reader copies the slot and retries if the
+ sequence was odd or has changed meanwhile, see shm_table_read().
+ header.generation changes each time the daemon (re)creates the table.
+
+ This header can be included by C++ consumer programs, readers only need
+ shm_open(name, O_RDONLY), mmap(PROT_READ) and shm_table_read().
+-----------------------------------------------------------------------------
+*/
+
+#ifndef _SHMTABLE_H_
+#define _SHMTABLE_H_
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+
+#include "payload.h"
+
+/*********************
+ *      DEFINES
+ *********************/
+#define SHM_TABLE_MAGIC 0x4D42544C		// "MBTL"
+#define SHM_TABLE_VERSION 1
+#define SHM_TABLE_TOPIC_MAX 96			// size of topic in tag descriptor (incl. NUL)
+
+/**********************
+ *      TYPEDEFS
+ **********************/
+typedef enum
+{
+	SHM_QUALITY_NONE = 0,	// no value received yet
+	SHM_QUALITY_GOOD = 1,	// value from last successful read
+	SHM_QUALITY_BAD = 2		// last read failed (noread), value is the last good value
+}shm_quality_t;
+
+typedef struct
+{
+	uint32_t magic;			// SHM_TABLE_MAGIC
+	uint32_t version;		// SHM_TABLE_VERSION
+	uint32_t headerSize;	// sizeof(shm_table_header_t)
+	uint32_t slotCount;		// number of tags
+	uint32_t descSize;		// sizeof(shm_tag_desc_t)
+	uint32_t slotSize;		// sizeof(shm_slot_t)
+	uint32_t descOffset;	// offset of tag descriptor array
+	uint32_t slotOffset;	// offset of slot array
+	uint32_t layoutHash;	// hash of tag layout (changes with the config file)
+	uint32_t reserved;
+	uint64_t generation;	// time the table was created [ns since epoch]
+}shm_table_header_t;
+
+typedef struct
+{
+	char topic[SHM_TABLE_TOPIC_MAX];	// MQTT topic of tag
+	uint16_t address;					// register address
+	uint8_t slaveId;					// modbus slave
+	uint8_t reserved[5];
+}shm_tag_desc_t;
+
+typedef struct
+{
+	uint32_t seq;			// sequence lock, odd while the slot is updated
+	uint8_t valueType;		// value_type_t
+	uint8_t quality;		// shm_quality_t
+	uint16_t reserved;
+	uint64_t timestamp;		// time of reading [ns since epoch]
+	union {					// value, interpreted according to valueType
+		bool b;
+		int64_t i;
+		uint64_t u;
+		double f;
+	};
+	uint64_t updateCount;	// number of updates
+}shm_slot_t;
+
+/**********************
+ * GLOBAL PROTOTYPES
+ **********************/
+
+/**
+ * Read a slot consistently (reader side, lock-free)
+ * @param slots: slot array (mapped object + header->slotOffset)
+ * @param index: slot index
+ * @param result: storage for slot copy
+ * @param maxRetries: give up after this number of concurrent updates
+ * @return false if no consistent copy could be made
+ */
+static inline bool shm_table_read(const shm_slot_t *slots, uint32_t index, shm_slot_t *result, int maxRetries) {
+	const shm_slot_t *slot = &slots[index];
+	uint32_t seq1, seq2;
+	for (int i = 0; i <= maxRetries; i++) {
+		seq1 = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq1 & 1) continue;			// update in progress
+		result->valueType = slot->valueType;
+		result->quality = slot->quality;
+		result->timestamp = slot->timestamp;
+		result->u = slot->u;
+		result->updateCount = slot->updateCount;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		seq2 = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+		if (seq1 == seq2) {
+			result->seq = seq1;
+			return true;
+		}
+	}
+	return false;
+}
+
+class ShmTable {
+public:
+	ShmTable();
+	~ShmTable();
+
+	/**
+	 * Create shared memory table, an existing object is replaced
+	 * @param name: shared memory object name (e.g. "/mbbridge")
+	 * @param slotCount: number of tags
+	 * @param layoutHash: hash of tag layout
+	 * @return false on failure
+	 */
+	bool open(const char *name, uint32_t slotCount, uint32_t layoutHash);
+
+	/**
+	 * Unmap and remove shared memory table
+	 */
+	void close(void);
+
+	/**
+	 * @return true if table is open
+	 */
+	bool isOpen(void);
+
+	/**
+	 * Set tag descriptor
+	 * @param index: slot index
+	 * @param topic: MQTT topic (truncated if too long)
+	 * @param slaveId: modbus slave
+	 * @param address: register address
+	 */
+	void setDescriptor(uint32_t index, const char *topic, uint8_t slaveId, uint16_t address);
+
+	/**
+	 * Update slot (writer side, never blocks)
+	 * @param index: slot index
+	 * @param value: new value, NULL to keep the current value (quality change only)
+	 * @param timestamp: time of reading [ns]
+	 * @param quality: shm_quality_t
+	 */
+	void update(uint32_t index, const typed_value_t *value, uint64_t timestamp, shm_quality_t quality);
+
+private:
+	std::string _name;
+	size_t _mapSize;
+	shm_table_header_t *_header;	// start of mapped object
+	shm_tag_desc_t *_descs;			// tag descriptors
+	shm_slot_t *_slots;				// value slots
+};
+
+#endif /* _SHMTABLE_H_ */
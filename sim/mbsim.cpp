@@ -0,0 +1,598 @@
+/**
+ * @file mbsim.cpp
+ *
+-----------------------------------------------------------------------------
+ Modbus RTU slave simulator on a pseudo-terminal
+
+ Creates a pty pair and answers requests for many slave IDs behind the one
+ port. mbbridge is pointed at the pty (modbusrtu.device = link name), no
+ RS485 hardware is required.
+
+ The register map of every slave is generated from an mbbridge config file
+ (mbslaves and mqtt_tags), or with -n for slaves 1..n with a fixed map.
+ Registers of slaves in the config file exist from address 0 up to the
+ highest configured address, reads beyond return exception 2 (illegal data
+ address), requests for unknown slaves are not answered (timeout).
+
+ Supported function codes: 1, 2, 3, 4, 5, 6, 15, 16
+
+ Faults can be injected with a probability per request:
+   no response (timeout), CRC error, exception response
+ The transmission time of the RTU line can be simulated for a baud rate
+ (11 bits per character), 0 = no line delay (accelerated).
+ With -k the simulator uses the virtual clock of the bridge (clock.virtual)
+ and advances it by the line time and response delay instead of waiting.
+
+ With -p a capture of a field bus (tools/mbcapture, see capture.h) is
+ replayed: requests found in the capture are answered with the captured
+ responses in their original order and response time, including missing
+ and corrupted responses. Other requests are simulated as usual.
+
+ The slave side of the RTU protocol is implemented here instead of using
+ libmodbus server contexts: a libmodbus RTU context only answers one slave
+ address, and owning the framing allows to corrupt responses.
+
+ usage: mbsim [options]
+   -c <file>     generate slaves and registers from mbbridge config file
+   -n <count>    simulate slaves 1..count (1000 registers of each type)
+   -l <link>     create symlink to the pty (default /tmp/ttyMBSIM)
+   -b <baud>     simulate line speed (default 0 = no line delay)
+   -d <ms>       additional response delay
+   -t <percent>  probability of no response (timeout)
+   -e <percent>  probability of a CRC error in the response
+   -x <percent>[:code]  probability of an exception response (default code 4)
+   -f <slave>    inject faults for this slave only
+   -g            input registers change on every read (counters)
+   -r <seed>     random seed for fault injection (default 1)
+   -k <name>     use virtual clock (shared memory name, see clock.h)
+   -p <file>     replay captured responses (tools/mbcapture)
+   -v            print every request
+-----------------------------------------------------------------------------
+*/
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <libconfig.h++>
+
+#include "../capture.h"
+#include "../clock.h"
+
+using namespace libconfig;
+
+/*********************
+ *      DEFINES
+ *********************/
+#define SIM_LINK_DEFAULT "/tmp/ttyMBSIM"
+#define SIM_SLAVES 248					// slave IDs 0 .. 247
+#define SIM_REGISTERS_DEFAULT 1000		// registers per type with -n
+#define SIM_FRAME_MAX 256				// RTU ADU size
+#define SIM_FRAME_TIMEOUT_MS 50			// discard incomplete request after this gap
+
+/**********************
+ *      TYPEDEFS
+ **********************/
+typedef struct
+{
+	bool present;
+	std::vector<uint8_t> coils;			// 0xxxx, FC 1, 5, 15
+	std::vector<uint8_t> inputs;		// 1xxxx, FC 2
+	std::vector<uint16_t> inputRegs;	// 3xxxx, FC 4
+	std::vector<uint16_t> holdingRegs;	// 4xxxx, FC 3, 6, 16
+	uint64_t requests;
+	uint64_t faults;
+}sim_slave_t;
+
+typedef struct
+{
+	std::vector<std::vector<uint8_t> > responses;	// in capture order, empty = no response
+	std::vector<uint32_t> rtt;						// response time [us]
+	size_t next;									// next response to serve
+}replay_t;
+
+/**********************
+ *  STATIC VARIABLES
+ **********************/
+static sim_slave_t slaves[SIM_SLAVES];
+static volatile sig_atomic_t exitSignal = 0;
+static int baudRate = 0;
+static int responseDelayMs = 0;
+static double timeoutPct = 0.0;
+static double crcErrorPct = 0.0;
+static double exceptionPct = 0.0;
+static int exceptionCode = 4;			// slave device failure
+static int faultSlave = -1;				// -1 = all slaves
+static bool counters = false;
+static bool verbose = false;
+static std::map<std::vector<uint8_t>, replay_t> replay;	// request ADU -> captured responses
+static uint64_t replayServed = 0;
+static uint64_t replayMissed = 0;			// requests not in capture
+
+/**********************
+ *   LOCAL FUNCTIONS
+ **********************/
+static void sig_handler(int signum) {
+	(void)signum;
+	exitSignal = 1;
+}
+
+static uint16_t crc16(const uint8_t *buf, int len) {
+	uint16_t crc = 0xFFFF;
+	for (int i = 0; i < len; i++) {
+		crc ^= buf[i];
+		for (int b = 0; b < 8; b++)
+			crc = (crc & 1) ? ((crc >> 1) ^ 0xA001) : (crc >> 1);
+	}
+	return crc;
+}
+
+static bool chance(double percent) {
+	if (percent <= 0.0) return false;
+	return ((double)rand() / ((double)RAND_MAX + 1.0)) * 100.0 < percent;
+}
+
+/**
+ * time to transmit characters on the RTU line [us]
+ */
+static uint64_t line_time_us(int chars) {
+	if (baudRate <= 0) return 0;
+	return ((uint64_t)chars * 11ULL * 1000000ULL) / (uint64_t)baudRate;
+}
+
+/**
+ * make sure register tables of a slave reach address (protocol address)
+ */
+static void slave_reserve(int id, int type, int address) {
+	sim_slave_t *s = &slaves[id];
+	size_t size = (size_t)address + 1;
+	s->present = true;
+	switch (type) {
+	case 0: if (s->coils.size() < size) s->coils.resize(size, 0); break;
+	case 1: if (s->inputs.size() < size) s->inputs.resize(size, 0); break;
+	case 3: if (s->inputRegs.size() < size) s->inputRegs.resize(size, 0); break;
+	case 4: if (s->holdingRegs.size() < size) s->holdingRegs.resize(size, 0); break;
+	default: break;
+	}
+}
+
+/**
+ * fill registers with generated values
+ */
+static void slave_init_values(int id) {
+	sim_slave_t *s = &slaves[id];
+	size_t i;
+	for (i = 0; i < s->coils.size(); i++) s->coils[i] = (i + id) & 1;
+	for (i = 0; i < s->inputs.size(); i++) s->inputs[i] = ((i + id) >> 1) & 1;
+	for (i = 0; i < s->inputRegs.size(); i++) s->inputRegs[i] = (uint16_t)(i * 7 + id);
+	for (i = 0; i < s->holdingRegs.size(); i++) s->holdingRegs[i] = (uint16_t)(i * 3 + id);
+}
+
+/**
+ * add register of a config file address (0xxxx .. 4xxxx)
+ */
+static void config_address(int id, int address, int registers) {
+	int type = address / 10000;
+	int offset = address % 10000;
+	if ((id <= 0) || (id >= SIM_SLAVES)) return;
+	if ((type == 2) || (type > 4)) return;
+	slave_reserve(id, type, offset + registers - 1);
+}
+
+static int value_registers(Setting &tag) {
+	std::string valueType;
+	if (tag.lookupValue("valuetype", valueType) && (valueType.find("32") != std::string::npos)) return 2;
+	return 1;
+}
+
+/**
+ * build slaves from mbbridge config file
+ */
+static bool config_load(const char *path) {
+	Config cfg;
+	int id, address, count = 0;
+	bool enabled;
+
+	try {
+		cfg.readFile(path);
+	} catch (const FileIOException &e) {
+		fprintf(stderr, "can't read <%s>\n", path);
+		return false;
+	} catch (const ParseException &e) {
+		fprintf(stderr, "%s:%d %s\n", e.getFile(), e.getLine(), e.getError());
+		return false;
+	}
+	if (cfg.exists("mbslaves")) {
+		Setting &slaveList = cfg.lookup("mbslaves");
+		for (int i = 0; i < slaveList.getLength(); i++) {
+			if (!slaveList[i].lookupValue("id", id)) continue;
+			if (slaveList[i].lookupValue("enabled", enabled) && !enabled) continue;
+			if ((id <= 0) || (id >= SIM_SLAVES)) continue;
+			slaves[id].present = true;
+			if (!slaveList[i].exists("tags")) continue;
+			Setting &tags = slaveList[i]["tags"];
+			for (int t = 0; t < tags.getLength(); t++) {
+				if (!tags[t].lookupValue("address", address)) continue;
+				config_address(id, address, value_registers(tags[t]));
+				count++;
+			}
+		}
+	}
+	if (cfg.exists("mqtt_tags")) {
+		Setting &tags = cfg.lookup("mqtt_tags");
+		for (int t = 0; t < tags.getLength(); t++) {
+			if (!tags[t].lookupValue("slaveid", id) || !tags[t].lookupValue("address", address)) continue;
+			config_address(id, address, value_registers(tags[t]));
+			count++;
+		}
+	}
+	for (id = 0; id < SIM_SLAVES; id++)
+		if (slaves[id].present) slave_init_values(id);
+	printf("%s: %d registers\n", path, count);
+	return true;
+}
+
+/**
+ * @return expected length of request in buf or 0 if not yet known
+ */
+static int request_length(const uint8_t *buf, int len) {
+	if (len < 2) return 0;
+	switch (buf[1]) {
+	case 1: case 2: case 3: case 4: case 5: case 6:
+		return 8;
+	case 15: case 16:
+		if (len < 7) return 0;
+		return 9 + buf[6];
+	default:
+		return -1;		// unsupported, resync
+	}
+}
+
+static int exception_response(uint8_t *rsp, const uint8_t *req, int code) {
+	rsp[0] = req[0];
+	rsp[1] = req[1] | 0x80;
+	rsp[2] = (uint8_t)code;
+	return 3;
+}
+
+/**
+ * process request
+ * @return length of response without CRC, 0 = no response
+ */
+static int process_request(const uint8_t *req, int len, uint8_t *rsp) {
+	sim_slave_t *s = &slaves[req[0]];
+	int fc = req[1];
+	int addr = (req[2] << 8) | req[3];
+	int nb = (req[4] << 8) | req[5];
+	int i, n;
+
+	(void)len;
+	rsp[0] = req[0];
+	rsp[1] = req[1];
+	switch (fc) {
+	case 1:
+	case 2: {
+		std::vector<uint8_t> &bits = (fc == 1) ? s->coils : s->inputs;
+		if ((nb < 1) || (nb > 2000)) return exception_response(rsp, req, 3);
+		if ((size_t)(addr + nb) > bits.size()) return exception_response(rsp, req, 2);
+		n = (nb + 7) / 8;
+		rsp[2] = (uint8_t)n;
+		memset(rsp + 3, 0, n);
+		for (i = 0; i < nb; i++)
+			if (bits[addr + i]) rsp[3 + i / 8] |= (uint8_t)(1 << (i % 8));
+		return 3 + n;
+	}
+	case 3:
+	case 4: {
+		std::vector<uint16_t> &regs = (fc == 3) ? s->holdingRegs : s->inputRegs;
+		if ((nb < 1) || (nb > 125)) return exception_response(rsp, req, 3);
+		if ((size_t)(addr + nb) > regs.size()) return exception_response(rsp, req, 2);
+		rsp[2] = (uint8_t)(nb * 2);
+		for (i = 0; i < nb; i++) {
+			rsp[3 + i * 2] = regs[addr + i] >> 8;
+			rsp[4 + i * 2] = regs[addr + i] & 0xFF;
+			if (counters && (fc == 4)) regs[addr + i]++;
+		}
+		return 3 + nb * 2;
+	}
+	case 5:
+		if ((size_t)addr >= s->coils.size()) return exception_response(rsp, req, 2);
+		if ((nb != 0xFF00) && (nb != 0x0000)) return exception_response(rsp, req, 3);
+		s->coils[addr] = (nb == 0xFF00);
+		memcpy(rsp, req, 6);
+		return 6;
+	case 6:
+		if ((size_t)addr >= s->holdingRegs.size()) return exception_response(rsp, req, 2);
+		s->holdingRegs[addr] = (uint16_t)nb;
+		memcpy(rsp, req, 6);
+		return 6;
+	case 15:
+		if ((nb < 1) || (nb > 1968) || (req[6] != (nb + 7) / 8)) return exception_response(rsp, req, 3);
+		if ((size_t)(addr + nb) > s->coils.size()) return exception_response(rsp, req, 2);
+		for (i = 0; i < nb; i++)
+			s->coils[addr + i] = (req[7 + i / 8] >> (i % 8)) & 1;
+		memcpy(rsp, req, 6);
+		return 6;
+	case 16:
+		if ((nb < 1) || (nb > 123) || (req[6] != nb * 2)) return exception_response(rsp, req, 3);
+		if ((size_t)(addr + nb) > s->holdingRegs.size()) return exception_response(rsp, req, 2);
+		for (i = 0; i < nb; i++)
+			s->holdingRegs[addr + i] = (uint16_t)((req[7 + i * 2] << 8) | req[8 + i * 2]);
+		memcpy(rsp, req, 6);
+		return 6;
+	default:
+		return exception_response(rsp, req, 1);
+	}
+}
+
+/**
+ * load capture file for replay
+ * @return number of captured requests or -1 on failure
+ */
+static int capture_load(const char *path) {
+	capture_file_header_t header;
+	capture_record_t rec;
+	uint8_t req[CAPTURE_FRAME_MAX], rsp[CAPTURE_FRAME_MAX];
+	replay_t *r;
+	int count = 0;
+	FILE *f = fopen(path, "rb");
+
+	if (f == NULL) {
+		perror(path);
+		return -1;
+	}
+	if ((fread(&header, sizeof(header), 1, f) != 1) || (header.magic != CAPTURE_MAGIC) ||
+		(header.version != CAPTURE_VERSION) || (header.recordSize != sizeof(capture_record_t))) {
+		fprintf(stderr, "%s: not a capture file (version %d)\n", path, CAPTURE_VERSION);
+		fclose(f);
+		return -1;
+	}
+	while (fread(&rec, sizeof(rec), 1, f) == 1) {
+		if ((rec.requestLen > CAPTURE_FRAME_MAX) || (rec.responseLen > CAPTURE_FRAME_MAX) ||
+			(fread(req, 1, rec.requestLen, f) != rec.requestLen) ||
+			(fread(rsp, 1, rec.responseLen, f) != rec.responseLen)) {
+			fprintf(stderr, "%s: truncated after %d records\n", path, count);
+			break;
+		}
+		r = &replay[std::vector<uint8_t>(req, req + rec.requestLen)];
+		r->responses.push_back(std::vector<uint8_t>(rsp, rsp + rec.responseLen));
+		r->rtt.push_back(rec.rtt);
+		count++;
+	}
+	fclose(f);
+	return count;
+}
+
+/**
+ * answer a request from the capture
+ * @return false if the request is not in the capture
+ */
+static bool replay_frame(int fd, const uint8_t *req, int len) {
+	std::map<std::vector<uint8_t>, replay_t>::iterator it;
+	replay_t *r;
+	size_t i;
+
+	it = replay.find(std::vector<uint8_t>(req, req + len));
+	if (it == replay.end()) {
+		replayMissed++;
+		return false;
+	}
+	r = &it->second;
+	i = r->next;
+	r->next = (i + 1) % r->responses.size();	// start over when the capture is exhausted
+	replayServed++;
+	if (req[0] < SIM_SLAVES) slaves[req[0]].requests++;
+	if (verbose)
+		printf("#%d FC%d: replay %zu/%zu, %zu bytes after %uus\n", req[0], req[1], i + 1, r->responses.size(), r->responses[i].size(), r->rtt[i]);
+	if (r->responses[i].empty()) return true;	// captured timeout
+	clock_sleep_us(r->rtt[i]);
+	if (write(fd, r->responses[i].data(), r->responses[i].size()) != (ssize_t)r->responses[i].size())
+		fprintf(stderr, "write failed: %s\n", strerror(errno));
+	return true;
+}
+
+/**
+ * handle one complete request frame
+ */
+static void handle_frame(int fd, const uint8_t *req, int len) {
+	uint8_t rsp[SIM_FRAME_MAX];
+	uint16_t crc;
+	int id = req[0], n;
+	bool faults;
+
+	if (crc16(req, len - 2) != (uint16_t)(req[len - 2] | (req[len - 1] << 8))) {
+		if (verbose) printf("#%d FC%d: request CRC error, ignored\n", id, req[1]);
+		return;
+	}
+	if (!replay.empty() && replay_frame(fd, req, len)) return;
+	if ((id == 0) || (id >= SIM_SLAVES) || !slaves[id].present) return;	// no such slave
+	slaves[id].requests++;
+	faults = (faultSlave < 0) || (faultSlave == id);
+	if (verbose)
+		printf("#%d FC%d addr %d nb %d\n", id, req[1], (req[2] << 8) | req[3], (req[4] << 8) | req[5]);
+	if (faults && chance(timeoutPct)) {
+		slaves[id].faults++;
+		if (verbose) printf("#%d: injected timeout\n", id);
+		return;
+	}
+	if (faults && chance(exceptionPct)) {
+		slaves[id].faults++;
+		n = exception_response(rsp, req, exceptionCode);
+	} else {
+		n = process_request(req, len, rsp);
+	}
+	if (n <= 0) return;
+	crc = crc16(rsp, n);
+	rsp[n++] = crc & 0xFF;
+	rsp[n++] = crc >> 8;
+	if (faults && chance(crcErrorPct)) {
+		slaves[id].faults++;
+		rsp[n - 1] ^= 0x5A;
+		if (verbose) printf("#%d: injected CRC error\n", id);
+	}
+	// transmission of request and response, slave turnaround
+	clock_sleep_us(((uint64_t)responseDelayMs * 1000ULL) + line_time_us(len + n));
+	if (write(fd, rsp, n) != n)
+		fprintf(stderr, "write failed: %s\n", strerror(errno));
+}
+
+static bool open_pty(int *master, int *slave, const char *link) {
+	struct termios tio;
+	const char *name;
+
+	*master = posix_openpt(O_RDWR | O_NOCTTY);
+	if ((*master < 0) || (grantpt(*master) != 0) || (unlockpt(*master) != 0)) {
+		perror("posix_openpt");
+		return false;
+	}
+	name = ptsname(*master);
+	// keep the slave side open, the master would see EIO while the bridge reconnects
+	*slave = open(name, O_RDWR | O_NOCTTY);
+	if (*slave < 0) {
+		perror(name);
+		return false;
+	}
+	tcgetattr(*slave, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(*slave, TCSANOW, &tio);
+	unlink(link);
+	if (symlink(name, link) != 0) {
+		perror(link);
+		return false;
+	}
+	printf("simulated RTU port %s -> %s\n", link, name);
+	return true;
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "usage: %s [-c cfgfile | -n slaves] [-l link] [-b baud] [-d ms] [-t %%] [-e %%] [-x %%[:code]] [-f slave] [-g] [-r seed] [-k clock] [-p capture] [-v]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+	const char *cfgFile = NULL;
+	const char *clockName = NULL;
+	const char *captureFile = NULL;
+	std::string link = SIM_LINK_DEFAULT;
+	uint8_t buf[SIM_FRAME_MAX * 2];
+	struct pollfd pfd;
+	int master, slaveFd, opt, n, len = 0, frameLen, slaveCount = 0, seed = 1, present = 0;
+	uint64_t requests = 0, faults = 0;
+	char *colon;
+
+	while ((opt = getopt(argc, argv, "c:n:l:b:d:t:e:x:f:gr:k:p:vh")) != -1) {
+		switch (opt) {
+		case 'c': cfgFile = optarg; break;
+		case 'n': slaveCount = atoi(optarg); break;
+		case 'l': link = optarg; break;
+		case 'b': baudRate = atoi(optarg); break;
+		case 'd': responseDelayMs = atoi(optarg); break;
+		case 't': timeoutPct = atof(optarg); break;
+		case 'e': crcErrorPct = atof(optarg); break;
+		case 'x':
+			exceptionPct = atof(optarg);
+			colon = strchr(optarg, ':');
+			if (colon != NULL) exceptionCode = atoi(colon + 1);
+			break;
+		case 'f': faultSlave = atoi(optarg); break;
+		case 'g': counters = true; break;
+		case 'r': seed = atoi(optarg); break;
+		case 'k': clockName = optarg; break;
+		case 'p': captureFile = optarg; break;
+		case 'v': verbose = true; break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if ((cfgFile == NULL) && (slaveCount <= 0) && (captureFile == NULL)) {
+		usage(argv[0]);
+		return 1;
+	}
+	srand(seed);
+	if ((clockName != NULL) && !clock_virtual_attach(clockName, false, 0, 0)) {
+		perror(clockName);
+		return 1;
+	}
+	if ((cfgFile != NULL) && !config_load(cfgFile)) return 1;
+	for (int id = 1; (id <= slaveCount) && (id < SIM_SLAVES); id++) {
+		slave_reserve(id, 0, SIM_REGISTERS_DEFAULT - 1);
+		slave_reserve(id, 1, SIM_REGISTERS_DEFAULT - 1);
+		slave_reserve(id, 3, SIM_REGISTERS_DEFAULT - 1);
+		slave_reserve(id, 4, SIM_REGISTERS_DEFAULT - 1);
+		slave_init_values(id);
+	}
+	for (int id = 1; id < SIM_SLAVES; id++)
+		if (slaves[id].present) present++;
+	printf("%d slaves\n", present);
+	if (captureFile != NULL) {
+		n = capture_load(captureFile);
+		if (n < 0) return 1;
+		printf("%d captured requests (%zu different) to replay\n", n, replay.size());
+	}
+	if (!open_pty(&master, &slaveFd, link.c_str())) return 1;
+	fflush(stdout);
+
+	signal(SIGINT, sig_handler);
+	signal(SIGTERM, sig_handler);
+	pfd.fd = master;
+	pfd.events = POLLIN;
+	while (!exitSignal) {
+		pfd.revents = 0;
+		n = poll(&pfd, 1, SIM_FRAME_TIMEOUT_MS);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		if (n == 0) {
+			len = 0;	// gap: discard incomplete request
+			continue;
+		}
+		n = read(master, buf + len, sizeof(buf) - len);
+		if (n <= 0) {
+			if ((n < 0) && (errno != EAGAIN) && (errno != EINTR) && (errno != EIO)) break;
+			continue;
+		}
+		len += n;
+		// extract complete frames
+		while ((frameLen = request_length(buf, len)) != 0) {
+			if ((frameLen < 0) || (frameLen > SIM_FRAME_MAX)) {
+				len = 0;	// garbage
+				break;
+			}
+			if (len < frameLen) break;
+			handle_frame(master, buf, frameLen);
+			memmove(buf, buf + frameLen, len - frameLen);
+			len -= frameLen;
+		}
+		if (verbose) fflush(stdout);
+	}
+	for (int id = 1; id < SIM_SLAVES; id++) {
+		if (slaves[id].requests == 0) continue;
+		printf("slave %3d: %llu requests, %llu faults injected\n", id,
+			(unsigned long long)slaves[id].requests, (unsigned long long)slaves[id].faults);
+		requests += slaves[id].requests;
+		faults += slaves[id].faults;
+	}
+	printf("total: %llu requests, %llu faults injected\n", (unsigned long long)requests, (unsigned long long)faults);
+	if (captureFile != NULL)
+		printf("replay: %llu requests answered from capture, %llu not in capture\n", (unsigned long long)replayServed, (unsigned long long)replayMissed);
+	unlink(link.c_str());
+	close(slaveFd);
+	close(master);
+	return 0;
+}
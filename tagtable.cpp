@@ -0,0 +1,135 @@
+/**
+ * @file tagtable.cpp
+ *
+ */
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <stddef.h>
+
+#include "tagtable.h"
+
+/*********************
+ * MEMBER FUNCTIONS
+ *********************/
+
+//
+// Class TagTable
+//
+
+TagTable::TagTable() {
+	_count = 0;
+	_address = NULL;
+	_slaveId = NULL;
+	_registerCount = NULL;
+	_registerType = NULL;
+	_group = NULL;
+	_referenceTime = NULL;
+}
+
+TagTable::~TagTable() {
+	release();
+}
+
+void TagTable::allocate(int count) {
+	release();
+	if (count < 1) return;
+	_count = count;
+	_address = new uint16_t[count]();
+	_slaveId = new uint8_t[count]();
+	_registerCount = new uint8_t[count]();
+	_registerType = new int8_t[count]();
+	_group = new int32_t[count]();
+	_referenceTime = new time_t[count]();
+}
+
+void TagTable::release(void) {
+	if (_count == 0) return;
+	delete [] _address;
+	delete [] _slaveId;
+	delete [] _registerCount;
+	delete [] _registerType;
+	delete [] _group;
+	delete [] _referenceTime;
+	_count = 0;
+	_address = NULL;
+	_slaveId = NULL;
+	_registerCount = NULL;
+	_registerType = NULL;
+	_group = NULL;
+	_referenceTime = NULL;
+}
+
+void TagTable::set(int index, ModbusTag *tag) {
+	if ((index < 0) || (index >= _count)) return;
+	_address[index] = tag->getRegisterAddress();
+	_slaveId[index] = tag->getSlaveId();
+	_registerCount[index] = (uint8_t) tag->getRegisterCount();
+	_registerType[index] = (int8_t) tag->getRegisterType();
+	_group[index] = tag->getGroup();
+	_referenceTime[index] = 0;
+}
+
+int TagTable::groupRange(const int *tagArray, int tagArraySize, int slave, int grp, int *addrLo, int *addrHi) {
+	int i, id, addr, addrEnd, count = 0;
+	int lo = 99999, hi = 0;
+	for (i = 0; i < tagArraySize; i++) {
+		id = tagArray[i];
+		if ((_slaveId[id] != slave) || (_group[id] != grp)) continue;
+		addr = _address[id];
+		addrEnd = addr + _registerCount[id] - 1;	// 32 bit values occupy two registers
+		if (addr < lo) lo = addr;
+		if (addrEnd > hi) hi = addrEnd;
+		count++;
+	}
+	*addrLo = lo;
+	*addrHi = hi;
+	return count;
+}
+
+//
+// Class TagIndex
+//
+
+TagIndex::TagIndex() {
+	_keyCount = 0;
+	_offsets = NULL;
+	_tags = NULL;
+}
+
+TagIndex::~TagIndex() {
+	release();
+}
+
+void TagIndex::build(const int *keys, int count, int keyCount) {
+	int i, key;
+	release();
+	if (keyCount < 1) return;
+	_keyCount = keyCount;
+	_offsets = new int[keyCount+1]();
+	// count tags per key
+	for (i = 0; i < count; i++) {
+		key = keys[i];
+		if ((key >= 0) && (key < keyCount)) _offsets[key+1]++;
+	}
+	for (key = 0; key < keyCount; key++)
+		_offsets[key+1] += _offsets[key];
+	_tags = new int[(_offsets[keyCount] > 0) ? _offsets[keyCount] : 1];
+	// place tags, _offsets[key] is used as insert position and restored below
+	for (i = 0; i < count; i++) {
+		key = keys[i];
+		if ((key >= 0) && (key < keyCount)) _tags[_offsets[key]++] = i;
+	}
+	for (key = keyCount; key > 0; key--)
+		_offsets[key] = _offsets[key-1];
+	_offsets[0] = 0;
+}
+
+void TagIndex::release(void) {
+	if (_offsets != NULL) delete [] _offsets;
+	if (_tags != NULL) delete [] _tags;
+	_keyCount = 0;
+	_offsets = NULL;
+	_tags = NULL;
+}
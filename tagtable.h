@@ -0,0 +1,134 @@
+/**
+ * @file tagtable.h
+
+-----------------------------------------------------------------------------
+ Class "TagTable" keeps the fields of the read tags which are needed to
+ plan and execute the modbus reads (slave, address, register count/type,
+ group, reference time) in dense arrays indexed by tag index.
+
+ The read loops scan these arrays only, the ModbusTag objects (topic,
+ format, scaling, noread configuration, ...) are only touched when a tag
+ is updated or published. A tag occupies 17 bytes in the table instead of
+ several cache lines in ModbusTag.
+ ModbusTag remains the owner of these settings (write tags, shared
+ memory, config cache and reload use them), the table is a derived copy
+ which is rebuilt from the tags by mb_assign_updatecycles() whenever the
+ tag array is built or replaced and is never written otherwise. Only the
+ reference time is kept in the table alone.
+
+ Class "TagIndex" groups tag indexes by a key (update cycle, slave ID) in
+ one contiguous array with an offset per key. The tags of a key are a
+ range with explicit size, the index is built in linear time and keeps the
+ config file order within each key.
+-----------------------------------------------------------------------------
+*/
+
+#ifndef _TAGTABLE_H_
+#define _TAGTABLE_H_
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <stdint.h>
+#include <time.h>
+
+#include "modbustag.h"
+
+class TagTable {
+public:
+	TagTable();
+	~TagTable();
+
+	/**
+	 * Allocate table, all entries are cleared
+	 * @param count: number of tags
+	 */
+	void allocate(int count);
+
+	/**
+	 * Free table
+	 */
+	void release(void);
+
+	/**
+	 * Copy the read planning fields of a tag into the table
+	 * @param index: tag index
+	 * @param tag: the tag
+	 */
+	void set(int index, ModbusTag *tag);
+
+	int count(void) { return _count; };
+	uint8_t slaveId(int index) { return _slaveId[index]; };
+	uint16_t address(int index) { return _address[index]; };
+	uint8_t registerCount(int index) { return _registerCount[index]; };
+	int8_t registerType(int index) { return _registerType[index]; };
+	int group(int index) { return _group[index]; };
+	time_t referenceTime(int index) { return _referenceTime[index]; };
+	void setReferenceTime(int index, time_t refTime) { _referenceTime[index] = refTime; };
+
+	/**
+	 * Determine the register range of a read group
+	 * @param tagArray: tag indexes to scan (update cycle)
+	 * @param tagArraySize: number of entries in tagArray
+	 * @param slave: slave ID of the group
+	 * @param grp: group ID
+	 * @param addrLo: lowest register address of the group (out)
+	 * @param addrHi: highest register address of the group (out)
+	 * @return number of tags in the group
+	 */
+	int groupRange(const int *tagArray, int tagArraySize, int slave, int grp, int *addrLo, int *addrHi);
+
+	/**
+	 * @return true if the tag belongs to slave and all its registers are within addrLo..addrHi
+	 */
+	bool inRange(int index, int slave, int addrLo, int addrHi) {
+		return (_slaveId[index] == slave) && (_address[index] >= addrLo) && ((_address[index] + _registerCount[index] - 1) <= addrHi);
+	};
+
+private:
+	int _count;
+	uint16_t *_address;			// register address
+	uint8_t *_slaveId;			// modbus slave
+	uint8_t *_registerCount;	// number of registers (1 or 2)
+	int8_t *_registerType;		// 0 = coil, 1 = DI, 3 = input reg, 4 = holding reg
+	int32_t *_group;			// group for multi read (< 1 = single read)
+	time_t *_referenceTime;		// read cycle time of last read
+};
+
+class TagIndex {
+public:
+	TagIndex();
+	~TagIndex();
+
+	/**
+	 * Build index (counting sort)
+	 * @param keys: key of each tag, tags with key < 0 or >= keyCount are not indexed
+	 * @param count: number of tags
+	 * @param keyCount: number of keys
+	 */
+	void build(const int *keys, int count, int keyCount);
+
+	/**
+	 * Free index
+	 */
+	void release(void);
+
+	int keyCount(void) { return _keyCount; };
+
+	/**
+	 * @return number of tags with key
+	 */
+	int size(int key) { return ((key < 0) || (key >= _keyCount)) ? 0 : (_offsets[key+1] - _offsets[key]); };
+
+	/**
+	 * @return indexes of tags with key (size(key) entries)
+	 */
+	const int *tags(int key) { return ((key < 0) || (key >= _keyCount)) ? NULL : &_tags[_offsets[key]]; };
+
+private:
+	int _keyCount;
+	int *_offsets;			// start of each key in _tags, keyCount+1 entries
+	int *_tags;				// tag indexes grouped by key
+};
+
+#endif /* _TAGTABLE_H_ */
@@ -0,0 +1,361 @@
+/**
+ * @file mbcapture.cpp
+ *
+ * Capture the traffic of a Modbus RTU bus for replay with sim/mbsim -p.
+ *
+ * The proxy opens the serial device and creates a pty for mbbridge
+ * (modbusrtu.device = link name). Every byte is forwarded unchanged in
+ * both directions, requests and responses are recorded with their timing.
+ * A request starts with the first byte from the bridge after a response
+ * or after a gap, the response is everything the device sends until then.
+ *
+ * usage: mbcapture -D <device> [-b baud] [-P parity] [-l link] -o <file>
+ *        mbcapture -r [-c] <file>
+ *   -D  serial device of the bus
+ *   -b  baud rate (default 9600)
+ *   -P  parity N, E or O (default N), 8 data bits, 1 stop bit
+ *   -l  pty link for the bridge (default /tmp/ttyMBCAP)
+ *   -o  capture file
+ *   -r  print capture file, -c as CSV
+ */
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../capture.h"
+
+/*********************
+ *      DEFINES
+ *********************/
+#define CAPTURE_LINK_DEFAULT "/tmp/ttyMBCAP"
+#define CAPTURE_GAP_MS 20			// silence which ends a request without response
+
+/**********************
+ *      TYPEDEFS
+ **********************/
+typedef struct
+{
+	capture_record_t rec;
+	uint8_t request[CAPTURE_FRAME_MAX];
+	uint8_t response[CAPTURE_FRAME_MAX];
+	uint64_t requestEnd;		// last request byte [ns, monotonic]
+	uint64_t responseEnd;		// last response byte [ns, monotonic]
+	bool active;
+}capture_pair_t;
+
+/**********************
+ *  STATIC VARIABLES
+ **********************/
+static volatile sig_atomic_t exitSignal = 0;
+static uint64_t records = 0;		// requests written
+static uint64_t timeouts = 0;		// requests without response
+
+/**********************
+ *   LOCAL FUNCTIONS
+ **********************/
+static void sig_handler(int signum) {
+	(void)signum;
+	exitSignal = 1;
+}
+
+static uint64_t now_ns(clockid_t id) {
+	struct timespec ts;
+	clock_gettime(id, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool write_all(int fd, const uint8_t *buf, int len) {
+	int n;
+	while (len > 0) {
+		n = write(fd, buf, len);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		buf += n;
+		len -= n;
+	}
+	return true;
+}
+
+static speed_t baud_constant(int baud) {
+	switch (baud) {
+	case 1200: return B1200;
+	case 2400: return B2400;
+	case 4800: return B4800;
+	case 9600: return B9600;
+	case 19200: return B19200;
+	case 38400: return B38400;
+	case 57600: return B57600;
+	case 115200: return B115200;
+	case 230400: return B230400;
+	default: return B0;
+	}
+}
+
+static int open_device(const char *device, int baud, char parity) {
+	struct termios tio;
+	speed_t speed = baud_constant(baud);
+	int fd;
+	if (speed == B0) {
+		fprintf(stderr, "unsupported baud rate %d\n", baud);
+		return -1;
+	}
+	fd = open(device, O_RDWR | O_NOCTTY);
+	if (fd < 0) {
+		perror(device);
+		return -1;
+	}
+	tcgetattr(fd, &tio);
+	cfmakeraw(&tio);
+	cfsetispeed(&tio, speed);
+	cfsetospeed(&tio, speed);
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_cflag &= ~(PARENB | PARODD | CSTOPB);
+	if (parity == 'E') tio.c_cflag |= PARENB;
+	if (parity == 'O') tio.c_cflag |= PARENB | PARODD;
+	tcsetattr(fd, TCSANOW, &tio);
+	tcflush(fd, TCIOFLUSH);
+	return fd;
+}
+
+static bool open_pty(int *master, int *slave, const char *link) {
+	struct termios tio;
+	const char *name;
+
+	*master = posix_openpt(O_RDWR | O_NOCTTY);
+	if ((*master < 0) || (grantpt(*master) != 0) || (unlockpt(*master) != 0)) {
+		perror("posix_openpt");
+		return false;
+	}
+	name = ptsname(*master);
+	// keep the slave side open, the master would see EIO while the bridge reconnects
+	*slave = open(name, O_RDWR | O_NOCTTY);
+	if (*slave < 0) {
+		perror(name);
+		return false;
+	}
+	tcgetattr(*slave, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(*slave, TCSANOW, &tio);
+	unlink(link);
+	if (symlink(name, link) != 0) {
+		perror(link);
+		return false;
+	}
+	printf("bridge port %s -> %s\n", link, name);
+	return true;
+}
+
+static bool write_pair(FILE *f, capture_pair_t *p) {
+	if (!p->active) return true;
+	p->active = false;
+	p->rec.rtt = 0;
+	if (p->rec.responseLen > 0)
+		p->rec.rtt = (uint32_t)((p->responseEnd - p->requestEnd) / 1000ULL);
+	else
+		timeouts++;
+	records++;
+	if ((fwrite(&p->rec, sizeof(p->rec), 1, f) != 1) ||
+		(fwrite(p->request, 1, p->rec.requestLen, f) != p->rec.requestLen) ||
+		(fwrite(p->response, 1, p->rec.responseLen, f) != p->rec.responseLen)) return false;
+	return fflush(f) == 0;
+}
+
+static int capture(const char *device, int baud, char parity, const char *link, const char *path) {
+	capture_file_header_t header;
+	capture_pair_t pair;
+	struct pollfd pfd[2];
+	uint8_t buf[CAPTURE_FRAME_MAX];
+	uint64_t now, lastBridge = 0;
+	int dev, master, slaveFd, n, space;
+	FILE *f;
+
+	dev = open_device(device, baud, parity);
+	if (dev < 0) return 1;
+	f = fopen(path, "wb");
+	if (f == NULL) {
+		perror(path);
+		return 1;
+	}
+	memset(&header, 0, sizeof(header));
+	header.magic = CAPTURE_MAGIC;
+	header.version = CAPTURE_VERSION;
+	header.recordSize = sizeof(capture_record_t);
+	header.baudRate = baud;
+	header.startTime = now_ns(CLOCK_REALTIME);
+	if (fwrite(&header, sizeof(header), 1, f) != 1) {
+		perror(path);
+		return 1;
+	}
+	if (!open_pty(&master, &slaveFd, link)) return 1;
+	fflush(stdout);
+	memset(&pair, 0, sizeof(pair));
+
+	signal(SIGINT, sig_handler);
+	signal(SIGTERM, sig_handler);
+	pfd[0].fd = master;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = dev;
+	pfd[1].events = POLLIN;
+	while (!exitSignal) {
+		pfd[0].revents = pfd[1].revents = 0;
+		n = poll(pfd, 2, 1000);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		now = now_ns(CLOCK_MONOTONIC);
+		// bridge -> device
+		if (pfd[0].revents & POLLIN) {
+			n = read(master, buf, sizeof(buf));
+			if (n > 0) {
+				if (!write_all(dev, buf, n)) {
+					perror(device);
+					break;
+				}
+				// a new request starts after a response or a gap
+				if (!pair.active || (pair.rec.responseLen > 0) || ((now - lastBridge) > CAPTURE_GAP_MS * 1000000ULL)) {
+					if (!write_pair(f, &pair)) {
+						perror(path);
+						break;
+					}
+					memset(&pair.rec, 0, sizeof(pair.rec));
+					pair.rec.time = now_ns(CLOCK_REALTIME);
+					pair.active = true;
+				}
+				space = CAPTURE_FRAME_MAX - pair.rec.requestLen;
+				if (n > space) n = space;
+				memcpy(&pair.request[pair.rec.requestLen], buf, n);
+				pair.rec.requestLen += n;
+				pair.requestEnd = now;
+				lastBridge = now;
+			}
+		}
+		// device -> bridge
+		if (pfd[1].revents & POLLIN) {
+			n = read(dev, buf, sizeof(buf));
+			if (n > 0) {
+				write_all(master, buf, n);
+				if (pair.active) {
+					space = CAPTURE_FRAME_MAX - pair.rec.responseLen;
+					if (n > space) n = space;
+					memcpy(&pair.response[pair.rec.responseLen], buf, n);
+					pair.rec.responseLen += n;
+					pair.responseEnd = now;
+				}
+			} else if ((n < 0) && (errno != EAGAIN) && (errno != EINTR)) {
+				perror(device);
+				break;
+			}
+		}
+	}
+	write_pair(f, &pair);
+	fclose(f);
+	printf("%llu requests captured, %llu without response\n", (unsigned long long)records, (unsigned long long)timeouts);
+	unlink(link);
+	close(slaveFd);
+	close(master);
+	close(dev);
+	return 0;
+}
+
+static const char *response_type(const capture_record_t *rec, const uint8_t *req, const uint8_t *rsp) {
+	if (rec->responseLen == 0) return "timeout";
+	if ((rec->responseLen < 5) || (rsp[0] != req[0])) return "invalid";
+	if (rsp[1] & 0x80) return "exception";
+	return "ok";
+}
+
+static int print_capture(const char *path, bool csv) {
+	capture_file_header_t header;
+	capture_record_t rec;
+	uint8_t req[CAPTURE_FRAME_MAX], rsp[CAPTURE_FRAME_MAX];
+	uint64_t count = 0;
+	FILE *f = fopen(path, "rb");
+
+	if (f == NULL) {
+		perror(path);
+		return 1;
+	}
+	if ((fread(&header, sizeof(header), 1, f) != 1) || (header.magic != CAPTURE_MAGIC)) {
+		fprintf(stderr, "%s: not a capture file\n", path);
+		return 1;
+	}
+	if ((header.version != CAPTURE_VERSION) || (header.recordSize != sizeof(capture_record_t))) {
+		fprintf(stderr, "%s: unsupported capture version %u\n", path, header.version);
+		return 1;
+	}
+	if (csv)
+		printf("time_ns,slave,fc,request_len,response_len,rtt_us,result\n");
+	else
+		printf("# %-12s %5s %3s %7s %8s %9s %s\n", "offset[ms]", "slave", "fc", "req", "rsp", "rtt[us]", "result");
+	while (fread(&rec, sizeof(rec), 1, f) == 1) {
+		if ((rec.requestLen > CAPTURE_FRAME_MAX) || (rec.responseLen > CAPTURE_FRAME_MAX) || (rec.requestLen < 2) ||
+			(fread(req, 1, rec.requestLen, f) != rec.requestLen) ||
+			(fread(rsp, 1, rec.responseLen, f) != rec.responseLen)) {
+			fprintf(stderr, "%s: truncated after %llu records\n", path, (unsigned long long)count);
+			break;
+		}
+		if (csv)
+			printf("%llu,%u,%u,%u,%u,%u,%s\n", (unsigned long long)rec.time, req[0], req[1], rec.requestLen,
+				rec.responseLen, rec.rtt, response_type(&rec, req, rsp));
+		else
+			printf("  %12.3f %5u %3u %7u %8u %9u %s\n", (double)(rec.time - header.startTime) / 1e6, req[0], req[1],
+				rec.requestLen, rec.responseLen, rec.rtt, response_type(&rec, req, rsp));
+		count++;
+	}
+	fclose(f);
+	if (!csv) printf("# %llu records, %u baud\n", (unsigned long long)count, header.baudRate);
+	return 0;
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "usage: %s -D <device> [-b baud] [-P N|E|O] [-l link] -o <file>\n", name);
+	fprintf(stderr, "       %s -r [-c] <file>\n", name);
+}
+
+int main(int argc, char *argv[]) {
+	const char *device = NULL, *output = NULL, *link = CAPTURE_LINK_DEFAULT;
+	int baud = 9600, opt;
+	char parity = 'N';
+	bool print = false, csv = false;
+
+	while ((opt = getopt(argc, argv, "D:b:P:l:o:rch")) != -1) {
+		switch (opt) {
+		case 'D': device = optarg; break;
+		case 'b': baud = atoi(optarg); break;
+		case 'P': parity = optarg[0]; break;
+		case 'l': link = optarg; break;
+		case 'o': output = optarg; break;
+		case 'r': print = true; break;
+		case 'c': csv = true; break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (print) {
+		if (optind >= argc) {
+			usage(argv[0]);
+			return 1;
+		}
+		return print_capture(argv[optind], csv);
+	}
+	if ((device == NULL) || (output == NULL) || ((parity != 'N') && (parity != 'E') && (parity != 'O'))) {
+		usage(argv[0]);
+		return 1;
+	}
+	return capture(device, baud, parity, link, output);
+}
@@ -0,0 +1,107 @@
+/**
+ * @file mbtrace.cpp
+ *
+ * Decode a Modbus transaction trace written by mbbridge (SIGUSR1 or MQTT
+ * trace command) to text, one transaction per line.
+ *
+ * usage: mbtrace [-c] [-s slave] <tracefile>
+ *   -c  CSV output
+ *   -s  only transactions of this slave
+ */
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../trace.h"
+
+/**********************
+ *   LOCAL FUNCTIONS
+ **********************/
+static const char *result_name(int result) {
+	static const char *names[] = { "ok", "timeout", "exception", "crc", "error" };
+	if ((result < 0) || (result > TRACE_RESULT_ERROR)) return "?";
+	return names[result];
+}
+
+static void format_time(uint64_t ns, char *buf, size_t size) {
+	time_t sec = (time_t)(ns / 1000000000ULL);
+	struct tm tm;
+	size_t len;
+	localtime_r(&sec, &tm);
+	len = strftime(buf, size, "%Y-%m-%d %H:%M:%S", &tm);
+	snprintf(buf + len, size - len, ".%06u", (unsigned)((ns / 1000ULL) % 1000000ULL));
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "usage: %s [-c] [-s slave] <tracefile>\n", name);
+	fprintf(stderr, "  -c  CSV output\n  -s  only transactions of this slave\n");
+}
+
+int main(int argc, char *argv[]) {
+	trace_file_header_t header;
+	trace_record_t rec;
+	char timeStr[48];
+	bool csv = false;
+	int slave = -1, opt;
+	uint32_t i, shown = 0;
+	FILE *f;
+
+	while ((opt = getopt(argc, argv, "cs:h")) != -1) {
+		switch (opt) {
+		case 'c': csv = true; break;
+		case 's': slave = atoi(optarg); break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (optind >= argc) {
+		usage(argv[0]);
+		return 1;
+	}
+	f = fopen(argv[optind], "rb");
+	if (f == NULL) {
+		perror(argv[optind]);
+		return 1;
+	}
+	if ((fread(&header, sizeof(header), 1, f) != 1) || (header.magic != TRACE_MAGIC)) {
+		fprintf(stderr, "%s: not a trace file\n", argv[optind]);
+		return 1;
+	}
+	if ((header.version != TRACE_VERSION) || (header.recordSize != sizeof(trace_record_t))) {
+		fprintf(stderr, "%s: unsupported trace version %u (record size %u)\n", argv[optind], header.version, header.recordSize);
+		return 1;
+	}
+	format_time(header.dumpTime, timeStr, sizeof(timeStr));
+	if (csv) {
+		printf("time_ns,slave,fc,address,count,result,code,rtt_us,retry\n");
+	} else {
+		printf("# dump %s, %u records, %llu transactions since start\n", timeStr, header.count, (unsigned long long)header.total);
+		printf("# %-26s %5s %3s %7s %5s %-9s %4s %9s %5s\n", "time", "slave", "fc", "address", "count", "result", "code", "rtt[us]", "retry");
+	}
+	for (i = 0; i < header.count; i++) {
+		if (fread(&rec, sizeof(rec), 1, f) != 1) {
+			fprintf(stderr, "%s: truncated after %u records\n", argv[optind], i);
+			break;
+		}
+		if ((slave >= 0) && (rec.slaveId != slave)) continue;
+		if (csv) {
+			printf("%llu,%u,%u,%u,%u,%s,%u,%u,%u\n", (unsigned long long)rec.time, rec.slaveId, rec.function,
+				rec.address, rec.count, result_name(rec.result), rec.code, rec.rtt, rec.retry);
+		} else {
+			format_time(rec.time, timeStr, sizeof(timeStr));
+			printf("  %-26s %5u %3u %7u %5u %-9s %4u %9u %5u\n", timeStr, rec.slaveId, rec.function,
+				rec.address, rec.count, result_name(rec.result), rec.code, rec.rtt, rec.retry);
+		}
+		shown++;
+	}
+	fclose(f);
+	if (!csv) printf("# %u records shown\n", shown);
+	return 0;
+}
@@ -0,0 +1,150 @@
+/**
+ * @file trace.cpp
+ *
+ */
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <modbus.h>
+
+#include "trace.h"
+
+/**********************
+ *   LOCAL FUNCTIONS
+ **********************/
+
+/**
+ * write buffer completely
+ * @return false on failure
+ */
+static bool write_all(int fd, const void *buf, size_t len) {
+	const uint8_t *p = (const uint8_t *)buf;
+	ssize_t n;
+	while (len > 0) {
+		n = write(fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+/*********************
+ * MEMBER FUNCTIONS
+ *********************/
+
+//
+// Class TransactionTrace
+//
+
+TransactionTrace::TransactionTrace() {
+	_records = NULL;
+	_mask = 0;
+	_head = 0;
+}
+
+TransactionTrace::~TransactionTrace() {
+	free(_records);
+}
+
+bool TransactionTrace::init(uint32_t records) {
+	uint32_t size = 1;
+	if ((records == 0) || (records > (1U << 24))) return false;
+	while (size < records) size <<= 1;
+	free(_records);
+	_records = (trace_record_t *)calloc(size, sizeof(trace_record_t));
+	if (_records == NULL) return false;
+	_mask = size - 1;
+	_head = 0;
+	return true;
+}
+
+void TransactionTrace::record(int slaveId, int function, int address, int count, uint64_t rtt, int error, int retry, uint64_t time) {
+	trace_record_t *rec;
+	if (_records == NULL) return;
+	rec = &_records[_head & _mask];
+	rec->time = time;
+	rec->rtt = (rtt > UINT32_MAX) ? UINT32_MAX : (uint32_t)rtt;
+	rec->address = (uint16_t)address;
+	rec->count = (uint16_t)count;
+	rec->slaveId = (uint8_t)slaveId;
+	rec->function = (uint8_t)function;
+	rec->retry = (retry > 255) ? 255 : (uint8_t)retry;
+	rec->code = 0;
+	if (error == 0) {
+		rec->result = TRACE_RESULT_OK;
+	} else if (error == ETIMEDOUT) {
+		rec->result = TRACE_RESULT_TIMEOUT;
+	} else if ((error > MODBUS_ENOBASE) && (error < MODBUS_ENOBASE + MODBUS_EXCEPTION_MAX)) {
+		rec->result = TRACE_RESULT_EXCEPTION;
+		rec->code = (uint8_t)(error - MODBUS_ENOBASE);
+	} else if (error == EMBBADCRC) {
+		rec->result = TRACE_RESULT_CRC;
+	} else {
+		rec->result = TRACE_RESULT_ERROR;
+		rec->code = (uint8_t)error;
+	}
+	_head++;
+}
+
+int TransactionTrace::dump(const char *path, uint64_t time) {
+	trace_file_header_t header;
+	uint64_t first, count;
+	uint32_t start;
+	std::string tmpPath;
+	int fd;
+	bool ok;
+
+	if (_records == NULL) return -1;
+	count = (_head > (uint64_t)_mask + 1) ? (uint64_t)_mask + 1 : _head;
+	first = _head - count;
+	memset(&header, 0, sizeof(header));
+	header.magic = TRACE_MAGIC;
+	header.version = TRACE_VERSION;
+	header.recordSize = sizeof(trace_record_t);
+	header.count = (uint32_t)count;
+	header.total = _head;
+	header.dumpTime = time;
+	// write to temporary file, a reader never sees a partial dump
+	tmpPath = path;
+	tmpPath += ".tmp";
+	fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) return -1;
+	start = (uint32_t)(first & _mask);
+	ok = write_all(fd, &header, sizeof(header));
+	// ring may wrap: [start .. end of ring] [0 .. head)
+	if (ok && (count > 0)) {
+		uint64_t part = (uint64_t)_mask + 1 - start;
+		if (part > count) part = count;
+		ok = write_all(fd, &_records[start], part * sizeof(trace_record_t));
+		if (ok && (part < count))
+			ok = write_all(fd, &_records[0], (count - part) * sizeof(trace_record_t));
+	}
+	if (::close(fd) != 0) ok = false;
+	if (!ok || (rename(tmpPath.c_str(), path) != 0)) {
+		unlink(tmpPath.c_str());
+		return -1;
+	}
+	return (int)count;
+}
+
+uint64_t TransactionTrace::total(void) {
+	return _head;
+}
+
+uint32_t TransactionTrace::size(void) {
+	return (_records == NULL) ? 0 : _mask + 1;
+}
@@ -0,0 +1,121 @@
+/**
+ * @file trace.h
+
+-----------------------------------------------------------------------------
+ Class "TransactionTrace" keeps the most recent Modbus transactions in a
+ fixed size in-memory ring of compact binary records.
+
+ Recording is always on: a record is a 24 byte store into preallocated
+ memory, no locking, no allocation, no formatting. The ring is written to
+ a file on demand (SIGUSR1 or MQTT command) and can be decoded with
+ tools/mbtrace.
+
+ Dump file layout:
+   trace_file_header_t
+   trace_record_t[count] (oldest first)
+-----------------------------------------------------------------------------
+*/
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <stdint.h>
+#include <stddef.h>
+
+/*********************
+ *      DEFINES
+ *********************/
+#define TRACE_MAGIC 0x5254424D			// "MBTR"
+#define TRACE_VERSION 1
+#define TRACE_RECORDS_DEFAULT 4096		// ring size [records]
+
+/**********************
+ *      TYPEDEFS
+ **********************/
+typedef enum
+{
+	TRACE_RESULT_OK = 0,
+	TRACE_RESULT_TIMEOUT,		// no response
+	TRACE_RESULT_EXCEPTION,		// exception response, see code
+	TRACE_RESULT_CRC,			// response with invalid CRC
+	TRACE_RESULT_ERROR			// other error, code holds the low byte of errno
+}trace_result_t;
+
+typedef struct
+{
+	uint64_t time;			// completion of transaction [ns since epoch]
+	uint32_t rtt;			// round trip time [us]
+	uint16_t address;		// protocol address (0 based, without register type offset)
+	uint16_t count;			// number of registers / bits
+	uint8_t slaveId;
+	uint8_t function;		// Modbus function code
+	uint8_t result;			// trace_result_t
+	uint8_t code;			// exception code
+	uint8_t retry;			// 0 = first attempt
+	uint8_t reserved[3];
+}trace_record_t;
+
+typedef struct
+{
+	uint32_t magic;			// TRACE_MAGIC
+	uint32_t version;		// TRACE_VERSION
+	uint32_t recordSize;	// sizeof(trace_record_t)
+	uint32_t count;			// number of records in file
+	uint64_t total;			// number of transactions recorded since start
+	uint64_t dumpTime;		// time of dump [ns since epoch]
+}trace_file_header_t;
+
+class TransactionTrace {
+public:
+	TransactionTrace();
+	~TransactionTrace();
+
+	/**
+	 * Allocate ring
+	 * @param records: ring size, rounded up to a power of two
+	 * @return false on failure
+	 */
+	bool init(uint32_t records);
+
+	/**
+	 * Record a transaction
+	 * @param slaveId: slave address
+	 * @param function: Modbus function code
+	 * @param address: protocol address
+	 * @param count: number of registers / bits
+	 * @param rtt: round trip time [us]
+	 * @param error: errno of a failed transaction, 0 = success
+	 * @param retry: retry number
+	 * @param time: completion time [ns since epoch]
+	 */
+	void record(int slaveId, int function, int address, int count, uint64_t rtt, int error, int retry, uint64_t time);
+
+	/**
+	 * Write ring to file (oldest record first)
+	 * must be called from the thread which records
+	 * @param path: file name
+	 * @param time: time of dump [ns since epoch]
+	 * @return number of records written or -1 on failure
+	 */
+	int dump(const char *path, uint64_t time);
+
+	/**
+	 * @return number of transactions recorded since start
+	 */
+	uint64_t total(void);
+
+	/**
+	 * @return ring size [records]
+	 */
+	uint32_t size(void);
+
+private:
+	trace_record_t *_records;
+	uint32_t _mask;			// ring size - 1
+	uint64_t _head;			// number of records written
+};
+
+#endif /* _TRACE_H_ */
@@ -0,0 +1,57 @@
+/**
+ * @file writescheduler.cpp
+ *
+ */
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include "writescheduler.h"
+
+/*********************
+ * MEMBER FUNCTIONS
+ *********************/
+
+//
+// Class WriteScheduler
+//
+
+WriteScheduler::WriteScheduler() {
+	_nextSequence = 1;
+	_count = 0;
+}
+
+void WriteScheduler::reserve(int capacity) {
+	std::vector<write_command_t> storage;
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (capacity < 1) return;
+	storage.reserve(capacity);
+	_queue = std::priority_queue<write_command_t, std::vector<write_command_t>, _later>(_later(), std::move(storage));
+	_count = 0;
+}
+
+void WriteScheduler::push(write_command_t *command) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	command->sequence = _nextSequence++;
+	_queue.push(*command);
+	_count = (int) _queue.size();
+}
+
+void WriteScheduler::requeue(const write_command_t *command) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_queue.push(*command);
+	_count = (int) _queue.size();
+}
+
+bool WriteScheduler::pop(write_command_t *command) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (_queue.empty()) return false;
+	*command = _queue.top();
+	_queue.pop();
+	_count = (int) _queue.size();
+	return true;
+}
+
+int WriteScheduler::count(void) {
+	return _count;
+}
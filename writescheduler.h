@@ -0,0 +1,88 @@
+/**
+ * @file writescheduler.h
+
+-----------------------------------------------------------------------------
+ Class "WriteScheduler" orders pending modbus writes.
+
+ Write commands are queued by the MQTT thread and executed by the main
+ loop, highest priority class first and within a class in order of
+ arrival. Push and pop are O(log n), the queue storage is reserved once
+ for the number of write tags (a tag has at most one queued command).
+ Commands can carry a deadline, the caller drops commands which have not
+ been executed in time.
+-----------------------------------------------------------------------------
+*/
+
+#ifndef _WRITESCHEDULER_H_
+#define _WRITESCHEDULER_H_
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+#include <queue>
+#include <vector>
+
+/**********************
+ *      TYPEDEFS
+ **********************/
+typedef struct
+{
+	int tagIndex;			// index of write tag
+	int priority;			// priority class, higher is more urgent
+	uint64_t sequence;		// arrival order
+	uint64_t arrival;		// time the command was received [ns since epoch]
+	uint64_t deadline;		// drop command after this time [ns since epoch], 0 = never
+}write_command_t;
+
+class WriteScheduler {
+public:
+	WriteScheduler();
+
+	/**
+	 * Reserve queue storage
+	 * @param capacity: number of write tags
+	 */
+	void reserve(int capacity);
+
+	/**
+	 * Queue new command, the sequence number is assigned
+	 * @param command: command (sequence is ignored)
+	 */
+	void push(write_command_t *command);
+
+	/**
+	 * Queue a command again (e.g. for retry), keeps its position
+	 */
+	void requeue(const write_command_t *command);
+
+	/**
+	 * Remove most urgent command
+	 * @param command: storage for command
+	 * @return false if no command is pending
+	 */
+	bool pop(write_command_t *command);
+
+	/**
+	 * @return number of pending commands (without locking)
+	 */
+	int count(void);
+
+private:
+	struct _later {
+		bool operator()(const write_command_t &a, const write_command_t &b) const {
+			if (a.priority != b.priority) return a.priority < b.priority;
+			return a.sequence > b.sequence;
+		}
+	};
+
+	std::mutex _mutex;
+	std::priority_queue<write_command_t, std::vector<write_command_t>, _later> _queue;
+	uint64_t _nextSequence;
+	std::atomic<int> _count;
+};
+
+#endif /* _WRITESCHEDULER_H_ */